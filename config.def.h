@@ -4,6 +4,9 @@
 /* Terminal */
 #define TERMINAL (char *[]){ "st", "-e", "fish", NULL }
 
+/* Editor of names for bulk rename, it is waited for, "%f" is replaced with file of names */
+#define NAME_EDITOR (const gchar *[]){ "st", "-e", "vi", "%f", NULL }
+
 /* Bookmarks */
 static const char *bookmarks[] = {
 	"/",
@@ -14,11 +17,93 @@ static const char *bookmarks[] = {
 /* Time format, check *man date* for more formatting info */
 static const char *timefmt = "%Y/%m/%d %H:%M:%S";
 
-/* Poll time for directory updating (in seconds) */
-static const int polltime = 15;
+/* Delay for collecting directory changes before list update (in ms) */
+static const int update_delay = 150;
+
+/* Memory limit for listings of recently visited directories (in bytes) */
+static const size_t cache_size = 64 * 1024 * 1024;
+
+/* Bookmarks are read ahead at start and directory under cursor after it rests (in ms).
+ * Larger directories are left for foreground, read ahead never evicts visited listings */
+static const int prefetch_delay = 400;
+static const guint prefetch_entries = 200000;
+
+/* Search stays on filesystem where it started */
+static const int search_xdev = 1;
+
+/* Persistent index under $XDG_CACHE_HOME, NULL turns it off. It keeps listings of
+ * visited directories and of directories under roots, shown before directory is read
+ * and looked up by locate. Directories whose mtime changed are read again on update */
+static const gchar * index_file = "bfm/index";
+/* Roots indexed as a whole, e.g. "~", none by default so only visited directories are kept */
+static const gchar * index_roots[] = {
+	NULL,
+};
+/* Interval of index updates (in s) */
+static const int index_interval = 900;
+
+/* Filesystems with slow stat are listed from names and types first, metadata follows
+ * for rows on screen first. Listing is shown partial if it is not read in timeout (in ms) */
+static const St_fs_rule fs_rules[] = {
+	{ "nfs",	3000 },
+	{ "cifs",	3000 },
+	{ "smb*",	3000 },
+	{ "fuse",	3000 },
+	{ "9p",		3000 },
+	{ "ceph",	3000 },
+	{ "afs",	3000 },
+};
+
+/* Interval of file operation progress updates (in ms) */
+static const int job_status_delay = 250;
+
+/* Programs for activated files, first rule with matching MIME type wins.
+ * Programs are started directly, "%f" argument is replaced with file path */
+static const St_rule rules[] = {
+	{ "text/*",							(const gchar *[]){ "geany", "%f", NULL } },
+	{ "application/json",				(const gchar *[]){ "geany", "%f", NULL } },
+	{ "image/*",						(const gchar *[]){ "sxiv", "%f", NULL } },
+	{ "video/*",						(const gchar *[]){ "mpv", "%f", NULL } },
+	{ "audio/*",						(const gchar *[]){ "mpv", "%f", NULL } },
+	{ "application/pdf",				(const gchar *[]){ "zathura", "%f", NULL } },
+	{ "application/x-*executable",		(const gchar *[]){ "%f", NULL } },
+	{ "*",								(const gchar *[]){ "xdg-open", "%f", NULL } },
+};
 
-/* Command to be executed when activating a file */
-static const char *filecmd[] = { "/bin/sh/", "-c", "~/bin/exec_rifle", "\"$BFM_PATH\"", NULL };
+/* Archives opened as read-only directories, entries are extracted on demand.
+ * Files which can not be read as archive are left to rules */
+static const gchar * archives[] = {
+	"application/x-tar",
+	"application/x-*tar",
+	"application/gzip",
+	"application/x-xz",
+	"application/x-bzip2",
+	"application/zstd",
+	"application/zip",
+	"application/x-7z-compressed",
+	"application/vnd.rar",
+	"application/x-rar",
+	"application/x-cpio",
+	"application/x-iso9660-image",
+};
+
+/* Optional columns, values are looked up only for rows on screen */
+static const St_column columns[] = {
+	{ EXTRA_OWNER,	"Owner",	"________",				FALSE },
+	{ EXTRA_GROUP,	"Group",	"________",				FALSE },
+	{ EXTRA_INODE,	"Inode",	"888888888888",			FALSE },
+	{ EXTRA_LINKS,	"Links",	"8888",					FALSE },
+	{ EXTRA_MIME,	"Type",		"application/x-sharedlib",	FALSE },
+	{ EXTRA_TARGET,	"Target",	"________________",		FALSE },
+};
+
+/* Thumbnails of images, shown size and most kept in memory per window */
+static const gboolean show_thumbs = FALSE;
+static const gint thumb_size = 48;
+static const guint thumb_memo = 4096;
+
+/* First instance opens windows for later ones, "bfm -d" keeps it running without windows */
+static const gboolean single_instance = TRUE;
 
 /* Key bindings */
 static S_key keys[] = {
@@ -43,11 +128,56 @@ static S_key keys[] = {
 	/* Make directory */
 	{ 0,					GDK_F7,			bfm_make_dir,		{ .i = 0755 } },
 
-	/*{ MODKEY,				GDK_m,			bfm_mv,				{ 0 } },*/
+	/* Show or hide optional columns */
+	{ GDK_MOD1_MASK,		GDK_o,			bfm_column_toggle,	{ .i = EXTRA_OWNER } },
+	{ GDK_MOD1_MASK,		GDK_g,			bfm_column_toggle,	{ .i = EXTRA_GROUP } },
+	{ GDK_MOD1_MASK,		GDK_i,			bfm_column_toggle,	{ .i = EXTRA_INODE } },
+	{ GDK_MOD1_MASK,		GDK_l,			bfm_column_toggle,	{ .i = EXTRA_LINKS } },
+	{ GDK_MOD1_MASK,		GDK_m,			bfm_column_toggle,	{ .i = EXTRA_MIME } },
+	{ GDK_MOD1_MASK,		GDK_y,			bfm_column_toggle,	{ .i = EXTRA_TARGET } },
+
+	/* Show or hide thumbnails */
+	{ GDK_MOD1_MASK,		GDK_p,			bfm_thumb_toggle,	{ 0 } },
+
+	/* Copy and move into asked directory, existing files are skipped,
+	 * overwritten with Shift or kept beside numbered copy with Alt */
+	{ MODKEY,				GDK_c,			bfm_copy,			{ .i = CONFLICT_SKIP } },
+	{ MODKEY|GDK_SHIFT_MASK,GDK_c,			bfm_copy,			{ .i = CONFLICT_OVERWRITE } },
+	{ MODKEY|GDK_MOD1_MASK,	GDK_c,			bfm_copy,			{ .i = CONFLICT_RENAME } },
+	{ MODKEY,				GDK_m,			bfm_copy,			{ .b = TRUE, .i = CONFLICT_SKIP } },
+	{ MODKEY|GDK_SHIFT_MASK,GDK_m,			bfm_copy,			{ .b = TRUE, .i = CONFLICT_OVERWRITE } },
+	{ MODKEY|GDK_MOD1_MASK,	GDK_m,			bfm_copy,			{ .b = TRUE, .i = CONFLICT_RENAME } },
 
 	/* Set path */
 	{ MODKEY,				GDK_l,			bfm_set_path,		{ 0 } },
 
+	/* Search in subdirectories by glob, regex, fuzzy name or glob and content.
+	 * Results open in new window, Escape stops search */
+	{ 0,					GDK_F3,			bfm_search,			{ .i = FILTER_GLOB } },
+	{ GDK_SHIFT_MASK,		GDK_F3,			bfm_search,			{ .i = FILTER_REGEX } },
+	{ MODKEY,				GDK_F3,			bfm_search,			{ .i = FILTER_FUZZY } },
+	{ GDK_MOD1_MASK,		GDK_F3,			bfm_search,			{ .b = TRUE, .i = FILTER_GLOB } },
+
+	/* Locate names in persistent index by substring or glob, results open in new window */
+	{ MODKEY|GDK_SHIFT_MASK,GDK_F3,			bfm_locate,			{ .i = FILTER_SUBSTR } },
+	{ GDK_MOD1_MASK|GDK_SHIFT_MASK,GDK_F3,	bfm_locate,			{ .i = FILTER_GLOB } },
+
+	/* Compare tree with tree of other window, differences open in new window, Escape stops */
+	{ 0,					GDK_F9,			bfm_compare,		{ 0 } },
+
+	/* Filter names, typing narrows list too, Escape clears */
+	{ MODKEY,				GDK_f,			bfm_set_filter,		{ .i = FILTER_GLOB } },
+	{ MODKEY|GDK_SHIFT_MASK,GDK_f,			bfm_set_filter,		{ .i = FILTER_REGEX } },
+
+	/* Select all, none, invert or toggle cursor row, select names by glob or regex, Alt unselects by glob */
+	{ MODKEY,				GDK_a,			bfm_select,			{ .i = SELECT_ALL } },
+	{ MODKEY|GDK_SHIFT_MASK,GDK_a,			bfm_select,			{ .i = SELECT_NONE } },
+	{ MODKEY,				GDK_i,			bfm_select,			{ .i = SELECT_INVERT } },
+	{ MODKEY,				GDK_space,		bfm_select,			{ .i = SELECT_TOGGLE } },
+	{ MODKEY,				GDK_s,			bfm_select_match,	{ .i = FILTER_GLOB } },
+	{ MODKEY|GDK_SHIFT_MASK,GDK_s,			bfm_select_match,	{ .i = FILTER_REGEX } },
+	{ MODKEY|GDK_MOD1_MASK,	GDK_s,			bfm_select_match,	{ .b = TRUE, .i = FILTER_GLOB } },
+
 	/* Reload dir*/
 	{ MODKEY, 				GDK_r,			bfm_reload,			{ 0 } },
 
@@ -55,4 +185,27 @@ static S_key keys[] = {
 	{ MODKEY,                GDK_1,         bfm_bookmark,       { .i = 0 } },
 	{ MODKEY,                GDK_2,         bfm_bookmark,       { .i = 1 } },
 	{ MODKEY,                GDK_3,         bfm_bookmark,       { .i = 2 } },
+
+	/* Sorting, repeat to reverse */
+	{ GDK_MOD1_MASK,		GDK_n,			bfm_set_sort,		{ .i = NAME_STR } },
+	{ GDK_MOD1_MASK,		GDK_s,			bfm_set_sort,		{ .i = SIZE_UINT64 } },
+	{ GDK_MOD1_MASK,		GDK_t,			bfm_set_sort,		{ .i = MTIME_INT64 } },
+	{ GDK_MOD1_MASK,		GDK_e,			bfm_set_sort,		{ .i = SORT_EXT_ID } },
+
+	/* Recursive sizes of directories on same filesystem, apparent or allocated,
+	 * repeat to show own sizes again */
+	{ MODKEY,				GDK_d,			bfm_dirsize,		{ .i = DU_APPARENT } },
+	{ MODKEY|GDK_SHIFT_MASK,GDK_d,			bfm_dirsize,		{ .i = DU_ALLOCATED } },
+
+	/* Rename selected files in editor, by numbered template, regex, to lower or upper case.
+	 * Renames are previewed and done only if none collides */
+	{ 0,					GDK_F2,			bfm_rename,			{ .i = RENAME_EDITOR, .v = NAME_EDITOR } },
+	{ GDK_SHIFT_MASK,		GDK_F2,			bfm_rename,			{ .i = RENAME_SEQUENCE } },
+	{ MODKEY,				GDK_F2,			bfm_rename,			{ .i = RENAME_REGEX } },
+	{ GDK_MOD1_MASK,		GDK_F2,			bfm_rename,			{ .i = RENAME_LOWER } },
+	{ GDK_MOD1_MASK|GDK_SHIFT_MASK,GDK_F2,	bfm_rename,			{ .i = RENAME_UPPER } },
+
+	/* Delete recursively in background, Ctrl+Escape stops file operations */
+	{ 0,					GDK_Delete,		bfm_remove,			{ 0 } },
+	{ MODKEY,				GDK_Escape,		bfm_job_stop,		{ 0 } },
 };
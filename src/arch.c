@@ -0,0 +1,880 @@
+#include <archive.h>
+#include <archive_entry.h>
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arch.h"
+#include "trace.h"
+
+/* Indexes of recently opened archives kept for browsing */
+#define ARCH_CACHE     4
+/* Entries indexed before receiver is notified */
+#define ARCH_BATCH     2048
+/* Maximum delay before notifying about incomplete batch (in ms) */
+#define ARCH_LATENCY   40
+/* Read block of archive file */
+#define ARCH_BLOCK     65536
+
+/* Structs */
+/* Children of directory in index order, entry index + 1, 0 if there is none */
+typedef struct
+{
+	uint32_t first;
+	uint32_t last;
+} St_arch_list;
+
+/* Indexed entry, strings are offsets into arena */
+typedef struct
+{
+	uint32_t     path;
+	uint32_t     name;
+	/* Length of parent path, 0 for top level */
+	uint32_t     dirlen;
+	/* Next entry of same directory, index + 1 */
+	uint32_t     next;
+	St_arch_list child;
+	mode_t       mode;
+	off_t        size;
+	time_t       mtime;
+} St_arch_ent;
+
+/* Entries of one archive, shared by cache once complete */
+typedef struct
+{
+	int               refs;
+	/* Archive file identity, index is valid while it is same */
+	dev_t             dev;
+	ino_t             ino;
+	off_t             size;
+	struct timespec   mtime;
+	St_arch_ent     * ent;
+	size_t            len;
+	size_t            cap;
+	char            * arena;
+	size_t            arena_len;
+	size_t            arena_cap;
+	/* Directory path to entry index + 1, open addressing */
+	uint32_t        * dirs;
+	size_t            dirs_len;
+	size_t            dirs_cap;
+	/* Top level entries */
+	St_arch_list      top;
+	long              msec;
+} St_arch_index;
+
+struct St_arch
+{
+	pthread_mutex_t    lock;
+	/* Owner and worker hold a reference each */
+	int                refs;
+	int                cancel;
+	int                done;
+	/* Extracted tree is removed once worker is over */
+	int                discard;
+	/* Notification is sent and not yet answered */
+	int                signalled;
+	struct archive   * ar;
+	struct archive_entry * first;
+	St_arch_index    * index;
+	/* Last entry taken by receiver, index + 1, 0 before first one */
+	uint32_t           pos;
+	/* Extraction of paths inside archive into dest */
+	char             * file;
+	char            ** paths;
+	size_t             n_paths;
+	char             * dest;
+	size_t             count;
+	size_t             errors;
+	char             * error;
+	long               start;
+	long               msec;
+	/* Receiver */
+	Arch_notify        notify;
+	void             * data;
+};
+
+/* Globals */
+/* Complete indexes, most recently used first */
+static pthread_mutex_t   cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static St_arch_index   * cache[ARCH_CACHE];
+
+/* Functions */
+static long
+bfm_arch_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+bfm_arch_index_unref ( St_arch_index * x )
+{
+	if ( !x || __atomic_sub_fetch( &x->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	free( x->ent );
+	free( x->arena );
+	free( x->dirs );
+	free(x);
+}
+
+/* Memory taken by index */
+static size_t
+bfm_arch_index_memory ( const St_arch_index * x )
+{
+	return sizeof(St_arch_index) + x->cap * sizeof(St_arch_ent) + x->arena_cap + x->dirs_cap * sizeof(uint32_t);
+}
+
+/* Take complete index of unchanged archive from cache */
+static St_arch_index *
+bfm_arch_cache_get ( const struct stat * st )
+{
+	St_arch_index * x = NULL;
+	int             i;
+
+	pthread_mutex_lock( &cache_lock );
+	for ( i = 0; i < ARCH_CACHE && cache[i]; i++ )
+	{
+		if ( cache[i]->dev == st->st_dev && cache[i]->ino == st->st_ino && cache[i]->size == st->st_size
+		  && cache[i]->mtime.tv_sec == st->st_mtim.tv_sec && cache[i]->mtime.tv_nsec == st->st_mtim.tv_nsec )
+		{
+			x = cache[i];
+			memmove( cache + 1, cache, i * sizeof(St_arch_index *) );
+			cache[0] = x;
+			__atomic_add_fetch( &x->refs, 1, __ATOMIC_ACQ_REL );
+			break;
+		}
+	}
+	pthread_mutex_unlock( &cache_lock );
+
+	return x;
+}
+
+/* Keep complete index, least recently used one is dropped */
+static void
+bfm_arch_cache_put ( St_arch_index * x )
+{
+	St_arch_index * old;
+
+	__atomic_add_fetch( &x->refs, 1, __ATOMIC_ACQ_REL );
+
+	pthread_mutex_lock( &cache_lock );
+	old = cache[ ARCH_CACHE - 1 ];
+	memmove( cache + 1, cache, ( ARCH_CACHE - 1 ) * sizeof(St_arch_index *) );
+	cache[0] = x;
+	pthread_mutex_unlock( &cache_lock );
+
+	bfm_arch_index_unref(old);
+}
+
+static uint32_t
+bfm_arch_hash ( const char * s, size_t len )
+{
+	uint32_t h = 2166136261u;
+
+	while ( len-- )
+		h = ( h ^ (unsigned char)* s++ ) * 16777619u;
+
+	return h;
+}
+
+/* Slot of directory path, empty slot if it is not indexed */
+static size_t
+bfm_arch_dir_slot ( const St_arch_index * x, const char * path, size_t len )
+{
+	size_t             mask = x->dirs_cap - 1;
+	size_t             i = bfm_arch_hash( path, len ) & mask;
+	const St_arch_ent * e;
+
+	for ( ; x->dirs[i]; i = ( i + 1 ) & mask )
+	{
+		e = &x->ent[ x->dirs[i] - 1 ];
+		if ( strncmp( x->arena + e->path, path, len ) == 0 && x->arena[ e->path + len ] == '\0' )
+			break;
+	}
+
+	return i;
+}
+
+static void
+bfm_arch_dir_insert ( St_arch_index * x, uint32_t e )
+{
+	uint32_t * old = x->dirs;
+	size_t     cap = x->dirs_cap;
+	size_t     i;
+
+	/* Table is kept at most half full */
+	if ( ( x->dirs_len + 1 ) * 2 > x->dirs_cap )
+	{
+		x->dirs_cap = x->dirs_cap ? x->dirs_cap * 2 : 1024;
+		x->dirs = calloc( x->dirs_cap, sizeof(uint32_t) );
+		for ( i = 0; i < cap; i++ )
+			if ( old[i] )
+				x->dirs[ bfm_arch_dir_slot( x, x->arena + x->ent[ old[i] - 1 ].path,
+				                            strlen( x->arena + x->ent[ old[i] - 1 ].path ) ) ] = old[i];
+		free(old);
+	}
+
+	x->dirs[ bfm_arch_dir_slot( x, x->arena + x->ent[e].path, strlen( x->arena + x->ent[e].path ) ) ] = e + 1;
+	x->dirs_len++;
+}
+
+/* Index of directory entry, -1 if there is none */
+static long
+bfm_arch_dir_find ( const St_arch_index * x, const char * path, size_t len )
+{
+	if ( !x->dirs_cap )
+		return -1;
+
+	return (long)x->dirs[ bfm_arch_dir_slot( x, path, len ) ] - 1;
+}
+
+/* Append entry of path with given length, returns -1 if index is full */
+static long
+bfm_arch_append ( St_arch_index * x, const char * path, size_t len, mode_t mode, off_t size, time_t mtime )
+{
+	St_arch_ent  * e;
+	St_arch_list * list;
+	const char   * slash;
+
+	if ( x->arena_len + len + 1 > UINT32_MAX || x->len + 1 >= UINT32_MAX )
+		return -1;
+
+	if ( x->len == x->cap )
+	{
+		x->cap = x->cap ? x->cap * 2 : 1024;
+		x->ent = realloc( x->ent, x->cap * sizeof(St_arch_ent) );
+	}
+	if ( x->arena_len + len + 1 > x->arena_cap )
+	{
+		x->arena_cap = x->arena_cap ? x->arena_cap * 2 : 65536;
+		if ( x->arena_cap < x->arena_len + len + 1 )
+			x->arena_cap = x->arena_len + len + 1;
+		x->arena = realloc( x->arena, x->arena_cap );
+	}
+
+	e = &x->ent[ x->len ];
+	e->path = x->arena_len;
+	memcpy( x->arena + x->arena_len, path, len );
+	x->arena[ x->arena_len + len ] = '\0';
+	x->arena_len += len + 1;
+
+	slash = memrchr( path, '/', len );
+	e->dirlen = slash ? slash - path : 0;
+	e->name = e->path + ( slash ? e->dirlen + 1 : 0 );
+	e->next = e->child.first = e->child.last = 0;
+	e->mode = mode;
+	e->size = size;
+	e->mtime = mtime;
+
+	/* Parent is indexed before its entries, listing walks only its children */
+	list = e->dirlen ? &x->ent[ bfm_arch_dir_find( x, path, e->dirlen ) ].child : &x->top;
+	if ( list->last )
+		x->ent[ list->last - 1 ].next = x->len + 1;
+	else
+		list->first = x->len + 1;
+	list->last = x->len + 1;
+
+	if ( S_ISDIR(mode) )
+		bfm_arch_dir_insert( x, x->len );
+
+	return x->len++;
+}
+
+/* Make sure directory and its parents are listed, archives may store files only */
+static int
+bfm_arch_parents ( St_arch_index * x, const char * path, size_t len, time_t mtime )
+{
+	const char * slash;
+
+	if ( !len || bfm_arch_dir_find( x, path, len ) >= 0 )
+		return 0;
+
+	if ( ( slash = memrchr( path, '/', len ) ) && bfm_arch_parents( x, path, slash - path, mtime ) < 0 )
+		return -1;
+
+	return bfm_arch_append( x, path, len, S_IFDIR | 0755, 0, mtime ) < 0 ? -1 : 0;
+}
+
+/* Index entry, directory stored after its files replaces made up one */
+static int
+bfm_arch_add ( St_arch_index * x, const char * path, mode_t mode, off_t size, time_t mtime )
+{
+	size_t       len = strlen(path);
+	const char * slash = memrchr( path, '/', len );
+	long         d;
+
+	if ( slash && bfm_arch_parents( x, path, slash - path, mtime ) < 0 )
+		return -1;
+
+	if ( S_ISDIR(mode) && ( d = bfm_arch_dir_find( x, path, len ) ) >= 0 )
+	{
+		x->ent[d].mode = mode;
+		x->ent[d].mtime = mtime;
+		return 0;
+	}
+
+	return bfm_arch_append( x, path, len, mode, size, mtime ) < 0 ? -1 : 0;
+}
+
+/* Path inside archive without leading "/" and "./" and trailing "/".
+ * Returns NULL for archive root and paths going up */
+static char *
+bfm_arch_norm ( const char * path, char * buf, size_t size )
+{
+	char * s;
+	char * p;
+	size_t len;
+
+	while ( * path == '/' || ( path[0] == '.' && path[1] == '/' ) )
+		path += * path == '/' ? 1 : 2;
+
+	if ( ( len = strlen(path) ) >= size )
+		return NULL;
+	memcpy( buf, path, len + 1 );
+
+	while ( len && buf[ len - 1 ] == '/' )
+		buf[ --len ] = '\0';
+	if ( !len || strcmp( buf, "." ) == 0 )
+		return NULL;
+
+	/* Folded slashes, no part is ".." */
+	for ( s = p = buf; * s; s++ )
+		if ( !( * s == '/' && s[1] == '/' ) )
+			* p++ = * s;
+	* p = '\0';
+
+	for ( s = buf; s; s = ( s = strchr( s, '/' ) ) ? s + 1 : NULL )
+		if ( s[0] == '.' && s[1] == '.' && ( s[2] == '/' || !s[2] ) )
+			return NULL;
+
+	return buf;
+}
+
+/* Open archive for reading */
+static struct archive *
+bfm_arch_read ( const char * file )
+{
+	struct archive * ar = archive_read_new();
+
+	archive_read_support_filter_all(ar);
+	archive_read_support_format_all(ar);
+
+	if ( archive_read_open_filename( ar, file, ARCH_BLOCK ) != ARCHIVE_OK )
+	{
+		archive_read_free(ar);
+		return NULL;
+	}
+
+	return ar;
+}
+
+static void
+bfm_arch_set_error ( St_arch * a, const char * msg )
+{
+	free( a->error );
+	a->error = strdup( msg ? msg : "unknown error" );
+}
+
+/* Tell receiver about waiting entries */
+static void
+bfm_arch_signal ( St_arch * a, int done )
+{
+	int signal = 0;
+
+	pthread_mutex_lock( &a->lock );
+	a->done = done;
+	if ( !a->signalled && !a->cancel )
+		signal = a->signalled = 1;
+	pthread_mutex_unlock( &a->lock );
+
+	if ( signal )
+		a->notify( a, a->data );
+}
+
+/* Index whole archive in one pass, data is skipped */
+static void *
+bfm_arch_index_worker ( void * p )
+{
+	St_arch              * a = p;
+	struct archive_entry * e = a->first;
+	char                   buf[PATH_MAX];
+	char                 * path;
+	size_t                 n = 0;
+	long                   last = bfm_arch_msec();
+	int                    r = ARCHIVE_OK;
+	int                    full = 0;
+	uint64_t               t = bfm_trace_begin();
+
+	while ( !__atomic_load_n( &a->cancel, __ATOMIC_RELAXED ) )
+	{
+		if ( ( path = bfm_arch_norm( archive_entry_pathname(e), buf, sizeof(buf) ) ) )
+		{
+			pthread_mutex_lock( &a->lock );
+			full = bfm_arch_add( a->index, path, archive_entry_mode(e), archive_entry_size(e), archive_entry_mtime(e) ) < 0;
+			pthread_mutex_unlock( &a->lock );
+			if ( full )
+			{
+				bfm_arch_set_error( a, "too many entries" );
+				break;
+			}
+		}
+
+		if ( ++n >= ARCH_BATCH || bfm_arch_msec() - last > ARCH_LATENCY )
+		{
+			bfm_arch_signal( a, 0 );
+			n = 0;
+			last = bfm_arch_msec();
+		}
+
+		if ( ( r = archive_read_next_header( a->ar, &e ) ) == ARCHIVE_EOF )
+			break;
+		if ( r < ARCHIVE_WARN )
+		{
+			bfm_arch_set_error( a, archive_error_string( a->ar ) );
+			break;
+		}
+	}
+
+	a->index->msec = a->msec = bfm_arch_msec() - a->start;
+	bfm_trace_end( "archive", t );
+
+	/* Only complete index is reused */
+	if ( r == ARCHIVE_EOF && !__atomic_load_n( &a->cancel, __ATOMIC_RELAXED ) )
+		bfm_arch_cache_put( a->index );
+
+	archive_read_free( a->ar );
+	a->ar = NULL;
+	bfm_arch_signal( a, 1 );
+	bfm_arch_unref(a);
+
+	return NULL;
+}
+
+/* Create reading with owner reference */
+static St_arch *
+bfm_arch_new ( Arch_notify notify, void * data )
+{
+	St_arch * a = calloc( 1, sizeof(St_arch) );
+
+	pthread_mutex_init( &a->lock, NULL );
+	a->refs = 1;
+	a->start = bfm_arch_msec();
+	a->notify = notify;
+	a->data = data;
+
+	return a;
+}
+
+/* Run worker holding its own reference */
+static void
+bfm_arch_run ( St_arch * a, void * (* worker)( void * ) )
+{
+	pthread_t      thr;
+	pthread_attr_t attr;
+
+	bfm_arch_ref(a);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+	/* Run synchronously if no thread is available */
+	if ( pthread_create( &thr, &attr, worker, a ) != 0 )
+		worker(a);
+
+	pthread_attr_destroy(&attr);
+}
+
+/* Start indexing of archive file, NULL if it is not readable archive.
+ * Index of unchanged archive is reused without reading it again */
+St_arch *
+bfm_arch_open ( const char * file, Arch_notify notify, void * data )
+{
+	St_arch_index * x;
+	St_arch       * a;
+	struct stat     st;
+	int             r;
+
+	if ( stat( file, &st ) < 0 || !S_ISREG( st.st_mode ) )
+		return NULL;
+
+	if ( ( x = bfm_arch_cache_get(&st) ) )
+	{
+		a = bfm_arch_new( notify, data );
+		a->index = x;
+		a->msec = x->msec;
+		bfm_arch_signal( a, 1 );
+		return a;
+	}
+
+	a = bfm_arch_new( notify, data );
+	if ( !( a->ar = bfm_arch_read(file) ) )
+	{
+		bfm_arch_unref(a);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Files which only look like archives fail on first header, any text passes as mtree */
+	if ( ( r = archive_read_next_header( a->ar, &a->first ) ) < ARCHIVE_WARN || r == ARCHIVE_EOF
+	  || ( archive_format( a->ar ) & ARCHIVE_FORMAT_BASE_MASK ) == ARCHIVE_FORMAT_MTREE )
+	{
+		archive_read_free( a->ar );
+		a->ar = NULL;
+		bfm_arch_unref(a);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	a->index = calloc( 1, sizeof(St_arch_index) );
+	a->index->refs = 1;
+	a->index->dev = st.st_dev;
+	a->index->ino = st.st_ino;
+	a->index->size = st.st_size;
+	a->index->mtime = st.st_mtim;
+
+	bfm_arch_run( a, bfm_arch_index_worker );
+	return a;
+}
+
+/* Receive up to max entries of directory inside archive, "" is top level.
+ * State is set to one of ScanState */
+size_t
+bfm_arch_take ( St_arch * a, const char * dir, St_entry * out, size_t max, int * state )
+{
+	St_arch_index     * x = a->index;
+	const St_arch_ent * e;
+	size_t              dlen = strlen(dir);
+	size_t              n = 0;
+	uint32_t            next;
+	long                d;
+
+	pthread_mutex_lock( &a->lock );
+
+	/* Taking goes on after last taken child, directory may be indexed later */
+	if ( a->pos )
+		next = x->ent[ a->pos - 1 ].next;
+	else if ( !dlen )
+		next = x->top.first;
+	else
+		next = ( d = bfm_arch_dir_find( x, dir, dlen ) ) >= 0 ? x->ent[d].child.first : 0;
+
+	for ( ; next && n < max; next = e->next )
+	{
+		e = &x->ent[ next - 1 ];
+		a->pos = next;
+
+		out[n].name = strdup( x->arena + e->name );
+		out[n].mode = e->mode;
+		out[n].size = e->size;
+		out[n++].mtime = e->mtime;
+	}
+
+	if (next)
+		* state = SCAN_MORE;
+	else if ( a->done )
+		* state = SCAN_DONE;
+	else
+	{
+		a->signalled = 0;
+		* state = SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &a->lock );
+	return n;
+}
+
+/* Start taking from first entry again, for other directory of same archive */
+void
+bfm_arch_rewind ( St_arch * a )
+{
+	pthread_mutex_lock( &a->lock );
+	a->pos = 0;
+	pthread_mutex_unlock( &a->lock );
+}
+
+/* Path under dest for entry selected directly or through its directory, NULL if it is not selected */
+static char *
+bfm_arch_target ( St_arch * a, const char * path )
+{
+	const char * slash;
+	char       * target;
+	size_t       len;
+	size_t       i;
+
+	for ( i = 0; i < a->n_paths; i++ )
+	{
+		len = strlen( a->paths[i] );
+		if ( strncmp( path, a->paths[i], len ) != 0 || ( path[len] && path[len] != '/' ) )
+			continue;
+
+		/* Selected name lands directly in dest */
+		slash = strrchr( a->paths[i], '/' );
+		path += slash ? slash - a->paths[i] + 1 : 0;
+
+		len = strlen( a->dest ) + strlen(path) + 2;
+		target = malloc(len);
+		snprintf( target, len, "%s/%s", a->dest, path );
+		return target;
+	}
+
+	return NULL;
+}
+
+/* Copy data of current entry */
+static int
+bfm_arch_copy_data ( St_arch * a, struct archive * disk )
+{
+	const void * buf;
+	size_t       size;
+	la_int64_t   off;
+	int          r;
+
+	while ( !__atomic_load_n( &a->cancel, __ATOMIC_RELAXED ) )
+	{
+		if ( ( r = archive_read_data_block( a->ar, &buf, &size, &off ) ) == ARCHIVE_EOF )
+			return ARCHIVE_OK;
+		if ( r < ARCHIVE_WARN )
+		{
+			bfm_arch_set_error( a, archive_error_string( a->ar ) );
+			return r;
+		}
+		if ( archive_write_data_block( disk, buf, size, off ) < ARCHIVE_WARN )
+		{
+			bfm_arch_set_error( a, archive_error_string(disk) );
+			return ARCHIVE_FAILED;
+		}
+	}
+
+	return ARCHIVE_FAILED;
+}
+
+/* Remove file of extracted tree, others are removed anyway */
+static int
+bfm_arch_remove_one ( const char * path, const struct stat * st, int flag, struct FTW * ftw )
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+	remove(path);
+	return 0;
+}
+
+/* Remove directory with extracted entries */
+void
+bfm_arch_remove ( const char * dir )
+{
+	nftw( dir, bfm_arch_remove_one, 16, FTW_DEPTH | FTW_PHYS );
+}
+
+/* Extract selected entries in one pass, existing files are not replaced */
+static void *
+bfm_arch_extract_worker ( void * p )
+{
+	St_arch              * a = p;
+	struct archive       * disk = archive_write_disk_new();
+	struct archive_entry * e;
+	char                   buf[PATH_MAX];
+	char                 * path;
+	char                 * target;
+	char                 * link;
+	struct stat            st;
+	int                    r = ARCHIVE_OK;
+
+	/* Targets are absolute paths under dest, names were already checked by bfm_arch_norm */
+	archive_write_disk_set_options( disk, ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_NO_OVERWRITE
+	                                      | ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_SECURE_NODOTDOT );
+	archive_write_disk_set_standard_lookup(disk);
+
+	if ( !( a->ar = bfm_arch_read( a->file ) ) )
+	{
+		bfm_arch_set_error( a, strerror(EINVAL) );
+		a->errors++;
+	}
+
+	while ( a->ar && !__atomic_load_n( &a->cancel, __ATOMIC_RELAXED ) )
+	{
+		if ( ( r = archive_read_next_header( a->ar, &e ) ) == ARCHIVE_EOF )
+			break;
+		if ( r < ARCHIVE_WARN )
+		{
+			bfm_arch_set_error( a, archive_error_string( a->ar ) );
+			a->errors++;
+			break;
+		}
+
+		if ( !( path = bfm_arch_norm( archive_entry_pathname(e), buf, sizeof(buf) ) )
+		  || !( target = bfm_arch_target( a, path ) ) )
+			continue;
+		/* Skipped silently by disk writer, existing directories are merged */
+		r = lstat( target, &st ) == 0 && !( S_ISDIR( st.st_mode ) && S_ISDIR( archive_entry_mode(e) ) );
+		archive_entry_set_pathname( e, target );
+		free(target);
+		if (r)
+		{
+			bfm_arch_set_error( a, strerror(EEXIST) );
+			a->errors++;
+			continue;
+		}
+
+		/* Hard link has to point into extracted part too */
+		if ( archive_entry_hardlink(e) )
+		{
+			link = NULL;
+			if ( ( path = bfm_arch_norm( archive_entry_hardlink(e), buf, sizeof(buf) ) )
+			  && ( link = bfm_arch_target( a, path ) ) )
+				archive_entry_set_hardlink( e, link );
+			free(link);
+			if ( !link )
+			{
+				bfm_arch_set_error( a, "hard link target is not extracted" );
+				a->errors++;
+				continue;
+			}
+		}
+
+		if ( archive_write_header( disk, e ) < ARCHIVE_WARN )
+		{
+			bfm_arch_set_error( a, archive_error_string(disk) );
+			a->errors++;
+		}
+		else if ( bfm_arch_copy_data( a, disk ) < ARCHIVE_WARN || archive_write_finish_entry(disk) < ARCHIVE_WARN )
+			a->errors++;
+		else
+			a->count++;
+	}
+
+	archive_write_close(disk);
+	archive_write_free(disk);
+	if ( a->ar )
+		archive_read_free( a->ar );
+	a->ar = NULL;
+
+	a->msec = bfm_arch_msec() - a->start;
+	bfm_arch_signal( a, 1 );
+
+	pthread_mutex_lock( &a->lock );
+	r = a->discard;
+	pthread_mutex_unlock( &a->lock );
+	if (r)
+		bfm_arch_remove( a->dest );
+	bfm_arch_unref(a);
+
+	return NULL;
+}
+
+/* Extract paths inside archive into dest, directories with their content.
+ * Receiver is notified when it is over */
+St_arch *
+bfm_arch_extract ( const char * file, char * const * paths, size_t n, const char * dest, Arch_notify notify, void * data )
+{
+	St_arch * a = bfm_arch_new( notify, data );
+	size_t    i;
+
+	a->file = strdup(file);
+	/* Secure symlink check covers whole target path, so dest itself is taken without links */
+	if ( !( a->dest = realpath( dest, NULL ) ) )
+		a->dest = strdup(dest);
+	a->paths = malloc( n * sizeof(char *) );
+	a->n_paths = n;
+	for ( i = 0; i < n; i++ )
+		a->paths[i] = strdup( paths[i] );
+
+	bfm_arch_run( a, bfm_arch_extract_worker );
+	return a;
+}
+
+/* Indexed or extracted entries, failed extractions, duration and memory of index */
+void
+bfm_arch_stats ( St_arch * a, size_t * count, size_t * errors, long * msec, size_t * memory )
+{
+	pthread_mutex_lock( &a->lock );
+	* count = a->index ? a->index->len : a->count;
+	* errors = a->errors;
+	* msec = a->msec;
+	* memory = a->index ? bfm_arch_index_memory( a->index ) : 0;
+	pthread_mutex_unlock( &a->lock );
+}
+
+/* Last error, NULL if there was none. Valid once reading is over */
+const char *
+bfm_arch_error ( St_arch * a )
+{
+	return a->error;
+}
+
+/* Receiver data */
+void *
+bfm_arch_data ( St_arch * a )
+{
+	return a->data;
+}
+
+/* Check if reading was cancelled by owner */
+int
+bfm_arch_cancelled ( St_arch * a )
+{
+	return __atomic_load_n( &a->cancel, __ATOMIC_RELAXED );
+}
+
+/* Stop reading and release owner reference */
+void
+bfm_arch_cancel ( St_arch * a )
+{
+	pthread_mutex_lock( &a->lock );
+	__atomic_store_n( &a->cancel, 1, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &a->lock );
+
+	bfm_arch_unref(a);
+}
+
+/* Cancel extraction and remove dest with what was extracted into it */
+void
+bfm_arch_discard ( St_arch * a )
+{
+	int done;
+
+	/* Running worker removes it when it stops writing */
+	pthread_mutex_lock( &a->lock );
+	done = a->done;
+	a->discard = !done;
+	pthread_mutex_unlock( &a->lock );
+
+	if (done)
+		bfm_arch_remove( a->dest );
+	bfm_arch_cancel(a);
+}
+
+void
+bfm_arch_ref ( St_arch * a )
+{
+	__atomic_add_fetch( &a->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_arch_unref ( St_arch * a )
+{
+	size_t i;
+
+	if ( __atomic_sub_fetch( &a->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	for ( i = 0; i < a->n_paths; i++ )
+		free( a->paths[i] );
+	free( a->paths );
+	free( a->file );
+	free( a->dest );
+	free( a->error );
+	bfm_arch_index_unref( a->index );
+	pthread_mutex_destroy( &a->lock );
+	free(a);
+}
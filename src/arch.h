@@ -0,0 +1,30 @@
+#ifndef BFM_ARCH_H
+#define BFM_ARCH_H
+
+#include <stddef.h>
+
+#include "scan.h"
+
+/* Structs */
+/* Background reading of archive, indexing for browsing or extraction */
+typedef struct St_arch St_arch;
+
+/* Called from worker thread when new entries are indexed or extraction is over */
+typedef void (* Arch_notify)( St_arch *, void * );
+
+/* Protos */
+St_arch *    bfm_arch_open      ( const char *, Arch_notify, void * );
+St_arch *    bfm_arch_extract   ( const char *, char * const *, size_t, const char *, Arch_notify, void * );
+size_t       bfm_arch_take      ( St_arch *, const char *, St_entry *, size_t, int * );
+void         bfm_arch_rewind    ( St_arch * );
+void         bfm_arch_stats     ( St_arch *, size_t *, size_t *, long *, size_t * );
+const char * bfm_arch_error     ( St_arch * );
+void *       bfm_arch_data      ( St_arch * );
+int          bfm_arch_cancelled ( St_arch * );
+void         bfm_arch_cancel    ( St_arch * );
+void         bfm_arch_discard   ( St_arch * );
+void         bfm_arch_remove    ( const char * );
+void         bfm_arch_ref       ( St_arch * );
+void         bfm_arch_unref     ( St_arch * );
+
+#endif
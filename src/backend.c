@@ -0,0 +1,442 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "trace.h"
+
+/* Depth of submission queue */
+#define URING_DEPTH   256
+/* Threads in stat pool, including caller */
+#define POOL_THREADS  8
+/* Entries taken by pool thread at once */
+#define POOL_CHUNK    16
+/* Only fields shown in columns are requested */
+#define STATX_FIELDS  ( STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME )
+
+/* Structs */
+/* Raw io_uring instance */
+typedef struct
+{
+	int                   fd;
+	void                * sq_ptr;
+	void                * cq_ptr;
+	size_t                sq_size;
+	size_t                cq_size;
+	struct io_uring_sqe * sqes;
+	unsigned            * sq_head;
+	unsigned            * sq_tail;
+	unsigned            * sq_mask;
+	unsigned            * sq_array;
+	unsigned            * cq_head;
+	unsigned            * cq_tail;
+	unsigned            * cq_mask;
+	struct io_uring_cqe * cqes;
+} St_uring;
+
+struct St_backend
+{
+	St_uring       ring;
+	/* Results for submitted requests */
+	struct statx  * stx;
+	/* Requests completed, completions come in any order */
+	unsigned char * fin;
+	size_t          stx_cap;
+};
+
+/* Batch handed to stat pool */
+typedef struct St_pool_job
+{
+	int                  dfd;
+	St_entry           * ent;
+	size_t               n;
+	/* Next unclaimed entry */
+	size_t               next;
+	/* Finished entries */
+	size_t               done;
+	struct St_pool_job * nx;
+} St_pool_job;
+
+/* Globals */
+static pthread_once_t  backend_once = PTHREAD_ONCE_INIT;
+static int             backend_type = BACKEND_STATX;
+static pthread_once_t  pool_once = PTHREAD_ONCE_INIT;
+static int             pool_threads = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  pool_done = PTHREAD_COND_INITIALIZER;
+static St_pool_job   * pool_jobs = NULL;
+
+/* Functions */
+/* Fill entry from statx result, mode 0 marks failure */
+static void
+bfm_backend_fill ( St_entry * e, const struct statx * stx )
+{
+	e->mode  = stx->stx_mode;
+	e->size  = stx->stx_size;
+	e->mtime = stx->stx_mtime.tv_sec;
+}
+
+/* Serial statx() calls */
+static void
+bfm_backend_stat_sync ( int dfd, St_entry * ent, size_t n )
+{
+	struct statx stx;
+	size_t i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( statx( dfd, ent[i].name, AT_STATX_SYNC_AS_STAT, STATX_FIELDS, &stx ) == 0 )
+			bfm_backend_fill( &ent[i], &stx );
+		else
+			ent[i].mode = 0;
+	}
+}
+
+static int
+bfm_uring_setup ( St_uring * r, unsigned depth )
+{
+	struct io_uring_params p;
+
+	memset( &p, 0, sizeof(p) );
+	memset( r, 0, sizeof(* r) );
+
+	if ( ( r->fd = syscall( __NR_io_uring_setup, depth, &p ) ) < 0 )
+		return -1;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	/* Both rings are mapped at once on newer kernels */
+	if ( p.features & IORING_FEAT_SINGLE_MMAP )
+		r->sq_size = r->cq_size = r->sq_size > r->cq_size ? r->sq_size : r->cq_size;
+
+	r->sq_ptr = mmap( NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING );
+	if ( r->sq_ptr == MAP_FAILED )
+		goto fail;
+
+	if ( p.features & IORING_FEAT_SINGLE_MMAP )
+		r->cq_ptr = r->sq_ptr;
+	else if ( ( r->cq_ptr = mmap( NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING ) ) == MAP_FAILED )
+		goto fail_sq;
+
+	r->sqes = mmap( NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES );
+	if ( r->sqes == MAP_FAILED )
+		goto fail_cq;
+
+	r->sq_head  = (unsigned *)( (char *)r->sq_ptr + p.sq_off.head );
+	r->sq_tail  = (unsigned *)( (char *)r->sq_ptr + p.sq_off.tail );
+	r->sq_mask  = (unsigned *)( (char *)r->sq_ptr + p.sq_off.ring_mask );
+	r->sq_array = (unsigned *)( (char *)r->sq_ptr + p.sq_off.array );
+	r->cq_head  = (unsigned *)( (char *)r->cq_ptr + p.cq_off.head );
+	r->cq_tail  = (unsigned *)( (char *)r->cq_ptr + p.cq_off.tail );
+	r->cq_mask  = (unsigned *)( (char *)r->cq_ptr + p.cq_off.ring_mask );
+	r->cqes     = (struct io_uring_cqe *)( (char *)r->cq_ptr + p.cq_off.cqes );
+
+	return 0;
+
+fail_cq:
+	if ( r->cq_ptr != r->sq_ptr )
+		munmap( r->cq_ptr, r->cq_size );
+fail_sq:
+	munmap( r->sq_ptr, r->sq_size );
+fail:
+	close( r->fd );
+	r->fd = -1;
+	return -1;
+}
+
+static void
+bfm_uring_close ( St_uring * r )
+{
+	if ( r->fd < 0 )
+		return;
+
+	munmap( r->sqes, ( * r->sq_mask + 1 ) * sizeof(struct io_uring_sqe) );
+	if ( r->cq_ptr != r->sq_ptr )
+		munmap( r->cq_ptr, r->cq_size );
+	munmap( r->sq_ptr, r->sq_size );
+	close( r->fd );
+	r->fd = -1;
+}
+
+/* Check if kernel supports statx operation */
+static int
+bfm_uring_probe ( void )
+{
+	St_uring                r;
+	struct io_uring_probe * pr;
+	size_t                  sz = sizeof(* pr) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	int                     ok = 0;
+
+	if ( bfm_uring_setup( &r, 4 ) != 0 )
+		return 0;
+
+	pr = calloc( 1, sz );
+	if ( syscall( __NR_io_uring_register, r.fd, IORING_REGISTER_PROBE, pr, IORING_OP_LAST ) == 0 )
+		ok = pr->last_op >= IORING_OP_STATX && ( pr->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED );
+
+	free(pr);
+	bfm_uring_close(&r);
+	return ok;
+}
+
+/* Submit statx requests through io_uring and wait for them */
+static void
+bfm_backend_stat_uring ( St_backend * be, int dfd, St_entry * ent, size_t n )
+{
+	St_uring * r = &be->ring;
+	size_t     sent = 0;
+	size_t     reaped = 0;
+	unsigned   tail;
+	unsigned   head;
+	unsigned   todo;
+	size_t     i;
+
+	if ( n > be->stx_cap )
+	{
+		be->stx_cap = n;
+		be->stx = realloc( be->stx, n * sizeof(struct statx) );
+		be->fin = realloc( be->fin, n );
+	}
+	memset( be->fin, 0, n );
+
+	while ( reaped < n )
+	{
+		/* Fill free submission slots */
+		tail = * r->sq_tail;
+		todo = 0;
+		while ( sent < n && sent - reaped < URING_DEPTH )
+		{
+			unsigned              idx = tail & * r->sq_mask;
+			struct io_uring_sqe * sqe = &r->sqes[idx];
+
+			memset( sqe, 0, sizeof(* sqe) );
+			sqe->opcode      = IORING_OP_STATX;
+			sqe->fd          = dfd;
+			sqe->addr        = (uintptr_t)ent[sent].name;
+			sqe->len         = STATX_FIELDS;
+			sqe->off         = (uintptr_t)&be->stx[sent];
+			sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+			sqe->user_data   = sent;
+			r->sq_array[idx] = idx;
+
+			tail++;
+			sent++;
+			todo++;
+		}
+		__atomic_store_n( r->sq_tail, tail, __ATOMIC_RELEASE );
+
+		while ( syscall( __NR_io_uring_enter, r->fd, todo, 1, IORING_ENTER_GETEVENTS, NULL, 0 ) < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			/* Ring is unusable, finish unanswered requests with plain calls */
+			bfm_uring_close(r);
+			for ( i = 0; i < n; i++ )
+				if ( !be->fin[i] )
+					bfm_backend_stat_sync( dfd, ent + i, 1 );
+			return;
+		}
+
+		/* Collect completions */
+		head = * r->cq_head;
+		while ( head != __atomic_load_n( r->cq_tail, __ATOMIC_ACQUIRE ) )
+		{
+			struct io_uring_cqe * cqe = &r->cqes[ head & * r->cq_mask ];
+
+			/* Entry is found by user_data, completions are not in submission order */
+			i = cqe->user_data;
+			if ( cqe->res == 0 )
+				bfm_backend_fill( &ent[i], &be->stx[i] );
+			else
+				ent[i].mode = 0;
+			be->fin[i] = 1;
+
+			head++;
+			reaped++;
+		}
+		__atomic_store_n( r->cq_head, head, __ATOMIC_RELEASE );
+	}
+}
+
+/* Take a chunk of job, called with pool lock held */
+static void
+bfm_pool_run ( St_pool_job * job )
+{
+	size_t i;
+	size_t end;
+
+	while ( job->next < job->n )
+	{
+		i = job->next;
+		end = job->next = i + POOL_CHUNK < job->n ? i + POOL_CHUNK : job->n;
+
+		pthread_mutex_unlock(&pool_lock);
+		bfm_backend_stat_sync( job->dfd, job->ent + i, end - i );
+		pthread_mutex_lock(&pool_lock);
+
+		if ( ( job->done += end - i ) == job->n )
+			pthread_cond_broadcast(&pool_done);
+	}
+}
+
+/* Unlink job from queue, called with pool lock held */
+static void
+bfm_pool_unlink ( St_pool_job * job )
+{
+	St_pool_job ** p;
+
+	for ( p = &pool_jobs; * p; p = &( * p )->nx )
+	{
+		if ( * p == job )
+		{
+			* p = job->nx;
+			break;
+		}
+	}
+}
+
+/* Stat pool thread routine */
+static void *
+bfm_pool_worker ( void * p )
+{
+	St_pool_job * job;
+	(void)p;
+
+	pthread_mutex_lock(&pool_lock);
+	for (;;)
+	{
+		while ( !pool_jobs )
+			pthread_cond_wait( &pool_work, &pool_lock );
+
+		/* Drop exhausted job so no thread spins on it */
+		job = pool_jobs;
+		bfm_pool_run(job);
+		bfm_pool_unlink(job);
+	}
+
+	return NULL;
+}
+
+/* Split batch between pool threads, calling thread takes part too */
+static void
+bfm_backend_stat_pool ( int dfd, St_entry * ent, size_t n )
+{
+	St_pool_job job = { dfd, ent, n, 0, 0, NULL };
+
+	pthread_mutex_lock(&pool_lock);
+	job.nx = pool_jobs;
+	pool_jobs = &job;
+	pthread_cond_broadcast(&pool_work);
+
+	bfm_pool_run(&job);
+	bfm_pool_unlink(&job);
+
+	while ( job.done < job.n )
+		pthread_cond_wait( &pool_done, &pool_lock );
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* Start stat pool, return number of threads started;
+ * stat() mostly waits for disk or network, so size does not depend on CPU count */
+static int
+bfm_pool_start ( void )
+{
+	pthread_t thr;
+	int       i;
+
+	for ( i = 0; i < POOL_THREADS - 1; i++ )
+		if ( pthread_create( &thr, NULL, bfm_pool_worker, NULL ) != 0 || pthread_detach(thr) != 0 )
+			break;
+
+	return i;
+}
+
+static void
+bfm_pool_init ( void )
+{
+	pool_threads = bfm_pool_start();
+}
+
+/* Choose backend, BFM_SCAN environment variable overrides probing */
+static void
+bfm_backend_select ( void )
+{
+	const char * env = getenv("BFM_SCAN");
+
+	if ( env && strcmp( env, "statx" ) == 0 )
+		backend_type = BACKEND_STATX;
+	else if ( ( !env || strcmp( env, "io_uring" ) == 0 ) && bfm_uring_probe() )
+		backend_type = BACKEND_URING;
+	else if ( pthread_once( &pool_once, bfm_pool_init ), pool_threads > 0 )
+		backend_type = BACKEND_THREADS;
+	else
+		backend_type = BACKEND_STATX;
+}
+
+/* Name of active backend */
+const char *
+bfm_backend_name ( void )
+{
+	static const char * names[] = { "io_uring", "threads", "statx" };
+
+	pthread_once( &backend_once, bfm_backend_select );
+	return names[backend_type];
+}
+
+int
+bfm_backend_type ( void )
+{
+	pthread_once( &backend_once, bfm_backend_select );
+	return backend_type;
+}
+
+/* Create state for one scanning thread */
+St_backend *
+bfm_backend_new ( void )
+{
+	St_backend * be = calloc( 1, sizeof(St_backend) );
+
+	be->ring.fd = -1;
+	/* Ring can still fail at runtime, e.g. memlock limit, pool takes over then */
+	if ( bfm_backend_type() == BACKEND_URING && bfm_uring_setup( &be->ring, URING_DEPTH ) != 0 )
+		pthread_once( &pool_once, bfm_pool_init );
+
+	return be;
+}
+
+void
+bfm_backend_free ( St_backend * be )
+{
+	bfm_uring_close( &be->ring );
+	free( be->stx );
+	free( be->fin );
+	free(be);
+}
+
+/* Collect metadata for batch of named entries relative to directory */
+void
+bfm_backend_stat ( St_backend * be, int dfd, St_entry * ent, size_t n )
+{
+	uint64_t t = bfm_trace_begin();
+
+	if ( be->ring.fd >= 0 )
+		bfm_backend_stat_uring( be, dfd, ent, n );
+	else if ( pool_threads > 0 && n > POOL_CHUNK )
+		bfm_backend_stat_pool( dfd, ent, n );
+	else
+		bfm_backend_stat_sync( dfd, ent, n );
+
+	bfm_trace_end( "stat", t );
+}
@@ -0,0 +1,28 @@
+#ifndef BFM_BACKEND_H
+#define BFM_BACKEND_H
+
+#include <stddef.h>
+
+#include "scan.h"
+
+/* Enums */
+/* Metadata collection methods */
+enum BackendType
+{
+	BACKEND_URING,
+	BACKEND_THREADS,
+	BACKEND_STATX
+};
+
+/* Structs */
+/* Per-scan backend state */
+typedef struct St_backend St_backend;
+
+/* Protos */
+St_backend * bfm_backend_new   ( void );
+const char * bfm_backend_name  ( void );
+int          bfm_backend_type  ( void );
+void         bfm_backend_free  ( St_backend * );
+void         bfm_backend_stat  ( St_backend *, int, St_entry *, size_t );
+
+#endif
@@ -0,0 +1,577 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "format.h"
+#include "listing.h"
+#include "scan.h"
+#include "sort.h"
+#include "trace.h"
+
+/* Entries per directory of deep tree, one of them leads deeper */
+#define BENCH_LEVEL    100
+/* Length of names in long name tree */
+#define BENCH_LONG     200
+/* Same as default in config.h */
+#define BENCH_TIMEFMT  "%Y/%m/%d %H:%M:%S"
+
+/* Structs */
+/* Measured part of listing pipeline */
+typedef struct
+{
+	const char * name;
+	double       msec;
+	/* Negative if syscalls can not be counted */
+	long long    syscalls;
+	/* Peak resident set during stage */
+	long         rss_kib;
+} St_stage;
+
+/* Listing of one directory passing through pipeline */
+typedef struct
+{
+	St_entry   * ent;
+	size_t       len;
+	size_t       cap;
+	St_listing * list;
+	uint32_t   * rows;
+} St_run;
+
+/* Scan completion */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	int             ready;
+} St_wait;
+
+/* Enums */
+/* Stages in pipeline order */
+enum Stage
+{
+	STAGE_CREATE,
+	STAGE_SCAN,
+	STAGE_FILL,
+	STAGE_SORT,
+	STAGE_FORMAT,
+	N_STAGES
+};
+
+/* Shapes of generated trees */
+enum Shape
+{
+	SHAPE_WIDE,
+	SHAPE_DEEP,
+	SHAPE_LONG,
+	N_SHAPES
+};
+
+/* Globals */
+static const char * stage_names[N_STAGES] = { "create", "scan", "fill", "sort", "format" };
+static const char * shape_names[N_SHAPES] = { "wide", "deep", "long" };
+static const char * exts[] = { "txt", "c", "jpg", "tar.gz", "md", "" };
+/* Syscall counter inherited by threads, -1 if it is not available */
+static int          sysfd = -1;
+static int          json = 0;
+static int          first = 1;
+
+/* Functions */
+static double
+bfm_bench_now ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Count entries into syscalls of process, threads started later are included */
+static void
+bfm_bench_sys_open ( void )
+{
+	static const char * ids[] = {
+		"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+		"/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+	};
+	struct perf_event_attr attr;
+	FILE                 * f;
+	unsigned long long     id;
+	size_t                 i;
+
+	for ( i = 0; i < sizeof(ids) / sizeof(* ids); i++ )
+	{
+		if ( !( f = fopen( ids[i], "r" ) ) )
+			continue;
+		if ( fscanf( f, "%llu", &id ) != 1 )
+			id = 0;
+		fclose(f);
+
+		memset( &attr, 0, sizeof(attr) );
+		attr.type = PERF_TYPE_TRACEPOINT;
+		attr.size = sizeof(attr);
+		attr.config = id;
+		attr.inherit = 1;
+		if ( id && ( sysfd = syscall( SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC ) ) >= 0 )
+			return;
+	}
+}
+
+static long long
+bfm_bench_sys_read ( void )
+{
+	unsigned long long n;
+
+	if ( sysfd < 0 || read( sysfd, &n, sizeof(n) ) != sizeof(n) )
+		return -1;
+	return n;
+}
+
+/* Reset peak resident set to current one */
+static void
+bfm_bench_rss_reset ( void )
+{
+	int fd = open( "/proc/self/clear_refs", O_WRONLY | O_CLOEXEC );
+
+	if ( fd >= 0 )
+	{
+		if ( write( fd, "5", 1 ) < 0 )
+			fprintf( stderr, "clear_refs: %s\n", strerror(errno) );
+		close(fd);
+	}
+}
+
+static long
+bfm_bench_rss_peak ( void )
+{
+	char   line[128];
+	long   kib = -1;
+	FILE * f = fopen( "/proc/self/status", "r" );
+
+	if ( !f )
+		return -1;
+	while ( fgets( line, sizeof(line), f ) )
+		if ( sscanf( line, "VmHWM: %ld", &kib ) == 1 )
+			break;
+	fclose(f);
+
+	return kib;
+}
+
+static void
+bfm_bench_begin ( long long * sys, double * start )
+{
+	bfm_bench_rss_reset();
+	* sys = bfm_bench_sys_read();
+	* start = bfm_bench_now();
+}
+
+/* Add measurement to stage, stage may be run once per directory */
+static void
+bfm_bench_end ( St_stage * s, long long sys, double start )
+{
+	long long now = bfm_bench_sys_read();
+	long      rss = bfm_bench_rss_peak();
+
+	s->msec += bfm_bench_now() - start;
+	s->syscalls = sys < 0 || now < 0 ? -1 : s->syscalls + now - sys;
+	if ( rss > s->rss_kib )
+		s->rss_kib = rss;
+}
+
+/* Name of entry i in tree of given shape */
+static void
+bfm_bench_name ( int shape, size_t i, char * buf, size_t len )
+{
+	const char * ext = exts[ i % ( sizeof(exts) / sizeof(* exts) ) ];
+	/* Some capitals so that names have separate sort keys */
+	const char * base = i % 7 ? "file" : "File";
+
+	if ( shape == SHAPE_LONG )
+		snprintf( buf, len, "%s with a long name %0*zu%s%s",
+		          base, (int)( BENCH_LONG - 24 - strlen(ext) ), i, * ext ? "." : "", ext );
+	else
+		snprintf( buf, len, "%s-%zu%s%s", base, i, * ext ? "." : "", ext );
+}
+
+/* Fill directory with n entries, every twentieth is directory */
+static int
+bfm_bench_fill ( int dfd, int shape, size_t from, size_t n )
+{
+	char   name[NAME_MAX + 1];
+	size_t i;
+	int    fd;
+
+	for ( i = from; i < from + n; i++ )
+	{
+		bfm_bench_name( shape, i, name, sizeof(name) );
+
+		if ( i % 20 == 19 )
+		{
+			if ( mkdirat( dfd, name, 0755 ) < 0 )
+				return -1;
+			continue;
+		}
+
+		if ( ( fd = openat( dfd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644 ) ) < 0 )
+			return -1;
+		/* Sparse files of varying size */
+		if ( ftruncate( fd, ( i * 2654435761u ) % ( 1 << 24 ) ) < 0 )
+		{
+			close(fd);
+			return -1;
+		}
+		close(fd);
+	}
+
+	return 0;
+}
+
+/* Create tree of n entries under root, deep tree nests one level per BENCH_LEVEL */
+static int
+bfm_bench_create ( const char * root, int shape, size_t n )
+{
+	size_t done = 0;
+	size_t k;
+	int    dfd;
+	int    next;
+	int    ret;
+
+	if ( mkdir( root, 0755 ) < 0 || ( dfd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0 )
+		return -1;
+
+	if ( shape != SHAPE_DEEP )
+	{
+		ret = bfm_bench_fill( dfd, shape, 0, n );
+		close(dfd);
+		return ret;
+	}
+
+	while ( done < n )
+	{
+		k = n - done < BENCH_LEVEL ? n - done : BENCH_LEVEL - 1;
+		if ( bfm_bench_fill( dfd, shape, done, k ) < 0 )
+			break;
+		done += k;
+
+		if ( done < n )
+		{
+			if ( mkdirat( dfd, "next", 0755 ) < 0 || ( next = openat( dfd, "next", O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0 )
+				break;
+			close(dfd);
+			dfd = next;
+			done++;
+		}
+	}
+
+	close(dfd);
+	return done < n ? -1 : 0;
+}
+
+/* Remove directory content, paths of deep tree are longer than PATH_MAX */
+static void
+bfm_bench_remove ( int dfd )
+{
+	struct dirent * e;
+	DIR           * dir;
+	int             fd;
+
+	if ( !( dir = fdopendir(dfd) ) )
+	{
+		close(dfd);
+		return;
+	}
+
+	while ( ( e = readdir(dir) ) )
+	{
+		if ( !bfm_name_validat( e->d_name, 1 ) )
+			continue;
+		if ( unlinkat( dirfd(dir), e->d_name, 0 ) == 0 )
+			continue;
+		if ( ( fd = openat( dirfd(dir), e->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) ) >= 0 )
+		{
+			bfm_bench_remove(fd);
+			unlinkat( dirfd(dir), e->d_name, AT_REMOVEDIR );
+		}
+	}
+
+	closedir(dir);
+}
+
+static void
+bfm_bench_notify ( St_scan * sc, void * data )
+{
+	St_wait * w = data;
+	(void)sc;
+
+	pthread_mutex_lock( &w->lock );
+	w->ready = 1;
+	pthread_cond_signal( &w->cond );
+	pthread_mutex_unlock( &w->lock );
+}
+
+/* Read directory with scanner used by window */
+static void
+bfm_bench_scan ( int dfd, St_run * r )
+{
+	St_wait   w = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+	St_scan * sc;
+	DIR     * dir;
+	int       state = SCAN_WAIT;
+	size_t    n;
+
+	r->len = 0;
+	if ( !( dir = fdopendir( dup(dfd) ) ) || !( sc = bfm_scan_start( dir, bfm_bench_notify, &w ) ) )
+		return;
+
+	while ( state != SCAN_DONE )
+	{
+		pthread_mutex_lock( &w.lock );
+		while ( !w.ready )
+			pthread_cond_wait( &w.cond, &w.lock );
+		w.ready = 0;
+		pthread_mutex_unlock( &w.lock );
+
+		do
+		{
+			if ( r->cap - r->len < 1024 )
+			{
+				r->cap = r->cap ? r->cap * 2 : 4096;
+				r->ent = realloc( r->ent, r->cap * sizeof(St_entry) );
+			}
+			n = bfm_scan_take( sc, r->ent + r->len, r->cap - r->len, &state );
+			r->len += n;
+		} while ( state == SCAN_MORE );
+	}
+
+	bfm_scan_cancel(sc);
+}
+
+/* Move entries into listing as list model does */
+static void
+bfm_bench_fill_list ( St_run * r )
+{
+	size_t i;
+
+	r->list = bfm_listing_new();
+	r->rows = malloc( ( r->len + 1 ) * sizeof(uint32_t) );
+	for ( i = 0; i < r->len; i++ )
+	{
+		r->rows[i] = bfm_listing_add( r->list, &r->ent[i] );
+		free( r->ent[i].name );
+	}
+}
+
+/* Render every visible column of every row */
+static void
+bfm_bench_format ( St_run * r )
+{
+	const St_rec * rec;
+	char           perm[FMT_PERM_LEN];
+	char           buf[64];
+	volatile char  sink = 0;
+	size_t         i;
+
+	for ( i = 0; i < r->len; i++ )
+	{
+		rec = &r->list->rec[ r->rows[i] ];
+		bfm_col_ctr_perm( rec->mode, perm );
+		bfm_col_ctr_size( rec->size, buf, sizeof(buf) );
+		sink ^= buf[0];
+		bfm_col_ctr_time( BENCH_TIMEFMT, rec->mtime, buf, sizeof(buf) );
+		sink ^= buf[0] ^ perm[0];
+	}
+}
+
+/* Pass one directory through scan, fill, sort and format */
+static size_t
+bfm_bench_dir ( int dfd, St_stage * st, St_run * r )
+{
+	long long sys;
+	double    start;
+	size_t    n;
+
+	bfm_bench_begin( &sys, &start );
+	bfm_bench_scan( dfd, r );
+	bfm_bench_end( &st[STAGE_SCAN], sys, start );
+
+	bfm_bench_begin( &sys, &start );
+	bfm_bench_fill_list(r);
+	bfm_bench_end( &st[STAGE_FILL], sys, start );
+
+	bfm_bench_begin( &sys, &start );
+	bfm_sort_rows( r->list, SORT_NAME, 0, r->rows, r->len );
+	bfm_bench_end( &st[STAGE_SORT], sys, start );
+
+	bfm_bench_begin( &sys, &start );
+	bfm_bench_format(r);
+	bfm_bench_end( &st[STAGE_FORMAT], sys, start );
+
+	n = r->len;
+	bfm_listing_free( r->list );
+	free( r->rows );
+	r->list = NULL;
+	r->rows = NULL;
+
+	return n;
+}
+
+static void
+bfm_bench_print ( const char * tree, size_t n, const St_stage * s )
+{
+	if ( json )
+	{
+		printf( "%s\n    {\"tree\": \"%s\", \"entries\": %zu, \"stage\": \"%s\", \"msec\": %.3f, ",
+		        first ? "" : ",", tree, n, s->name, s->msec );
+		if ( s->syscalls < 0 )
+			printf( "\"syscalls\": null, " );
+		else
+			printf( "\"syscalls\": %lld, ", s->syscalls );
+		printf( "\"peak_rss_kib\": %ld}", s->rss_kib );
+	}
+	else
+	{
+		if ( first )
+			printf( "%-8s %9s %-8s %12s %10s %10s\n", "tree", "entries", "stage", "ms", "syscalls", "peak KiB" );
+		printf( "%-8s %9zu %-8s %12.3f ", tree, n, s->name, s->msec );
+		if ( s->syscalls < 0 )
+			printf( "%10s ", "-" );
+		else
+			printf( "%10lld ", s->syscalls );
+		printf( "%10ld\n", s->rss_kib );
+	}
+
+	first = 0;
+}
+
+/* Create tree, pass each of its directories through pipeline and remove it */
+static int
+bfm_bench_tree ( const char * base, int shape, size_t n )
+{
+	St_stage  st[N_STAGES];
+	St_run    r;
+	char      root[PATH_MAX + 32];
+	long long sys;
+	double    start;
+	size_t    listed = 0;
+	int       dfd;
+	int       next;
+	int       i;
+	int       ret = 0;
+
+	memset( st, 0, sizeof(st) );
+	memset( &r, 0, sizeof(r) );
+	for ( i = 0; i < N_STAGES; i++ )
+		st[i].name = stage_names[i];
+	snprintf( root, sizeof(root), "%s/%s-%zu", base, shape_names[shape], n );
+
+	bfm_bench_begin( &sys, &start );
+	if ( bfm_bench_create( root, shape, n ) < 0 )
+	{
+		fprintf( stderr, "%s: %s\n", root, strerror(errno) );
+		ret = -1;
+	}
+	bfm_bench_end( &st[STAGE_CREATE], sys, start );
+
+	/* Deep tree is listed level by level as if walked into */
+	dfd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	while ( ret == 0 && dfd >= 0 )
+	{
+		listed += bfm_bench_dir( dfd, st, &r );
+		next = shape == SHAPE_DEEP ? openat( dfd, "next", O_RDONLY | O_DIRECTORY | O_CLOEXEC ) : -1;
+		close(dfd);
+		dfd = next;
+	}
+	if ( dfd >= 0 )
+		close(dfd);
+	free( r.ent );
+
+	for ( i = ret == 0 ? 0 : 1; i < N_STAGES; i++ )
+		bfm_bench_print( shape_names[shape], i == STAGE_CREATE ? n : listed, &st[i] );
+
+	if ( ( dfd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) >= 0 )
+		bfm_bench_remove(dfd);
+	rmdir(root);
+
+	return ret;
+}
+
+static void
+bfm_bench_usage ( const char * self )
+{
+	fprintf( stderr, "usage: %s [-j] [-n entries[,entries...]] [-s wide,deep,long] [dir]\n", self );
+}
+
+int
+main ( int argc, char ** argv )
+{
+	const char * sizes = "1000,100000,1000000";
+	const char * shapes = "wide,deep,long";
+	const char * tmp = getenv("TMPDIR");
+	char         base[PATH_MAX];
+	char       * end;
+	size_t       n;
+	int          opt;
+	int          i;
+	int          ret = 0;
+
+	while ( ( opt = getopt( argc, argv, "jn:s:" ) ) != -1 )
+	{
+		switch ( opt )
+		{
+			case 'j': json = 1; break;
+			case 'n': sizes = optarg; break;
+			case 's': shapes = optarg; break;
+			default:
+				bfm_bench_usage( argv[0] );
+				return 2;
+		}
+	}
+
+	/* Before any thread exists so that all of them are counted */
+	bfm_bench_sys_open();
+	bfm_trace_init();
+
+	snprintf( base, sizeof(base), "%s/bfm-bench-XXXXXX", optind < argc ? argv[optind] : tmp ? tmp : "/tmp" );
+	if ( !mkdtemp(base) )
+	{
+		fprintf( stderr, "%s: %s\n", base, strerror(errno) );
+		return 1;
+	}
+
+	if ( json )
+		printf( "{\n  \"backend\": \"%s\",\n  \"threads\": %ld,\n  \"results\": [",
+		        bfm_backend_name(), sysconf(_SC_NPROCESSORS_ONLN) );
+	else
+		printf( "backend %s, %s\n", bfm_backend_name(), sysfd < 0 ? "syscalls are not counted" : "syscalls counted" );
+
+	for ( ; * sizes; sizes = * end ? end + 1 : end )
+	{
+		n = strtoul( sizes, &end, 10 );
+		if ( end == sizes || ( * end && * end != ',' ) )
+		{
+			bfm_bench_usage( argv[0] );
+			ret = 2;
+			break;
+		}
+
+		for ( i = 0; i < N_SHAPES; i++ )
+			if ( strstr( shapes, shape_names[i] ) && bfm_bench_tree( base, i, n ) < 0 )
+				ret = 1;
+	}
+
+	if ( json )
+		printf( "\n  ]\n}\n" );
+
+	rmdir(base);
+	bfm_trace_finish();
+	return ret;
+}
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+
+#include "cache.h"
+
+/* Structs */
+typedef struct St_node St_node;
+struct St_node
+{
+	St_cached   c;
+	size_t      memory;
+	St_node   * prev;
+	St_node   * next;
+};
+
+struct St_cache
+{
+	/* Most recently used first */
+	St_node        * head;
+	St_node        * tail;
+	size_t           budget;
+	St_cache_stats   stats;
+};
+
+/* Functions */
+St_cache *
+bfm_cache_new ( size_t budget )
+{
+	St_cache * c = calloc( 1, sizeof(St_cache) );
+
+	if ( c )
+		c->budget = budget;
+
+	return c;
+}
+
+static void
+bfm_cache_unlink ( St_cache * c, St_node * n )
+{
+	if ( n->prev )
+		n->prev->next = n->next;
+	else
+		c->head = n->next;
+
+	if ( n->next )
+		n->next->prev = n->prev;
+	else
+		c->tail = n->prev;
+
+	c->stats.entries--;
+	c->stats.memory -= n->memory;
+}
+
+/* Take listing out of cache, return 0 if it is not there.
+ * Listing is returned even if directory changed, it is close to current state */
+int
+bfm_cache_take ( St_cache * c, dev_t dev, ino_t ino, const struct timespec * mtime, St_cached * out )
+{
+	St_node * n;
+
+	for ( n = c->head; n; n = n->next )
+		if ( n->c.dev == dev && n->c.ino == ino )
+			break;
+
+	if ( !n )
+	{
+		c->stats.misses++;
+		return 0;
+	}
+
+	if ( n->c.mtime.tv_sec == mtime->tv_sec && n->c.mtime.tv_nsec == mtime->tv_nsec )
+		c->stats.hits++;
+	else
+		c->stats.stale++;
+
+	bfm_cache_unlink( c, n );
+	* out = n->c;
+	free(n);
+	return 1;
+}
+
+/* Check if listing is stored, counters are not changed */
+int
+bfm_cache_has ( const St_cache * c, dev_t dev, ino_t ino )
+{
+	const St_node * n;
+
+	for ( n = c->head; n; n = n->next )
+		if ( n->c.dev == dev && n->c.ino == ino )
+			return 1;
+
+	return 0;
+}
+
+/* Store listing, cache takes ownership and evicts old ones to fit budget */
+void
+bfm_cache_put ( St_cache * c, const St_cached * e )
+{
+	St_node * n;
+	St_node * old;
+
+	/* Newer listing replaces one left by other window */
+	for ( n = c->head; n; n = n->next )
+	{
+		if ( n->c.dev == e->dev && n->c.ino == e->ino )
+		{
+			bfm_cache_unlink( c, n );
+			bfm_listing_free( n->c.list );
+			free(n);
+			break;
+		}
+	}
+
+	if ( !( n = malloc( sizeof(St_node) ) ) )
+	{
+		bfm_listing_free( e->list );
+		return;
+	}
+
+	n->c = * e;
+	n->memory = bfm_listing_memory( e->list );
+	n->prev = NULL;
+	n->next = c->head;
+	if ( c->head )
+		c->head->prev = n;
+	else
+		c->tail = n;
+	c->head = n;
+
+	c->stats.entries++;
+	c->stats.memory += n->memory;
+
+	/* Listing larger than budget is dropped right away */
+	while ( c->stats.memory > c->budget && ( old = c->tail ) )
+	{
+		bfm_cache_unlink( c, old );
+		bfm_listing_free( old->c.list );
+		free(old);
+		c->stats.evicted++;
+	}
+}
+
+void
+bfm_cache_stats ( const St_cache * c, St_cache_stats * s )
+{
+	* s = c->stats;
+}
+
+void
+bfm_cache_free ( St_cache * c )
+{
+	St_node * n;
+
+	while ( ( n = c->head ) )
+	{
+		bfm_cache_unlink( c, n );
+		bfm_listing_free( n->c.list );
+		free(n);
+	}
+
+	free(c);
+}
@@ -0,0 +1,49 @@
+#ifndef BFM_CACHE_H
+#define BFM_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "listing.h"
+
+/* Structs */
+/* Listing of directory left by window */
+typedef struct
+{
+	dev_t             dev;
+	ino_t             ino;
+	/* Directory modification time when listing was complete */
+	struct timespec   mtime;
+	/* Owned by cache while stored */
+	St_listing      * list;
+	/* Records under cursor and on top of view, LISTING_NONE if unknown */
+	uint32_t          cursor;
+	uint32_t          top;
+} St_cached;
+
+/* Lookup counters */
+typedef struct
+{
+	unsigned long hits;
+	/* Found, but directory changed since */
+	unsigned long stale;
+	unsigned long misses;
+	unsigned long evicted;
+	size_t        entries;
+	size_t        memory;
+} St_cache_stats;
+
+/* Least recently used listings within memory budget */
+typedef struct St_cache St_cache;
+
+/* Protos */
+St_cache * bfm_cache_new   ( size_t );
+int        bfm_cache_take  ( St_cache *, dev_t, ino_t, const struct timespec *, St_cached * );
+int        bfm_cache_has   ( const St_cache *, dev_t, ino_t );
+void       bfm_cache_put   ( St_cache *, const St_cached * );
+void       bfm_cache_stats ( const St_cache *, St_cache_stats * );
+void       bfm_cache_free  ( St_cache * );
+
+#endif
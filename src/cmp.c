@@ -0,0 +1,757 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cmp.h"
+#include "scan.h"
+
+/* Worker threads, shared by directory reading and hashing */
+#define CMP_THREADS   8
+/* Read block for hashing, multiple of hash stripe */
+#define CMP_BLOCK     ( 1 << 20 )
+/* File hashes kept between runs, least recently used ones are evicted */
+#define CMP_CACHE_MAX 65536
+
+/* XXH64 primes */
+#define XXH_P1 11400714785074694791ull
+#define XXH_P2 14029467366897019727ull
+#define XXH_P3 1609587929392839161ull
+#define XXH_P4 9650029242287828579ull
+#define XXH_P5 2870177450012600261ull
+
+/* Structs */
+/* Directory pair to read or file pair to hash */
+typedef struct
+{
+	int  hash;
+	/* Relative to roots, "." for roots themselves */
+	char path[];
+} St_cmpnode;
+
+/* Entry of one side of directory pair */
+typedef struct
+{
+	char        * name;
+	struct stat   st;
+} St_cmpent;
+
+/* Remembered content hash, valid while file is unchanged */
+typedef struct
+{
+	dev_t           dev;
+	ino_t           ino;
+	struct timespec mtime;
+	off_t           size;
+	uint64_t        hash;
+	/* Used since clock hand passed */
+	int             used;
+} St_cmphash;
+
+/* Running XXH64 state, fed with whole stripes */
+typedef struct
+{
+	uint64_t v[4];
+	uint64_t len;
+} St_xxh;
+
+struct St_cmp
+{
+	pthread_mutex_t   lock;
+	/* Owner and runner hold a reference each */
+	int               refs;
+	int               cancel;
+	int               done;
+	/* Notification is sent and not yet answered */
+	int               signalled;
+	/* Results waiting for receiver */
+	St_cmp_entry    * pend;
+	size_t            pend_len;
+	size_t            pend_pos;
+	size_t            pend_cap;
+	/* Parameters */
+	int               oldfd;
+	int               newfd;
+	/* Pairs waiting for workers */
+	pthread_mutex_t   q_lock;
+	pthread_cond_t    wake;
+	St_cmpnode     ** queue;
+	size_t            q_len;
+	size_t            q_cap;
+	size_t            active;
+	/* Statistics */
+	St_cmp_stats      stats;
+	long              start;
+	/* Receiver */
+	Cmp_notify        notify;
+	void            * data;
+};
+
+/* Globals */
+static pthread_mutex_t   cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static St_cmphash      * cache = NULL;
+static size_t            cache_len = 0;
+static size_t            cache_hand = 0;
+
+/* Functions */
+/* Milliseconds from monotonic clock */
+static long
+bfm_cmp_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+bfm_cmp_stopped ( St_cmp * c )
+{
+	return __atomic_load_n( &c->cancel, __ATOMIC_RELAXED );
+}
+
+static uint64_t
+bfm_xxh_rotl ( uint64_t x, int r )
+{
+	return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+static uint64_t
+bfm_xxh_read64 ( const unsigned char * p )
+{
+	uint64_t v;
+	memcpy( &v, p, sizeof(v) );
+	return v;
+}
+
+static uint64_t
+bfm_xxh_round ( uint64_t acc, uint64_t in )
+{
+	return bfm_xxh_rotl( acc + in * XXH_P2, 31 ) * XXH_P1;
+}
+
+static uint64_t
+bfm_xxh_merge ( uint64_t acc, uint64_t v )
+{
+	return ( acc ^ bfm_xxh_round( 0, v ) ) * XXH_P1 + XXH_P4;
+}
+
+static void
+bfm_xxh_init ( St_xxh * x )
+{
+	x->v[0] = XXH_P1 + XXH_P2;
+	x->v[1] = XXH_P2;
+	x->v[2] = 0;
+	x->v[3] = -XXH_P1;
+	x->len = 0;
+}
+
+/* Feed whole 32 byte stripes, n is their multiple */
+static void
+bfm_xxh_stripes ( St_xxh * x, const unsigned char * p, size_t n )
+{
+	const unsigned char * end = p + n;
+
+	for ( ; p < end; p += 32 )
+	{
+		x->v[0] = bfm_xxh_round( x->v[0], bfm_xxh_read64(p) );
+		x->v[1] = bfm_xxh_round( x->v[1], bfm_xxh_read64( p + 8 ) );
+		x->v[2] = bfm_xxh_round( x->v[2], bfm_xxh_read64( p + 16 ) );
+		x->v[3] = bfm_xxh_round( x->v[3], bfm_xxh_read64( p + 24 ) );
+	}
+	x->len += n;
+}
+
+/* Hash of everything fed and of last n bytes, n is below stripe size */
+static uint64_t
+bfm_xxh_final ( St_xxh * x, const unsigned char * p, size_t n )
+{
+	uint64_t h;
+	uint32_t w;
+	int      i;
+
+	x->len += n;
+	if ( x->len >= 32 )
+	{
+		h = bfm_xxh_rotl( x->v[0], 1 ) + bfm_xxh_rotl( x->v[1], 7 ) + bfm_xxh_rotl( x->v[2], 12 ) + bfm_xxh_rotl( x->v[3], 18 );
+		for ( i = 0; i < 4; i++ )
+			h = bfm_xxh_merge( h, x->v[i] );
+	}
+	else
+		h = x->v[2] + XXH_P5;
+	h += x->len;
+
+	for ( ; n >= 8; p += 8, n -= 8 )
+		h = bfm_xxh_rotl( h ^ bfm_xxh_round( 0, bfm_xxh_read64(p) ), 27 ) * XXH_P1 + XXH_P4;
+	if ( n >= 4 )
+	{
+		memcpy( &w, p, sizeof(w) );
+		h = bfm_xxh_rotl( h ^ (uint64_t)w * XXH_P1, 23 ) * XXH_P2 + XXH_P3;
+		p += 4;
+		n -= 4;
+	}
+	for ( ; n; p++, n-- )
+		h = bfm_xxh_rotl( h ^ * p * XXH_P5, 11 ) * XXH_P1;
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/* Home slot of file in cache */
+static size_t
+bfm_cmp_home ( dev_t dev, ino_t ino )
+{
+	return ( ino * 0x9e3779b97f4a7c15ull ^ dev ) & ( CMP_CACHE_MAX * 2 - 1 );
+}
+
+/* Slot of file in cache, zero inode marks free slot */
+static size_t
+bfm_cmp_slot ( dev_t dev, ino_t ino )
+{
+	size_t mask = CMP_CACHE_MAX * 2 - 1;
+	size_t h = bfm_cmp_home( dev, ino );
+
+	while ( cache[h].ino && ( cache[h].ino != ino || cache[h].dev != dev ) )
+		h = ( h + 1 ) & mask;
+
+	return h;
+}
+
+/* Find hash of unchanged file */
+static int
+bfm_cmp_cache_get ( const struct stat * st, uint64_t * out )
+{
+	size_t h;
+	int    found = 0;
+
+	pthread_mutex_lock( &cache_lock );
+	if ( cache )
+	{
+		h = bfm_cmp_slot( st->st_dev, st->st_ino );
+		if ( cache[h].ino && cache[h].size == st->st_size
+		  && cache[h].mtime.tv_sec == st->st_mtim.tv_sec
+		  && cache[h].mtime.tv_nsec == st->st_mtim.tv_nsec )
+		{
+			* out = cache[h].hash;
+			cache[h].used = 1;
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock( &cache_lock );
+
+	return found;
+}
+
+/* Drop one hash not used since clock hand passed it, following ones move back to keep probing intact */
+static void
+bfm_cmp_cache_evict ( void )
+{
+	size_t mask = CMP_CACHE_MAX * 2 - 1;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	while ( !cache[ cache_hand ].ino || cache[ cache_hand ].used )
+	{
+		cache[ cache_hand ].used = 0;
+		cache_hand = ( cache_hand + 1 ) & mask;
+	}
+
+	for ( i = cache_hand, j = ( i + 1 ) & mask; cache[j].ino; j = ( j + 1 ) & mask )
+	{
+		/* Entry moves only if its home is not between freed slot and itself */
+		k = bfm_cmp_home( cache[j].dev, cache[j].ino );
+		if ( ( j > i && ( k <= i || k > j ) ) || ( j < i && k <= i && k > j ) )
+		{
+			cache[i] = cache[j];
+			i = j;
+		}
+	}
+
+	memset( &cache[i], 0, sizeof(St_cmphash) );
+	cache_len--;
+}
+
+static void
+bfm_cmp_cache_put ( const struct stat * st, uint64_t hash )
+{
+	size_t h;
+
+	pthread_mutex_lock( &cache_lock );
+	if ( !cache )
+		cache = calloc( CMP_CACHE_MAX * 2, sizeof(St_cmphash) );
+
+	h = bfm_cmp_slot( st->st_dev, st->st_ino );
+	if ( !cache[h].ino && cache_len == CMP_CACHE_MAX )
+	{
+		bfm_cmp_cache_evict();
+		h = bfm_cmp_slot( st->st_dev, st->st_ino );
+	}
+	if ( !cache[h].ino )
+		cache_len++;
+	cache[h].dev   = st->st_dev;
+	cache[h].ino   = st->st_ino;
+	cache[h].mtime = st->st_mtim;
+	cache[h].size  = st->st_size;
+	cache[h].hash  = hash;
+	cache[h].used  = 1;
+	pthread_mutex_unlock( &cache_lock );
+}
+
+/* Pass difference to receiver, NULL name only updates state */
+static void
+bfm_cmp_emit ( St_cmp * c, const char * dir, const char * name, int state, const struct stat * st, int done )
+{
+	St_cmp_entry * e;
+	int            signal = 0;
+
+	pthread_mutex_lock( &c->lock );
+
+	if ( name )
+	{
+		if ( c->pend_len == c->pend_cap )
+		{
+			c->pend_cap = c->pend_cap ? c->pend_cap * 2 : 64;
+			c->pend = realloc( c->pend, c->pend_cap * sizeof(St_cmp_entry) );
+		}
+		e = &c->pend[ c->pend_len++ ];
+		e->name = malloc( strlen(dir) + strlen(name) + 2 );
+		if ( strcmp( dir, "." ) )
+			sprintf( e->name, "%s/%s", dir, name );
+		else
+			strcpy( e->name, name );
+		e->state = state;
+		e->mode  = st->st_mode;
+		e->size  = st->st_size;
+		e->mtime = st->st_mtime;
+	}
+	c->done = done;
+
+	if ( !c->signalled && !c->cancel )
+		signal = c->signalled = 1;
+
+	pthread_mutex_unlock( &c->lock );
+
+	if ( signal )
+		c->notify( c, c->data );
+}
+
+static void
+bfm_cmp_push ( St_cmp * c, int hash, const char * dir, const char * name )
+{
+	St_cmpnode * n = malloc( sizeof(St_cmpnode) + strlen(dir) + ( name ? strlen(name) : 0 ) + 2 );
+
+	n->hash = hash;
+	if ( !name )
+		strcpy( n->path, dir );
+	else if ( strcmp( dir, "." ) )
+		sprintf( n->path, "%s/%s", dir, name );
+	else
+		strcpy( n->path, name );
+
+	pthread_mutex_lock( &c->q_lock );
+	if ( c->q_len == c->q_cap )
+	{
+		c->q_cap = c->q_cap ? c->q_cap * 2 : 64;
+		c->queue = realloc( c->queue, c->q_cap * sizeof(St_cmpnode *) );
+	}
+	c->queue[ c->q_len++ ] = n;
+	c->active++;
+	pthread_cond_signal( &c->wake );
+	pthread_mutex_unlock( &c->q_lock );
+}
+
+static int
+bfm_cmp_ent_cmp ( const void * a, const void * b )
+{
+	return strcmp( ( (const St_cmpent *)a )->name, ( (const St_cmpent *)b )->name );
+}
+
+/* Read entries of one side sorted by name, symlinks are not followed */
+static St_cmpent *
+bfm_cmp_read ( int rootfd, const char * path, size_t * n )
+{
+	St_cmpent     * ent = NULL;
+	struct dirent * e;
+	DIR           * dir;
+	size_t          cap = 0;
+	int             fd;
+
+	* n = 0;
+	if ( ( fd = openat( rootfd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 )
+		return NULL;
+	if ( !( dir = fdopendir(fd) ) )
+	{
+		close(fd);
+		return NULL;
+	}
+
+	while ( ( e = readdir(dir) ) )
+	{
+		if ( !bfm_name_validat( e->d_name, 1 ) )
+			continue;
+
+		if ( * n == cap )
+		{
+			cap = cap ? cap * 2 : 64;
+			ent = realloc( ent, cap * sizeof(St_cmpent) );
+		}
+		if ( fstatat( dirfd(dir), e->d_name, &ent[ * n ].st, AT_SYMLINK_NOFOLLOW ) == 0 )
+			ent[ ( * n )++ ].name = strdup( e->d_name );
+	}
+
+	closedir(dir);
+	qsort( ent, * n, sizeof(St_cmpent), bfm_cmp_ent_cmp );
+	return ent;
+}
+
+/* Symlinks point to same place */
+static int
+bfm_cmp_link ( St_cmp * c, const char * dir, const char * name )
+{
+	char    path[PATH_MAX];
+	char    a[PATH_MAX];
+	char    b[PATH_MAX];
+	ssize_t la;
+	ssize_t lb;
+
+	snprintf( path, sizeof(path), "%s/%s", dir, name );
+	la = readlinkat( c->oldfd, path, a, sizeof(a) );
+	lb = readlinkat( c->newfd, path, b, sizeof(b) );
+
+	return la >= 0 && la == lb && memcmp( a, b, la ) == 0;
+}
+
+/* Report entries of directory pair, queue common subdirectories and files to hash */
+static void
+bfm_cmp_dir ( St_cmp * c, const char * path )
+{
+	St_cmpent * o;
+	St_cmpent * n;
+	size_t      n_o;
+	size_t      n_n;
+	size_t      i = 0;
+	size_t      j = 0;
+	int         d;
+
+	o = bfm_cmp_read( c->oldfd, path, &n_o );
+	n = bfm_cmp_read( c->newfd, path, &n_n );
+	__atomic_add_fetch( &c->stats.dirs, 1, __ATOMIC_RELAXED );
+
+	while ( ( i < n_o || j < n_n ) && !bfm_cmp_stopped(c) )
+	{
+		d = i == n_o ? 1 : j == n_n ? -1 : strcmp( o[i].name, n[j].name );
+
+		if ( d < 0 )
+			bfm_cmp_emit( c, path, o[i].name, CMP_REMOVED, &o[i].st, 0 );
+		else if ( d > 0 )
+			bfm_cmp_emit( c, path, n[j].name, CMP_ADDED, &n[j].st, 0 );
+		else if ( ( o[i].st.st_mode & S_IFMT ) != ( n[j].st.st_mode & S_IFMT ) )
+			bfm_cmp_emit( c, path, n[j].name, CMP_CHANGED, &n[j].st, 0 );
+		else if ( S_ISDIR( n[j].st.st_mode ) )
+			bfm_cmp_push( c, 0, path, n[j].name );
+		else if ( S_ISLNK( n[j].st.st_mode ) )
+		{
+			if ( !bfm_cmp_link( c, path, n[j].name ) )
+				bfm_cmp_emit( c, path, n[j].name, CMP_CHANGED, &n[j].st, 0 );
+		}
+		else if ( S_ISREG( n[j].st.st_mode ) )
+		{
+			/* Same size and time is taken as same content, other size as other content */
+			__atomic_add_fetch( &c->stats.files, 1, __ATOMIC_RELAXED );
+			if ( o[i].st.st_size != n[j].st.st_size )
+				bfm_cmp_emit( c, path, n[j].name, CMP_CHANGED, &n[j].st, 0 );
+			else if ( o[i].st.st_mtim.tv_sec != n[j].st.st_mtim.tv_sec
+			       || o[i].st.st_mtim.tv_nsec != n[j].st.st_mtim.tv_nsec )
+				bfm_cmp_push( c, 1, path, n[j].name );
+		}
+
+		i += d <= 0;
+		j += d >= 0;
+	}
+
+	for ( i = 0; i < n_o; i++ )
+		free( o[i].name );
+	for ( j = 0; j < n_n; j++ )
+		free( n[j].name );
+	free(o);
+	free(n);
+}
+
+/* Content hash of file under root, 0 if it can not be read */
+static int
+bfm_cmp_hash ( St_cmp * c, int rootfd, const char * path, unsigned char * buf, struct stat * st, uint64_t * out )
+{
+	St_xxh  x;
+	size_t  len;
+	ssize_t r = 0;
+	int     fd;
+
+	if ( ( fd = openat( rootfd, path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 )
+		return 0;
+	if ( fstat( fd, st ) < 0 )
+	{
+		close(fd);
+		return 0;
+	}
+
+	if ( bfm_cmp_cache_get( st, out ) )
+	{
+		__atomic_add_fetch( &c->stats.hits, 1, __ATOMIC_RELAXED );
+		close(fd);
+		return 1;
+	}
+
+	/* Read rather than mapped, file truncated meanwhile can not fault */
+	posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+	bfm_xxh_init(&x);
+	for ( ;; )
+	{
+		for ( len = 0; len < CMP_BLOCK; len += r )
+			if ( ( r = read( fd, buf + len, CMP_BLOCK - len ) ) <= 0 )
+				break;
+		if ( r < 0 || bfm_cmp_stopped(c) )
+		{
+			close(fd);
+			return 0;
+		}
+
+		__atomic_add_fetch( &c->stats.bytes, len, __ATOMIC_RELAXED );
+		bfm_xxh_stripes( &x, buf, len & ~(size_t)31 );
+		if ( len < CMP_BLOCK )
+			break;
+	}
+	* out = bfm_xxh_final( &x, buf + ( len & ~(size_t)31 ), len & 31 );
+
+	close(fd);
+	bfm_cmp_cache_put( st, * out );
+	return 1;
+}
+
+/* Compare content of file pair with same size */
+static void
+bfm_cmp_file ( St_cmp * c, const char * path, unsigned char * buf )
+{
+	const char * name = strrchr( path, '/' );
+	struct stat  so;
+	struct stat  sn;
+	uint64_t     ho;
+	uint64_t     hn;
+	char         dir[PATH_MAX];
+
+	__atomic_add_fetch( &c->stats.hashed, 1, __ATOMIC_RELAXED );
+	if ( bfm_cmp_hash( c, c->oldfd, path, buf, &so, &ho ) && bfm_cmp_hash( c, c->newfd, path, buf, &sn, &hn )
+	  && ho == hn && so.st_size == sn.st_size )
+		return;
+	if ( bfm_cmp_stopped(c) )
+		return;
+
+	/* Unreadable file is reported too, it can not be shown same */
+	snprintf( dir, sizeof(dir), "%.*s", name ? (int)( name - path ) : 1, name ? path : "." );
+	if ( fstatat( c->newfd, path, &sn, AT_SYMLINK_NOFOLLOW ) == 0 )
+		bfm_cmp_emit( c, dir, name ? name + 1 : path, CMP_CHANGED, &sn, 0 );
+}
+
+static void *
+bfm_cmp_worker ( void * p )
+{
+	St_cmp        * c = p;
+	St_cmpnode    * n;
+	unsigned char * buf = malloc(CMP_BLOCK);
+
+	pthread_mutex_lock( &c->q_lock );
+	for ( ;; )
+	{
+		while ( !c->q_len && c->active )
+			pthread_cond_wait( &c->wake, &c->q_lock );
+		if ( !c->q_len )
+			break;
+
+		/* Newest first keeps queue short */
+		n = c->queue[ --c->q_len ];
+		pthread_mutex_unlock( &c->q_lock );
+
+		/* After cancel queued pairs are only released */
+		if ( !bfm_cmp_stopped(c) )
+		{
+			if ( n->hash )
+				bfm_cmp_file( c, n->path, buf );
+			else
+				bfm_cmp_dir( c, n->path );
+		}
+		free(n);
+
+		pthread_mutex_lock( &c->q_lock );
+		if ( !--c->active )
+			pthread_cond_broadcast( &c->wake );
+	}
+	pthread_mutex_unlock( &c->q_lock );
+
+	free(buf);
+	return NULL;
+}
+
+static void *
+bfm_cmp_main ( void * p )
+{
+	St_cmp    * c = p;
+	pthread_t   thr[CMP_THREADS];
+	int         started[CMP_THREADS];
+	size_t      i;
+
+	bfm_cmp_push( c, 0, ".", NULL );
+
+	for ( i = 1; i < CMP_THREADS; i++ )
+		started[i] = pthread_create( &thr[i], NULL, bfm_cmp_worker, c ) == 0;
+	bfm_cmp_worker(c);
+	for ( i = 1; i < CMP_THREADS; i++ )
+		if ( started[i] )
+			pthread_join( thr[i], NULL );
+
+	c->stats.msec = bfm_cmp_msec() - c->start;
+	bfm_cmp_emit( c, NULL, NULL, 0, NULL, 1 );
+
+	bfm_cmp_unref(c);
+	return NULL;
+}
+
+/* Start comparing new tree against old one. NULL if either can not be opened */
+St_cmp *
+bfm_cmp_start ( const char * old, const char * new, Cmp_notify notify, void * data )
+{
+	St_cmp       * c = calloc( 1, sizeof(St_cmp) );
+	pthread_t      thr;
+	pthread_attr_t attr;
+
+	c->oldfd = open( old, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	c->newfd = open( new, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	if ( c->oldfd < 0 || c->newfd < 0 )
+	{
+		if ( c->oldfd >= 0 )
+			close( c->oldfd );
+		if ( c->newfd >= 0 )
+			close( c->newfd );
+		free(c);
+		return NULL;
+	}
+
+	pthread_mutex_init( &c->lock, NULL );
+	pthread_mutex_init( &c->q_lock, NULL );
+	pthread_cond_init( &c->wake, NULL );
+	c->refs   = 2;
+	c->notify = notify;
+	c->data   = data;
+	c->start  = bfm_cmp_msec();
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+	if ( pthread_create( &thr, &attr, bfm_cmp_main, c ) != 0 )
+	{
+		/* Run synchronously if no thread is available */
+		bfm_cmp_main(c);
+	}
+
+	pthread_attr_destroy(&attr);
+	return c;
+}
+
+/* Receive up to max differences, state is set to one of ScanState */
+size_t
+bfm_cmp_take ( St_cmp * c, St_cmp_entry * out, size_t max, int * state )
+{
+	size_t n;
+
+	pthread_mutex_lock( &c->lock );
+
+	n = c->pend_len - c->pend_pos;
+	if ( n > max )
+		n = max;
+
+	if ( n )
+		memcpy( out, c->pend + c->pend_pos, n * sizeof(St_cmp_entry) );
+	c->pend_pos += n;
+
+	if ( c->pend_pos < c->pend_len )
+		* state = SCAN_MORE;
+	else
+	{
+		c->pend_pos = c->pend_len = 0;
+		c->signalled = 0;
+		* state = c->done ? SCAN_DONE : SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &c->lock );
+	return n;
+}
+
+/* Receiver data */
+void *
+bfm_cmp_data ( St_cmp * c )
+{
+	return c->data;
+}
+
+void
+bfm_cmp_stats ( St_cmp * c, St_cmp_stats * s )
+{
+	* s = c->stats;
+}
+
+/* Check if comparison was cancelled by owner */
+int
+bfm_cmp_cancelled ( St_cmp * c )
+{
+	return bfm_cmp_stopped(c);
+}
+
+/* Stop comparison and release owner reference */
+void
+bfm_cmp_cancel ( St_cmp * c )
+{
+	size_t i;
+
+	pthread_mutex_lock( &c->lock );
+	__atomic_store_n( &c->cancel, 1, __ATOMIC_RELAXED );
+	for ( i = c->pend_pos; i < c->pend_len; i++ )
+		free( c->pend[i].name );
+	c->pend_pos = c->pend_len = 0;
+	pthread_mutex_unlock( &c->lock );
+
+	bfm_cmp_unref(c);
+}
+
+void
+bfm_cmp_ref ( St_cmp * c )
+{
+	__atomic_add_fetch( &c->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_cmp_unref ( St_cmp * c )
+{
+	size_t i;
+
+	if ( __atomic_sub_fetch( &c->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	for ( i = c->pend_pos; i < c->pend_len; i++ )
+		free( c->pend[i].name );
+	free( c->pend );
+	free( c->queue );
+	close( c->oldfd );
+	close( c->newfd );
+	pthread_mutex_destroy( &c->lock );
+	pthread_mutex_destroy( &c->q_lock );
+	pthread_cond_destroy( &c->wake );
+	free(c);
+}
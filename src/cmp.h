@@ -0,0 +1,63 @@
+#ifndef BFM_CMP_H
+#define BFM_CMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Structs */
+/* Background comparison of two directory trees */
+typedef struct St_cmp St_cmp;
+
+/* Called from worker thread when new differences are waiting */
+typedef void (* Cmp_notify)( St_cmp *, void * );
+
+/* Entry which differs, directories only on one side are not entered */
+typedef struct
+{
+	/* Path relative to roots, allocated with malloc(), owned by receiver */
+	char   * name;
+	/* One of CmpState */
+	int      state;
+	/* Of new entry, of old one if it was removed */
+	mode_t   mode;
+	off_t    size;
+	time_t   mtime;
+} St_cmp_entry;
+
+/* Counters, valid when comparison is done */
+typedef struct
+{
+	size_t   dirs;
+	size_t   files;
+	/* Files with same size and other mtime, compared by content */
+	size_t   hashed;
+	/* Hashes taken from cache */
+	size_t   hits;
+	uint64_t bytes;
+	long     msec;
+} St_cmp_stats;
+
+/* Enums */
+enum CmpState
+{
+	/* Only in new tree */
+	CMP_ADDED,
+	/* Only in old tree */
+	CMP_REMOVED,
+	/* Other type, size, content or link target */
+	CMP_CHANGED
+};
+
+/* Protos */
+St_cmp * bfm_cmp_start     ( const char *, const char *, Cmp_notify, void * );
+size_t   bfm_cmp_take      ( St_cmp *, St_cmp_entry *, size_t, int * );
+void *   bfm_cmp_data      ( St_cmp * );
+void     bfm_cmp_stats     ( St_cmp *, St_cmp_stats * );
+int      bfm_cmp_cancelled ( St_cmp * );
+void     bfm_cmp_cancel    ( St_cmp * );
+void     bfm_cmp_ref       ( St_cmp * );
+void     bfm_cmp_unref     ( St_cmp * );
+
+#endif
@@ -0,0 +1,591 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "du.h"
+#include "scan.h"
+
+/* Worker threads, reading is bound by metadata lookups rather than CPU,
+ * so it does not follow CPU count */
+#define DU_THREADS    8
+/* Buffer for raw directory records */
+#define DU_DENTS_BUF  32768
+/* Directory totals kept between runs, table is dropped when full */
+#define DU_CACHE_MAX  16384
+
+/* Structs */
+/* Record returned by getdents64 */
+struct linux_dirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/* Directory waiting to be read */
+typedef struct
+{
+	/* Index of selected directory it belongs to */
+	uint32_t top;
+	/* Relative to root */
+	char     path[];
+} St_dunode;
+
+/* File identity */
+typedef struct
+{
+	dev_t dev;
+	ino_t ino;
+} St_devino;
+
+/* Totals of selected directory */
+typedef struct
+{
+	uint64_t apparent;
+	uint64_t allocated;
+	/* Directories queued or being read */
+	long     pending;
+} St_dutop;
+
+/* Remembered total, valid while directory modification time is same */
+typedef struct
+{
+	dev_t           dev;
+	ino_t           ino;
+	struct timespec mtime;
+	uint64_t        apparent;
+	uint64_t        allocated;
+} St_ducached;
+
+struct St_du
+{
+	pthread_mutex_t   lock;
+	/* Owner and runner hold a reference each */
+	int               refs;
+	int               cancel;
+	int               done;
+	/* Notification is sent and not yet answered */
+	int               signalled;
+	/* Results waiting for receiver */
+	St_du_entry     * pend;
+	size_t            pend_len;
+	size_t            pend_pos;
+	size_t            pend_cap;
+	/* Parameters */
+	int               rootfd;
+	dev_t             rootdev;
+	char           ** names;
+	St_dutop        * tops;
+	size_t            n_tops;
+	int               fresh;
+	/* Directories waiting for workers */
+	pthread_mutex_t   q_lock;
+	pthread_cond_t    wake;
+	St_dunode      ** queue;
+	size_t            q_len;
+	size_t            q_cap;
+	size_t            active;
+	/* Directories and hard linked files already counted */
+	pthread_mutex_t   seen_lock;
+	St_devino       * seen;
+	size_t            seen_len;
+	size_t            seen_cap;
+	/* Statistics */
+	size_t            dirs;
+	size_t            files;
+	size_t            hits;
+	long              start;
+	long              msec;
+	/* Receiver */
+	Du_notify         notify;
+	void            * data;
+};
+
+/* Globals */
+static pthread_mutex_t   cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static St_ducached     * cache = NULL;
+static size_t            cache_len = 0;
+
+/* Functions */
+/* Milliseconds from monotonic clock */
+static long
+bfm_du_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+bfm_du_stopped ( St_du * d )
+{
+	return __atomic_load_n( &d->cancel, __ATOMIC_RELAXED );
+}
+
+/* Slot of file in hash table of given size, zero inode marks free slot */
+static size_t
+bfm_du_slot ( const void * table, size_t stride, size_t cap, dev_t dev, ino_t ino )
+{
+	const St_devino * e;
+	size_t            mask = cap - 1;
+	size_t            h = ( ino * 0x9e3779b97f4a7c15ull ^ dev ) & mask;
+
+	for ( ;; h = ( h + 1 ) & mask )
+	{
+		e = (const St_devino *)( (const char *)table + h * stride );
+		if ( !e->ino || ( e->ino == ino && e->dev == dev ) )
+			return h;
+	}
+}
+
+/* Remember file, return 0 if it was counted before */
+static int
+bfm_du_enter ( St_du * d, dev_t dev, ino_t ino )
+{
+	St_devino * old;
+	size_t      n;
+	size_t      h;
+	int         ret = 0;
+
+	pthread_mutex_lock( &d->seen_lock );
+
+	if ( ( d->seen_len + 1 ) * 2 > d->seen_cap )
+	{
+		old = d->seen;
+		n = d->seen_cap;
+		d->seen_cap = d->seen_cap ? d->seen_cap * 2 : 1024;
+		d->seen = calloc( d->seen_cap, sizeof(St_devino) );
+
+		while ( n-- )
+			if ( old[n].ino )
+				d->seen[ bfm_du_slot( d->seen, sizeof(St_devino), d->seen_cap, old[n].dev, old[n].ino ) ] = old[n];
+		free(old);
+	}
+
+	h = bfm_du_slot( d->seen, sizeof(St_devino), d->seen_cap, dev, ino );
+	if ( !d->seen[h].ino )
+	{
+		d->seen[h].dev = dev;
+		d->seen[h].ino = ino;
+		d->seen_len++;
+		ret = 1;
+	}
+
+	pthread_mutex_unlock( &d->seen_lock );
+	return ret;
+}
+
+/* Find unchanged total of directory */
+static int
+bfm_du_cache_get ( const struct stat * st, St_ducached * out )
+{
+	size_t h;
+	int    found = 0;
+
+	pthread_mutex_lock( &cache_lock );
+	if ( cache )
+	{
+		h = bfm_du_slot( cache, sizeof(St_ducached), DU_CACHE_MAX * 2, st->st_dev, st->st_ino );
+		if ( cache[h].ino
+		  && cache[h].mtime.tv_sec == st->st_mtim.tv_sec
+		  && cache[h].mtime.tv_nsec == st->st_mtim.tv_nsec )
+		{
+			* out = cache[h];
+			found = 1;
+		}
+	}
+	pthread_mutex_unlock( &cache_lock );
+
+	return found;
+}
+
+static void
+bfm_du_cache_put ( const St_ducached * c )
+{
+	size_t h;
+
+	pthread_mutex_lock( &cache_lock );
+	if ( !cache || cache_len == DU_CACHE_MAX )
+	{
+		free(cache);
+		cache = calloc( DU_CACHE_MAX * 2, sizeof(St_ducached) );
+		cache_len = 0;
+	}
+
+	h = bfm_du_slot( cache, sizeof(St_ducached), DU_CACHE_MAX * 2, c->dev, c->ino );
+	if ( !cache[h].ino )
+		cache_len++;
+	cache[h] = * c;
+	pthread_mutex_unlock( &cache_lock );
+}
+
+/* Pass total of selected directory to receiver */
+static void
+bfm_du_emit ( St_du * d, size_t top, uint64_t apparent, uint64_t allocated, int done )
+{
+	int signal = 0;
+
+	pthread_mutex_lock( &d->lock );
+
+	if ( top < d->n_tops )
+	{
+		if ( d->pend_len == d->pend_cap )
+		{
+			d->pend_cap = d->pend_cap ? d->pend_cap * 2 : 64;
+			d->pend = realloc( d->pend, d->pend_cap * sizeof(St_du_entry) );
+		}
+		d->pend[ d->pend_len ].name = strdup( d->names[top] );
+		d->pend[ d->pend_len ].apparent = apparent;
+		d->pend[ d->pend_len++ ].allocated = allocated;
+	}
+	d->done = done;
+
+	if ( !d->signalled && !d->cancel )
+		signal = d->signalled = 1;
+
+	pthread_mutex_unlock( &d->lock );
+
+	if ( signal )
+		d->notify( d, d->data );
+}
+
+static void
+bfm_du_push ( St_du * d, uint32_t top, const char * dir, const char * name )
+{
+	St_dunode * n = malloc( sizeof(St_dunode) + strlen(dir) + strlen(name) + 2 );
+
+	n->top = top;
+	if ( * dir )
+		sprintf( n->path, "%s/%s", dir, name );
+	else
+		strcpy( n->path, name );
+
+	__atomic_add_fetch( &d->tops[top].pending, 1, __ATOMIC_ACQ_REL );
+
+	pthread_mutex_lock( &d->q_lock );
+	if ( d->q_len == d->q_cap )
+	{
+		d->q_cap = d->q_cap ? d->q_cap * 2 : 64;
+		d->queue = realloc( d->queue, d->q_cap * sizeof(St_dunode *) );
+	}
+	d->queue[ d->q_len++ ] = n;
+	d->active++;
+	pthread_cond_signal( &d->wake );
+	pthread_mutex_unlock( &d->q_lock );
+}
+
+static void
+bfm_du_add ( St_du * d, uint32_t top, const struct stat * st )
+{
+	__atomic_add_fetch( &d->tops[top].apparent, st->st_size, __ATOMIC_RELAXED );
+	__atomic_add_fetch( &d->tops[top].allocated, (uint64_t)st->st_blocks * 512, __ATOMIC_RELAXED );
+}
+
+/* Count files of directory and queue its subdirectories */
+static void
+bfm_du_dir ( St_du * d, St_dunode * n, char * buf )
+{
+	struct linux_dirent64 * e;
+	struct stat             st;
+	long                    len;
+	long                    pos;
+	int                     fd;
+
+	if ( ( fd = openat( d->rootfd, n->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 )
+		return;
+
+	__atomic_add_fetch( &d->dirs, 1, __ATOMIC_RELAXED );
+
+	while ( !bfm_du_stopped(d)
+	     && ( len = syscall( SYS_getdents64, fd, buf, DU_DENTS_BUF ) ) > 0 )
+	{
+		for ( pos = 0; pos < len; pos += e->d_reclen )
+		{
+			e = (struct linux_dirent64 *)( buf + pos );
+			if ( !bfm_name_validat( e->d_name, 1 ) || fstatat( fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+				continue;
+
+			if ( S_ISDIR( st.st_mode ) )
+			{
+				/* Mount points count only as themselves */
+				if ( st.st_dev != d->rootdev )
+					bfm_du_add( d, n->top, &st );
+				/* Bind mounts are entered once */
+				else if ( bfm_du_enter( d, st.st_dev, st.st_ino ) )
+				{
+					bfm_du_add( d, n->top, &st );
+					bfm_du_push( d, n->top, n->path, e->d_name );
+				}
+			}
+			/* Hard linked file is counted where it is found first */
+			else if ( st.st_nlink < 2 || bfm_du_enter( d, st.st_dev, st.st_ino ) )
+			{
+				bfm_du_add( d, n->top, &st );
+				__atomic_add_fetch( &d->files, 1, __ATOMIC_RELAXED );
+			}
+		}
+	}
+
+	close(fd);
+}
+
+/* Last directory of selected one is done */
+static void
+bfm_du_finish ( St_du * d, uint32_t top )
+{
+	St_ducached c;
+	struct stat st;
+
+	if ( __atomic_sub_fetch( &d->tops[top].pending, 1, __ATOMIC_ACQ_REL ) || bfm_du_stopped(d) )
+		return;
+
+	c.apparent = __atomic_load_n( &d->tops[top].apparent, __ATOMIC_ACQUIRE );
+	c.allocated = __atomic_load_n( &d->tops[top].allocated, __ATOMIC_ACQUIRE );
+
+	if ( fstatat( d->rootfd, d->names[top], &st, AT_SYMLINK_NOFOLLOW ) == 0 )
+	{
+		c.dev = st.st_dev;
+		c.ino = st.st_ino;
+		c.mtime = st.st_mtim;
+		bfm_du_cache_put(&c);
+	}
+
+	bfm_du_emit( d, top, c.apparent, c.allocated, 0 );
+}
+
+static void *
+bfm_du_worker ( void * p )
+{
+	St_du     * d = p;
+	St_dunode * n;
+	char      * buf = malloc(DU_DENTS_BUF);
+
+	pthread_mutex_lock( &d->q_lock );
+	for ( ;; )
+	{
+		while ( !d->q_len && d->active )
+			pthread_cond_wait( &d->wake, &d->q_lock );
+		if ( !d->q_len )
+			break;
+
+		/* Newest first keeps queue short */
+		n = d->queue[ --d->q_len ];
+		pthread_mutex_unlock( &d->q_lock );
+
+		/* After cancel queued directories are only released */
+		if ( !bfm_du_stopped(d) )
+			bfm_du_dir( d, n, buf );
+		bfm_du_finish( d, n->top );
+		free(n);
+
+		pthread_mutex_lock( &d->q_lock );
+		if ( !--d->active )
+			pthread_cond_broadcast( &d->wake );
+	}
+	pthread_mutex_unlock( &d->q_lock );
+
+	free(buf);
+	return NULL;
+}
+
+/* Queue selected directories, totals known from cache are passed at once */
+static void *
+bfm_du_main ( void * p )
+{
+	St_du       * d = p;
+	St_ducached   c;
+	struct stat   st;
+	pthread_t     thr[DU_THREADS];
+	int           started[DU_THREADS];
+	size_t        i;
+
+	for ( i = 0; i < d->n_tops && !bfm_du_stopped(d); i++ )
+	{
+		if ( fstatat( d->rootfd, d->names[i], &st, AT_SYMLINK_NOFOLLOW ) < 0 || !S_ISDIR( st.st_mode ) )
+			continue;
+
+		if ( st.st_dev != d->rootdev )
+			bfm_du_emit( d, i, st.st_size, (uint64_t)st.st_blocks * 512, 0 );
+		else if ( !d->fresh && bfm_du_cache_get( &st, &c ) )
+		{
+			__atomic_add_fetch( &d->hits, 1, __ATOMIC_RELAXED );
+			bfm_du_emit( d, i, c.apparent, c.allocated, 0 );
+		}
+		else if ( bfm_du_enter( d, st.st_dev, st.st_ino ) )
+		{
+			bfm_du_add( d, i, &st );
+			bfm_du_push( d, i, "", d->names[i] );
+		}
+	}
+
+	for ( i = 1; i < DU_THREADS; i++ )
+		started[i] = pthread_create( &thr[i], NULL, bfm_du_worker, d ) == 0;
+	bfm_du_worker(d);
+	for ( i = 1; i < DU_THREADS; i++ )
+		if ( started[i] )
+			pthread_join( thr[i], NULL );
+
+	d->msec = bfm_du_msec() - d->start;
+	bfm_du_emit( d, d->n_tops, 0, 0, 1 );
+
+	bfm_du_unref(d);
+	return NULL;
+}
+
+/* Start summing sizes of directory names under root on its filesystem,
+ * cached totals are skipped when fresh is set. NULL if root can not be opened */
+St_du *
+bfm_du_start ( const char * root, char * const * names, size_t n, int fresh, Du_notify notify, void * data )
+{
+	St_du        * d = calloc( 1, sizeof(St_du) );
+	struct stat    st;
+	pthread_t      thr;
+	pthread_attr_t attr;
+	size_t         i;
+
+	if ( ( d->rootfd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0 || fstat( d->rootfd, &st ) < 0 )
+	{
+		if ( d->rootfd >= 0 )
+			close( d->rootfd );
+		free(d);
+		return NULL;
+	}
+
+	d->rootdev = st.st_dev;
+	d->names = malloc( n * sizeof(char *) );
+	for ( i = 0; i < n; i++ )
+		d->names[i] = strdup( names[i] );
+	d->tops = calloc( n, sizeof(St_dutop) );
+	d->n_tops = n;
+	d->fresh = fresh;
+
+	pthread_mutex_init( &d->lock, NULL );
+	pthread_mutex_init( &d->q_lock, NULL );
+	pthread_mutex_init( &d->seen_lock, NULL );
+	pthread_cond_init( &d->wake, NULL );
+	d->refs   = 2;
+	d->notify = notify;
+	d->data   = data;
+	d->start  = bfm_du_msec();
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+	if ( pthread_create( &thr, &attr, bfm_du_main, d ) != 0 )
+	{
+		/* Run synchronously if no thread is available */
+		bfm_du_main(d);
+	}
+
+	pthread_attr_destroy(&attr);
+	return d;
+}
+
+/* Receive up to max totals, state is set to one of ScanState */
+size_t
+bfm_du_take ( St_du * d, St_du_entry * out, size_t max, int * state )
+{
+	size_t n;
+
+	pthread_mutex_lock( &d->lock );
+
+	n = d->pend_len - d->pend_pos;
+	if ( n > max )
+		n = max;
+
+	if ( n )
+		memcpy( out, d->pend + d->pend_pos, n * sizeof(St_du_entry) );
+	d->pend_pos += n;
+
+	if ( d->pend_pos < d->pend_len )
+		* state = SCAN_MORE;
+	else
+	{
+		d->pend_pos = d->pend_len = 0;
+		d->signalled = 0;
+		* state = d->done ? SCAN_DONE : SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &d->lock );
+	return n;
+}
+
+/* Receiver data */
+void *
+bfm_du_data ( St_du * d )
+{
+	return d->data;
+}
+
+/* Directories read, files counted, totals taken from cache and time spent,
+ * valid when computation is done */
+void
+bfm_du_stats ( St_du * d, size_t * dirs, size_t * files, size_t * hits, long * msec )
+{
+	* dirs = d->dirs;
+	* files = d->files;
+	* hits = d->hits;
+	* msec = d->msec;
+}
+
+/* Check if computation was cancelled by owner */
+int
+bfm_du_cancelled ( St_du * d )
+{
+	return bfm_du_stopped(d);
+}
+
+/* Stop computation and release owner reference */
+void
+bfm_du_cancel ( St_du * d )
+{
+	size_t i;
+
+	pthread_mutex_lock( &d->lock );
+	__atomic_store_n( &d->cancel, 1, __ATOMIC_RELAXED );
+	for ( i = d->pend_pos; i < d->pend_len; i++ )
+		free( d->pend[i].name );
+	d->pend_pos = d->pend_len = 0;
+	pthread_mutex_unlock( &d->lock );
+
+	bfm_du_unref(d);
+}
+
+void
+bfm_du_ref ( St_du * d )
+{
+	__atomic_add_fetch( &d->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_du_unref ( St_du * d )
+{
+	size_t i;
+
+	if ( __atomic_sub_fetch( &d->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	for ( i = d->pend_pos; i < d->pend_len; i++ )
+		free( d->pend[i].name );
+	for ( i = 0; i < d->n_tops; i++ )
+		free( d->names[i] );
+	free( d->pend );
+	free( d->names );
+	free( d->tops );
+	free( d->queue );
+	free( d->seen );
+	close( d->rootfd );
+	pthread_mutex_destroy( &d->lock );
+	pthread_mutex_destroy( &d->q_lock );
+	pthread_mutex_destroy( &d->seen_lock );
+	pthread_cond_destroy( &d->wake );
+	free(d);
+}
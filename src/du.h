@@ -0,0 +1,43 @@
+#ifndef BFM_DU_H
+#define BFM_DU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Structs */
+/* Background recursive size computation */
+typedef struct St_du St_du;
+
+/* Called from worker thread when new sizes are waiting */
+typedef void (* Du_notify)( St_du *, void * );
+
+/* Total size of directory tree */
+typedef struct
+{
+	/* Allocated with malloc(), owned by receiver */
+	char     * name;
+	/* Sum of file sizes and of allocated blocks */
+	uint64_t   apparent;
+	uint64_t   allocated;
+} St_du_entry;
+
+/* Enums */
+/* Size shown for directories */
+enum DuMode
+{
+	DU_OFF,
+	DU_APPARENT,
+	DU_ALLOCATED
+};
+
+/* Protos */
+St_du * bfm_du_start     ( const char *, char * const *, size_t, int, Du_notify, void * );
+size_t  bfm_du_take      ( St_du *, St_du_entry *, size_t, int * );
+void *  bfm_du_data      ( St_du * );
+void    bfm_du_stats     ( St_du *, size_t *, size_t *, size_t *, long * );
+int     bfm_du_cancelled ( St_du * );
+void    bfm_du_cancel    ( St_du * );
+void    bfm_du_ref       ( St_du * );
+void    bfm_du_unref     ( St_du * );
+
+#endif
@@ -0,0 +1,544 @@
+#include <fcntl.h>
+#include <glib.h>
+#include <grp.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "extra.h"
+#include "mime.h"
+#include "scan.h"
+#include "trace.h"
+
+/* Buffer for passwd and group records */
+#define EXTRA_PW_BUF    4096
+/* Resolving threads per window, stat mostly waits for disk or network */
+#define EXTRA_THREADS   4
+/* Requests kept, older ones were scrolled past */
+#define EXTRA_QUEUE_MAX 1024
+
+/* Parts of value resolved so far */
+#define EXTRA_HAVE_STAT   1
+#define EXTRA_HAVE_MIME   2
+#define EXTRA_HAVE_TARGET 4
+
+/* Structs */
+/* Values of one name, valid while its modification time is same */
+typedef struct
+{
+	int64_t      mtime;
+	unsigned     have;
+	/* Parts waiting for worker */
+	unsigned     asked;
+	/* Stat failed */
+	int          gone;
+	uid_t        uid;
+	gid_t        gid;
+	ino_t        ino;
+	nlink_t      nlink;
+	/* Static string */
+	const char * mime;
+	char       * target;
+} St_extra_val;
+
+/* Directory of requests, shared until it is left */
+typedef struct
+{
+	int fd;
+	int refs;
+} St_extra_dir;
+
+/* Part of value waiting for worker, result goes back in same struct */
+typedef struct
+{
+	St_extra_dir * dir;
+	char         * name;
+	mode_t         mode;
+	unsigned       part;
+	/* Requests from before clear are dropped */
+	unsigned       gen;
+	/* Request was dropped for newer ones and may be repeated */
+	int            dropped;
+	St_extra_val   val;
+} St_extra_req;
+
+struct St_extra
+{
+	/* Name to St_extra_val, used by owner only */
+	GHashTable      * vals;
+	/* Directory of current requests and descriptor it was made from */
+	St_extra_dir    * dir;
+	int               dfd;
+	pthread_mutex_t   lock;
+	/* Owner and each worker hold a reference */
+	int               refs;
+	int               cancel;
+	/* Notification is sent and not yet answered */
+	int               signalled;
+	unsigned          gen;
+	/* Newest request is taken first, it is the one on screen */
+	St_extra_req   ** queue;
+	size_t            q_len;
+	size_t            q_cap;
+	int               workers;
+	/* Results waiting for receiver */
+	St_extra_req   ** pend;
+	size_t            pend_len;
+	size_t            pend_pos;
+	size_t            pend_cap;
+	/* Receiver */
+	Extra_notify      notify;
+	void            * data;
+};
+
+/* Globals */
+/* Account names of whole process, ids are stored as keys */
+static GHashTable * users = NULL;
+static GHashTable * groups = NULL;
+
+/* Functions */
+static void
+bfm_extra_val_free ( gpointer p )
+{
+	St_extra_val * v = p;
+
+	free( v->target );
+	g_free(v);
+}
+
+static void
+bfm_extra_dir_unref ( St_extra_dir * d )
+{
+	if ( d && !__atomic_sub_fetch( &d->refs, 1, __ATOMIC_ACQ_REL ) )
+	{
+		close( d->fd );
+		free(d);
+	}
+}
+
+static void
+bfm_extra_req_free ( St_extra_req * r )
+{
+	bfm_extra_dir_unref( r->dir );
+	free( r->name );
+	free( r->val.target );
+	free(r);
+}
+
+/* Create resolver of values, threads are started on demand */
+St_extra *
+bfm_extra_new ( Extra_notify notify, void * data )
+{
+	St_extra * x = calloc( 1, sizeof(St_extra) );
+
+	x->vals = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, bfm_extra_val_free );
+	x->dfd = -1;
+	pthread_mutex_init( &x->lock, NULL );
+	x->refs = 1;
+	x->notify = notify;
+	x->data = data;
+
+	return x;
+}
+
+/* Drop values, waiting requests and results, names are from other directory now */
+void
+bfm_extra_clear ( St_extra * x )
+{
+	size_t i;
+
+	g_hash_table_remove_all( x->vals );
+	bfm_extra_dir_unref( x->dir );
+	x->dir = NULL;
+	x->dfd = -1;
+
+	pthread_mutex_lock( &x->lock );
+	x->gen++;
+	for ( i = 0; i < x->q_len; i++ )
+		bfm_extra_req_free( x->queue[i] );
+	x->q_len = 0;
+	for ( i = x->pend_pos; i < x->pend_len; i++ )
+		bfm_extra_req_free( x->pend[i] );
+	x->pend_pos = x->pend_len = 0;
+	pthread_mutex_unlock( &x->lock );
+}
+
+/* Drop values of changed name */
+void
+bfm_extra_forget ( St_extra * x, const char * name )
+{
+	g_hash_table_remove( x->vals, name );
+}
+
+/* User name of uid, number if it has no name */
+const char *
+bfm_extra_user ( uid_t uid )
+{
+	struct passwd   pw;
+	struct passwd * res = NULL;
+	char            buf[EXTRA_PW_BUF];
+	char          * name;
+
+	if ( !users )
+		users = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, g_free );
+	else if ( ( name = g_hash_table_lookup( users, GUINT_TO_POINTER(uid) ) ) )
+		return name;
+
+	if ( getpwuid_r( uid, &pw, buf, sizeof(buf), &res ) == 0 && res )
+		name = g_strdup( pw.pw_name );
+	else
+		name = g_strdup_printf( "%u", (unsigned)uid );
+
+	g_hash_table_insert( users, GUINT_TO_POINTER(uid), name );
+	return name;
+}
+
+/* Group name of gid, number if it has no name */
+const char *
+bfm_extra_group ( gid_t gid )
+{
+	struct group   gr;
+	struct group * res = NULL;
+	char           buf[EXTRA_PW_BUF];
+	char         * name;
+
+	if ( !groups )
+		groups = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, g_free );
+	else if ( ( name = g_hash_table_lookup( groups, GUINT_TO_POINTER(gid) ) ) )
+		return name;
+
+	if ( getgrgid_r( gid, &gr, buf, sizeof(buf), &res ) == 0 && res )
+		name = g_strdup( gr.gr_name );
+	else
+		name = g_strdup_printf( "%u", (unsigned)gid );
+
+	g_hash_table_insert( groups, GUINT_TO_POINTER(gid), name );
+	return name;
+}
+
+/* Part of value shown by column */
+static unsigned
+bfm_extra_part ( int col )
+{
+	switch ( col )
+	{
+		case EXTRA_MIME:   return EXTRA_HAVE_MIME;
+		case EXTRA_TARGET: return EXTRA_HAVE_TARGET;
+		default:           return EXTRA_HAVE_STAT;
+	}
+}
+
+/* Resolve part of value relative to directory, runs on worker */
+static void
+bfm_extra_resolve ( St_extra_req * r )
+{
+	St_extra_val * v = &r->val;
+	struct stat    st;
+	char           buf[PATH_MAX];
+	ssize_t        len;
+
+	switch ( r->part )
+	{
+		case EXTRA_HAVE_MIME:
+			v->mime = bfm_mime_type_at( r->dir->fd, r->name, r->mode );
+			break;
+		case EXTRA_HAVE_TARGET:
+			if ( S_ISLNK( r->mode ) && ( len = readlinkat( r->dir->fd, r->name, buf, sizeof(buf) - 1 ) ) >= 0 )
+			{
+				buf[len] = '\0';
+				v->target = strdup(buf);
+			}
+			break;
+		case EXTRA_HAVE_STAT:
+			if ( fstatat( r->dir->fd, r->name, &st, AT_SYMLINK_NOFOLLOW ) == 0 )
+			{
+				v->uid = st.st_uid;
+				v->gid = st.st_gid;
+				v->ino = st.st_ino;
+				v->nlink = st.st_nlink;
+			}
+			else
+				v->gone = 1;
+			break;
+	}
+}
+
+/* Queue result, called with lock held. Returns 1 if receiver has to be notified */
+static int
+bfm_extra_push ( St_extra * x, St_extra_req * r )
+{
+	if ( x->pend_len == x->pend_cap )
+	{
+		x->pend_cap = x->pend_cap ? x->pend_cap * 2 : 64;
+		x->pend = realloc( x->pend, x->pend_cap * sizeof(St_extra_req *) );
+	}
+	x->pend[ x->pend_len++ ] = r;
+
+	if ( x->signalled || x->cancel )
+		return 0;
+	return x->signalled = 1;
+}
+
+static void *
+bfm_extra_worker ( void * p )
+{
+	St_extra     * x = p;
+	St_extra_req * r;
+	uint64_t       t;
+	int            signal;
+
+	pthread_mutex_lock( &x->lock );
+	while ( x->q_len && !x->cancel )
+	{
+		r = x->queue[ --x->q_len ];
+		pthread_mutex_unlock( &x->lock );
+
+		t = bfm_trace_begin();
+		bfm_extra_resolve(r);
+		bfm_trace_end( "extra", t );
+
+		pthread_mutex_lock( &x->lock );
+		signal = 0;
+		if ( r->gen == x->gen && !x->cancel )
+			signal = bfm_extra_push( x, r );
+		else
+			bfm_extra_req_free(r);
+
+		if ( signal )
+		{
+			pthread_mutex_unlock( &x->lock );
+			x->notify( x, x->data );
+			pthread_mutex_lock( &x->lock );
+		}
+	}
+	x->workers--;
+	pthread_mutex_unlock( &x->lock );
+
+	bfm_extra_unref(x);
+	return NULL;
+}
+
+/* Ask for part of value of name under directory */
+static void
+bfm_extra_request ( St_extra * x, int dfd, const char * name, mode_t mode, unsigned part )
+{
+	St_extra_req * r;
+	pthread_t      thr;
+	pthread_attr_t attr;
+	int            fd;
+	int            signal = 0;
+
+	/* Workers keep their own descriptor, window may close its one */
+	if ( !x->dir || x->dfd != dfd )
+	{
+		if ( ( fd = fcntl( dfd, F_DUPFD_CLOEXEC, 0 ) ) < 0 )
+			return;
+		bfm_extra_dir_unref( x->dir );
+		x->dir = malloc( sizeof(St_extra_dir) );
+		x->dir->fd = fd;
+		x->dir->refs = 1;
+		x->dfd = dfd;
+	}
+
+	r = calloc( 1, sizeof(St_extra_req) );
+	r->dir = x->dir;
+	__atomic_add_fetch( &r->dir->refs, 1, __ATOMIC_ACQ_REL );
+	r->name = strdup(name);
+	r->mode = mode;
+	r->part = part;
+
+	pthread_mutex_lock( &x->lock );
+	r->gen = x->gen;
+
+	/* Oldest request is for row scrolled away, it is asked again when drawn */
+	if ( x->q_len == EXTRA_QUEUE_MAX )
+	{
+		x->queue[0]->dropped = 1;
+		signal = bfm_extra_push( x, x->queue[0] );
+		memmove( x->queue, x->queue + 1, --x->q_len * sizeof(St_extra_req *) );
+	}
+
+	if ( x->q_len == x->q_cap )
+	{
+		x->q_cap = x->q_cap ? x->q_cap * 2 : 64;
+		x->queue = realloc( x->queue, x->q_cap * sizeof(St_extra_req *) );
+	}
+	x->queue[ x->q_len++ ] = r;
+
+	if ( x->workers < EXTRA_THREADS )
+	{
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+		bfm_extra_ref(x);
+		if ( pthread_create( &thr, &attr, bfm_extra_worker, x ) == 0 )
+			x->workers++;
+		/* Owner reference is still held */
+		else
+			bfm_extra_unref(x);
+		pthread_attr_destroy(&attr);
+	}
+	pthread_mutex_unlock( &x->lock );
+
+	if ( signal )
+		x->notify( x, x->data );
+}
+
+/* Text of column for name under directory descriptor, values are resolved
+ * once per modification time by workers, empty until they come */
+const char *
+bfm_extra_text ( St_extra * x, int dfd, const char * name, mode_t mode, int64_t mtime, int col, char * buf, size_t len )
+{
+	St_extra_val * v = g_hash_table_lookup( x->vals, name );
+	unsigned       part = bfm_extra_part(col);
+
+	if ( !v || v->mtime != mtime )
+	{
+		v = g_new0( St_extra_val, 1 );
+		v->mtime = mtime;
+		g_hash_table_replace( x->vals, g_strdup(name), v );
+	}
+
+	if ( !( v->have & part ) )
+	{
+		if ( !( v->asked & part ) && dfd >= 0 )
+		{
+			v->asked |= part;
+			bfm_extra_request( x, dfd, name, mode, part );
+		}
+		return "";
+	}
+
+	if ( v->gone && part == EXTRA_HAVE_STAT )
+		return "";
+
+	switch ( col )
+	{
+		case EXTRA_OWNER:
+			return bfm_extra_user( v->uid );
+		case EXTRA_GROUP:
+			return bfm_extra_group( v->gid );
+		case EXTRA_INODE:
+			snprintf( buf, len, "%llu", (unsigned long long)v->ino );
+			return buf;
+		case EXTRA_LINKS:
+			snprintf( buf, len, "%lu", (unsigned long)v->nlink );
+			return buf;
+		case EXTRA_MIME:
+			return v->mime;
+		case EXTRA_TARGET:
+			return v->target ? v->target : "";
+	}
+
+	return "";
+}
+
+/* Store resolved values and receive up to max names whose rows have to be
+ * drawn again, names are allocated with malloc(). State is SCAN_MORE or SCAN_WAIT */
+size_t
+bfm_extra_take ( St_extra * x, char ** names, size_t max, int * state )
+{
+	St_extra_req * r;
+	St_extra_val * v;
+	size_t         n = 0;
+
+	pthread_mutex_lock( &x->lock );
+
+	for ( ; n < max && x->pend_pos < x->pend_len; x->pend_pos++ )
+	{
+		r = x->pend[ x->pend_pos ];
+
+		/* Value of name changed meanwhile, new one asks again */
+		if ( ( v = g_hash_table_lookup( x->vals, r->name ) ) && ( v->asked & r->part ) )
+		{
+			v->asked &= ~r->part;
+			if ( !r->dropped )
+			{
+				v->have |= r->part;
+				switch ( r->part )
+				{
+					case EXTRA_HAVE_MIME:
+						v->mime = r->val.mime;
+						break;
+					case EXTRA_HAVE_TARGET:
+						v->target = r->val.target;
+						r->val.target = NULL;
+						break;
+					case EXTRA_HAVE_STAT:
+						v->gone  = r->val.gone;
+						v->uid   = r->val.uid;
+						v->gid   = r->val.gid;
+						v->ino   = r->val.ino;
+						v->nlink = r->val.nlink;
+						break;
+				}
+			}
+
+			names[n++] = r->name;
+			r->name = NULL;
+		}
+		bfm_extra_req_free(r);
+	}
+
+	if ( x->pend_pos < x->pend_len )
+		* state = SCAN_MORE;
+	else
+	{
+		x->pend_pos = x->pend_len = 0;
+		x->signalled = 0;
+		* state = SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &x->lock );
+	return n;
+}
+
+/* Receiver data */
+void *
+bfm_extra_data ( St_extra * x )
+{
+	return x->data;
+}
+
+/* Check if resolver was cancelled by owner */
+int
+bfm_extra_cancelled ( St_extra * x )
+{
+	return __atomic_load_n( &x->cancel, __ATOMIC_RELAXED );
+}
+
+/* Stop resolving and release owner reference */
+void
+bfm_extra_cancel ( St_extra * x )
+{
+	pthread_mutex_lock( &x->lock );
+	__atomic_store_n( &x->cancel, 1, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &x->lock );
+
+	bfm_extra_clear(x);
+	bfm_extra_unref(x);
+}
+
+void
+bfm_extra_ref ( St_extra * x )
+{
+	__atomic_add_fetch( &x->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_extra_unref ( St_extra * x )
+{
+	if ( __atomic_sub_fetch( &x->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	bfm_extra_clear(x);
+	g_hash_table_destroy( x->vals );
+	free( x->queue );
+	free( x->pend );
+	pthread_mutex_destroy( &x->lock );
+	free(x);
+}
@@ -0,0 +1,42 @@
+#ifndef BFM_EXTRA_H
+#define BFM_EXTRA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Enums */
+/* Optional columns, values are resolved when row is drawn */
+enum ExtraColumns
+{
+	EXTRA_OWNER,
+	EXTRA_GROUP,
+	EXTRA_INODE,
+	EXTRA_LINKS,
+	EXTRA_MIME,
+	EXTRA_TARGET,
+	N_EXTRA
+};
+
+/* Structs */
+/* Resolved values of listed names, resolved by background workers */
+typedef struct St_extra St_extra;
+
+/* Called from worker thread when new values are waiting */
+typedef void (* Extra_notify)( St_extra *, void * );
+
+/* Protos */
+St_extra *   bfm_extra_new       ( Extra_notify, void * );
+const char * bfm_extra_text      ( St_extra *, int, const char *, mode_t, int64_t, int, char *, size_t );
+size_t       bfm_extra_take      ( St_extra *, char **, size_t, int * );
+const char * bfm_extra_user      ( uid_t );
+const char * bfm_extra_group     ( gid_t );
+void *       bfm_extra_data      ( St_extra * );
+void         bfm_extra_clear     ( St_extra * );
+void         bfm_extra_forget    ( St_extra *, const char * );
+int          bfm_extra_cancelled ( St_extra * );
+void         bfm_extra_cancel    ( St_extra * );
+void         bfm_extra_ref       ( St_extra * );
+void         bfm_extra_unref     ( St_extra * );
+
+#endif
@@ -0,0 +1,252 @@
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "filter.h"
+
+/* Functions */
+void
+bfm_filter_init ( St_filter * f, int dotfiles )
+{
+	memset( f, 0, sizeof(* f) );
+	f->dotfiles = dotfiles;
+	f->type = FILTER_NONE;
+}
+
+void
+bfm_filter_free ( St_filter * f )
+{
+	if ( f->type == FILTER_REGEX )
+		regfree( &f->re );
+
+	free( f->pattern );
+	f->pattern = NULL;
+	f->type = FILTER_NONE;
+}
+
+/* Set name pattern, empty pattern removes it. Returns -1 for invalid regex */
+int
+bfm_filter_set ( St_filter * f, int type, const char * pattern )
+{
+	char * k;
+
+	bfm_filter_free(f);
+
+	if ( !pattern || !* pattern || type == FILTER_NONE )
+		return 0;
+
+	if ( type == FILTER_REGEX && regcomp( &f->re, pattern, REG_EXTENDED | REG_ICASE | REG_NOSUB ) != 0 )
+		return -1;
+
+	f->type = type;
+	f->pattern = strdup(pattern);
+	f->pattern_len = strlen(pattern);
+
+	/* Matched against casefolded keys */
+	if ( type == FILTER_SUBSTR || type == FILTER_FUZZY )
+		for ( k = f->pattern; * k; k++ )
+			if ( * k >= 'A' && * k <= 'Z' )
+				* k += 'a' - 'A';
+
+	return 0;
+}
+
+/* Filter hides some records */
+int
+bfm_filter_active ( const St_filter * f )
+{
+	return !f->dotfiles || f->type != FILTER_NONE;
+}
+
+/* First occurrence of needle, needle is at least two bytes long */
+static const char *
+bfm_filter_find ( const char * h, size_t n, const char * s, size_t k )
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	/* Compare first and last bytes of needle at 16 positions at once,
+	 * then check candidates */
+	const __m128i first = _mm_set1_epi8( s[0] );
+	const __m128i last = _mm_set1_epi8( s[ k - 1 ] );
+	__m128i       a;
+	__m128i       b;
+	unsigned      mask;
+
+	for ( ; i + k - 1 + 16 <= n; i += 16 )
+	{
+		a = _mm_loadu_si128( (const __m128i *)( h + i ) );
+		b = _mm_loadu_si128( (const __m128i *)( h + i + k - 1 ) );
+		mask = _mm_movemask_epi8( _mm_and_si128( _mm_cmpeq_epi8( a, first ), _mm_cmpeq_epi8( b, last ) ) );
+
+		while ( mask )
+		{
+			const char * c = h + i + __builtin_ctz(mask);
+			if ( memcmp( c + 1, s + 1, k - 2 ) == 0 )
+				return c;
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	return i < n ? memmem( h + i, n - i, s, k ) : NULL;
+}
+
+/* Record owning arena offset, searching forward from record at or
+ * before it. Offsets grow with record index */
+static uint32_t
+bfm_filter_owner ( const St_listing * l, uint32_t from, size_t off )
+{
+	uint32_t lo = from;
+	uint32_t hi;
+	uint32_t step = 1;
+	uint32_t mid;
+
+	/* Hits are usually close to each other */
+	while ( lo + step < l->len && l->rec[ lo + step ].name <= off )
+	{
+		lo += step;
+		step *= 2;
+	}
+	hi = lo + step < l->len ? lo + step : l->len;
+
+	while ( hi - lo > 1 )
+	{
+		mid = lo + ( hi - lo ) / 2;
+		if ( l->rec[mid].name <= off )
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Substring search over whole arena instead of name by name */
+static void
+bfm_filter_mark_substr ( const St_filter * f, const St_listing * l, uint8_t * match )
+{
+	const char * p = l->arena;
+	const char * end = l->arena + l->arena_len;
+	const char * hit;
+	const St_rec * r;
+	uint32_t     i = 0;
+
+	memset( match, 0, l->len );
+
+	while ( p < end )
+	{
+		if ( f->pattern_len == 1 )
+			hit = memchr( p, f->pattern[0], end - p );
+		else
+			hit = bfm_filter_find( p, end - p, f->pattern, f->pattern_len );
+		if ( !hit )
+			break;
+
+		i = bfm_filter_owner( l, i, hit - l->arena );
+		r = &l->rec[i];
+
+		/* Hit in original name of record with separate key */
+		if ( (size_t)( hit - l->arena ) < r->key )
+		{
+			p = l->arena + r->key;
+			continue;
+		}
+
+		match[i] = 1;
+		p = i + 1 < l->len ? l->arena + l->rec[ i + 1 ].name : end;
+	}
+}
+
+/* Pattern characters appear in string in same order */
+static int
+bfm_filter_fuzzy ( const char * s, const char * p, int fold )
+{
+	char c;
+
+	for ( ; * p; p++ )
+	{
+		for ( ; ( c = * s ); s++ )
+		{
+			if ( fold && c >= 'A' && c <= 'Z' )
+				c += 'a' - 'A';
+			if ( c == * p )
+				break;
+		}
+
+		if ( !* s++ )
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Check pattern for single record */
+static int
+bfm_filter_pattern ( const St_filter * f, const St_listing * l, uint32_t i )
+{
+	switch ( f->type )
+	{
+		case FILTER_SUBSTR:
+			return strstr( bfm_listing_key( l, i ), f->pattern ) != NULL;
+		case FILTER_GLOB:
+			return fnmatch( f->pattern, bfm_listing_name( l, i ), FNM_CASEFOLD ) == 0;
+		case FILTER_REGEX:
+			return regexec( &f->re, bfm_listing_name( l, i ), 0, NULL, 0 ) == 0;
+		case FILTER_FUZZY:
+			return bfm_filter_fuzzy( bfm_listing_key( l, i ), f->pattern, 0 );
+		default:
+			return 1;
+	}
+}
+
+/* Check pattern for name outside of listing, dotfiles are not checked */
+int
+bfm_filter_name ( const St_filter * f, const char * name )
+{
+	switch ( f->type )
+	{
+		case FILTER_SUBSTR:
+			return strcasestr( name, f->pattern ) != NULL;
+		case FILTER_GLOB:
+			return fnmatch( f->pattern, name, FNM_CASEFOLD ) == 0;
+		case FILTER_REGEX:
+			return regexec( &f->re, name, 0, NULL, 0 ) == 0;
+		case FILTER_FUZZY:
+			return bfm_filter_fuzzy( name, f->pattern, 1 );
+		default:
+			return 1;
+	}
+}
+
+/* Record is visible */
+int
+bfm_filter_match ( const St_filter * f, const St_listing * l, uint32_t i )
+{
+	if ( !f->dotfiles && * bfm_listing_name( l, i ) == '.' )
+		return 0;
+
+	return bfm_filter_pattern( f, l, i );
+}
+
+/* Set flag for every visible record */
+void
+bfm_filter_mark ( const St_filter * f, const St_listing * l, uint8_t * match )
+{
+	uint32_t i;
+
+	if ( f->type == FILTER_SUBSTR )
+		bfm_filter_mark_substr( f, l, match );
+	else
+		for ( i = 0; i < l->len; i++ )
+			match[i] = bfm_filter_pattern( f, l, i );
+
+	if ( !f->dotfiles )
+		for ( i = 0; i < l->len; i++ )
+			if ( * bfm_listing_name( l, i ) == '.' )
+				match[i] = 0;
+}
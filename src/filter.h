@@ -0,0 +1,43 @@
+#ifndef BFM_FILTER_H
+#define BFM_FILTER_H
+
+#include <regex.h>
+#include <stdint.h>
+
+#include "listing.h"
+
+/* Enums */
+/* Kind of name pattern */
+enum FilterType
+{
+	FILTER_NONE,
+	/* Casefolded substring, used for type-ahead */
+	FILTER_SUBSTR,
+	FILTER_GLOB,
+	FILTER_REGEX,
+	/* Casefolded characters in order, with anything between */
+	FILTER_FUZZY
+};
+
+/* Structs */
+/* Visibility rules for listing records */
+typedef struct
+{
+	/* Show names beginning with dot */
+	int       dotfiles;
+	int       type;
+	char    * pattern;
+	size_t    pattern_len;
+	regex_t   re;
+} St_filter;
+
+/* Protos */
+int  bfm_filter_active ( const St_filter * );
+int  bfm_filter_match  ( const St_filter *, const St_listing *, uint32_t );
+int  bfm_filter_name   ( const St_filter *, const char * );
+int  bfm_filter_set    ( St_filter *, int, const char * );
+void bfm_filter_init   ( St_filter *, int );
+void bfm_filter_free   ( St_filter * );
+void bfm_filter_mark   ( const St_filter *, const St_listing *, uint8_t * );
+
+#endif
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "format.h"
+
+/* Functions */
+/* Write modification time */
+void
+bfm_col_ctr_time ( const char * fmt, time_t t, char * buf, size_t len )
+{
+	struct tm tm;
+
+	if ( !localtime_r( &t, &tm ) || strftime( buf, len, fmt, &tm ) == 0 )
+		* buf = '\0';
+}
+
+/* Write file size */
+void
+bfm_col_ctr_size ( uint64_t size, char * buf, size_t len )
+{
+	/* Bytes */
+	if ( size < 1024 )
+		snprintf( buf, len, "%i B", (int)size );
+	/* KiBytes */
+	else if ( size < 1024*1024 )
+		snprintf( buf, len, "%.1f KiB", size / 1024.0 );
+	/* MiBytes */
+	else if ( size < 1024*1024*1024 )
+		snprintf( buf, len, "%.1f MiB", size / ( 1024.0 * 1024 ) );
+	/* GiBytes */
+	else
+		snprintf( buf, len, "%.1f GiB", size / ( 1024.0 * 1024 * 1024 ) );
+}
+
+/* Write file permissions and type, buffer holds FMT_PERM_LEN bytes */
+void
+bfm_col_ctr_perm ( mode_t mode, char * buf )
+{
+	/* File type */
+	char ident;
+	switch ( mode & S_IFMT )
+	{
+		case S_IFBLK:	ident = 'b'; break;
+		case S_IFCHR:	ident = 'c'; break;
+		case S_IFDIR:	ident = 'd'; break;
+		case S_IFIFO:	ident = 'p'; break;
+		case S_IFLNK:	ident = 'l'; break;
+		case S_IFREG:	ident = '-'; break;
+		case S_IFSOCK:	ident = 's'; break;
+		default:		ident = '?'; break;
+	}
+
+	/* File permissions */
+	const char *permstr[] = { "---", "--x", "-w-", "-wx", "r--", "r-x", "rw-", "rwx" };
+	snprintf( buf, FMT_PERM_LEN, "%c%s%s%s",
+	          ident,
+	          permstr[ ( mode >> 6 ) & 7 ],
+	          permstr[ ( mode >> 3 ) & 7 ],
+	          permstr[ mode & 7 ]
+	        );
+}
@@ -0,0 +1,17 @@
+#ifndef BFM_FORMAT_H
+#define BFM_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Length of permissions string with terminator */
+#define FMT_PERM_LEN 11
+
+/* Protos */
+void bfm_col_ctr_perm ( mode_t, char * );
+void bfm_col_ctr_size ( uint64_t, char *, size_t );
+void bfm_col_ctr_time ( const char *, time_t, char *, size_t );
+
+#endif
@@ -0,0 +1,943 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+
+/* File of other version is ignored and rebuilt */
+#define INDEX_MAGIC   "BFMINDEX"
+#define INDEX_VERSION 1
+/* Written in native byte order, file from machine with other order is rebuilt */
+#define INDEX_ORDER   0x01020304u
+/* Last word of complete file */
+#define INDEX_TAIL    0x4c494154584449ull
+/* Deepest directory crawled under root */
+#define INDEX_DEPTH   64
+
+/* Structs */
+/* File header, followed by directories sorted by path, entries, names and tail */
+typedef struct
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t order;
+	/* Whole file, torn file does not match */
+	uint64_t size;
+	uint64_t n_dirs;
+	uint64_t n_ents;
+	uint64_t n_names;
+} St_index_head;
+
+/* Directory with entries following each other from first */
+typedef struct
+{
+	uint64_t dev;
+	uint64_t ino;
+	int64_t  mtime;
+	int64_t  mtime_ns;
+	uint64_t first;
+	uint32_t n;
+	/* Offset of absolute path in names */
+	uint32_t path;
+} St_index_dir;
+
+typedef struct
+{
+	int64_t  size;
+	int64_t  mtime;
+	/* Offset in names */
+	uint32_t name;
+	uint32_t mode;
+} St_index_ent;
+
+/* Read-only view of mapped file or of index being built */
+typedef struct
+{
+	const St_index_dir * dirs;
+	size_t               n_dirs;
+	const St_index_ent * ents;
+	size_t               n_ents;
+	const char         * names;
+	size_t               n_names;
+} St_index_view;
+
+/* Index being built, directories are sorted when written */
+typedef struct
+{
+	St_index_dir * dirs;
+	size_t         n_dirs;
+	size_t         cap_dirs;
+	St_index_ent * ents;
+	size_t         n_ents;
+	size_t         cap_ents;
+	char         * names;
+	size_t         n_names;
+	size_t         cap_names;
+	/* Path to latest directory index + 1, open addressing */
+	uint32_t     * hash;
+	size_t         hash_cap;
+} St_index_build;
+
+struct St_index
+{
+	pthread_mutex_t   lock;
+	char            * file;
+	/* Mapped file, replaced by worker under lock */
+	void            * base;
+	size_t            size;
+	St_index_view     map;
+	/* Listings put since last update */
+	St_index_build    pending;
+	/* Worker, joined before next one is started */
+	pthread_t         thr;
+	int               started;
+	int               busy;
+	int               cancel;
+	char           ** roots;
+	Index_notify      notify;
+	void            * data;
+	/* Counted by worker, copied to stats when update is done */
+	size_t            reread;
+	size_t            dropped;
+	St_index_stats    stats;
+};
+
+/* Functions */
+static long
+bfm_index_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a string hash */
+static uint32_t
+bfm_index_hash_str ( const char * s )
+{
+	uint32_t h = 2166136261u;
+
+	while ( * s )
+		h = ( h ^ (unsigned char)* s++ ) * 16777619u;
+
+	return h;
+}
+
+/* String at offset, offsets from file are checked */
+static const char *
+bfm_index_str ( const St_index_view * v, uint32_t off )
+{
+	return off < v->n_names ? v->names + off : "";
+}
+
+static void
+bfm_index_view ( const St_index_build * b, St_index_view * v )
+{
+	v->dirs    = b->dirs;
+	v->n_dirs  = b->n_dirs;
+	v->ents    = b->ents;
+	v->n_ents  = b->n_ents;
+	v->names   = b->names;
+	v->n_names = b->n_names;
+}
+
+static void
+bfm_index_build_free ( St_index_build * b )
+{
+	free( b->dirs );
+	free( b->ents );
+	free( b->names );
+	free( b->hash );
+	memset( b, 0, sizeof(* b) );
+}
+
+/* Copy string into names, UINT32_MAX if they are full */
+static uint32_t
+bfm_index_push ( St_index_build * b, const char * s )
+{
+	size_t len = strlen(s) + 1;
+	size_t off = b->n_names;
+
+	if ( off + len >= UINT32_MAX )
+		return UINT32_MAX;
+
+	if ( off + len > b->cap_names )
+	{
+		while ( off + len > b->cap_names )
+			b->cap_names = b->cap_names ? b->cap_names * 2 : 65536;
+		b->names = realloc( b->names, b->cap_names );
+	}
+
+	memcpy( b->names + off, s, len );
+	b->n_names += len;
+	return off;
+}
+
+/* Latest directory with path, -1 if there is none */
+static long
+bfm_index_find ( const St_index_build * b, const char * path )
+{
+	size_t mask = b->hash_cap - 1;
+	size_t h;
+
+	if ( !b->hash )
+		return -1;
+
+	for ( h = bfm_index_hash_str(path) & mask; b->hash[h]; h = ( h + 1 ) & mask )
+		if ( strcmp( b->names + b->dirs[ b->hash[h] - 1 ].path, path ) == 0 )
+			return b->hash[h] - 1;
+
+	return -1;
+}
+
+/* Point path of directory at it, replacing earlier one */
+static void
+bfm_index_hash_put ( St_index_build * b, size_t i )
+{
+	size_t       mask = b->hash_cap - 1;
+	const char * path = b->names + b->dirs[i].path;
+	size_t       h;
+
+	for ( h = bfm_index_hash_str(path) & mask; b->hash[h]; h = ( h + 1 ) & mask )
+		if ( strcmp( b->names + b->dirs[ b->hash[h] - 1 ].path, path ) == 0 )
+			break;
+
+	b->hash[h] = i + 1;
+}
+
+/* Start directory, its entries are added next. Returns 0 if index is full */
+static int
+bfm_index_add_dir ( St_index_build * b, const char * path, uint64_t dev, uint64_t ino, int64_t mtime, int64_t mtime_ns )
+{
+	St_index_dir * d;
+	uint32_t       off;
+	size_t         i;
+
+	if ( b->n_dirs >= UINT32_MAX - 1 || ( off = bfm_index_push( b, path ) ) == UINT32_MAX )
+		return 0;
+
+	if ( b->n_dirs == b->cap_dirs )
+	{
+		b->cap_dirs = b->cap_dirs ? b->cap_dirs * 2 : 256;
+		b->dirs = realloc( b->dirs, b->cap_dirs * sizeof(St_index_dir) );
+	}
+
+	d = &b->dirs[ b->n_dirs ];
+	d->dev      = dev;
+	d->ino      = ino;
+	d->mtime    = mtime;
+	d->mtime_ns = mtime_ns;
+	d->first    = b->n_ents;
+	d->n        = 0;
+	d->path     = off;
+
+	/* Paths are looked up while building, index is kept half empty */
+	if ( ( b->n_dirs + 1 ) * 2 > b->hash_cap )
+	{
+		free( b->hash );
+		b->hash_cap = b->hash_cap ? b->hash_cap * 2 : 512;
+		b->hash = calloc( b->hash_cap, sizeof(uint32_t) );
+		for ( i = 0; i < b->n_dirs; i++ )
+			bfm_index_hash_put( b, i );
+	}
+
+	bfm_index_hash_put( b, b->n_dirs++ );
+	return 1;
+}
+
+/* Add entry to last directory */
+static void
+bfm_index_add_ent ( St_index_build * b, const char * name, uint32_t mode, int64_t size, int64_t mtime )
+{
+	St_index_ent * e;
+	uint32_t       off;
+
+	if ( ( off = bfm_index_push( b, name ) ) == UINT32_MAX )
+		return;
+
+	if ( b->n_ents == b->cap_ents )
+	{
+		b->cap_ents = b->cap_ents ? b->cap_ents * 2 : 4096;
+		b->ents = realloc( b->ents, b->cap_ents * sizeof(St_index_ent) );
+	}
+
+	e = &b->ents[ b->n_ents++ ];
+	e->name  = off;
+	e->mode  = mode;
+	e->size  = size;
+	e->mtime = mtime;
+	b->dirs[ b->n_dirs - 1 ].n++;
+}
+
+/* Copy directory with its entries from other index */
+static void
+bfm_index_copy ( St_index_build * b, const St_index_view * v, size_t i )
+{
+	const St_index_dir * d = &v->dirs[i];
+	const St_index_ent * e;
+	uint64_t             j;
+
+	if ( !bfm_index_add_dir( b, bfm_index_str( v, d->path ), d->dev, d->ino, d->mtime, d->mtime_ns ) )
+		return;
+
+	for ( j = 0; j < d->n; j++ )
+	{
+		e = &v->ents[ d->first + j ];
+		bfm_index_add_ent( b, bfm_index_str( v, e->name ), e->mode, e->size, e->mtime );
+	}
+}
+
+/* Read directory from disk, takes ownership of fd */
+static void
+bfm_index_read ( St_index_build * b, const char * path, int fd, const struct stat * dst )
+{
+	struct stat     st;
+	struct dirent * e;
+	DIR           * dir;
+
+	if ( !( dir = fdopendir(fd) ) )
+	{
+		close(fd);
+		return;
+	}
+
+	if ( bfm_index_add_dir( b, path, dst->st_dev, dst->st_ino, dst->st_mtim.tv_sec, dst->st_mtim.tv_nsec ) )
+	{
+		/* Symlinks are followed like in listing, broken ones are left out */
+		while ( ( e = readdir(dir) ) )
+			if ( strcmp( e->d_name, "." ) && strcmp( e->d_name, ".." )
+			  && fstatat( dirfd(dir), e->d_name, &st, 0 ) == 0 )
+				bfm_index_add_ent( b, e->d_name, st.st_mode, st.st_size, st.st_mtime );
+	}
+
+	closedir(dir);
+}
+
+/* Directory of mapped file by path, binary search */
+static long
+bfm_index_lookup ( const St_index_view * v, const char * path )
+{
+	size_t lo = 0;
+	size_t hi = v->n_dirs;
+	size_t mid;
+	int    c;
+
+	while ( lo < hi )
+	{
+		mid = lo + ( hi - lo ) / 2;
+		if ( ( c = strcmp( bfm_index_str( v, v->dirs[mid].path ), path ) ) == 0 )
+			return mid;
+		if ( c < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return -1;
+}
+
+/* Directory is the same as when it was listed */
+static int
+bfm_index_same ( const St_index_dir * d, const struct stat * st )
+{
+	return d->dev == (uint64_t)st->st_dev && d->ino == (uint64_t)st->st_ino
+	    && d->mtime == st->st_mtim.tv_sec && d->mtime_ns == st->st_mtim.tv_nsec;
+}
+
+/* Add directory opened as fd, unchanged listing is taken from pending or old index */
+static void
+bfm_index_take ( St_index * x, St_index_build * b, St_index_build * pend, const char * path, int fd, const struct stat * st )
+{
+	St_index_view v;
+	long          i;
+
+	bfm_index_view( pend, &v );
+	if ( ( i = bfm_index_find( pend, path ) ) >= 0 && bfm_index_same( &v.dirs[i], st ) )
+	{
+		bfm_index_copy( b, &v, i );
+		close(fd);
+		return;
+	}
+
+	if ( ( i = bfm_index_lookup( &x->map, path ) ) >= 0 && bfm_index_same( &x->map.dirs[i], st ) )
+	{
+		bfm_index_copy( b, &x->map, i );
+		close(fd);
+		return;
+	}
+
+	x->reread++;
+	bfm_index_read( b, path, fd, st );
+}
+
+/* Walk tree under root, staying on its filesystem. Dot directories are not entered */
+static void
+bfm_index_crawl ( St_index * x, St_index_build * b, St_index_build * pend, const char * root )
+{
+	struct stat   st;
+	char       ** stack = NULL;
+	int         * depth = NULL;
+	size_t        n = 0;
+	size_t        cap = 0;
+	dev_t         dev = 0;
+	char        * path;
+	const char  * name;
+	size_t        d;
+	size_t        j;
+	int           level;
+	int           fd;
+
+	if ( !( path = strdup(root) ) )
+		return;
+	level = 0;
+
+	for ( ;; )
+	{
+		fd = bfm_index_find( b, path ) < 0 ? open( path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) : -1;
+		if ( fd >= 0 && fstat( fd, &st ) == 0 && ( level == 0 || st.st_dev == dev ) )
+		{
+			dev = level == 0 ? st.st_dev : dev;
+			d = b->n_dirs;
+			bfm_index_take( x, b, pend, path, fd, &st );
+
+			/* Subdirectories of what was just added */
+			for ( j = 0; level < INDEX_DEPTH && d < b->n_dirs && j < b->dirs[d].n; j++ )
+			{
+				name = b->names + b->ents[ b->dirs[d].first + j ].name;
+				if ( !S_ISDIR( b->ents[ b->dirs[d].first + j ].mode ) || * name == '.' )
+					continue;
+
+				if ( n == cap )
+				{
+					cap = cap ? cap * 2 : 256;
+					stack = realloc( stack, cap * sizeof(char *) );
+					depth = realloc( depth, cap * sizeof(int) );
+				}
+				stack[n] = malloc( strlen(path) + strlen(name) + 2 );
+				sprintf( stack[n], "%s%s%s", path, strcmp( path, "/" ) ? "/" : "", name );
+				depth[n++] = level + 1;
+			}
+		}
+		else if ( fd >= 0 )
+			close(fd);
+		free(path);
+
+		if ( !n || __atomic_load_n( &x->cancel, __ATOMIC_RELAXED ) )
+			break;
+		path = stack[--n];
+		level = depth[n];
+	}
+
+	while ( n )
+		free( stack[--n] );
+	free(stack);
+	free(depth);
+}
+
+/* Add directory visited before, unless it is gone. Without crawling it is kept as it was */
+static void
+bfm_index_visit ( St_index * x, St_index_build * b, St_index_build * pend, const St_index_view * v, size_t i )
+{
+	const char  * path = bfm_index_str( v, v->dirs[i].path );
+	struct stat   st;
+	int           fd;
+
+	if ( bfm_index_find( b, path ) >= 0 )
+		return;
+
+	if ( !x->roots )
+	{
+		bfm_index_copy( b, v, i );
+		return;
+	}
+
+	if ( ( fd = open( path, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0 || fstat( fd, &st ) < 0 )
+	{
+		if ( fd >= 0 )
+			close(fd);
+		x->dropped++;
+		return;
+	}
+
+	bfm_index_take( x, b, pend, path, fd, &st );
+}
+
+static int
+bfm_index_cmp_path ( const void * a, const void * b, void * p )
+{
+	const St_index_build * x = p;
+
+	return strcmp( x->names + x->dirs[ * (const uint32_t *)a ].path, x->names + x->dirs[ * (const uint32_t *)b ].path );
+}
+
+/* Write index next to file and move it over, file is complete or not replaced */
+static int
+bfm_index_write ( const char * file, const St_index_build * b )
+{
+	St_index_head   h;
+	uint64_t        tail = INDEX_TAIL;
+	uint32_t      * order;
+	char          * tmp;
+	FILE          * f;
+	size_t          i;
+	int             ok;
+
+	if ( !( tmp = malloc( strlen(file) + 5 ) ) )
+		return 0;
+	sprintf( tmp, "%s.tmp", file );
+
+	/* Directories are sorted by path for lookup, entries stay in place */
+	order = malloc( ( b->n_dirs + 1 ) * sizeof(uint32_t) );
+	for ( i = 0; i < b->n_dirs; i++ )
+		order[i] = i;
+	qsort_r( order, b->n_dirs, sizeof(uint32_t), bfm_index_cmp_path, (void *)b );
+
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, INDEX_MAGIC, sizeof(h.magic) );
+	h.version = INDEX_VERSION;
+	h.order   = INDEX_ORDER;
+	h.n_dirs  = b->n_dirs;
+	h.n_ents  = b->n_ents;
+	h.n_names = b->n_names;
+	h.size    = sizeof(h) + b->n_dirs * sizeof(St_index_dir) + b->n_ents * sizeof(St_index_ent) + b->n_names + sizeof(tail);
+
+	ok = ( f = fopen( tmp, "we" ) ) && fwrite( &h, sizeof(h), 1, f ) == 1;
+	for ( i = 0; ok && i < b->n_dirs; i++ )
+		ok = fwrite( &b->dirs[ order[i] ], sizeof(St_index_dir), 1, f ) == 1;
+	ok = ok && fwrite( b->ents, sizeof(St_index_ent), b->n_ents, f ) == b->n_ents;
+	ok = ok && fwrite( b->names, 1, b->n_names, f ) == b->n_names;
+	ok = ok && fwrite( &tail, sizeof(tail), 1, f ) == 1;
+
+	/* Data is on disk before rename makes it visible */
+	ok = ok && fflush(f) == 0 && fsync( fileno(f) ) == 0;
+	if ( f && fclose(f) != 0 )
+		ok = 0;
+	ok = ok && rename( tmp, file ) == 0;
+	if ( !ok )
+		unlink(tmp);
+
+	free(order);
+	free(tmp);
+	return ok;
+}
+
+/* Map file and check it is complete, 0 if it is missing or not usable */
+static int
+bfm_index_map ( const char * file, void ** base, size_t * size, St_index_view * v )
+{
+	St_index_head   h;
+	struct stat     st;
+	uint64_t        tail;
+	const char    * p;
+	size_t          i;
+	int             fd;
+
+	if ( ( fd = open( file, O_RDONLY | O_CLOEXEC ) ) < 0 )
+		return 0;
+	if ( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof(h) + sizeof(tail)
+	  || ( p = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 ) ) == MAP_FAILED )
+	{
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	/* Counts are checked against size before anything is computed from them */
+	memcpy( &h, p, sizeof(h) );
+	memcpy( &tail, p + st.st_size - sizeof(tail), sizeof(tail) );
+	if ( memcmp( h.magic, INDEX_MAGIC, sizeof(h.magic) ) || h.version != INDEX_VERSION || h.order != INDEX_ORDER
+	  || h.size != (uint64_t)st.st_size || tail != INDEX_TAIL
+	  || h.n_dirs > h.size / sizeof(St_index_dir) || h.n_ents > h.size / sizeof(St_index_ent) || h.n_names > h.size
+	  || sizeof(h) + h.n_dirs * sizeof(St_index_dir) + h.n_ents * sizeof(St_index_ent) + h.n_names + sizeof(tail) != h.size
+	  || ( h.n_names && p[ sizeof(h) + h.n_dirs * sizeof(St_index_dir) + h.n_ents * sizeof(St_index_ent) + h.n_names - 1 ] ) )
+	{
+		munmap( (void *)p, st.st_size );
+		return 0;
+	}
+
+	v->dirs    = (const St_index_dir *)( p + sizeof(h) );
+	v->n_dirs  = h.n_dirs;
+	v->ents    = (const St_index_ent *)( v->dirs + h.n_dirs );
+	v->n_ents  = h.n_ents;
+	v->names   = (const char *)( v->ents + h.n_ents );
+	v->n_names = h.n_names;
+
+	for ( i = 0; i < v->n_dirs; i++ )
+	{
+		if ( v->dirs[i].first > v->n_ents || v->dirs[i].n > v->n_ents - v->dirs[i].first )
+		{
+			munmap( (void *)p, st.st_size );
+			return 0;
+		}
+	}
+
+	* base = (void *)p;
+	* size = st.st_size;
+	return 1;
+}
+
+/* Copy directories of index except those with path or those listed in other index, latest ones only */
+static void
+bfm_index_copy_except ( St_index_build * dst, const St_index_build * src, const char * path, const St_index_build * other )
+{
+	St_index_view   v;
+	const char    * p;
+	size_t          i;
+
+	bfm_index_view( src, &v );
+	for ( i = 0; i < src->n_dirs; i++ )
+	{
+		p = src->names + src->dirs[i].path;
+		if ( bfm_index_find( src, p ) == (long)i && !( path && strcmp( p, path ) == 0 )
+		  && !( other && bfm_index_find( other, p ) >= 0 ) )
+			bfm_index_copy( dst, &v, i );
+	}
+}
+
+/* Put directories of src into dst, replacing those with same path */
+static void
+bfm_index_merge ( St_index_build * dst, const St_index_build * src )
+{
+	St_index_build b;
+
+	memset( &b, 0, sizeof(b) );
+	bfm_index_copy_except( &b, dst, NULL, src );
+	bfm_index_copy_except( &b, src, NULL, NULL );
+	bfm_index_build_free(dst);
+	* dst = b;
+}
+
+/* Build new index from roots, visited directories and old file, then swap it in */
+static void *
+bfm_index_worker ( void * p )
+{
+	St_index       * x = p;
+	St_index_build   b;
+	St_index_build   pend;
+	St_index_view    v;
+	void           * base = NULL;
+	size_t           size = 0;
+	long             start = bfm_index_msec();
+	size_t           crawled;
+	size_t           i;
+
+	memset( &b, 0, sizeof(b) );
+	pthread_mutex_lock( &x->lock );
+	pend = x->pending;
+	memset( &x->pending, 0, sizeof(x->pending) );
+	pthread_mutex_unlock( &x->lock );
+
+	/* Only worker replaces map, it is read here without lock */
+	x->reread = x->dropped = 0;
+	for ( i = 0; x->roots && x->roots[i] && !__atomic_load_n( &x->cancel, __ATOMIC_RELAXED ); i++ )
+		bfm_index_crawl( x, &b, &pend, x->roots[i] );
+	crawled = i;
+
+	/* Latest listing of visited directory wins */
+	bfm_index_view( &pend, &v );
+	for ( i = pend.n_dirs; i-- && !__atomic_load_n( &x->cancel, __ATOMIC_RELAXED ); )
+		if ( bfm_index_find( &pend, bfm_index_str( &v, v.dirs[i].path ) ) == (long)i )
+			bfm_index_visit( x, &b, &pend, &v, i );
+	for ( i = 0; i < x->map.n_dirs && !__atomic_load_n( &x->cancel, __ATOMIC_RELAXED ); i++ )
+		bfm_index_visit( x, &b, &pend, &x->map, i );
+
+	/* Stopped update is dropped, listings put meanwhile stay pending for next one */
+	if ( __atomic_load_n( &x->cancel, __ATOMIC_RELAXED ) )
+	{
+		pthread_mutex_lock( &x->lock );
+		bfm_index_merge( &pend, &x->pending );
+		bfm_index_build_free( &x->pending );
+		x->pending = pend;
+		pthread_mutex_unlock( &x->lock );
+		bfm_index_build_free(&b);
+		__atomic_store_n( &x->busy, 0, __ATOMIC_RELEASE );
+		return NULL;
+	}
+
+	/* Without roots and changes file already holds the same */
+	if ( !crawled && !pend.n_dirs && !x->reread && !x->dropped && x->base )
+	{
+		pthread_mutex_lock( &x->lock );
+		x->stats.reread = x->stats.dropped = 0;
+		x->stats.msec = bfm_index_msec() - start;
+		pthread_mutex_unlock( &x->lock );
+	}
+	else if ( bfm_index_write( x->file, &b ) && bfm_index_map( x->file, &base, &size, &v ) )
+	{
+		pthread_mutex_lock( &x->lock );
+		if ( x->base )
+			munmap( x->base, x->size );
+		x->base = base;
+		x->size = size;
+		x->map = v;
+		x->stats.dirs = v.n_dirs;
+		x->stats.entries = v.n_ents;
+		x->stats.size = size;
+		x->stats.reread = x->reread;
+		x->stats.dropped = x->dropped;
+		x->stats.msec = bfm_index_msec() - start;
+		pthread_mutex_unlock( &x->lock );
+	}
+
+	bfm_index_build_free(&b);
+	bfm_index_build_free(&pend);
+	__atomic_store_n( &x->busy, 0, __ATOMIC_RELEASE );
+
+	if ( x->notify )
+		x->notify( x, x->data );
+	return NULL;
+}
+
+/* Open index kept in file, it is created on first update. NULL only if out of memory */
+St_index *
+bfm_index_open ( const char * file )
+{
+	St_index * x = calloc( 1, sizeof(St_index) );
+
+	if ( !x || !( x->file = strdup(file) ) )
+	{
+		free(x);
+		return NULL;
+	}
+
+	pthread_mutex_init( &x->lock, NULL );
+
+	/* Missing, torn or old file is the same as empty one */
+	if ( bfm_index_map( file, &x->base, &x->size, &x->map ) )
+	{
+		x->stats.dirs = x->map.n_dirs;
+		x->stats.entries = x->map.n_ents;
+		x->stats.size = x->size;
+	}
+
+	return x;
+}
+
+/* Fill last known listing of directory, 0 if it is not indexed or is other directory now */
+int
+bfm_index_dir ( St_index * x, const char * path, dev_t dev, ino_t ino, St_cached * out )
+{
+	St_index_view   v;
+	St_entry        e;
+	long            i;
+	uint64_t        j;
+
+	pthread_mutex_lock( &x->lock );
+
+	bfm_index_view( &x->pending, &v );
+	if ( ( i = bfm_index_find( &x->pending, path ) ) < 0 )
+	{
+		v = x->map;
+		i = bfm_index_lookup( &v, path );
+	}
+
+	if ( i < 0 || v.dirs[i].dev != (uint64_t)dev || v.dirs[i].ino != (uint64_t)ino )
+	{
+		pthread_mutex_unlock( &x->lock );
+		return 0;
+	}
+
+	out->dev = dev;
+	out->ino = ino;
+	out->mtime.tv_sec = v.dirs[i].mtime;
+	out->mtime.tv_nsec = v.dirs[i].mtime_ns;
+	out->cursor = out->top = LISTING_NONE;
+	out->list = bfm_listing_new();
+	for ( j = 0; j < v.dirs[i].n; j++ )
+	{
+		e.name  = (char *)bfm_index_str( &v, v.ents[ v.dirs[i].first + j ].name );
+		e.mode  = v.ents[ v.dirs[i].first + j ].mode;
+		e.size  = v.ents[ v.dirs[i].first + j ].size;
+		e.mtime = v.ents[ v.dirs[i].first + j ].mtime;
+		bfm_listing_add( out->list, &e );
+	}
+
+	pthread_mutex_unlock( &x->lock );
+	return 1;
+}
+
+/* Keep listing of visited directory, written with next update */
+void
+bfm_index_put ( St_index * x, const char * path, const St_cached * c )
+{
+	const St_rec   * r;
+	St_index_build   b;
+	uint32_t         i;
+
+	pthread_mutex_lock( &x->lock );
+
+	/* Directory visited again replaces its pending listing, others are copied over */
+	if ( bfm_index_find( &x->pending, path ) >= 0 )
+	{
+		memset( &b, 0, sizeof(b) );
+		bfm_index_copy_except( &b, &x->pending, path, NULL );
+		bfm_index_build_free( &x->pending );
+		x->pending = b;
+	}
+
+	if ( bfm_index_add_dir( &x->pending, path, c->dev, c->ino, c->mtime.tv_sec, c->mtime.tv_nsec ) )
+	{
+		for ( i = 0; i < c->list->len; i++ )
+		{
+			r = &c->list->rec[i];
+			if ( r->mode )
+				bfm_index_add_ent( &x->pending, bfm_listing_name( c->list, i ), r->mode, r->size, r->mtime );
+		}
+	}
+
+	pthread_mutex_unlock( &x->lock );
+}
+
+/* Add matching entries of directory to results, 0 when there are max of them */
+static int
+bfm_index_match ( const St_index_view * v, size_t i, const St_filter * f, St_entry * res, size_t max, size_t * n )
+{
+	const St_index_dir * d = &v->dirs[i];
+	const St_index_ent * e;
+	const char         * dir = bfm_index_str( v, d->path );
+	const char         * name;
+	uint64_t             j;
+
+	/* Path relative to root */
+	dir += * dir == '/';
+	if ( !f->dotfiles && ( * dir == '.' || strstr( dir, "/." ) ) )
+		return 1;
+
+	for ( j = 0; j < d->n; j++ )
+	{
+		e = &v->ents[ d->first + j ];
+		name = bfm_index_str( v, e->name );
+		if ( ( !f->dotfiles && * name == '.' ) || !bfm_filter_name( f, name ) )
+			continue;
+
+		if ( * n == max )
+			return 0;
+		if ( !( res[ * n ].name = malloc( strlen(dir) + strlen(name) + 2 ) ) )
+			return 0;
+		sprintf( res[ * n ].name, "%s%s%s", dir, * dir ? "/" : "", name );
+		res[ * n ].mode  = e->mode;
+		res[ * n ].size  = e->size;
+		res[ * n ].mtime = e->mtime;
+		( * n )++;
+	}
+
+	return 1;
+}
+
+/* Look names up in whole index, up to max results with paths relative to root.
+ * Array and names are allocated with malloc() */
+St_entry *
+bfm_index_locate ( St_index * x, const St_filter * f, size_t max, size_t * n )
+{
+	St_entry      * res = malloc( ( max + 1 ) * sizeof(St_entry) );
+	St_index_view   v;
+	size_t          i;
+	int             more = 1;
+
+	* n = 0;
+	if ( !res )
+		return NULL;
+
+	pthread_mutex_lock( &x->lock );
+
+	/* Directories visited since update are newer than file */
+	bfm_index_view( &x->pending, &v );
+	for ( i = 0; more && i < v.n_dirs; i++ )
+		if ( bfm_index_find( &x->pending, bfm_index_str( &v, v.dirs[i].path ) ) == (long)i )
+			more = bfm_index_match( &v, i, f, res, max, n );
+	for ( i = 0; more && i < x->map.n_dirs; i++ )
+		if ( bfm_index_find( &x->pending, bfm_index_str( &x->map, x->map.dirs[i].path ) ) < 0 )
+			more = bfm_index_match( &x->map, i, f, res, max, n );
+
+	pthread_mutex_unlock( &x->lock );
+	return res;
+}
+
+/* Start background update, 0 if one is running. Directories under roots are crawled,
+ * visited ones are checked, only those with changed mtime are read again */
+int
+bfm_index_update ( St_index * x, const char * const * roots, Index_notify notify, void * data )
+{
+	size_t i;
+	size_t n = 0;
+
+	if ( __atomic_load_n( &x->busy, __ATOMIC_ACQUIRE ) )
+		return 0;
+	if ( x->started )
+		pthread_join( x->thr, NULL );
+	x->started = 0;
+
+	if ( x->roots )
+		for ( i = 0; x->roots[i]; i++ )
+			free( x->roots[i] );
+	free( x->roots );
+
+	while ( roots[n] )
+		n++;
+	x->roots = calloc( n + 1, sizeof(char *) );
+	for ( i = 0; x->roots && i < n; i++ )
+		x->roots[i] = strdup( roots[i] );
+
+	x->notify = notify;
+	x->data = data;
+	x->cancel = 0;
+	x->busy = 1;
+	if ( !x->roots || pthread_create( &x->thr, NULL, bfm_index_worker, x ) != 0 )
+	{
+		x->busy = 0;
+		return 0;
+	}
+
+	x->started = 1;
+	return 1;
+}
+
+void
+bfm_index_stats ( St_index * x, St_index_stats * s )
+{
+	pthread_mutex_lock( &x->lock );
+	* s = x->stats;
+	pthread_mutex_unlock( &x->lock );
+}
+
+/* Stop update and write listings visited since last one, without reading disk */
+void
+bfm_index_close ( St_index * x )
+{
+	size_t i;
+
+	if ( x->started )
+	{
+		__atomic_store_n( &x->cancel, 1, __ATOMIC_RELAXED );
+		pthread_join( x->thr, NULL );
+	}
+
+	if ( x->roots )
+		for ( i = 0; x->roots[i]; i++ )
+			free( x->roots[i] );
+	free( x->roots );
+	x->roots = NULL;
+
+	if ( x->pending.n_dirs )
+	{
+		x->cancel = 0;
+		x->notify = NULL;
+		bfm_index_worker(x);
+	}
+
+	if ( x->base )
+		munmap( x->base, x->size );
+	bfm_index_build_free( &x->pending );
+	pthread_mutex_destroy( &x->lock );
+	free( x->file );
+	free(x);
+}
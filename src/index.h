@@ -0,0 +1,40 @@
+#ifndef BFM_INDEX_H
+#define BFM_INDEX_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "cache.h"
+#include "filter.h"
+#include "scan.h"
+
+/* Structs */
+/* Persistent listings of visited and configured directories in memory-mapped file */
+typedef struct St_index St_index;
+
+/* Called from worker thread when update of index file is over */
+typedef void (* Index_notify)( St_index *, void * );
+
+/* Counters of last update */
+typedef struct
+{
+	size_t dirs;
+	size_t entries;
+	/* Directories read again because their mtime changed */
+	size_t reread;
+	/* Directories gone since last update */
+	size_t dropped;
+	size_t size;
+	long   msec;
+} St_index_stats;
+
+/* Protos */
+St_index * bfm_index_open   ( const char * );
+int        bfm_index_dir    ( St_index *, const char *, dev_t, ino_t, St_cached * );
+void       bfm_index_put    ( St_index *, const char *, const St_cached * );
+St_entry * bfm_index_locate ( St_index *, const St_filter *, size_t, size_t * );
+int        bfm_index_update ( St_index *, const char * const *, Index_notify, void * );
+void       bfm_index_stats  ( St_index *, St_index_stats * );
+void       bfm_index_close  ( St_index * );
+
+#endif
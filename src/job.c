@@ -0,0 +1,1276 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "job.h"
+#include "scan.h"
+
+/* Worker threads of single job, unlinking is bound by metadata updates
+ * rather than CPU, so it does not follow CPU count */
+#define JOB_THREADS   8
+/* Copying threads, few streams keep disks near sequential bandwidth
+ * while small files still overlap their metadata updates */
+#define COPY_THREADS  4
+/* Bytes moved by one kernel call, also interval of cancel checks */
+#define COPY_CHUNK    ( 16 * 1024 * 1024 )
+/* Buffer of plain read and write fallback */
+#define COPY_BUF      ( 1024 * 1024 )
+/* Buffer for raw directory records */
+#define JOB_DENTS_BUF 32768
+/* Item without parent directory */
+#define COPY_NONE     ( (uint32_t)-1 )
+
+/* Structs */
+/* Record returned by getdents64 */
+struct linux_dirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/* Directory being deleted, removed when its last child is gone */
+typedef struct St_dnode St_dnode;
+struct St_dnode
+{
+	St_dnode * parent;
+	/* Unfinished children plus one for reading directory itself */
+	long       pending;
+	/* Relative to job directory */
+	char       path[];
+};
+
+/* File planned for copying, directories precede their contents */
+typedef struct
+{
+	/* Relative to job directory */
+	char            * src;
+	/* Relative to destination */
+	char            * dst;
+	mode_t            mode;
+	off_t             size;
+	dev_t             rdev;
+	/* Access and modification times */
+	struct timespec   times[2];
+	/* Enclosing directory item */
+	uint32_t          parent;
+	/* Selected name item belongs to */
+	uint32_t          top;
+	/* Item failed or was skipped, contents of directory are skipped too */
+	int               skip;
+} St_copyitem;
+
+/* Failed file */
+typedef struct
+{
+	char * path;
+	int    err;
+} St_job_error;
+
+struct St_job
+{
+	pthread_mutex_t   lock;
+	/* Owner and runner hold a reference each */
+	int               refs;
+	int               cancel;
+	int               type;
+	/* Directory names are relative to */
+	char            * dir;
+	int               dfd;
+	char           ** names;
+	size_t            n_names;
+	/* Progress */
+	St_job_progress   prog;
+	long              start;
+	St_job_error    * err;
+	size_t            err_len;
+	size_t            err_cap;
+	/* Directories waiting for workers */
+	pthread_cond_t    wake;
+	St_dnode       ** queue;
+	size_t            q_len;
+	size_t            q_cap;
+	/* Directories queued or being read */
+	size_t            active;
+	/* Copy and move */
+	char            * dest;
+	int               destfd;
+	struct stat       dest_st;
+	int               conflict;
+	/* Names in destination, NULL when nothing was created */
+	char           ** targets;
+	/* Selected names which must stay in place after move */
+	char            * keep;
+	St_copyitem     * items;
+	size_t            n_items;
+	size_t            items_cap;
+	/* Next item for copying workers */
+	size_t            next;
+	/* Transfer methods found unsupported between filesystems */
+	int               noclone;
+	int               nocfr;
+	int               nosendfile;
+	/* Receiver */
+	Job_notify        notify;
+	void            * data;
+};
+
+/* Globals */
+/* Copy and move jobs run one at a time, parallel streams to same disk
+ * only add seeking */
+static pthread_mutex_t turn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  turn_cond = PTHREAD_COND_INITIALIZER;
+static int             turn_busy = 0;
+
+/* Functions */
+/* Milliseconds from monotonic clock */
+static long
+bfm_job_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Remember failed path */
+static void
+bfm_job_fail ( St_job * j, const char * dir, const char * name, int err )
+{
+	char * path = malloc( strlen(dir) + strlen(name) + 2 );
+
+	if ( * dir )
+		sprintf( path, "%s/%s", dir, name );
+	else
+		strcpy( path, name );
+
+	pthread_mutex_lock( &j->lock );
+	if ( j->err_len == j->err_cap )
+	{
+		j->err_cap = j->err_cap ? j->err_cap * 2 : 16;
+		j->err = realloc( j->err, j->err_cap * sizeof(St_job_error) );
+	}
+	j->err[ j->err_len ].path = path;
+	j->err[ j->err_len++ ].err = err;
+	j->prog.errors++;
+	pthread_mutex_unlock( &j->lock );
+}
+
+/* Count removed file, cleanup after move is not reported */
+static void
+bfm_job_removed ( St_job * j, int dir )
+{
+	if ( j->type == JOB_DELETE )
+		__atomic_add_fetch( dir ? &j->prog.dirs : &j->prog.files, 1, __ATOMIC_RELAXED );
+}
+
+/* Run function on pool of threads including caller */
+static void
+bfm_job_pool ( St_job * j, void * (* worker)( void * ), int n )
+{
+	pthread_t thr[JOB_THREADS];
+	int       started[JOB_THREADS];
+	int       i;
+
+	for ( i = 1; i < n; i++ )
+		started[i] = pthread_create( &thr[i], NULL, worker, j ) == 0;
+	worker(j);
+	for ( i = 1; i < n; i++ )
+		if ( started[i] )
+			pthread_join( thr[i], NULL );
+}
+
+/* Deleting */
+static St_dnode *
+bfm_job_dnode ( St_dnode * parent, const char * dir, const char * name )
+{
+	St_dnode * d = malloc( sizeof(St_dnode) + strlen(dir) + strlen(name) + 2 );
+
+	d->parent = parent;
+	d->pending = 1;
+	if ( * dir )
+		sprintf( d->path, "%s/%s", dir, name );
+	else
+		strcpy( d->path, name );
+
+	return d;
+}
+
+static void
+bfm_job_push ( St_job * j, St_dnode * d )
+{
+	pthread_mutex_lock( &j->lock );
+	if ( j->q_len == j->q_cap )
+	{
+		j->q_cap = j->q_cap ? j->q_cap * 2 : 64;
+		j->queue = realloc( j->queue, j->q_cap * sizeof(St_dnode *) );
+	}
+	j->queue[ j->q_len++ ] = d;
+	j->active++;
+	pthread_cond_signal( &j->wake );
+	pthread_mutex_unlock( &j->lock );
+}
+
+/* Drop one reference of directory, remove it and release parent when it is last */
+static void
+bfm_job_release ( St_job * j, St_dnode * d )
+{
+	St_dnode * parent;
+	char     * slash;
+
+	while ( d && !__atomic_sub_fetch( &d->pending, 1, __ATOMIC_ACQ_REL ) )
+	{
+		if ( unlinkat( j->dfd, d->path, AT_REMOVEDIR ) == 0 )
+			bfm_job_removed( j, 1 );
+		/* Failures are already reported for contents */
+		else if ( !bfm_job_cancelled(j) && errno != ENOTEMPTY && errno != EEXIST )
+		{
+			slash = strrchr( d->path, '/' );
+			if ( slash )
+				* slash = '\0';
+			bfm_job_fail( j, slash ? d->path : "", slash ? slash + 1 : d->path, errno );
+		}
+
+		parent = d->parent;
+		free(d);
+		d = parent;
+	}
+}
+
+/* Unlink files of directory and queue its subdirectories */
+static void
+bfm_job_delete_dir ( St_job * j, St_dnode * d, char * buf )
+{
+	struct linux_dirent64 * e;
+	long                    len = 0;
+	long                    pos;
+	int                     fd;
+
+	if ( ( fd = openat( j->dfd, d->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 )
+	{
+		bfm_job_fail( j, "", d->path, errno );
+		return;
+	}
+
+	while ( !bfm_job_cancelled(j)
+	     && ( len = syscall( SYS_getdents64, fd, buf, JOB_DENTS_BUF ) ) > 0 )
+	{
+		for ( pos = 0; pos < len; pos += e->d_reclen )
+		{
+			e = (struct linux_dirent64 *)( buf + pos );
+			if ( !bfm_name_validat( e->d_name, 1 ) )
+				continue;
+
+			if ( e->d_type != DT_DIR )
+			{
+				if ( unlinkat( fd, e->d_name, 0 ) == 0 )
+				{
+					bfm_job_removed( j, 0 );
+					continue;
+				}
+				/* Type was unknown */
+				if ( errno != EISDIR )
+				{
+					bfm_job_fail( j, d->path, e->d_name, errno );
+					continue;
+				}
+			}
+
+			__atomic_add_fetch( &d->pending, 1, __ATOMIC_ACQ_REL );
+			bfm_job_push( j, bfm_job_dnode( d, d->path, e->d_name ) );
+		}
+	}
+
+	if ( len < 0 )
+		bfm_job_fail( j, "", d->path, errno );
+
+	close(fd);
+}
+
+static void *
+bfm_job_delete_worker ( void * p )
+{
+	St_job   * j = p;
+	St_dnode * d;
+	char     * buf = malloc(JOB_DENTS_BUF);
+
+	pthread_mutex_lock( &j->lock );
+	for ( ;; )
+	{
+		while ( !j->q_len && j->active )
+			pthread_cond_wait( &j->wake, &j->lock );
+		if ( !j->q_len )
+			break;
+
+		/* Newest first keeps number of open subtrees low */
+		d = j->queue[ --j->q_len ];
+		pthread_mutex_unlock( &j->lock );
+
+		/* After cancel queued directories are only released */
+		if ( !bfm_job_cancelled(j) )
+			bfm_job_delete_dir( j, d, buf );
+		bfm_job_release( j, d );
+
+		pthread_mutex_lock( &j->lock );
+		if ( !--j->active )
+			pthread_cond_broadcast( &j->wake );
+	}
+	pthread_mutex_unlock( &j->lock );
+
+	free(buf);
+	return NULL;
+}
+
+/* Unlink selected name or queue it for workers when it is directory */
+static void
+bfm_job_delete_top ( St_job * j, const char * name )
+{
+	struct stat st;
+
+	if ( fstatat( j->dfd, name, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+		bfm_job_fail( j, "", name, errno );
+	else if ( S_ISDIR( st.st_mode ) )
+		bfm_job_push( j, bfm_job_dnode( NULL, "", name ) );
+	else if ( unlinkat( j->dfd, name, 0 ) == 0 )
+		bfm_job_removed( j, 0 );
+	else
+		bfm_job_fail( j, "", name, errno );
+}
+
+/* Delete selected names, directories are deleted by pool of workers */
+static void
+bfm_job_run_delete ( St_job * j )
+{
+	size_t i;
+
+	for ( i = 0; i < j->n_names && !bfm_job_cancelled(j); i++ )
+		bfm_job_delete_top( j, j->names[i] );
+
+	bfm_job_pool( j, bfm_job_delete_worker, JOB_THREADS );
+}
+
+/* Copying */
+/* Join relative path and name */
+static char *
+bfm_job_join ( const char * dir, const char * name )
+{
+	char * path = malloc( strlen(dir) + strlen(name) + 2 );
+
+	if ( * dir )
+		sprintf( path, "%s/%s", dir, name );
+	else
+		strcpy( path, name );
+
+	return path;
+}
+
+/* Report failed item, its selected name is kept in place by move */
+static void
+bfm_job_copy_fail ( St_job * j, St_copyitem * it, int err )
+{
+	it->skip = 1;
+	__atomic_store_n( &j->keep[ it->top ], 1, __ATOMIC_RELAXED );
+	bfm_job_fail( j, "", it->src, err );
+}
+
+/* Existing destination is left alone, it keeps source of move too */
+static void
+bfm_job_copy_skip ( St_job * j, St_copyitem * it )
+{
+	it->skip = 1;
+	__atomic_store_n( &j->keep[ it->top ], 1, __ATOMIC_RELAXED );
+	__atomic_add_fetch( &j->prog.skipped, 1, __ATOMIC_RELAXED );
+}
+
+static St_copyitem *
+bfm_job_item ( St_job * j, char * src, char * dst, const struct stat * st, uint32_t parent, uint32_t top )
+{
+	St_copyitem * it;
+
+	if ( j->n_items == j->items_cap )
+	{
+		j->items_cap = j->items_cap ? j->items_cap * 2 : 256;
+		j->items = realloc( j->items, j->items_cap * sizeof(St_copyitem) );
+	}
+
+	it = &j->items[ j->n_items++ ];
+	it->src = src;
+	it->dst = dst;
+	it->mode = st->st_mode;
+	it->size = st->st_size;
+	it->rdev = st->st_rdev;
+	it->times[0] = st->st_atim;
+	it->times[1] = st->st_mtim;
+	it->parent = parent;
+	it->top = top;
+	it->skip = 0;
+
+	if ( S_ISREG( st->st_mode ) )
+		__atomic_add_fetch( &j->prog.total, st->st_size, __ATOMIC_RELAXED );
+
+	return it;
+}
+
+/* Read directory item and append its contents, items array may move */
+static void
+bfm_job_plan_dir ( St_job * j, uint32_t k, char * buf )
+{
+	struct linux_dirent64 * e;
+	struct stat             st;
+	long                    len = 0;
+	long                    pos;
+	int                     fd;
+
+	if ( ( fd = openat( j->dfd, j->items[k].src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 )
+	{
+		bfm_job_copy_fail( j, &j->items[k], errno );
+		return;
+	}
+
+	while ( !bfm_job_cancelled(j)
+	     && ( len = syscall( SYS_getdents64, fd, buf, JOB_DENTS_BUF ) ) > 0 )
+	{
+		for ( pos = 0; pos < len; pos += e->d_reclen )
+		{
+			e = (struct linux_dirent64 *)( buf + pos );
+			if ( !bfm_name_validat( e->d_name, 1 ) )
+				continue;
+
+			if ( fstatat( fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+			{
+				j->keep[ j->items[k].top ] = 1;
+				bfm_job_fail( j, j->items[k].src, e->d_name, errno );
+			}
+			/* Destination inside copied tree would be copied into itself */
+			else if ( st.st_dev == j->dest_st.st_dev && st.st_ino == j->dest_st.st_ino )
+			{
+				j->keep[ j->items[k].top ] = 1;
+				bfm_job_fail( j, j->items[k].src, e->d_name, EINVAL );
+			}
+			else
+				bfm_job_item( j,
+				              bfm_job_join( j->items[k].src, e->d_name ),
+				              bfm_job_join( j->items[k].dst, e->d_name ),
+				              &st, k, j->items[k].top );
+		}
+	}
+
+	/* Tree is copied only in part, source of move is kept */
+	if ( len < 0 )
+	{
+		__atomic_store_n( &j->keep[ j->items[k].top ], 1, __ATOMIC_RELAXED );
+		bfm_job_fail( j, "", j->items[k].src, errno );
+	}
+
+	close(fd);
+}
+
+/* Free name in destination, number is put before extension */
+static char *
+bfm_job_unique ( St_job * j, const char * name )
+{
+	struct stat  st;
+	const char * dot = strrchr( name + 1, '.' );
+	size_t       stem = dot && dot[1] ? (size_t)( dot - name ) : strlen(name);
+	char       * s;
+	int          i;
+
+	if ( fstatat( j->destfd, name, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+		return strdup(name);
+
+	s = malloc( strlen(name) + 16 );
+	for ( i = 1; ; i++ )
+	{
+		sprintf( s, "%.*s (%d)%s", (int)stem, name, i, name + stem );
+		if ( fstatat( j->destfd, s, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+			return s;
+	}
+}
+
+/* Check if directory is destination or one of its parents */
+static int
+bfm_job_inside ( St_job * j, const struct stat * st )
+{
+	struct stat cur = j->dest_st;
+	struct stat up;
+	int         fd = dup( j->destfd );
+	int         up_fd;
+	int         r = 0;
+
+	while ( fd >= 0 )
+	{
+		if ( cur.st_dev == st->st_dev && cur.st_ino == st->st_ino )
+		{
+			r = 1;
+			break;
+		}
+
+		up_fd = openat( fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+		close(fd);
+		fd = up_fd;
+
+		/* Root is its own parent */
+		if ( fd < 0 || fstat( fd, &up ) < 0 || ( up.st_dev == cur.st_dev && up.st_ino == cur.st_ino ) )
+			break;
+		cur = up;
+	}
+
+	if ( fd >= 0 )
+		close(fd);
+	return r;
+}
+
+/* Rename selected name, 1 if it is done, 0 if it has to be copied */
+static int
+bfm_job_rename ( St_job * j, size_t i, const struct stat * st )
+{
+	struct stat dst;
+	int         r;
+
+	r = renameat2( j->dfd, j->names[i], j->destfd, j->targets[i],
+	               j->conflict == CONFLICT_OVERWRITE ? 0 : RENAME_NOREPLACE );
+	/* Filesystem does not support flag */
+	if ( r < 0 && errno == EINVAL && j->conflict != CONFLICT_OVERWRITE )
+	{
+		if ( fstatat( j->destfd, j->targets[i], &dst, AT_SYMLINK_NOFOLLOW ) == 0 )
+			errno = EEXIST;
+		else
+			r = renameat( j->dfd, j->names[i], j->destfd, j->targets[i] );
+	}
+
+	if ( r == 0 )
+	{
+		__atomic_add_fetch( S_ISDIR( st->st_mode ) ? &j->prog.dirs : &j->prog.files, 1, __ATOMIC_RELAXED );
+		return 1;
+	}
+
+	switch ( errno )
+	{
+		/* Different filesystem */
+		case EXDEV:
+			return 0;
+		/* Existing directory is merged */
+		case EEXIST:
+		case ENOTEMPTY:
+			if ( S_ISDIR( st->st_mode )
+			  && fstatat( j->destfd, j->targets[i], &dst, AT_SYMLINK_NOFOLLOW ) == 0
+			  && S_ISDIR( dst.st_mode ) )
+				return 0;
+			if ( j->conflict == CONFLICT_SKIP )
+			{
+				__atomic_add_fetch( &j->prog.skipped, 1, __ATOMIC_RELAXED );
+				return 1;
+			}
+			break;
+	}
+
+	bfm_job_fail( j, "", j->names[i], errno );
+	return 1;
+}
+
+/* Collect items of selected names, moves are renamed when possible */
+static void
+bfm_job_plan ( St_job * j, char * buf )
+{
+	struct stat  st;
+	struct stat  dst;
+	const char * base;
+	size_t       i;
+	uint32_t     k;
+
+	for ( i = 0; i < j->n_names && !bfm_job_cancelled(j); i++ )
+	{
+		if ( fstatat( j->dfd, j->names[i], &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+		{
+			bfm_job_fail( j, "", j->names[i], errno );
+			continue;
+		}
+
+		/* Search results are given as paths, only last part is copied */
+		base = strrchr( j->names[i], '/' );
+		base = base ? base + 1 : j->names[i];
+		j->targets[i] = j->conflict == CONFLICT_RENAME ? bfm_job_unique( j, base ) : strdup(base);
+
+		/* Directory copied into itself */
+		if ( S_ISDIR( st.st_mode ) && bfm_job_inside( j, &st ) )
+		{
+			bfm_job_fail( j, "", j->names[i], EINVAL );
+			continue;
+		}
+
+		/* Name copied onto itself */
+		if ( fstatat( j->destfd, j->targets[i], &dst, AT_SYMLINK_NOFOLLOW ) == 0
+		  && st.st_dev == dst.st_dev && st.st_ino == dst.st_ino )
+		{
+			if ( j->type == JOB_MOVE || j->conflict == CONFLICT_SKIP )
+				__atomic_add_fetch( &j->prog.skipped, 1, __ATOMIC_RELAXED );
+			else
+				bfm_job_fail( j, "", j->names[i], EEXIST );
+			continue;
+		}
+
+		if ( j->type == JOB_MOVE && bfm_job_rename( j, i, &st ) )
+			continue;
+
+		bfm_job_item( j, strdup( j->names[i] ), strdup( j->targets[i] ), &st, COPY_NONE, i );
+	}
+
+	/* Items array grows while directories are read */
+	for ( k = 0; k < j->n_items && !bfm_job_cancelled(j); k++ )
+		if ( S_ISDIR( j->items[k].mode ) && !j->items[k].skip )
+			bfm_job_plan_dir( j, k, buf );
+}
+
+/* Create destination directories in order, existing ones are merged */
+static void
+bfm_job_make_dirs ( St_job * j )
+{
+	St_copyitem * it;
+	struct stat   st;
+	size_t        k;
+
+	for ( k = 0; k < j->n_items && !bfm_job_cancelled(j); k++ )
+	{
+		it = &j->items[k];
+		if ( it->parent != COPY_NONE && j->items[ it->parent ].skip )
+		{
+			it->skip = 1;
+			continue;
+		}
+		if ( it->skip || !S_ISDIR( it->mode ) )
+			continue;
+
+		/* Final mode is set after contents are written */
+		if ( mkdirat( j->destfd, it->dst, S_IRWXU ) == 0 )
+		{
+			__atomic_add_fetch( &j->prog.dirs, 1, __ATOMIC_RELAXED );
+			continue;
+		}
+		if ( errno != EEXIST )
+			bfm_job_copy_fail( j, it, errno );
+		else if ( fstatat( j->destfd, it->dst, &st, 0 ) == 0 && S_ISDIR( st.st_mode ) )
+		{
+			/* Merged directory keeps its attributes */
+			it->mode = 0;
+		}
+		else if ( j->conflict != CONFLICT_OVERWRITE )
+			bfm_job_copy_skip( j, it );
+		else if ( unlinkat( j->destfd, it->dst, 0 ) < 0 || mkdirat( j->destfd, it->dst, S_IRWXU ) < 0 )
+			bfm_job_copy_fail( j, it, errno );
+		else
+			__atomic_add_fetch( &j->prog.dirs, 1, __ATOMIC_RELAXED );
+	}
+}
+
+/* Copy extended attributes, those not supported by destination are dropped */
+static int
+bfm_job_xattrs ( int in, int out )
+{
+	char    * list;
+	char    * name;
+	char    * val = NULL;
+	ssize_t   len;
+	ssize_t   vlen;
+	int       err = 0;
+
+	if ( ( len = flistxattr( in, NULL, 0 ) ) <= 0 )
+		return 0;
+
+	list = malloc(len);
+	if ( ( len = flistxattr( in, list, len ) ) < 0 )
+		len = 0;
+
+	for ( name = list; name < list + len && !err; name += strlen(name) + 1 )
+	{
+		if ( ( vlen = fgetxattr( in, name, NULL, 0 ) ) < 0 )
+			continue;
+		val = realloc( val, vlen + 1 );
+		if ( ( vlen = fgetxattr( in, name, val, vlen ) ) < 0 )
+			continue;
+		if ( fsetxattr( out, name, val, vlen, 0 ) < 0
+		  && errno != ENOTSUP && errno != EPERM && errno != EACCES )
+			err = errno;
+	}
+
+	free(val);
+	free(list);
+	return err;
+}
+
+/* Move file data between descriptors, fastest supported method first */
+static int
+bfm_job_transfer ( St_job * j, int in, int out, off_t size, char ** buf )
+{
+	ssize_t n;
+	ssize_t w;
+	ssize_t off;
+	int     first;
+
+	if ( !__atomic_load_n( &j->noclone, __ATOMIC_RELAXED ) )
+	{
+		/* Shared extents on same filesystem, no data is copied */
+		if ( ioctl( out, FICLONE, in ) == 0 )
+		{
+			__atomic_add_fetch( &j->prog.bytes, size, __ATOMIC_RELAXED );
+			return 0;
+		}
+		if ( errno == EXDEV || errno == EOPNOTSUPP || errno == ENOTTY )
+			__atomic_store_n( &j->noclone, 1, __ATOMIC_RELAXED );
+	}
+
+	posix_fadvise( in, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+	/* Data stays in kernel, filesystem may offload copy */
+	if ( !__atomic_load_n( &j->nocfr, __ATOMIC_RELAXED ) )
+	{
+		for ( first = 1; !bfm_job_cancelled(j); first = 0 )
+		{
+			if ( ( n = copy_file_range( in, NULL, out, NULL, COPY_CHUNK, 0 ) ) > 0 )
+				__atomic_add_fetch( &j->prog.bytes, n, __ATOMIC_RELAXED );
+			else if ( n == 0 )
+				return 0;
+			else if ( first && ( errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP ) )
+			{
+				__atomic_store_n( &j->nocfr, 1, __ATOMIC_RELAXED );
+				break;
+			}
+			else
+				return errno;
+		}
+	}
+
+	if ( !__atomic_load_n( &j->nosendfile, __ATOMIC_RELAXED ) )
+	{
+		for ( first = 1; !bfm_job_cancelled(j); first = 0 )
+		{
+			if ( ( n = sendfile( out, in, NULL, COPY_CHUNK ) ) > 0 )
+				__atomic_add_fetch( &j->prog.bytes, n, __ATOMIC_RELAXED );
+			else if ( n == 0 )
+				return 0;
+			else if ( first && ( errno == EINVAL || errno == ENOSYS ) )
+			{
+				__atomic_store_n( &j->nosendfile, 1, __ATOMIC_RELAXED );
+				break;
+			}
+			else
+				return errno;
+		}
+	}
+
+	if ( !* buf )
+		* buf = malloc(COPY_BUF);
+
+	while ( !bfm_job_cancelled(j) )
+	{
+		if ( ( n = read( in, * buf, COPY_BUF ) ) == 0 )
+			return 0;
+		if ( n < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			return errno;
+		}
+
+		for ( off = 0; off < n; off += w )
+		{
+			if ( ( w = write( out, * buf + off, n - off ) ) < 0 )
+			{
+				if ( errno == EINTR )
+				{
+					w = 0;
+					continue;
+				}
+				return errno;
+			}
+		}
+		__atomic_add_fetch( &j->prog.bytes, n, __ATOMIC_RELAXED );
+	}
+
+	return ECANCELED;
+}
+
+/* Copy regular file with its attributes */
+static int
+bfm_job_copy_reg ( St_job * j, St_copyitem * it, char ** buf )
+{
+	struct stat ist;
+	struct stat ost;
+	int         in;
+	int         out;
+	int         err = 0;
+	int         flags = O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC;
+
+	if ( ( in = openat( j->dfd, it->src, O_RDONLY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 )
+		return errno;
+
+	if ( j->conflict != CONFLICT_OVERWRITE )
+		flags |= O_EXCL;
+
+	/* Symbolic link in the way is replaced rather than followed */
+	if ( ( out = openat( j->destfd, it->dst, flags, S_IRUSR | S_IWUSR ) ) < 0
+	  && errno == ELOOP && j->conflict == CONFLICT_OVERWRITE
+	  && unlinkat( j->destfd, it->dst, 0 ) == 0 )
+		out = openat( j->destfd, it->dst, flags, S_IRUSR | S_IWUSR );
+
+	if ( out < 0 )
+	{
+		err = errno;
+		close(in);
+		return err;
+	}
+
+	/* Overwriting source with itself would truncate it */
+	if ( fstat( in, &ist ) == 0 && fstat( out, &ost ) == 0
+	  && ist.st_dev == ost.st_dev && ist.st_ino == ost.st_ino )
+	{
+		close(in);
+		close(out);
+		return EEXIST;
+	}
+
+	if ( ftruncate( out, 0 ) < 0
+	  || ( err = bfm_job_transfer( j, in, out, it->size, buf ) )
+	  || fchmod( out, it->mode & 07777 ) < 0 )
+		err = err ? err : errno;
+	else
+		err = bfm_job_xattrs( in, out );
+
+	if ( !err && futimens( out, it->times ) < 0 )
+		err = errno;
+
+	close(in);
+	if ( close(out) < 0 && !err )
+		err = errno;
+
+	/* Partial copy is not left behind */
+	if ( err )
+		unlinkat( j->destfd, it->dst, 0 );
+
+	return err;
+}
+
+/* Create symbolic link or special file, existing one is replaced on overwrite */
+static int
+bfm_job_copy_node ( St_job * j, St_copyitem * it )
+{
+	char    target[PATH_MAX];
+	ssize_t len = 0;
+	int     r;
+	int     tries;
+
+	if ( S_ISLNK( it->mode ) )
+	{
+		if ( ( len = readlinkat( j->dfd, it->src, target, sizeof(target) - 1 ) ) < 0 )
+			return errno;
+		target[len] = '\0';
+	}
+
+	for ( tries = 0; tries < 2; tries++ )
+	{
+		if ( S_ISLNK( it->mode ) )
+			r = symlinkat( target, j->destfd, it->dst );
+		else
+			r = mknodat( j->destfd, it->dst, it->mode, it->rdev );
+
+		if ( r == 0 )
+			break;
+		if ( errno != EEXIST || j->conflict != CONFLICT_OVERWRITE || tries
+		  || unlinkat( j->destfd, it->dst, 0 ) < 0 )
+			return errno;
+	}
+
+	if ( !S_ISLNK( it->mode ) && fchmodat( j->destfd, it->dst, it->mode & 07777, 0 ) < 0 )
+		return errno;
+	if ( utimensat( j->destfd, it->dst, it->times, AT_SYMLINK_NOFOLLOW ) < 0 )
+		return errno;
+
+	return 0;
+}
+
+/* Take next file from job queue until it is empty */
+static void *
+bfm_job_copy_worker ( void * p )
+{
+	St_job      * j = p;
+	St_copyitem * it;
+	char        * buf = NULL;
+	size_t        k;
+	int           err;
+
+	while ( !bfm_job_cancelled(j)
+	     && ( k = __atomic_fetch_add( &j->next, 1, __ATOMIC_RELAXED ) ) < j->n_items )
+	{
+		it = &j->items[k];
+		if ( it->skip || S_ISDIR( it->mode ) || !it->mode )
+			continue;
+		if ( it->parent != COPY_NONE && j->items[ it->parent ].skip )
+			continue;
+
+		err = S_ISREG( it->mode ) ? bfm_job_copy_reg( j, it, &buf ) : bfm_job_copy_node( j, it );
+		if ( !err )
+			__atomic_add_fetch( &j->prog.files, 1, __ATOMIC_RELAXED );
+		else if ( err == EEXIST && j->conflict == CONFLICT_SKIP )
+			bfm_job_copy_skip( j, it );
+		else if ( err != ECANCELED )
+			bfm_job_copy_fail( j, it, err );
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* Give created directories their attributes, after contents are written */
+static void
+bfm_job_finish_dirs ( St_job * j )
+{
+	St_copyitem * it;
+	size_t        k;
+	int           in;
+	int           out;
+	int           err;
+
+	for ( k = j->n_items; k-- > 0 && !bfm_job_cancelled(j); )
+	{
+		it = &j->items[k];
+		if ( it->skip || !S_ISDIR( it->mode ) )
+			continue;
+
+		in = openat( j->dfd, it->src, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+		out = openat( j->destfd, it->dst, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+
+		if ( in < 0 || out < 0 )
+			err = errno;
+		else if ( !( err = bfm_job_xattrs( in, out ) )
+		       && ( fchmod( out, it->mode & 07777 ) < 0 || futimens( out, it->times ) < 0 ) )
+			err = errno;
+
+		if ( err )
+			bfm_job_copy_fail( j, it, err );
+
+		if ( in >= 0 )
+			close(in);
+		if ( out >= 0 )
+			close(out);
+	}
+}
+
+/* Wait until no other copy runs, 0 if job was cancelled meanwhile */
+static int
+bfm_job_take_turn ( St_job * j )
+{
+	struct timespec ts;
+
+	pthread_mutex_lock( &turn_lock );
+	__atomic_store_n( &j->prog.queued, turn_busy, __ATOMIC_RELAXED );
+	while ( turn_busy && !bfm_job_cancelled(j) )
+	{
+		clock_gettime( CLOCK_REALTIME, &ts );
+		ts.tv_nsec += 100000000;
+		if ( ts.tv_nsec >= 1000000000 )
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait( &turn_cond, &turn_lock, &ts );
+	}
+	if ( !bfm_job_cancelled(j) )
+		turn_busy = 1;
+	__atomic_store_n( &j->prog.queued, 0, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &turn_lock );
+
+	/* Time is measured from start of transfer */
+	__atomic_store_n( &j->start, bfm_job_msec(), __ATOMIC_RELAXED );
+	return !bfm_job_cancelled(j);
+}
+
+static void
+bfm_job_end_turn ( void )
+{
+	pthread_mutex_lock( &turn_lock );
+	turn_busy = 0;
+	pthread_cond_signal( &turn_cond );
+	pthread_mutex_unlock( &turn_lock );
+}
+
+/* Copy or move selected names into destination */
+static void
+bfm_job_run_copy ( St_job * j )
+{
+	char   buf[JOB_DENTS_BUF];
+	size_t i;
+
+	if ( !bfm_job_take_turn(j) )
+		return;
+
+	bfm_job_plan( j, buf );
+	bfm_job_make_dirs(j);
+	bfm_job_pool( j, bfm_job_copy_worker, COPY_THREADS );
+	bfm_job_finish_dirs(j);
+
+	/* Sources of moved names are removed only when all their files arrived */
+	if ( j->type == JOB_MOVE && !bfm_job_cancelled(j) )
+	{
+		for ( i = 0; i < j->n_items && j->items[i].parent == COPY_NONE; i++ )
+			if ( !j->keep[ j->items[i].top ] )
+				bfm_job_delete_top( j, j->items[i].src );
+		bfm_job_pool( j, bfm_job_delete_worker, JOB_THREADS );
+	}
+
+	bfm_job_end_turn();
+}
+
+/* Runner thread */
+static void *
+bfm_job_main ( void * p )
+{
+	St_job * j = p;
+
+	switch ( j->type )
+	{
+		case JOB_DELETE:
+			bfm_job_run_delete(j);
+			break;
+		case JOB_COPY:
+		case JOB_MOVE:
+			bfm_job_run_copy(j);
+			break;
+	}
+
+	__atomic_store_n( &j->prog.msec, bfm_job_msec() - __atomic_load_n( &j->start, __ATOMIC_RELAXED ), __ATOMIC_RELAXED );
+	j->notify( j, j->data );
+	bfm_job_unref(j);
+	return NULL;
+}
+
+/* Start job in background, destination is NULL for delete */
+static St_job *
+bfm_job_start ( int type, const char * dir, char * const * names, size_t n, const char * dest, int conflict,
+                Job_notify notify, void * data )
+{
+	St_job       * j = calloc( 1, sizeof(St_job) );
+	pthread_t      thr;
+	pthread_attr_t attr;
+	size_t         i;
+
+	j->destfd = -1;
+	if ( ( j->dfd = open( dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0
+	  || ( dest && ( ( j->destfd = open( dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0
+	              || fstat( j->destfd, &j->dest_st ) < 0 ) ) )
+	{
+		i = errno;
+		if ( j->dfd >= 0 )
+			close( j->dfd );
+		free(j);
+		errno = i;
+		return NULL;
+	}
+
+	if ( dest )
+	{
+		j->dest = strdup(dest);
+		j->targets = calloc( n, sizeof(char *) );
+		j->keep = calloc( n, 1 );
+	}
+	j->conflict = conflict;
+
+	j->dir = strdup(dir);
+	j->names = malloc( n * sizeof(char *) );
+	for ( i = 0; i < n; i++ )
+		j->names[i] = strdup( names[i] );
+	j->n_names = n;
+
+	pthread_mutex_init( &j->lock, NULL );
+	pthread_cond_init( &j->wake, NULL );
+	j->refs   = 2;
+	j->type   = type;
+	j->notify = notify;
+	j->data   = data;
+	j->start  = bfm_job_msec();
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+	if ( pthread_create( &thr, &attr, bfm_job_main, j ) != 0 )
+	{
+		/* Run synchronously if no thread is available */
+		bfm_job_main(j);
+	}
+
+	pthread_attr_destroy(&attr);
+	return j;
+}
+
+/* Recursively delete names in directory, NULL if directory can not be opened */
+St_job *
+bfm_job_delete ( const char * dir, char * const * names, size_t n, Job_notify notify, void * data )
+{
+	return bfm_job_start( JOB_DELETE, dir, names, n, NULL, 0, notify, data );
+}
+
+/* Recursively copy names into destination, resolving existing names by ConflictPolicy */
+St_job *
+bfm_job_copy ( const char * dir, char * const * names, size_t n, const char * dest, int conflict,
+               Job_notify notify, void * data )
+{
+	return bfm_job_start( JOB_COPY, dir, names, n, dest, conflict, notify, data );
+}
+
+/* Rename names into destination, copying and deleting them across filesystems */
+St_job *
+bfm_job_move ( const char * dir, char * const * names, size_t n, const char * dest, int conflict,
+               Job_notify notify, void * data )
+{
+	return bfm_job_start( JOB_MOVE, dir, names, n, dest, conflict, notify, data );
+}
+
+/* Failed path relative to job directory and its error, NULL after last one */
+const char *
+bfm_job_error ( St_job * j, size_t i, int * err )
+{
+	const char * path = NULL;
+
+	pthread_mutex_lock( &j->lock );
+	if ( i < j->err_len )
+	{
+		path = j->err[i].path;
+		* err = j->err[i].err;
+	}
+	pthread_mutex_unlock( &j->lock );
+
+	return path;
+}
+
+/* Directory given at start */
+const char *
+bfm_job_dir ( St_job * j )
+{
+	return j->dir;
+}
+
+/* Number of names given at start */
+size_t
+bfm_job_count ( St_job * j )
+{
+	return j->n_names;
+}
+
+const char *
+bfm_job_name ( St_job * j, size_t i )
+{
+	return j->names[i];
+}
+
+/* Destination of copy or move, NULL for delete */
+const char *
+bfm_job_dest ( St_job * j )
+{
+	return j->dest;
+}
+
+/* Name of selected name in destination, NULL for delete or when it was not found */
+const char *
+bfm_job_target ( St_job * j, size_t i )
+{
+	return j->targets ? j->targets[i] : NULL;
+}
+
+/* Receiver data */
+void *
+bfm_job_data ( St_job * j )
+{
+	return j->data;
+}
+
+int
+bfm_job_type ( St_job * j )
+{
+	return j->type;
+}
+
+/* Snapshot of counters, time is valid when job is over */
+void
+bfm_job_progress ( St_job * j, St_job_progress * p )
+{
+	p->files = __atomic_load_n( &j->prog.files, __ATOMIC_RELAXED );
+	p->dirs = __atomic_load_n( &j->prog.dirs, __ATOMIC_RELAXED );
+	p->skipped = __atomic_load_n( &j->prog.skipped, __ATOMIC_RELAXED );
+	p->bytes = __atomic_load_n( &j->prog.bytes, __ATOMIC_RELAXED );
+	p->msec = __atomic_load_n( &j->prog.msec, __ATOMIC_RELAXED );
+
+	pthread_mutex_lock( &j->lock );
+	p->errors = j->prog.errors;
+	pthread_mutex_unlock( &j->lock );
+
+	p->total = __atomic_load_n( &j->prog.total, __ATOMIC_RELAXED );
+	p->queued = __atomic_load_n( &j->prog.queued, __ATOMIC_RELAXED );
+	if ( !p->msec )
+		p->msec = bfm_job_msec() - __atomic_load_n( &j->start, __ATOMIC_RELAXED );
+}
+
+/* Check if job was cancelled by owner */
+int
+bfm_job_cancelled ( St_job * j )
+{
+	return __atomic_load_n( &j->cancel, __ATOMIC_RELAXED );
+}
+
+/* Stop job as soon as possible, it is still reported as finished */
+void
+bfm_job_cancel ( St_job * j )
+{
+	__atomic_store_n( &j->cancel, 1, __ATOMIC_RELAXED );
+}
+
+void
+bfm_job_ref ( St_job * j )
+{
+	__atomic_add_fetch( &j->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_job_unref ( St_job * j )
+{
+	size_t i;
+
+	if ( __atomic_sub_fetch( &j->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	for ( i = 0; i < j->n_names; i++ )
+		free( j->names[i] );
+	for ( i = 0; i < j->err_len; i++ )
+		free( j->err[i].path );
+	for ( i = 0; i < j->n_items; i++ )
+	{
+		free( j->items[i].src );
+		free( j->items[i].dst );
+	}
+	for ( i = 0; j->targets && i < j->n_names; i++ )
+		free( j->targets[i] );
+	free( j->names );
+	free( j->dir );
+	free( j->err );
+	free( j->queue );
+	free( j->items );
+	free( j->targets );
+	free( j->keep );
+	free( j->dest );
+	if ( j->destfd >= 0 )
+		close( j->destfd );
+	close( j->dfd );
+	pthread_mutex_destroy( &j->lock );
+	pthread_cond_destroy( &j->wake );
+	free(j);
+}
@@ -0,0 +1,67 @@
+#ifndef BFM_JOB_H
+#define BFM_JOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Structs */
+/* Background file operation */
+typedef struct St_job St_job;
+
+/* Called from worker thread when job is over */
+typedef void (* Job_notify)( St_job *, void * );
+
+/* Counters of finished work */
+typedef struct
+{
+	size_t   files;
+	size_t   dirs;
+	/* Existing names left alone */
+	size_t   skipped;
+	size_t   errors;
+	/* Copied data and data planned for copying */
+	uint64_t bytes;
+	uint64_t total;
+	/* Waiting until other copy is over */
+	int      queued;
+	long     msec;
+} St_job_progress;
+
+/* Enums */
+/* Kind of operation */
+enum JobType
+{
+	JOB_DELETE,
+	JOB_COPY,
+	JOB_MOVE
+};
+
+/* Handling of names existing in destination */
+enum ConflictPolicy
+{
+	/* Existing files are kept, directories are merged */
+	CONFLICT_SKIP,
+	CONFLICT_OVERWRITE,
+	/* Copy is given free name like "name (1).ext" */
+	CONFLICT_RENAME
+};
+
+/* Protos */
+St_job *     bfm_job_copy      ( const char *, char * const *, size_t, const char *, int, Job_notify, void * );
+St_job *     bfm_job_delete    ( const char *, char * const *, size_t, Job_notify, void * );
+St_job *     bfm_job_move      ( const char *, char * const *, size_t, const char *, int, Job_notify, void * );
+const char * bfm_job_dest      ( St_job * );
+const char * bfm_job_dir       ( St_job * );
+const char * bfm_job_error     ( St_job *, size_t, int * );
+const char * bfm_job_name      ( St_job *, size_t );
+const char * bfm_job_target    ( St_job *, size_t );
+size_t       bfm_job_count     ( St_job * );
+void *       bfm_job_data      ( St_job * );
+int          bfm_job_type      ( St_job * );
+void         bfm_job_progress  ( St_job *, St_job_progress * );
+int          bfm_job_cancelled ( St_job * );
+void         bfm_job_cancel    ( St_job * );
+void         bfm_job_ref       ( St_job * );
+void         bfm_job_unref     ( St_job * );
+
+#endif
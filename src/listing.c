@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "listing.h"
+
+/* Initial number of records */
+#define LISTING_INIT  256
+/* Initial arena size */
+#define ARENA_INIT    8192
+
+/* Functions */
+/* FNV-1a string hash */
+static uint32_t
+bfm_listing_hash_str ( const char * s )
+{
+	uint32_t h = 2166136261u;
+
+	while ( * s )
+		h = ( h ^ (unsigned char)* s++ ) * 16777619u;
+
+	return h;
+}
+
+/* Put record into name index, index must have free slots */
+static void
+bfm_listing_hash_put ( St_listing * l, uint32_t i )
+{
+	uint32_t mask = l->hash_cap - 1;
+	uint32_t h = bfm_listing_hash_str( bfm_listing_name( l, i ) ) & mask;
+
+	while ( l->hash[h] != LISTING_NONE )
+		h = ( h + 1 ) & mask;
+
+	l->hash[h] = i;
+	l->hash_len++;
+}
+
+/* Rebuild name index to fit current records */
+static void
+bfm_listing_hash_build ( St_listing * l )
+{
+	uint32_t i;
+
+	l->hash_cap = 64;
+	while ( l->hash_cap < l->len * 2 + 2 )
+		l->hash_cap *= 2;
+
+	free( l->hash );
+	l->hash = malloc( l->hash_cap * sizeof(uint32_t) );
+	memset( l->hash, 0xff, l->hash_cap * sizeof(uint32_t) );
+	l->hash_len = 0;
+
+	for ( i = 0; i < l->len; i++ )
+		if ( l->rec[i].mode )
+			bfm_listing_hash_put( l, i );
+}
+
+St_listing *
+bfm_listing_new ( void )
+{
+	return calloc( 1, sizeof(St_listing) );
+}
+
+void
+bfm_listing_free ( St_listing * l )
+{
+	free( l->rec );
+	free( l->arena );
+	free( l->hash );
+	free(l);
+}
+
+/* Drop all records, keeping allocated memory */
+void
+bfm_listing_clear ( St_listing * l )
+{
+	l->len = 0;
+	l->arena_len = 0;
+	l->dead = 0;
+
+	free( l->hash );
+	l->hash = NULL;
+	l->hash_cap = l->hash_len = 0;
+}
+
+/* Memory used by listing in bytes */
+size_t
+bfm_listing_memory ( const St_listing * l )
+{
+	return sizeof(* l) + l->cap * sizeof(St_rec) + l->arena_cap + l->hash_cap * sizeof(uint32_t);
+}
+
+const char *
+bfm_listing_name ( const St_listing * l, uint32_t i )
+{
+	return l->arena + l->rec[i].name;
+}
+
+/* Name with capital ASCII letters folded, used for sorting */
+const char *
+bfm_listing_key ( const St_listing * l, uint32_t i )
+{
+	return l->arena + l->rec[i].key;
+}
+
+/* Copy string into arena, return its offset */
+static uint32_t
+bfm_listing_push ( St_listing * l, const char * s, size_t len )
+{
+	uint32_t off = l->arena_len;
+
+	if ( l->arena_len + len > l->arena_cap )
+	{
+		while ( l->arena_len + len > l->arena_cap )
+			l->arena_cap = l->arena_cap ? l->arena_cap * 2 : ARENA_INIT;
+		l->arena = realloc( l->arena, l->arena_cap );
+	}
+
+	memcpy( l->arena + off, s, len );
+	l->arena_len += len;
+	return off;
+}
+
+/* Set record fields from scanned entry */
+void
+bfm_listing_set ( St_listing * l, uint32_t i, const St_entry * e )
+{
+	l->rec[i].mode  = e->mode;
+	l->rec[i].size  = e->size;
+	l->rec[i].mtime = e->mtime;
+}
+
+/* Append entry, return its record index */
+uint32_t
+bfm_listing_add ( St_listing * l, const St_entry * e )
+{
+	St_rec     * r;
+	const char * dot;
+	char       * k;
+	size_t       len = strlen( e->name ) + 1;
+
+	if ( l->len == l->cap )
+	{
+		l->cap = l->cap ? l->cap * 2 : LISTING_INIT;
+		l->rec = realloc( l->rec, l->cap * sizeof(St_rec) );
+	}
+
+	r = &l->rec[ l->len ];
+	r->name = r->key = bfm_listing_push( l, e->name, len );
+
+	/* Folding keeps length, so extension offset is valid for key too */
+	for ( k = l->arena + r->name; * k; k++ )
+	{
+		if ( * k >= 'A' && * k <= 'Z' )
+		{
+			r->key = bfm_listing_push( l, e->name, len );
+			for ( k = l->arena + r->key; * k; k++ )
+				if ( * k >= 'A' && * k <= 'Z' )
+					* k += 'a' - 'A';
+			break;
+		}
+	}
+
+	/* Leading dot does not start extension */
+	dot = strrchr( e->name + 1, '.' );
+	r->ext = dot && dot[1] ? dot - e->name : 0;
+
+	bfm_listing_set( l, l->len, e );
+
+	/* Keep index in sync once it exists */
+	if ( l->hash )
+	{
+		if ( ( l->hash_len + 1 ) * 2 > l->hash_cap )
+		{
+			l->len++;
+			bfm_listing_hash_build(l);
+			return l->len - 1;
+		}
+
+		bfm_listing_hash_put( l, l->len );
+	}
+
+	return l->len++;
+}
+
+/* Mark record as removed, its slot is reclaimed by compaction */
+void
+bfm_listing_remove ( St_listing * l, uint32_t i )
+{
+	if ( l->rec[i].mode )
+		l->dead++;
+	l->rec[i].mode = 0;
+}
+
+/* Drop removed records with their names and rebuild name index.
+ * Map receives new index of each old record, LISTING_NONE for removed ones */
+void
+bfm_listing_compact ( St_listing * l, uint32_t * map )
+{
+	char     * arena = malloc( l->arena_cap );
+	size_t     len = 0;
+	size_t     size;
+	uint32_t   n = 0;
+	uint32_t   i;
+	St_rec     r;
+
+	for ( i = 0; i < l->len; i++ )
+	{
+		if ( !l->rec[i].mode )
+		{
+			map[i] = LISTING_NONE;
+			continue;
+		}
+
+		/* Folded key follows name only if it differs */
+		r = l->rec[i];
+		size = strlen( l->arena + r.name ) + 1;
+		memcpy( arena + len, l->arena + r.name, size );
+		r.name = len;
+		len += size;
+		if ( l->rec[i].key != l->rec[i].name )
+		{
+			memcpy( arena + len, l->arena + r.key, size );
+			r.key = len;
+			len += size;
+		}
+		else
+			r.key = r.name;
+
+		map[i] = n;
+		l->rec[ n++ ] = r;
+	}
+
+	free( l->arena );
+	l->arena = arena;
+	l->arena_len = len;
+	l->len = n;
+	l->dead = 0;
+
+	if ( l->hash )
+		bfm_listing_hash_build(l);
+}
+
+/* Find live record by name */
+uint32_t
+bfm_listing_find ( St_listing * l, const char * name )
+{
+	uint32_t mask;
+	uint32_t h;
+	uint32_t i;
+
+	if ( !l->hash )
+		bfm_listing_hash_build(l);
+
+	mask = l->hash_cap - 1;
+	for ( h = bfm_listing_hash_str(name) & mask; ( i = l->hash[h] ) != LISTING_NONE; h = ( h + 1 ) & mask )
+		if ( l->rec[i].mode && strcmp( bfm_listing_name( l, i ), name ) == 0 )
+			return i;
+
+	return LISTING_NONE;
+}
@@ -0,0 +1,58 @@
+#ifndef BFM_LISTING_H
+#define BFM_LISTING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "scan.h"
+
+/* Returned when entry is not found */
+#define LISTING_NONE ( (uint32_t)-1 )
+
+/* Structs */
+/* Fixed-size entry record */
+typedef struct
+{
+	/* Offset of name in arena */
+	uint32_t name;
+	/* Offset of casefolded name, same as name if it has no capitals */
+	uint32_t key;
+	/* Zero for removed entries */
+	uint32_t mode;
+	/* Offset of extension inside name, zero if there is none */
+	uint16_t ext;
+	int64_t  size;
+	int64_t  mtime;
+} St_rec;
+
+/* Flat array of records with names in single arena */
+typedef struct
+{
+	St_rec   * rec;
+	uint32_t   len;
+	uint32_t   cap;
+	char     * arena;
+	size_t     arena_len;
+	size_t     arena_cap;
+	/* Name index, built on first lookup */
+	uint32_t * hash;
+	uint32_t   hash_cap;
+	uint32_t   hash_len;
+	/* Removed records still holding their slots */
+	uint32_t   dead;
+} St_listing;
+
+/* Protos */
+St_listing * bfm_listing_new    ( void );
+const char * bfm_listing_key    ( const St_listing *, uint32_t );
+const char * bfm_listing_name   ( const St_listing *, uint32_t );
+size_t       bfm_listing_memory ( const St_listing * );
+uint32_t     bfm_listing_add    ( St_listing *, const St_entry * );
+uint32_t     bfm_listing_find   ( St_listing *, const char * );
+void         bfm_listing_compact ( St_listing *, uint32_t * );
+void         bfm_listing_clear  ( St_listing * );
+void         bfm_listing_free   ( St_listing * );
+void         bfm_listing_remove ( St_listing *, uint32_t );
+void         bfm_listing_set    ( St_listing *, uint32_t, const St_entry * );
+
+#endif
@@ -1,17 +1,68 @@
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <gdk/gdkkeysyms.h>
 #include <gtk/gtk.h>
 #include <pthread.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/sysmacros.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arch.h"
+#include "backend.h"
+#include "cache.h"
+#include "cmp.h"
+#include "du.h"
+#include "extra.h"
+#include "format.h"
+#include "index.h"
+#include "job.h"
+#include "mime.h"
+#include "model.h"
+#include "rename.h"
+#include "scan.h"
+#include "search.h"
+#include "thumb.h"
+#include "trace.h"
 
 #define CLEANMASK(mask) (mask & ~(GDK_MOD2_MASK))
 
+/* Time later instance has to pass its path (in s) */
+#define DAEMON_TIMEOUT 1
+
+/* Rows inserted into list per idle callback */
+#define ROWS_PER_IDLE 1024
+
+/* Changed names at once above which directory is read again, unless listing is larger */
+#define UPDATE_RESCAN 4096
+
+/* Directories waiting for read ahead, older requests are from cursor passing by */
+#define PREFETCH_QUEUE 8
+
+/* First update of persistent index after start (in s), later ones follow config */
+#define INDEX_DELAY 30
+/* Results of locate listed at most */
+#define LOCATE_MAX 100000
+
 /* Structs */
+/* Filesystem where listing does not wait for metadata */
+typedef struct
+{
+	/* Glob matched against filesystem type */
+	const gchar * type;
+	/* Time before incomplete listing is shown (in ms) */
+	gint          timeout;
+} St_fs_rule;
+
 /* Main window */
 typedef struct
 {
@@ -19,12 +70,72 @@ typedef struct
 	GtkWidget * wind;
 	GtkWidget * scrl;
 	GtkWidget * tree;
-	/* Current directory */
+	GtkWidget * stat;
+	BfmModel  * model;
+	/* Current directory, path is for display and threads, names are opened under dfd */
 	gchar     * path;
+	gint        dfd;
+	/* Archive in path shown read-only instead, dir is path inside it, "" at top */
+	St_arch   * arch;
+	gchar     * arch_file;
+	gchar     * arch_dir;
+	/* Running extractions and directories of entries extracted for opening,
+	 * removed when archive is left */
+	GList     * extracts;
+	GList     * arch_tmps;
 	/* Showing dotfiles */
 	gboolean	dtfl;
-	/* Last update */
-	time_t      mtim;
+	/* Current directory identity and modification time */
+	dev_t            dev;
+	ino_t            ino;
+	struct timespec  mtim;
+	/* Scan in progress */
+	St_scan   * scan;
+	/* Rule of slow filesystem, names come first and scan fills their metadata */
+	const St_fs_rule * slow;
+	gboolean     stat_pass;
+	/* Listing of slow filesystem takes too long, it is shown partial */
+	guint        scan_timer;
+	gboolean     partial;
+	/* Records confirmed by revalidation scan of cached listing */
+	guchar     * seen;
+	guint32      n_seen;
+	/* Cursor rest before directory under it is read ahead */
+	guint        ahead_timer;
+	/* Handler moving selection with cursor */
+	gulong       cursor_sig;
+	/* Directory watch */
+	gint         infd;
+	gint         wd;
+	guint        inwatch;
+	/* Names changed since last update and backend collecting their metadata */
+	GHashTable * chng;
+	guint        chtimer;
+	St_backend * be;
+	/* Type-ahead filter text */
+	GString    * typed;
+	/* List shows search results under path */
+	gboolean     results;
+	St_search  * search;
+	/* Comparison against other tree and state of each listed difference */
+	St_cmp     * cmp;
+	GHashTable * diff;
+	/* Running file operations and their progress display */
+	GList      * jobs;
+	guint        jobtimer;
+	/* Recursive directory sizes, one of DuMode */
+	gint         dirsize;
+	St_du      * du;
+	/* Next computation ignores remembered sizes */
+	gboolean     du_fresh;
+	/* Optional columns and their values resolved for drawn rows */
+	GtkTreeViewColumn * extra_col[N_EXTRA];
+	St_extra          * extra;
+	/* Thumbnails of drawn image rows by name, least recently drawn go first */
+	GtkTreeViewColumn * thumb_col;
+	St_thumb          * thumb;
+	GHashTable        * thumbs;
+	GQueue            * thumb_lru;
 } St_win;
 
 /* Passed argument */
@@ -49,17 +160,65 @@ typedef struct
 	const St_arg args;
 } St_key;
 
-/* Enums */
-/* Columns for listed files */
-enum ListColumns
-{
-	NAME_STR,
-	PERMS_STR,
-	SIZE_STR,
-	MTIME_STR,
-	IS_DIR
-};
+/* Kept thumbnail, link in queue of window holds name */
+typedef struct
+{
+	/* NULL if file has none */
+	GdkPixbuf * pixbuf;
+	GList     * link;
+	GQueue    * lru;
+} St_thumb_ent;
+
+/* Extraction from shown archive */
+typedef struct
+{
+	St_win  * win;
+	St_arch * a;
+	/* File opened when done and its fresh temporary directory, NULL for copy */
+	gchar   * open;
+	gchar   * tmp;
+} St_extract;
+
+/* Later instance passing its path, read as it comes */
+typedef struct
+{
+	gchar buf[PATH_MAX + 32];
+	gsize len;
+	guint watch;
+	guint timer;
+} St_client;
+
+/* Names waiting in editor of bulk rename */
+typedef struct
+{
+	St_win    * win;
+	St_rename * r;
+	gchar     * file;
+	/* Directory names were taken from, window may have left it */
+	gint        dfd;
+} St_rename_edit;
+
+/* Program opening activated files */
+typedef struct
+{
+	/* Glob matched against MIME type */
+	const gchar         * type;
+	/* Program and arguments, "%f" is replaced with file path */
+	const gchar * const * argv;
+} St_rule;
+
+/* Optional column */
+typedef struct
+{
+	/* One of ExtraColumns */
+	gint          id;
+	const gchar * title;
+	/* Text setting column width */
+	const gchar * sample;
+	gboolean      visible;
+} St_column;
 
+/* Enums */
 /* List movement */
 enum Movement
 {
@@ -71,37 +230,163 @@ enum Movement
 	PAGEDOWN
 };
 
+/* Change of whole selection */
+enum Selection
+{
+	SELECT_ALL,
+	SELECT_NONE,
+	SELECT_INVERT,
+	/* Only cursor row */
+	SELECT_TOGGLE
+};
+
 /* Globals */
 static GList * windows = NULL;
+/* Listings of directories left by windows */
+static St_cache * cache = NULL;
+/* Directories waiting for read ahead, most likely first */
+static GQueue * ahead = NULL;
+/* Persistent index of visited directories and roots, NULL if turned off */
+static St_index * index_db = NULL;
+static gchar ** index_paths = NULL;
+/* Read ahead in progress and listing it fills */
+static St_scan * ahead_scan = NULL;
+static gchar * ahead_path = NULL;
+static St_cached ahead_c;
+/* File operation labels while running, when finished and when stopped */
+static const gchar * job_labels[][3] = {
+	[JOB_DELETE] = { "deleting", "deleted", "delete stopped" },
+	[JOB_COPY]   = { "copying", "copied", "copy stopped" },
+	[JOB_MOVE]   = { "moving", "moved", "move stopped" },
+};
+/* Socket of first instance, later ones pass paths through it */
+static gchar * sock_path = NULL;
+/* Started with -d, process stays without windows */
+static gboolean resident = FALSE;
+/* Invocation time of process, later windows are warm starts */
+static gint64 cold_start = 0;
+/* Prefixes of compare results by CmpState + 1, names not in table have none */
+static const gchar * diff_marks[] = { "", "+ ", "- ", "~ " };
+/* Shown until thumbnail is loaded */
+static GdkPixbuf * thumb_wait = NULL;
+/* Keypress waiting for redraw while tracing */
+static guint64 key_start = 0;
 
 /* Protos */
-GList *  bfm_get_selected  ( St_win * );
+gchar ** bfm_get_selected  ( St_win *, guint * );
+gboolean bfm_diff_removed  ( St_win *, const gchar * );
+gchar *  bfm_job_text      ( const gchar *, const St_job_progress *, guint64 );
+gchar *  bfm_path_resolve  ( const gchar *, const gchar * );
 St_win * bfm_create_window ( void );
+const St_fs_rule * bfm_fs_rule ( gint );
 gboolean bfm_keypress      ( GtkWidget *, GdkEventKey *, St_win * );
-gchar *  bfm_col_ctr_perm  ( mode_t );
-gchar *  bfm_col_ctr_size  ( size_t );
-gchar *  bfm_col_ctr_time  ( const char *, const struct tm * );
+gboolean bfm_typed_key     ( St_win *, guint );
+gboolean bfm_drag_select   ( GtkWidget *, GdkEventMotion *, St_win * );
 gchar *  bfm_prev_dir      ( gchar * );
 gchar *  bfm_text_dialog   ( GtkWindow *, const gchar *, const gchar * );
-gint     bfm_compare       ( GtkTreeModel *, GtkTreeIter *, GtkTreeIter *, gpointer );
-gint     bfm_get_mtime     ( const gchar *, time_t * );
-int      bfm_name_validat  ( const char * s, int );
+gint     bfm_text_width    ( GtkWidget *, const gchar * );
+gint     bfm_prefetch_accept ( gint );
+gboolean bfm_du_batch      ( gpointer );
+gboolean bfm_arch_batch    ( gpointer );
+gboolean bfm_compare_batch ( gpointer );
+gboolean bfm_daemon_accept ( GIOChannel *, GIOCondition, gpointer );
+gboolean bfm_daemon_read   ( GIOChannel *, GIOCondition, gpointer );
+gboolean bfm_daemon_stall  ( gpointer );
+gboolean bfm_daemon_send   ( const gchar *, gint64 );
+gboolean bfm_extract_done  ( gpointer );
+gboolean bfm_idle_init     ( gpointer );
+gboolean bfm_index_done    ( gpointer );
+gboolean bfm_index_run     ( gpointer );
+gboolean bfm_job_done      ( gpointer );
+gboolean bfm_job_status    ( gpointer );
+gboolean bfm_prefetch_batch ( gpointer );
+gboolean bfm_prefetch_cursor ( gpointer );
+gboolean bfm_read_batch    ( gpointer );
+gboolean bfm_rename_preview ( St_win *, St_rename *, size_t );
+gboolean bfm_scan_timeout  ( gpointer );
+gboolean bfm_stat_pass     ( St_win *, gboolean );
+gboolean bfm_search_batch  ( gpointer );
+gboolean bfm_spawn         ( const gchar * const *, const gchar *, gint, GChildWatchFunc, gpointer );
+gboolean bfm_extra_batch   ( gpointer );
+gboolean bfm_thumb_batch   ( gpointer );
+gboolean bfm_trace_redraw  ( gpointer );
+gboolean bfm_update        ( gpointer );
+gboolean bfm_watch_read    ( GIOChannel *, GIOCondition, gpointer );
+gboolean bfm_window_shown  ( gpointer );
+void     bfm_apply_filter  ( St_win *, gboolean );
+void     bfm_view_attach   ( St_win *, guint32, guint32 );
+void     bfm_view_detach   ( St_win *, guint32 *, guint32 * );
 void     bfm_action        ( GtkWidget *, GtkTreePath *, GtkTreeViewColumn *, St_win * );
+void     bfm_arch_get      ( St_win *, gchar * const *, guint, const gchar *, const gchar * );
+void     bfm_arch_leave    ( St_win * );
+void     bfm_arch_notify   ( St_arch *, void * );
+void     bfm_arch_show     ( St_win *, St_arch *, const gchar *, const gchar * );
 void     bfm_bookmark      ( St_win *, const St_arg * );
+void     bfm_cell_data     ( GtkTreeViewColumn *, GtkCellRenderer *, GtkTreeModel *, GtkTreeIter *, gpointer );
+void     bfm_cell_select   ( St_win *, GtkCellRenderer *, GtkTreeModel *, GtkTreeIter * );
+void     bfm_daemon_drop   ( gpointer );
+void     bfm_daemon_listen ( void );
+void     bfm_daemon_open   ( const gchar *, gint64 );
+void     bfm_column_toggle ( St_win *, const St_arg * );
+void     bfm_compare       ( St_win *, const St_arg * );
+void     bfm_compare_notify ( St_cmp *, void * );
+void     bfm_compare_stop  ( St_win *, gboolean );
+void     bfm_copy          ( St_win *, const St_arg * );
+void     bfm_cursor_changed ( GtkTreeView *, St_win * );
 void     bfm_destroywin    ( GtkWidget *, St_win * );
 void     bfm_dir_exec      ( St_win *, const St_arg * );
+void     bfm_dirsize       ( St_win *, const St_arg * );
+void     bfm_dirsize_run   ( St_win * );
+void     bfm_du_notify     ( St_du *, void * );
+void     bfm_extract_drop  ( St_win *, St_extract * );
+void     bfm_extract_notify ( St_arch *, void * );
+void     bfm_extra_cell    ( GtkTreeViewColumn *, GtkCellRenderer *, GtkTreeModel *, GtkTreeIter *, gpointer );
+void     bfm_extra_notify  ( St_extra *, void * );
+void     bfm_job_notify    ( St_job *, void * );
+void     bfm_job_run       ( St_win *, gint, const gchar *, gint );
+void     bfm_job_stop      ( St_win *, const St_arg * );
 void     bfm_list_dir      ( St_win *, const char * );
 void     bfm_make_dir      ( St_win *, const St_arg * );
+void     bfm_merge_entry   ( St_win *, const St_entry * );
 void     bfm_move_cursor   ( St_win *, const St_arg * );
 void     bfm_new_window    ( St_win *, const St_arg * );
 void     bfm_option_toggle ( St_win *, const St_arg * );
+void     bfm_prefetch      ( const gchar * );
+void     bfm_prefetch_next ( void );
+void     bfm_prefetch_notify ( St_scan *, void * );
+void     bfm_prefetch_stop ( void );
+void     bfm_read_cached   ( St_win *, DIR *, const St_cached * );
 void     bfm_read_files    ( St_win *, DIR * );
 void     bfm_reload        ( St_win *, const St_arg * );
+void     bfm_rename        ( St_win *, const St_arg * );
+void     bfm_rename_edit   ( St_win *, St_rename *, const gchar * const * );
+void     bfm_rename_edited ( GPid, gint, gpointer );
+void     bfm_rename_run    ( St_win *, St_rename *, gint );
+void     bfm_run_rule      ( const gchar *, const gchar *, gint );
+void     bfm_read_notify   ( St_scan *, void * );
+void     bfm_read_stop     ( St_win * );
+void     bfm_index_notify  ( St_index *, void * );
+void     bfm_locate        ( St_win *, const St_arg * );
+void     bfm_search        ( St_win *, const St_arg * );
+void     bfm_select        ( St_win *, const St_arg * );
+void     bfm_select_match  ( St_win *, const St_arg * );
+void     bfm_search_notify ( St_search *, void * );
+void     bfm_search_stop   ( St_win * );
 void     bfm_remove        ( St_win *, const St_arg * );
+void     bfm_save_listing  ( St_win * );
+void     bfm_set_filter    ( St_win *, const St_arg * );
 void     bfm_set_path      ( St_win *, const St_arg * );
-void     bfm_spawn         ( const gchar * const *, const gchar * );
+void     bfm_set_sort      ( St_win *, const St_arg * );
+void     bfm_set_title     ( St_win * );
+void     bfm_thumb_cell    ( GtkTreeViewColumn *, GtkCellRenderer *, GtkTreeModel *, GtkTreeIter *, gpointer );
+void     bfm_thumb_free    ( gpointer );
+void     bfm_thumb_put     ( St_win *, const gchar *, GdkPixbuf * );
+void     bfm_thumb_notify  ( St_thumb *, void * );
+void     bfm_thumb_toggle  ( St_win *, const St_arg * );
+void     bfm_type_ahead    ( St_win *, gboolean );
+void     bfm_spawn_exit    ( GPid, gint, gpointer );
 void     bfm_dialog_text   ( GtkWidget *, GtkDialog * );
-void     bfm_update        ( St_win * );
+void     bfm_watch_dir     ( St_win * );
 
 /* Include compile-time configuration file */
 #include "config.h"
@@ -113,25 +398,155 @@ bfm_option_toggle ( St_win * cr_w, const St_arg * args )
 {
 	(void)args;
 	cr_w->dtfl = !cr_w->dtfl;
-	bfm_reload( cr_w, NULL );
+	cr_w->model->filter.dotfiles = cr_w->dtfl;
+
+	/* Hiding dotfiles only removes rows */
+	bfm_apply_filter( cr_w, !cr_w->dtfl );
 }
 
-/* Checks if filename is beginnings with dot */
-int
-bfm_name_validat ( const char * s, int dot_flag )
+/* Apply collected directory changes to list */
+gboolean
+bfm_update ( gpointer p )
+{
+	St_win         * cr_w = p;
+	GHashTableIter   hi;
+	St_entry       * ent;
+	gpointer         name;
+	gsize            i;
+	gsize            n = 0;
+	guint32          cursor;
+	guint32          top;
+	struct stat      st;
+	gboolean         dirs = FALSE;
+
+	/* Changes are applied after scan finishes */
+	if ( cr_w->scan )
+		return TRUE;
+
+	cr_w->chtimer = 0;
+
+	/* Changes around shown archive are not in list */
+	if ( cr_w->arch )
+	{
+		g_hash_table_remove_all( cr_w->chng );
+		return FALSE;
+	}
+
+	/* Directory itself is gone, reload shows its parent. Large burst is cheaper to read again */
+	if ( fstat( cr_w->dfd, &st ) < 0 || !st.st_nlink
+	  || g_hash_table_size( cr_w->chng ) > MAX( UPDATE_RESCAN, cr_w->model->n_all ) )
+	{
+		g_hash_table_remove_all( cr_w->chng );
+		bfm_reload( cr_w, NULL );
+		return FALSE;
+	}
+
+	/* Stat every changed name at once */
+	ent = g_new( St_entry, g_hash_table_size( cr_w->chng ) );
+	g_hash_table_iter_init( &hi, cr_w->chng );
+	while ( g_hash_table_iter_next( &hi, &name, NULL ) )
+	{
+		if ( bfm_name_validat( name, TRUE ) )
+		{
+			ent[n].name = name;
+			ent[n++].mode = 0;
+		}
+	}
+
+	if ( !cr_w->be )
+		cr_w->be = bfm_backend_new();
+	bfm_backend_stat( cr_w->be, cr_w->dfd, ent, n );
+
+	for ( i = 0; i < n; i++ )
+	{
+		bfm_extra_forget( cr_w->extra, ent[i].name );
+		g_hash_table_remove( cr_w->thumbs, ent[i].name );
+		if ( S_ISDIR( ent[i].mode ) )
+			dirs = TRUE;
+	}
+
+	/* Whole batch is merged and ordered once */
+	bfm_view_detach( cr_w, &cursor, &top );
+	bfm_model_update( cr_w->model, ent, n );
+	bfm_view_attach( cr_w, cursor, top );
+
+	g_free(ent);
+	g_hash_table_remove_all( cr_w->chng );
+
+	/* Changed directories show their own size again */
+	if ( dirs && cr_w->dirsize )
+		bfm_dirsize_run(cr_w);
+
+	return FALSE;
+}
+
+/* Collect events from directory watch */
+gboolean
+bfm_watch_read ( GIOChannel * ch, GIOCondition cond, gpointer p )
 {
-	return dot_flag ? ( g_strcmp0( s, "." ) != 0 && g_strcmp0( s, ".." ) != 0 ) : * s != '.';
+	St_win                     * cr_w = p;
+	const struct inotify_event * ev;
+	union
+	{
+		struct inotify_event ev;
+		char                 buf[16384];
+	} u;
+	ssize_t  len;
+	ssize_t  pos;
+	gboolean rescan = FALSE;
+	(void)ch;
+	(void)cond;
+
+	while ( ( len = read( cr_w->infd, u.buf, sizeof(u.buf) ) ) > 0 )
+	{
+		for ( pos = 0; pos < len; pos += sizeof(struct inotify_event) + ev->len )
+		{
+			ev = (const struct inotify_event *)( u.buf + pos );
+
+			/* Events were lost */
+			if ( ev->mask & IN_Q_OVERFLOW )
+				rescan = TRUE;
+			/* Event from previous directory */
+			else if ( ev->wd != cr_w->wd )
+				continue;
+			/* Directory itself is gone */
+			else if ( ev->mask & ( IN_DELETE_SELF | IN_MOVE_SELF ) )
+				rescan = TRUE;
+			else if ( ev->len )
+				g_hash_table_replace( cr_w->chng, g_strdup( ev->name ), NULL );
+		}
+	}
+
+	if ( rescan )
+	{
+		g_hash_table_remove_all( cr_w->chng );
+		bfm_reload( cr_w, NULL );
+	}
+	/* Coalesce changes arriving in short period */
+	else if ( g_hash_table_size( cr_w->chng ) && !cr_w->chtimer )
+		cr_w->chtimer = g_timeout_add( update_delay, bfm_update, cr_w );
+
+	return TRUE;
 }
 
-/* Reload wrapper with time check */
+/* Move directory watch to current path */
 void
-bfm_update ( St_win * cr_w )
+bfm_watch_dir ( St_win * cr_w )
 {
-	time_t mtime = 0;
+	if ( cr_w->infd < 0 )
+		return;
 
-	if ( cr_w->path )
-		if ( bfm_get_mtime( cr_w->path, &mtime ) != 0 || mtime > cr_w->mtim )
-			bfm_reload( cr_w, NULL );
+	if ( cr_w->wd >= 0 )
+		inotify_rm_watch( cr_w->infd, cr_w->wd );
+
+	cr_w->wd = inotify_add_watch( cr_w->infd,
+	                              cr_w->path,
+	                              IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+	                              IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF |
+	                              IN_ONLYDIR
+	                            );
+	if ( cr_w->wd < 0 )
+		g_warning( "inotify: %s", strerror(errno) );
 }
 
 /* Dialog response handler */
@@ -166,14 +581,44 @@ bfm_text_dialog ( GtkWindow * p, const gchar * title, const gchar * text )
 	return str;
 }
 
-/* Invoke external executor */
+/* Invoke external executor, done is called when it exits. FALSE if it did not start */
+gboolean
+bfm_spawn ( const gchar * const * argv, const gchar * file, gint dfd, GChildWatchFunc done, gpointer data )
+{
+	posix_spawn_file_actions_t   fa;
+	GPtrArray                  * args = g_ptr_array_new();
+	pid_t                        pid;
+	gint                         err;
+	guint64                      t = bfm_trace_begin();
+
+	/* Arguments are passed as they are, no shell is involved */
+	for ( ; * argv; argv++ )
+		g_ptr_array_add( args, (gpointer)( file && strcmp( * argv, "%f" ) == 0 ? file : * argv ) );
+	g_ptr_array_add( args, NULL );
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen( &fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0 );
+	if ( dfd >= 0 )
+		posix_spawn_file_actions_addfchdir_np( &fa, dfd );
+
+	if ( ( err = posix_spawnp( &pid, args->pdata[0], &fa, NULL, (gchar **)args->pdata, environ ) ) )
+		g_warning( "%s: %s", (gchar *)args->pdata[0], strerror(err) );
+	else
+		g_child_watch_add( pid, done ? done : bfm_spawn_exit, data );
+
+	posix_spawn_file_actions_destroy(&fa);
+	g_ptr_array_free( args, TRUE );
+	bfm_trace_end( "spawn", t );
+	return !err;
+}
+
+/* Reap launched program */
 void
-bfm_spawn ( const gchar * const * argv, const gchar * path )
+bfm_spawn_exit ( GPid pid, gint status, gpointer p )
 {
-	char exz[BUFSIZ];
-	sprintf( exz, "%s \"%s\" &", *argv, path );
-	if( system(exz) )
-		fprintf( stderr, "execution of %s\n", exz );
+	(void)p;
+	(void)status;
+	g_spawn_close_pid(pid);
 }
 
 /* Set path to required directory */
@@ -198,7 +643,12 @@ void
 bfm_reload ( St_win * cr_w, const St_arg * args )
 {
 	(void)args;
-	bfm_list_dir( cr_w, cr_w->path );
+	cr_w->du_fresh = TRUE;
+
+	if ( cr_w->arch )
+		bfm_arch_show( cr_w, cr_w->arch, cr_w->arch_file, cr_w->arch_dir );
+	else
+		bfm_list_dir( cr_w, cr_w->path );
 }
 
 /* Moving on tree element */
@@ -250,22 +700,68 @@ bfm_make_dir ( St_win * cr_w, const St_arg * args )
 
 	g_return_if_fail( cr_w->path );
 
+	/* Archive is read-only */
+	if ( cr_w->arch )
+		return;
+
 	/* Invoke dialog */
 	if ( ( path = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "make directory", NULL ) ) )
 	{
 		/* Try to create */
-		if ( mkdir( path, args->i ) == -1 )
+		if ( mkdirat( cr_w->dfd, path, args->i ) == -1 )
 			g_warning( "mkdir: %s", strerror(errno) );
 		g_free(path);
 	}
 }
 
+/* Editing keys of typed filter and Escape of running search or compare,
+ * returns TRUE if key was used */
+gboolean
+bfm_typed_key ( St_win * cr_w, guint key )
+{
+	if ( key == GDK_BackSpace && cr_w->typed->len )
+	{
+		g_string_truncate( cr_w->typed, g_utf8_prev_char( cr_w->typed->str + cr_w->typed->len ) - cr_w->typed->str );
+		bfm_type_ahead( cr_w, FALSE );
+		return TRUE;
+	}
+	if ( key != GDK_Escape )
+		return FALSE;
+
+	if ( cr_w->search )
+		bfm_search_stop(cr_w);
+	else if ( cr_w->cmp )
+		bfm_compare_stop( cr_w, FALSE );
+	else if ( cr_w->model->filter.type != FILTER_NONE )
+	{
+		g_string_truncate( cr_w->typed, 0 );
+		bfm_type_ahead( cr_w, FALSE );
+	}
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
 /* Keypress handler */
 gboolean
 bfm_keypress ( GtkWidget * w, GdkEventKey * ev, St_win * cr_w )
 {
 	(void)w;
 	unsigned i;
+	gboolean found = FALSE;
+	gunichar ch;
+
+	/* Span ends once changes are drawn */
+	if ( bfm_trace_enabled && !key_start )
+	{
+		key_start = bfm_trace_now();
+		g_idle_add_full( GDK_PRIORITY_REDRAW + 1, bfm_trace_redraw, NULL, NULL );
+	}
+
+	/* Type-ahead keys go before bindings, BackSpace widens filter while text is typed */
+	if ( !( CLEANMASK( ev->state ) & ( GDK_CONTROL_MASK | GDK_MOD1_MASK ) ) && bfm_typed_key( cr_w, ev->keyval ) )
+		return TRUE;
 
 	/* Check earch entry in array */
 	for ( i = 0; i < ( sizeof(keys) / sizeof(* keys) ); i++ )
@@ -276,358 +772,2718 @@ bfm_keypress ( GtkWidget * w, GdkEventKey * ev, St_win * cr_w )
 			CLEANMASK( ev->state ) == keys[i].mod &&
 			keys[i].func
 		)
+		{
 			/* Invoke required function */
 			keys[i].func( cr_w, &keys[i].args );
+			found = TRUE;
+		}
+	}
+
+	if ( found || CLEANMASK( ev->state ) & ( GDK_CONTROL_MASK | GDK_MOD1_MASK ) )
+		return FALSE;
+
+	/* Type-ahead narrows list with every typed character */
+	if ( ( ch = gdk_keyval_to_unicode( ev->keyval ) ) && g_unichar_isgraph(ch) )
+	{
+		g_string_append_unichar( cr_w->typed, ch );
+		bfm_type_ahead( cr_w, TRUE );
+		return TRUE;
 	}
 
 	/* Reset boolean variable */
 	return FALSE;
 }
 
-/* GTK handler for selected element */
-GList *
-bfm_get_selected ( St_win * cr_w )
+/* Show list through changed filter, keeping cursor if it stays visible */
+void
+bfm_apply_filter ( St_win * cr_w, gboolean narrow )
 {
-	GtkTreeSelection * sel = gtk_tree_view_get_selection( GTK_TREE_VIEW( cr_w->tree ) );
-	GtkTreeModel * model;
-	GtkTreeIter iter;
-	GList * lsel = gtk_tree_selection_get_selected_rows( sel, &model );
-	GList * node = lsel;
-	GList * files = NULL;
-	gchar * name;
-
-	while ( node )
-	{
-		gtk_tree_model_get_iter( model, &iter, node->data );
-		gtk_tree_model_get( model, &iter, NAME_STR, &name, -1 );
-		files = g_list_append( files, name );
-
-		node = g_list_next(node);
-	}
+	guint32 cursor;
 
-	g_list_foreach( lsel, (GFunc)gtk_tree_path_free, NULL );
-	g_list_free(lsel);
+	bfm_view_detach( cr_w, &cursor, NULL );
+	bfm_model_refilter( cr_w->model, narrow );
+	bfm_view_attach( cr_w, cursor, LISTING_NONE );
 
-	return files;
+	bfm_set_title(cr_w);
 }
 
+/* Rows are replaced at once, view is detached to skip per-row signals.
+ * Records of cursor and of top row are kept, top is skipped if it is NULL */
 void
-bfm_remove ( St_win * cr_w, const St_arg * args )
+bfm_view_detach ( St_win * cr_w, guint32 * cursor, guint32 * top )
 {
-	GList * sel = bfm_get_selected(cr_w);
-	GList * i = sel;
-	char name[BUFSIZ];
+	GtkTreeView * tree = GTK_TREE_VIEW( cr_w->tree );
+	GtkTreePath * path;
+	GtkTreePath * end;
 
-	while (i)
+	* cursor = LISTING_NONE;
+	gtk_tree_view_get_cursor( tree, &path, NULL );
+	if ( path )
 	{
-		sprintf( name, "%s/%s", cr_w->path, (char *)i->data );
-		bfm_spawn( rmcmd, name );
-
-		i = g_list_next(i);
+		* cursor = cr_w->model->rows[ gtk_tree_path_get_indices(path)[0] ];
+		gtk_tree_path_free(path);
 	}
 
-//	g_list_foreach( sel, (GFunc)gtk_tree_path_free, NULL );
-//	g_list_free(sel);
+	if ( top )
+		* top = LISTING_NONE;
+	if ( top && gtk_tree_view_get_visible_range( tree, &path, &end ) )
+	{
+		* top = cr_w->model->rows[ gtk_tree_path_get_indices(path)[0] ];
+		gtk_tree_path_free(path);
+		gtk_tree_path_free(end);
+	}
 
-	bfm_reload( cr_w, args );
+	gtk_tree_view_set_model( tree, NULL );
 }
 
-/* Get modification time */
-gint
-bfm_get_mtime ( const gchar * path, time_t * time )
+/* Show replaced rows, cursor goes to first row if its record is not shown.
+ * Putting cursor back leaves selection alone */
+void
+bfm_view_attach ( St_win * cr_w, guint32 cursor, guint32 top )
 {
-	struct stat st;
-	gint err;
+	GtkTreeView * tree = GTK_TREE_VIEW( cr_w->tree );
+	GtkTreePath * path;
+
+	gtk_tree_view_set_model( tree, GTK_TREE_MODEL( cr_w->model ) );
+	g_signal_handler_block( tree, cr_w->cursor_sig );
 
-	g_return_val_if_fail( time, 0 );
+	if ( cursor != LISTING_NONE && cr_w->model->pos[cursor] != MODEL_HIDDEN )
+		path = gtk_tree_path_new_from_indices( cr_w->model->pos[cursor], -1 );
+	else if ( cr_w->model->n_rows )
+		path = gtk_tree_path_new_first();
+	else
+		path = NULL;
 
-	if ( ( err = stat( path, &st ) ) == 0 )
-		* time = st.st_mtime;
+	if ( path )
+	{
+		gtk_tree_view_set_cursor( tree, path, NULL, FALSE );
+		gtk_tree_path_free(path);
+	}
 
-	return err;
+	if ( top != LISTING_NONE && cr_w->model->pos[top] != MODEL_HIDDEN )
+	{
+		path = gtk_tree_path_new_from_indices( cr_w->model->pos[top], -1 );
+		gtk_tree_view_scroll_to_cell( tree, path, NULL, TRUE, 0.0, 0.0 );
+		gtk_tree_path_free(path);
+	}
+	g_signal_handler_unblock( tree, cr_w->cursor_sig );
 }
 
-/* Execute path */
+/* Filter by typed text, appended text only narrows substring filter */
 void
-bfm_dir_exec ( St_win * cr_w, const St_arg * args )
+bfm_type_ahead ( St_win * cr_w, gboolean append )
 {
-	g_return_if_fail( cr_w->path && args->v );
-	bfm_spawn( args->v, cr_w->path );
+	gboolean narrow = append && cr_w->model->filter.type == FILTER_SUBSTR;
+
+	bfm_filter_set( &cr_w->model->filter, FILTER_SUBSTR, cr_w->typed->str );
+	bfm_apply_filter( cr_w, narrow );
 }
 
-/* Proper window termination */
+/* Filter names with pattern from dialog */
 void
-bfm_destroywin ( GtkWidget * w, St_win * cr_w )
+bfm_set_filter ( St_win * cr_w, const St_arg * args )
 {
-	(void)w;
-	if ( ( windows = g_list_remove( windows, cr_w ) ) == NULL )
-		gtk_main_quit();
+	gchar * str = bfm_text_dialog( GTK_WINDOW( cr_w->wind ),
+	                               args->i == FILTER_REGEX ? "regex" : "filter",
+	                               cr_w->model->filter.type == args->i ? cr_w->model->filter.pattern : NULL
+	                             );
 
-	gtk_widget_destroy( cr_w->tree );
-	gtk_widget_destroy( cr_w->scrl );
-	gtk_widget_destroy( cr_w->wind );
+	if ( !str )
+		return;
 
-	if ( cr_w->path )
-		g_free( cr_w->path );
+	g_string_truncate( cr_w->typed, 0 );
+	if ( bfm_filter_set( &cr_w->model->filter, args->i, str ) < 0 )
+		g_warning( "%s: invalid regular expression", str );
 
-	g_free(cr_w);
+	bfm_apply_filter( cr_w, FALSE );
+	g_free(str);
 }
 
-/* Return string with modification time */
-gchar *
-bfm_col_ctr_time ( const char * fmt, const struct tm * time )
+/* Window title with path and active pattern */
+void
+bfm_set_title ( St_win * cr_w )
 {
-	gchar buf[64];
-	strftime( buf, sizeof(buf), fmt, time );
-	return g_strdup(buf);
-}
+	const gchar * kind = cr_w->diff ? ( cr_w->cmp ? " (comparing)" : " (compare)" )
+	                   : cr_w->results ? ( cr_w->search ? " (searching)" : " (search)" ) : "";
+	gchar       * where;
+	gchar       * title;
+
+	/* Path inside archive follows archive file */
+	if ( cr_w->arch )
+		where = g_build_filename( cr_w->arch_file, cr_w->arch_dir, NULL );
+	else
+		where = g_strdup( cr_w->path );
 
-/* Return string with file size */
-gchar *
-bfm_col_ctr_size ( size_t size )
-{
-	/* Bytes */
-	if ( size < 1024 )
-		return g_strdup_printf( "%i B", (int)size );
-	/* KiBytes */
-	else if ( size < 1024*1024 )
-		return g_strdup_printf( "%.1f KiB", size / 1024.0 );
-	/* MiBytes */
-	else if ( size < 1024*1024*1024 )
-		return g_strdup_printf( "%.1f MiB", size / ( 1024.0 * 1024 ) );
-	/* GiBytes */
+	if ( cr_w->model->filter.type == FILTER_NONE )
+		title = g_strdup_printf( "%s%s", where, kind );
 	else
-		return g_strdup_printf( "%.1f GiB", size / ( 1024.0 * 1024 * 1024 ) );
+		title = g_strdup_printf( "%s%s [%s]", where, kind, cr_w->model->filter.pattern );
+
+	gtk_window_set_title( GTK_WINDOW( cr_w->wind ), title );
+	g_free(title);
+	g_free(where);
 }
 
-/* Return string with file permissions and type */
-gchar *
-bfm_col_ctr_perm ( mode_t mode )
+/* Names of selected rows in row order, they point into listing and stay valid until it changes.
+ * Rows only in other tree of comparison are left out. Only array is freed, NULL if nothing is selected */
+gchar **
+bfm_get_selected ( St_win * cr_w, guint * n )
 {
-	/* File type */
-	char ident;
-	switch ( mode & S_IFMT )
+	gchar   ** names;
+	guint32  * rec;
+	guint32    i;
+	guint32    k = 0;
+
+	rec = bfm_model_selected( cr_w->model, n );
+	names = g_new( gchar *, * n );
+	for ( i = 0; i < * n; i++ )
+		if ( !bfm_diff_removed( cr_w, bfm_listing_name( cr_w->model->list, rec[i] ) ) )
+			names[k++] = (gchar *)bfm_listing_name( cr_w->model->list, rec[i] );
+
+	if ( k < * n )
+		g_warning( "%s: %u selected only in other tree, skipped", cr_w->path, * n - k );
+	g_free(rec);
+
+	if ( !( * n = k ) )
 	{
-		case S_IFBLK:	ident = 'b'; break;
-		case S_IFCHR:	ident = 'c'; break;
-		case S_IFDIR:	ident = 'd'; break;
-		case S_IFIFO:	ident = 'p'; break;
-		case S_IFLNK:	ident = 'l'; break;
-		case S_IFREG:	ident = '-'; break;
-		case S_IFSOCK:	ident = 's'; break;
-		default:		ident = '?'; break;
+		g_free(names);
+		return NULL;
 	}
-
-	/* File permissions */
-	char *permstr[] = { "---", "--x", "-w-", "-wx", "r--", "r-x", "rw-", "rwx" };
-	return g_strdup_printf( "%c%s%s%s",
-	                        ident,
-	                        permstr[ ( mode >> 6 ) & 7 ],
-	                        permstr[ ( mode >> 3 ) & 7 ],
-	                        permstr[ mode & 7 ]
-	                      );
+	return names;
 }
 
-gint
-bfm_compare ( GtkTreeModel * m, GtkTreeIter * a, GtkTreeIter * b, gpointer p )
+/* Check if name is only in other tree of comparison, it can not be opened here */
+gboolean
+bfm_diff_removed ( St_win * cr_w, const gchar * name )
 {
-	(void)p;
-	gchar * name[2];
-	gint isdir[2];
-	gint ret;
-
-	gtk_tree_model_get( m, a, NAME_STR, &name[0], IS_DIR, &isdir[0], -1 );
-	gtk_tree_model_get( m, b, NAME_STR, &name[1], IS_DIR, &isdir[1], -1 );
+	return cr_w->diff && GPOINTER_TO_INT( g_hash_table_lookup( cr_w->diff, name ) ) == CMP_REMOVED + 1;
+}
 
-	if ( isdir[0] == isdir[1] )
-		ret = g_ascii_strcasecmp( name[0], name[1] );
+/* Select all rows, none, those which were not selected or toggle cursor row.
+ * Whole selection changes without touching rows, only drawn ones are painted again */
+void
+bfm_select ( St_win * cr_w, const St_arg * args )
+{
+	GtkTreePath * path;
+	GtkTreeIter   iter;
+	guint32       rec;
+	guint64       t = bfm_trace_begin();
+
+	if ( args->i == SELECT_ALL || args->i == SELECT_NONE )
+		bfm_model_select_all( cr_w->model, args->i == SELECT_ALL );
+	else if ( args->i == SELECT_INVERT )
+		bfm_model_invert( cr_w->model );
 	else
-		ret = isdir[0] ? -1 : 1;
+	{
+		gtk_tree_view_get_cursor( GTK_TREE_VIEW( cr_w->tree ), &path, NULL );
+		if (path)
+		{
+			rec = cr_w->model->rows[ gtk_tree_path_get_indices(path)[0] ];
+			bfm_model_iter( cr_w->model, rec, &iter );
+			bfm_model_select_rec( cr_w->model, rec, !bfm_model_is_selected( cr_w->model, &iter ) );
+			cr_w->model->sel_anchor = rec;
+			gtk_tree_path_free(path);
+		}
+	}
 
-	g_free(name[0]);
-	g_free(name[1]);
-	return ret;
+	gtk_widget_queue_draw( cr_w->tree );
+	bfm_trace_end( "select", t );
 }
 
-/* Go to bookmark */
+/* Add rows with names matching asked pattern to selection, or remove them */
 void
-bfm_bookmark ( St_win * cr_w, const St_arg * args )
+bfm_select_match ( St_win * cr_w, const St_arg * args )
 {
-	if ( args->i >= 0 && (unsigned)args->i < ( sizeof(bookmarks) / sizeof(* bookmarks) ) )
-		bfm_list_dir( cr_w, (char *)bookmarks[ args->i ] );
+	St_filter   f;
+	guint8    * marks;
+	gchar     * str;
+
+	if ( !( str = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), args->b ? "unselect" : "select", NULL ) ) )
+		return;
+
+	/* Hidden dotfiles have no rows anyway */
+	bfm_filter_init( &f, cr_w->dtfl );
+	if ( bfm_filter_set( &f, args->i, str ) < 0 )
+		g_warning( "%s: invalid regular expression", str );
+	else
+	{
+		marks = g_malloc( cr_w->model->list->len + 1 );
+		bfm_filter_mark( &f, cr_w->model->list, marks );
+		bfm_model_select( cr_w->model, marks, !args->b );
+		gtk_widget_queue_draw( cr_w->tree );
+		g_free(marks);
+	}
+
+	bfm_filter_free(&f);
+	g_free(str);
 }
 
-/* Wrapper for element action */
+/* Start file operation on selected files, destination is NULL for delete */
 void
-bfm_action ( GtkWidget * w, GtkTreePath * p, GtkTreeViewColumn * c, St_win * cr_w )
+bfm_job_run ( St_win * cr_w, gint type, const gchar * dest, gint conflict )
 {
-	(void)w;
-	(void)c;
+	St_job  * j;
+	gchar  ** names;
+	guint     n;
 
-	/* Declarations */
-	GtkTreeIter    iter;
-	GtkTreeModel * model = gtk_tree_view_get_model( GTK_TREE_VIEW( cr_w->tree ) );
-	gboolean       is_dir;
-	gchar          fpath[PATH_MAX];
-	gchar *        name;
+	/* Whole selection goes to one job */
+	if ( !( names = bfm_get_selected( cr_w, &n ) ) )
+		return;
 
-	/* Creating tree model */
-	gtk_tree_model_get_iter( model, &iter, p );
-	gtk_tree_model_get( model,
-	                    &iter,
-	                    NAME_STR,
-	                    &name,
-	                    IS_DIR,
-	                    &is_dir,
-	                    -1
-	                  );
+	if ( cr_w->arch )
+		j = NULL;
+	else if ( type == JOB_DELETE )
+		j = bfm_job_delete( cr_w->path, names, n, bfm_job_notify, cr_w );
+	else if ( type == JOB_COPY )
+		j = bfm_job_copy( cr_w->path, names, n, dest, conflict, bfm_job_notify, cr_w );
+	else
+		j = bfm_job_move( cr_w->path, names, n, dest, conflict, bfm_job_notify, cr_w );
 
-	if ( chdir( cr_w->path ) < 0 )
-		g_warning( "chdir: %s", strerror(errno) );
+	if (j)
+	{
+		cr_w->jobs = g_list_append( cr_w->jobs, j );
+		bfm_job_status(cr_w);
+		if ( !cr_w->jobtimer )
+			cr_w->jobtimer = g_timeout_add( job_status_delay, bfm_job_status, cr_w );
+	}
+	/* Archive is read-only, copying extracts entries without replacing files */
+	else if ( cr_w->arch )
+	{
+		if ( type == JOB_COPY )
+			bfm_arch_get( cr_w, names, n, dest, NULL );
+	}
+	else
+		g_warning( "%s: %s", dest ? dest : cr_w->path, strerror(errno) );
 
-	if ( realpath( name, fpath ) == NULL )
-		g_warning( "realpath: %s", strerror(errno) );
-	g_free(name);
+	g_free(names);
+}
 
-	if ( is_dir )
-		/* open directory */
-		bfm_list_dir( cr_w, fpath );
-	else
-		/* execute program */
-		bfm_spawn( filecmd, fpath );
+/* Recursively delete selected files in background */
+void
+bfm_remove ( St_win * cr_w, const St_arg * args )
+{
+	(void)args;
+	bfm_job_run( cr_w, JOB_DELETE, NULL, 0 );
 }
 
+/* Copy or move selected files into asked directory, other window's one is offered */
 void
-bfm_read_files ( St_win * cr_w, DIR * dir )
+bfm_copy ( St_win * cr_w, const St_arg * args )
 {
-	GtkListStore    * store = GTK_LIST_STORE( gtk_tree_view_get_model( GTK_TREE_VIEW( cr_w->tree ) ) );
-	GtkTreeIter       iter;
-	GtkTreeSortable * sortable = GTK_TREE_SORTABLE(store);
-	gchar           * mtime_str;
-	gchar           * name_str;
-	gchar           * perms_str;
-	gchar           * size_str;
-	struct dirent   * e;
-	struct stat       st;
-	struct tm       * time;
-
-	/* remove previous entries */
-	gtk_list_store_clear(store);
-
-	/* disable sort to speed up insertion */
-	gtk_tree_sortable_set_sort_column_id( sortable,
-	                                      GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
-	                                      GTK_SORT_ASCENDING
-	                                    );
-
-	while ( ( e = readdir(dir) ) )
-	{
-		if ( bfm_name_validat( e->d_name, cr_w->dtfl )
-		&& ( stat( e->d_name, &st ) == 0 )
-		   )
-		{
-			if ( S_ISDIR( st.st_mode ) )
-				name_str = g_strdup_printf( "%s/", e->d_name );
-			else
-				name_str = g_strdup( e->d_name );
+	GList * i;
+	gchar * dest = NULL;
+	gchar * path;
 
-			time = localtime( &st.st_mtime );
-			mtime_str = bfm_col_ctr_time( timefmt, time );
-			perms_str = bfm_col_ctr_perm( st.st_mode );
-			size_str = bfm_col_ctr_size( st.st_size );
+	for ( i = g_list_last(windows); i && !dest; i = g_list_previous(i) )
+		if ( i->data != cr_w && ( (St_win *)i->data )->path )
+			dest = ( (St_win *)i->data )->path;
 
-			gtk_list_store_append( store, &iter );
-			gtk_list_store_set( store,
-			                    &iter,
-			                    NAME_STR, name_str,
-			                    PERMS_STR, perms_str,
-			                    SIZE_STR, size_str,
-			                    MTIME_STR, mtime_str,
-			                    IS_DIR, S_ISDIR(st.st_mode),
-			                    -1
-			                  );
+	if ( !( dest = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), args->b ? "move to" : "copy to",
+	                                dest ? dest : cr_w->path ) ) )
+		return;
 
-			g_free(name_str);
-			g_free(mtime_str);
-			g_free(perms_str);
-			g_free(size_str);
-		}
-	}
+	path = g_path_is_absolute(dest) ? g_strdup(dest) : g_build_filename( cr_w->path, dest, NULL );
+	bfm_job_run( cr_w, args->b ? JOB_MOVE : JOB_COPY, path, args->i );
 
-	/* reenable sort */
-	gtk_tree_sortable_set_sort_column_id( sortable, NAME_STR, GTK_SORT_ASCENDING );
+	g_free(path);
+	g_free(dest);
 }
 
-/* Return directory on upper level */
-gchar *
-bfm_prev_dir ( gchar * path )
+/* Rename selected files by numbered template, regex, case or in editor */
+void
+bfm_rename ( St_win * cr_w, const St_arg * args )
 {
-	gchar * p;
-	if ( ( p = g_strrstr( path, "/" ) ) )
+	gchar     ** names;
+	gchar      * arg = NULL;
+	gchar      * repl = NULL;
+	St_rename  * r;
+	guint        n;
+
+	/* Search results are not in one directory, archive is read-only */
+	if ( !cr_w->path || cr_w->results || cr_w->arch || !( names = bfm_get_selected( cr_w, &n ) ) )
+		return;
+
+	r = bfm_rename_new( names, n );
+	g_free(names);
+
+	if ( args->i == RENAME_EDITOR )
 	{
-		if ( p == path )
-			* ( p + 1 ) = '\0';
-		else
-			* p = '\0';
+		bfm_rename_edit( cr_w, r, args->v );
+		return;
 	}
 
-	return path;
+	if ( args->i == RENAME_SEQUENCE )
+		arg = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "rename to, # is digit, * is old name", "*-##" );
+	else if ( args->i == RENAME_REGEX
+	       && ( arg = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "rename matches of regex", NULL ) )
+	       && !( repl = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "replace with, \\1 is group", NULL ) ) )
+	{
+		g_free(arg);
+		arg = NULL;
+	}
+
+	if ( !arg && ( args->i == RENAME_SEQUENCE || args->i == RENAME_REGEX ) )
+		bfm_rename_free(r);
+	else if ( bfm_rename_map( r, args->i, arg, repl ) < 0 )
+	{
+		g_warning( "%s: invalid regex", arg );
+		bfm_rename_free(r);
+	}
+	else
+		bfm_rename_run( cr_w, r, cr_w->dfd );
+
+	g_free(arg);
+	g_free(repl);
 }
 
-/* Get directory content */
+/* Write names into file and let editor change them */
 void
-bfm_list_dir ( St_win * cr_w, const char * str )
+bfm_rename_edit ( St_win * cr_w, St_rename * r, const gchar * const * argv )
 {
-	g_return_if_fail(str);
+	St_rename_edit * e;
+	gchar          * text;
+	gchar          * file = NULL;
+	gsize            len;
+	gint             fd;
 
-	if ( cr_w->path )
-		if ( chdir( cr_w->path ) == -1 )
-			g_warning( "chdir: %s", strerror(errno) );
-
-	char r_path[PATH_MAX];
-	if ( realpath( str, r_path ) == NULL )
-		g_warning( "realpath: %s", strerror(errno) );
-
-	/* Try to open directory */
-	DIR * dir;
-	if ( !( dir = opendir(r_path) ) )
+	if ( !( text = bfm_rename_text( r, &len ) ) )
 	{
-		g_warning( "%s: %s\n", r_path, g_strerror(errno) );
-
-		/* Check if in root */
-		if ( strcmp( r_path, "/" ) != 0 )
-			bfm_list_dir( cr_w, bfm_prev_dir(r_path) );
+		g_warning( "rename: names with newline can not be edited" );
+		bfm_rename_free(r);
 		return;
 	}
 
-	if ( cr_w->path )
-		g_free( cr_w->path );
+	if ( ( fd = g_file_open_tmp( "bfm-rename-XXXXXX", &file, NULL ) ) < 0
+	  || write( fd, text, len ) != (ssize_t)len )
+	{
+		g_warning( "rename: %s", strerror(errno) );
+		if ( fd >= 0 )
+		{
+			close(fd);
+			unlink(file);
+		}
+		g_free(file);
+		free(text);
+		bfm_rename_free(r);
+		return;
+	}
+	close(fd);
+	free(text);
+
+	e = g_new( St_rename_edit, 1 );
+	e->win = cr_w;
+	e->r = r;
+	e->file = file;
+	if ( ( e->dfd = fcntl( cr_w->dfd, F_DUPFD_CLOEXEC, 0 ) ) < 0 )
+	{
+		g_warning( "rename: %s", strerror(errno) );
+		bfm_rename_edited( 0, -1, e );
+		return;
+	}
 
-	/* Fill window struct */
-	cr_w->path = g_strdup(r_path);
-	if ( chdir( cr_w->path ) == -1 )
-		g_warning( "chdir: %s", strerror(errno) );
-	bfm_get_mtime( cr_w->path, &cr_w->mtim );
-	gtk_window_set_title( GTK_WINDOW( cr_w->wind ), cr_w->path );
+	if ( !bfm_spawn( argv, file, cr_w->dfd, bfm_rename_edited, e ) )
+		bfm_rename_edited( 0, -1, e );
+}
 
-	/* Invoke wrapped function */
-	bfm_read_files( cr_w, dir );
+/* Editor exited, rename to names it left */
+void
+bfm_rename_edited ( GPid pid, gint status, gpointer p )
+{
+	St_rename_edit * e = p;
+	gchar          * text = NULL;
+	gsize            len;
+
+	if ( pid )
+		g_spawn_close_pid(pid);
+
+	/* Failed editor may have left names half written */
+	if ( status != -1 && !( WIFEXITED(status) && WEXITSTATUS(status) == 0 ) )
+		g_warning( "rename: editor failed, nothing renamed" );
+	/* Window is gone, it can be checked only while it is listed */
+	else if ( status != -1 && g_list_find( windows, e->win ) && g_file_get_contents( e->file, &text, &len, NULL ) )
+	{
+		if ( bfm_rename_parse( e->r, text, len ) < 0 )
+			g_warning( "rename: lines were added or removed, nothing renamed" );
+		else
+		{
+			bfm_rename_run( e->win, e->r, e->dfd );
+			e->r = NULL;
+		}
+	}
 
-	closedir(dir);
+	if ( e->r )
+		bfm_rename_free( e->r );
+	if ( e->dfd >= 0 )
+		close( e->dfd );
+	unlink( e->file );
+	g_free( e->file );
+	g_free(text);
+	g_free(e);
 }
 
-/* Creates new main window */
-St_win *
-bfm_create_window ( void )
+/* Show planned renames, TRUE if they are confirmed */
+gboolean
+bfm_rename_preview ( St_win * cr_w, St_rename * r, size_t bad )
+{
+	static const gchar * problems[] = {
+		[RENAME_INVALID]   = "invalid name",
+		[RENAME_DUPLICATE] = "same new name",
+		[RENAME_EXISTS]    = "name exists",
+	};
+	GtkWidget * dialog = gtk_dialog_new_with_buttons( "rename", GTK_WINDOW( cr_w->wind ), GTK_DIALOG_MODAL,
+	                                                  GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, NULL );
+	GtkWidget * area = gtk_dialog_get_content_area( GTK_DIALOG(dialog) );
+	GtkWidget * scrl = gtk_scrolled_window_new( NULL, NULL );
+	GtkWidget * view = gtk_text_view_new();
+	GtkWidget * label;
+	GString   * text = g_string_new(NULL);
+	gchar     * head;
+	gsize       changed = 0;
+	gsize       i;
+	gboolean    ok;
+
+	/* Problems go first, they are what has to be looked at */
+	for ( i = 0; i < bfm_rename_count(r); i++ )
+		if ( bfm_rename_problem( r, i ) != RENAME_OK )
+			g_string_append_printf( text, "%s -> %s: %s\n", bfm_rename_from( r, i ), bfm_rename_to( r, i ),
+			                        problems[ bfm_rename_problem( r, i ) ] );
+
+	for ( i = 0; i < bfm_rename_count(r); i++ )
+	{
+		if ( bfm_rename_problem( r, i ) == RENAME_OK && strcmp( bfm_rename_from( r, i ), bfm_rename_to( r, i ) ) != 0 )
+		{
+			g_string_append_printf( text, "%s -> %s\n", bfm_rename_from( r, i ), bfm_rename_to( r, i ) );
+			changed++;
+		}
+	}
+
+	head = g_strdup_printf( "%zu of %zu names change, %zu can not", changed, bfm_rename_count(r), bad );
+	label = gtk_label_new(head);
+	gtk_misc_set_alignment( GTK_MISC(label), 0, 0.5 );
+
+	gtk_text_buffer_set_text( gtk_text_view_get_buffer( GTK_TEXT_VIEW(view) ), text->str, text->len );
+	gtk_text_view_set_editable( GTK_TEXT_VIEW(view), FALSE );
+	gtk_scrolled_window_set_policy( GTK_SCROLLED_WINDOW(scrl), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC );
+	gtk_container_add( GTK_CONTAINER(scrl), view );
+	gtk_box_pack_start( GTK_BOX(area), label, FALSE, FALSE, 0 );
+	gtk_box_pack_start( GTK_BOX(area), scrl, TRUE, TRUE, 0 );
+	gtk_window_set_default_size( GTK_WINDOW(dialog), 600, 400 );
+	gtk_widget_show_all(area);
+
+	/* Renames are done all or none */
+	if ( !bad && changed )
+		gtk_dialog_add_button( GTK_DIALOG(dialog), "Rename", GTK_RESPONSE_ACCEPT );
+
+	ok = gtk_dialog_run( GTK_DIALOG(dialog) ) == GTK_RESPONSE_ACCEPT;
+
+	gtk_widget_destroy(dialog);
+	g_string_free( text, TRUE );
+	g_free(head);
+	return ok;
+}
+
+/* Check, preview and apply planned renames in directory dfd */
+void
+bfm_rename_run ( St_win * cr_w, St_rename * r, gint dfd )
+{
+	gint64 start;
+	size_t bad = bfm_rename_check( r, dfd );
+	size_t done;
+	size_t failed;
+	size_t i;
+
+	if ( bfm_rename_preview( cr_w, r, bad ) )
+	{
+		start = g_get_monotonic_time();
+		done = bfm_rename_apply( r, dfd, &failed );
+		g_debug( "%s: %zu renamed, %zu failed in %.1f ms", cr_w->path, done, failed,
+		         ( g_get_monotonic_time() - start ) / 1000.0 );
+
+		for ( i = 0; failed && i < bfm_rename_count(r); i++ )
+			if ( bfm_rename_error( r, i ) )
+				g_warning( "%s: %s", bfm_rename_from( r, i ), strerror( bfm_rename_error( r, i ) ) );
+	}
+
+	bfm_rename_free(r);
+}
+
+/* Stop file operations started from window */
+void
+bfm_job_stop ( St_win * cr_w, const St_arg * args )
+{
+	GList * i;
+	(void)args;
+
+	for ( i = cr_w->jobs; i; i = g_list_next(i) )
+		bfm_job_cancel( i->data );
+}
+
+/* Describe progress of file operations */
+gchar *
+bfm_job_text ( const gchar * label, const St_job_progress * p, guint64 rate )
+{
+	gchar size[32];
+	gchar total[32];
+	gchar speed[32];
+
+	if ( p->queued )
+		return g_strdup_printf( "%s: queued", label );
+	if ( !p->total )
+		return g_strdup_printf( "%s: %zu files, %zu directories, %zu skipped, %zu errors",
+		                        label, p->files, p->dirs, p->skipped, p->errors );
+
+	bfm_col_ctr_size( p->bytes, size, sizeof(size) );
+	bfm_col_ctr_size( p->total, total, sizeof(total) );
+	bfm_col_ctr_size( rate, speed, sizeof(speed) );
+
+	return g_strdup_printf( "%s: %zu files, %s of %s, %s/s, %" G_GUINT64_FORMAT " s left, %zu skipped, %zu errors",
+	                        label, p->files, size, total, speed,
+	                        rate && p->total > p->bytes ? ( p->total - p->bytes ) / rate : 0,
+	                        p->skipped, p->errors );
+}
+
+/* Show progress of running file operations */
+gboolean
+bfm_job_status ( gpointer p )
+{
+	St_win          * cr_w = p;
+	St_job_progress   prog;
+	St_job_progress   sum;
+	GList           * i;
+	const gchar     * label = NULL;
+	guint64           rate = 0;
+	gchar           * text;
+
+	if ( !cr_w->jobs )
+	{
+		cr_w->jobtimer = 0;
+		return FALSE;
+	}
+
+	/* Jobs of window are shown as one */
+	memset( &sum, 0, sizeof(sum) );
+	sum.queued = TRUE;
+	for ( i = cr_w->jobs; i; i = g_list_next(i) )
+	{
+		bfm_job_progress( i->data, &prog );
+		sum.files += prog.files;
+		sum.dirs += prog.dirs;
+		sum.skipped += prog.skipped;
+		sum.errors += prog.errors;
+		sum.bytes += prog.bytes;
+		sum.total += prog.total;
+		sum.queued = sum.queued && prog.queued;
+		if ( !prog.queued && prog.msec )
+			rate += prog.bytes * 1000 / prog.msec;
+
+		if ( !label )
+			label = job_labels[ bfm_job_type( i->data ) ][0];
+		else if ( label != job_labels[ bfm_job_type( i->data ) ][0] )
+			label = "working";
+	}
+
+	text = bfm_job_text( label, &sum, rate );
+	gtk_label_set_text( GTK_LABEL( cr_w->stat ), text );
+	gtk_widget_show( cr_w->stat );
+	g_free(text);
+
+	return TRUE;
+}
+
+/* Job callback, called from worker thread */
+void
+bfm_job_notify ( St_job * j, void * data )
+{
+	(void)data;
+	bfm_job_ref(j);
+	g_idle_add( bfm_job_done, j );
+}
+
+/* Report finished job and refresh its directory */
+gboolean
+bfm_job_done ( gpointer p )
+{
+	St_job          * j = p;
+	St_win          * cr_w = bfm_job_data(j);
+	St_job_progress   prog;
+	St_win          * win;
+	GList           * w;
+	const gchar     * path;
+	gchar           * text;
+	gsize             i;
+	gint              err;
+
+	/* Window is gone, it can be checked only while it is listed */
+	if ( !g_list_find( windows, cr_w ) || !g_list_find( cr_w->jobs, j ) )
+	{
+		bfm_job_unref(j);
+		return FALSE;
+	}
+
+	bfm_job_progress( j, &prog );
+	for ( i = 0; ( path = bfm_job_error( j, i, &err ) ); i++ )
+		g_warning( "%s/%s: %s", bfm_job_dir(j), path, strerror(err) );
+	g_debug( "%s: %s %zu files, %zu directories and %" G_GUINT64_FORMAT " bytes in %ld ms",
+	         bfm_job_dir(j), job_labels[ bfm_job_type(j) ][1], prog.files, prog.dirs, prog.bytes, prog.msec );
+
+	/* Changed names are picked up without relying on directory watch */
+	for ( w = windows; w; w = g_list_next(w) )
+	{
+		win = w->data;
+		if ( !win->path )
+			continue;
+
+		for ( i = 0; i < bfm_job_count(j); i++ )
+		{
+			if ( bfm_job_type(j) != JOB_COPY && strcmp( bfm_job_dir(j), win->path ) == 0 )
+				g_hash_table_replace( win->chng, g_strdup( bfm_job_name( j, i ) ), NULL );
+			if ( bfm_job_target( j, i ) && strcmp( bfm_job_dest(j), win->path ) == 0 )
+				g_hash_table_replace( win->chng, g_strdup( bfm_job_target( j, i ) ), NULL );
+		}
+		if ( g_hash_table_size( win->chng ) && !win->chtimer )
+			win->chtimer = g_timeout_add( update_delay, bfm_update, win );
+	}
+
+	cr_w->jobs = g_list_remove( cr_w->jobs, j );
+	text = bfm_job_text( job_labels[ bfm_job_type(j) ][ bfm_job_cancelled(j) ? 2 : 1 ], &prog,
+	                     prog.msec ? prog.bytes * 1000 / prog.msec : 0 );
+	gtk_label_set_text( GTK_LABEL( cr_w->stat ), text );
+	g_free(text);
+
+	/* Release owner and callback references */
+	bfm_job_unref(j);
+	bfm_job_unref(j);
+	return FALSE;
+}
+
+/* Execute path */
+void
+bfm_dir_exec ( St_win * cr_w, const St_arg * args )
+{
+	g_return_if_fail( cr_w->path && args->v );
+	bfm_spawn( args->v, NULL, cr_w->dfd, NULL, NULL );
+}
+
+/* Proper window termination */
+void
+bfm_destroywin ( GtkWidget * w, St_win * cr_w )
+{
+	GList * job;
+	(void)w;
+	if ( ( windows = g_list_remove( windows, cr_w ) ) == NULL && !resident )
+		gtk_main_quit();
+
+	bfm_save_listing(cr_w);
+
+	/* Stop unfinished scan */
+	bfm_read_stop(cr_w);
+	if ( cr_w->search )
+		bfm_search_cancel( cr_w->search );
+	bfm_compare_stop( cr_w, TRUE );
+	if ( cr_w->du )
+		bfm_du_cancel( cr_w->du );
+	g_free( cr_w->seen );
+	bfm_arch_leave(cr_w);
+	if ( cr_w->ahead_timer )
+		g_source_remove( cr_w->ahead_timer );
+	bfm_prefetch_next();
+
+	/* Stop file operations, their results are not reported anymore */
+	if ( cr_w->jobtimer )
+		g_source_remove( cr_w->jobtimer );
+	for ( job = cr_w->jobs; job; job = g_list_next(job) )
+	{
+		bfm_job_cancel( job->data );
+		bfm_job_unref( job->data );
+	}
+	g_list_free( cr_w->jobs );
+	while ( cr_w->extracts )
+		bfm_extract_drop( cr_w, cr_w->extracts->data );
+
+	/* Stop watching directory */
+	if ( cr_w->chtimer )
+		g_source_remove( cr_w->chtimer );
+	if ( cr_w->inwatch )
+		g_source_remove( cr_w->inwatch );
+	if ( cr_w->infd >= 0 )
+		close( cr_w->infd );
+
+	g_hash_table_destroy( cr_w->chng );
+	if ( cr_w->be )
+		bfm_backend_free( cr_w->be );
+	g_string_free( cr_w->typed, TRUE );
+	bfm_extra_cancel( cr_w->extra );
+	bfm_thumb_cancel( cr_w->thumb );
+	g_hash_table_destroy( cr_w->thumbs );
+	g_queue_free( cr_w->thumb_lru );
+
+	gtk_widget_destroy( cr_w->tree );
+	g_object_unref( cr_w->model );
+	gtk_widget_destroy( cr_w->scrl );
+	gtk_widget_destroy( cr_w->stat );
+	gtk_widget_destroy( cr_w->wind );
+
+	if ( cr_w->path )
+		g_free( cr_w->path );
+	if ( cr_w->dfd >= 0 )
+		close( cr_w->dfd );
+
+	g_free(cr_w);
+}
+
+/* Format visible cell from raw record */
+void
+bfm_cell_data ( GtkTreeViewColumn * c, GtkCellRenderer * rend, GtkTreeModel * m, GtkTreeIter * iter, gpointer p )
+{
+	const St_rec * r = bfm_model_rec( BFM_MODEL(m), iter );
+	St_win       * cr_w = g_object_get_data( G_OBJECT(c), "win" );
+	gchar          buf[NAME_MAX + 4];
+	const gchar  * str = buf;
+	const gchar  * name;
+	const gchar  * mark;
+	guint64        t = bfm_trace_begin();
+
+	bfm_cell_select( cr_w, rend, m, iter );
+
+	/* Metadata is not read yet, drawn rows are stat'ed first */
+	if ( r->size == SCAN_UNKNOWN && GPOINTER_TO_INT(p) != NAME_STR )
+	{
+		if ( cr_w->stat_pass && GPOINTER_TO_INT(p) == SIZE_UINT64 )
+			bfm_scan_hint( cr_w->scan, r - BFM_MODEL(m)->list->rec );
+		g_object_set( rend, "text", "", NULL );
+		bfm_trace_end( "format", t );
+		return;
+	}
+
+	switch ( GPOINTER_TO_INT(p) )
+	{
+		case NAME_STR:
+			/* Directories are marked with trailing slash, differences like in unified diff */
+			name = bfm_model_name( BFM_MODEL(m), iter );
+			mark = cr_w && cr_w->diff ? diff_marks[ GPOINTER_TO_INT( g_hash_table_lookup( cr_w->diff, name ) ) ] : "";
+			if ( S_ISDIR( r->mode ) || * mark )
+				g_snprintf( buf, sizeof(buf), "%s%s%s", mark, name, S_ISDIR( r->mode ) ? "/" : "" );
+			else
+				str = name;
+			break;
+		case PERMS_UINT:
+			bfm_col_ctr_perm( r->mode, buf );
+			break;
+		case SIZE_UINT64:
+			bfm_col_ctr_size( r->size, buf, sizeof(buf) );
+			break;
+		case MTIME_INT64:
+			bfm_col_ctr_time( timefmt, r->mtime, buf, sizeof(buf) );
+			break;
+	}
+
+	g_object_set( rend, "text", str, NULL );
+	bfm_trace_end( "format", t );
+}
+
+/* Paint row selected in model, view itself has no selection */
+void
+bfm_cell_select ( St_win * cr_w, GtkCellRenderer * rend, GtkTreeModel * m, GtkTreeIter * iter )
+{
+	GtkStyle * style = gtk_widget_get_style( cr_w->tree );
+	gboolean   on = bfm_model_is_selected( BFM_MODEL(m), iter );
+
+	g_object_set( rend, "cell-background-gdk", &style->base[GTK_STATE_SELECTED], "cell-background-set", on, NULL );
+	if ( GTK_IS_CELL_RENDERER_TEXT(rend) )
+		g_object_set( rend, "foreground-gdk", &style->text[GTK_STATE_SELECTED], "foreground-set", on, NULL );
+}
+
+/* Format optional column, only drawn rows reach here. Values come from workers */
+void
+bfm_extra_cell ( GtkTreeViewColumn * c, GtkCellRenderer * rend, GtkTreeModel * m, GtkTreeIter * iter, gpointer p )
+{
+	const St_rec * r = bfm_model_rec( BFM_MODEL(m), iter );
+	St_win       * cr_w = g_object_get_data( G_OBJECT(c), "win" );
+	gchar          buf[32];
+
+	bfm_cell_select( cr_w, rend, m, iter );
+
+	/* Entries of archive are not on disk */
+	g_object_set( rend, "text", cr_w->arch ? "" : bfm_extra_text( cr_w->extra, cr_w->dfd, bfm_model_name( BFM_MODEL(m), iter ),
+	                                                              r->mode, r->mtime, GPOINTER_TO_INT(p), buf, sizeof(buf) ), NULL );
+}
+
+/* Resolver callback, called from worker thread */
+void
+bfm_extra_notify ( St_extra * x, void * data )
+{
+	(void)data;
+	bfm_extra_ref(x);
+	g_idle_add( bfm_extra_batch, x );
+}
+
+/* Draw rows whose optional values were resolved */
+gboolean
+bfm_extra_batch ( gpointer p )
+{
+	St_extra    * x = p;
+	St_win      * cr_w;
+	char        * buf[ROWS_PER_IDLE];
+	GtkTreeIter   iter;
+	GtkTreePath * path;
+	guint32       rec;
+	size_t        i;
+	size_t        n;
+	int           state;
+
+	/* Window is gone */
+	if ( bfm_extra_cancelled(x) )
+	{
+		bfm_extra_unref(x);
+		return FALSE;
+	}
+
+	cr_w = bfm_extra_data(x);
+	n = bfm_extra_take( x, buf, G_N_ELEMENTS(buf), &state );
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( ( rec = bfm_model_find( cr_w->model, buf[i] ) ) != LISTING_NONE
+		  && cr_w->model->pos[rec] != MODEL_HIDDEN )
+		{
+			bfm_model_iter( cr_w->model, rec, &iter );
+			path = gtk_tree_path_new_from_indices( cr_w->model->pos[rec], -1 );
+			gtk_tree_model_row_changed( GTK_TREE_MODEL( cr_w->model ), path, &iter );
+			gtk_tree_path_free(path);
+		}
+		free( buf[i] );
+	}
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	bfm_extra_unref(x);
+	return FALSE;
+}
+
+/* Show thumbnail of drawn image row, placeholder until it is loaded */
+void
+bfm_thumb_cell ( GtkTreeViewColumn * c, GtkCellRenderer * rend, GtkTreeModel * m, GtkTreeIter * iter, gpointer p )
+{
+	St_win       * cr_w = p;
+	const St_rec * r = bfm_model_rec( BFM_MODEL(m), iter );
+	const char   * name = bfm_model_name( BFM_MODEL(m), iter );
+	const char   * type;
+	St_thumb_ent * e;
+	GdkPixbuf    * pb = NULL;
+	(void)c;
+
+	bfm_cell_select( cr_w, rend, m, iter );
+
+	/* Entries of archive are not on disk */
+	if ( !cr_w->arch && S_ISREG( r->mode ) && ( type = bfm_mime_ext(name) ) && g_str_has_prefix( type, "image/" ) )
+	{
+		if ( ( e = g_hash_table_lookup( cr_w->thumbs, name ) ) )
+		{
+			/* Drawn rows stay at head of queue */
+			g_queue_unlink( e->lru, e->link );
+			g_queue_push_head_link( e->lru, e->link );
+			pb = e->pixbuf;
+		}
+		else
+		{
+			pb = thumb_wait;
+			bfm_thumb_put( cr_w, name, g_object_ref(pb) );
+			bfm_thumb_request( cr_w->thumb, cr_w->path, name, r->mtime );
+		}
+	}
+
+	g_object_set( rend, "pixbuf", pb, NULL );
+}
+
+/* Keep thumbnail of name as most recent, taking pixbuf reference.
+ * Memory is bounded, least recently drawn ones come back from disk cache */
+void
+bfm_thumb_put ( St_win * cr_w, const gchar * name, GdkPixbuf * pb )
+{
+	St_thumb_ent * e = g_hash_table_lookup( cr_w->thumbs, name );
+	gchar        * key;
+
+	if ( e )
+	{
+		if ( e->pixbuf )
+			g_object_unref( e->pixbuf );
+		e->pixbuf = pb;
+		g_queue_unlink( e->lru, e->link );
+		g_queue_push_head_link( e->lru, e->link );
+		return;
+	}
+
+	while ( g_hash_table_size( cr_w->thumbs ) >= thumb_memo && cr_w->thumb_lru->tail )
+		g_hash_table_remove( cr_w->thumbs, cr_w->thumb_lru->tail->data );
+
+	key = g_strdup(name);
+	e = g_new( St_thumb_ent, 1 );
+	e->pixbuf = pb;
+	e->lru = cr_w->thumb_lru;
+	g_queue_push_head( e->lru, key );
+	e->link = e->lru->head;
+	g_hash_table_insert( cr_w->thumbs, key, e );
+}
+
+void
+bfm_thumb_free ( gpointer p )
+{
+	St_thumb_ent * e = p;
+
+	g_queue_delete_link( e->lru, e->link );
+	if ( e->pixbuf )
+		g_object_unref( e->pixbuf );
+	g_free(e);
+}
+
+/* Thumbnail callback, called from worker thread */
+void
+bfm_thumb_notify ( St_thumb * t, void * data )
+{
+	(void)data;
+	bfm_thumb_ref(t);
+	g_idle_add( bfm_thumb_batch, t );
+}
+
+/* Put loaded thumbnails into their rows */
+gboolean
+bfm_thumb_batch ( gpointer p )
+{
+	St_thumb        * t = p;
+	St_win          * cr_w;
+	St_thumb_result   buf[ROWS_PER_IDLE];
+	St_thumb_ent    * e;
+	GtkTreeIter       iter;
+	GtkTreePath     * path;
+	guint32           rec;
+	size_t            i;
+	size_t            n;
+	int               state;
+
+	/* Window is gone */
+	if ( bfm_thumb_cancelled(t) )
+	{
+		bfm_thumb_unref(t);
+		return FALSE;
+	}
+
+	cr_w = bfm_thumb_data(t);
+	n = bfm_thumb_take( t, buf, G_N_ELEMENTS(buf), &state );
+
+	for ( i = 0; i < n; i++ )
+	{
+		/* Dropped request is repeated if row is drawn again */
+		if ( buf[i].dropped )
+		{
+			if ( ( e = g_hash_table_lookup( cr_w->thumbs, buf[i].name ) ) && e->pixbuf == thumb_wait )
+				g_hash_table_remove( cr_w->thumbs, buf[i].name );
+		}
+		else
+			bfm_thumb_put( cr_w, buf[i].name, buf[i].pixbuf );
+
+		if ( ( rec = bfm_model_find( cr_w->model, buf[i].name ) ) != LISTING_NONE
+		  && cr_w->model->pos[rec] != MODEL_HIDDEN )
+		{
+			bfm_model_iter( cr_w->model, rec, &iter );
+			path = gtk_tree_path_new_from_indices( cr_w->model->pos[rec], -1 );
+			gtk_tree_model_row_changed( GTK_TREE_MODEL( cr_w->model ), path, &iter );
+			gtk_tree_path_free(path);
+		}
+		free( buf[i].name );
+	}
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	bfm_thumb_unref(t);
+	return FALSE;
+}
+
+/* Show or hide thumbnails, hidden ones are released */
+void
+bfm_thumb_toggle ( St_win * cr_w, const St_arg * args )
+{
+	gboolean show = !gtk_tree_view_column_get_visible( cr_w->thumb_col );
+	(void)args;
+
+	gtk_tree_view_column_set_visible( cr_w->thumb_col, show );
+	if ( !show )
+	{
+		bfm_thumb_clear( cr_w->thumb );
+		g_hash_table_remove_all( cr_w->thumbs );
+	}
+}
+
+/* Show or hide optional column */
+void
+bfm_column_toggle ( St_win * cr_w, const St_arg * args )
+{
+	GtkTreeViewColumn * col;
+
+	if ( args->i >= 0 && args->i < N_EXTRA && ( col = cr_w->extra_col[ args->i ] ) )
+		gtk_tree_view_column_set_visible( col, !gtk_tree_view_column_get_visible(col) );
+}
+
+/* Sort list by given id, same id again reverses order */
+void
+bfm_set_sort ( St_win * cr_w, const St_arg * args )
+{
+	GtkTreeSortable * sortable = GTK_TREE_SORTABLE( cr_w->model );
+	GtkSortType       order = GTK_SORT_ASCENDING;
+	gint              id;
+
+	if ( gtk_tree_sortable_get_sort_column_id( sortable, &id, &order ) && id == args->i )
+		order = order == GTK_SORT_ASCENDING ? GTK_SORT_DESCENDING : GTK_SORT_ASCENDING;
+	else
+		order = GTK_SORT_ASCENDING;
+
+	gtk_tree_sortable_set_sort_column_id( sortable, args->i, order );
+}
+
+/* Go to bookmark */
+void
+bfm_bookmark ( St_win * cr_w, const St_arg * args )
+{
+	if ( args->i >= 0 && (unsigned)args->i < ( sizeof(bookmarks) / sizeof(* bookmarks) ) )
+		bfm_list_dir( cr_w, (char *)bookmarks[ args->i ] );
+}
+
+/* Run program of first rule matching type */
+void
+bfm_run_rule ( const gchar * fpath, const gchar * type, gint dfd )
+{
+	guint i;
+
+	for ( i = 0; i < G_N_ELEMENTS(rules); i++ )
+	{
+		if ( fnmatch( rules[i].type, type, 0 ) == 0 )
+		{
+			bfm_spawn( rules[i].argv, fpath, dfd, NULL, NULL );
+			break;
+		}
+	}
+}
+
+/* Wrapper for element action */
+void
+bfm_action ( GtkWidget * w, GtkTreePath * p, GtkTreeViewColumn * c, St_win * cr_w )
+{
+	(void)w;
+	(void)c;
+
+	/* Declarations */
+	GtkTreeIter    iter;
+	GtkTreeModel * model = gtk_tree_view_get_model( GTK_TREE_VIEW( cr_w->tree ) );
+	gboolean       is_dir;
+	gchar        * fpath;
+	gchar        * tmp;
+	gchar *        name;
+	const gchar  * type;
+	St_arch      * a;
+	gint64         start = g_get_monotonic_time();
+	guint          i;
+
+	/* Creating tree model */
+	gtk_tree_model_get_iter( model, &iter, p );
+	gtk_tree_model_get( model,
+	                    &iter,
+	                    NAME_STR,
+	                    &name,
+	                    IS_DIR,
+	                    &is_dir,
+	                    -1
+	                  );
+
+	/* Directory inside archive is listed from index, file is extracted first */
+	if ( cr_w->arch )
+	{
+		if ( is_dir )
+		{
+			fpath = * cr_w->arch_dir ? g_strconcat( cr_w->arch_dir, "/", name, NULL ) : g_strdup(name);
+			bfm_arch_show( cr_w, cr_w->arch, cr_w->arch_file, fpath );
+			g_free(fpath);
+		}
+		/* Each extraction gets own directory, nothing stale is opened */
+		else if ( ( tmp = g_dir_make_tmp( "bfm-XXXXXX", NULL ) ) )
+		{
+			fpath = g_build_filename( tmp, name, NULL );
+			bfm_arch_get( cr_w, &name, 1, tmp, fpath );
+			g_free(fpath);
+			g_free(tmp);
+		}
+		g_free(name);
+		return;
+	}
+
+	if ( bfm_diff_removed( cr_w, name ) )
+	{
+		g_warning( "%s: only in other tree", name );
+		g_free(name);
+		return;
+	}
+
+	if ( is_dir )
+	{
+		/* open directory */
+		bfm_list_dir( cr_w, name );
+		g_free(name);
+		return;
+	}
+
+	fpath = g_build_filename( cr_w->path, name, NULL );
+	g_free(name);
+
+	/* Archive is browsed in window, unreadable one is left to rules */
+	type = bfm_mime_type( fpath, bfm_model_rec( BFM_MODEL(model), &iter )->mode );
+	for ( i = 0; i < G_N_ELEMENTS(archives); i++ )
+	{
+		if ( fnmatch( archives[i], type, 0 ) == 0 )
+		{
+			if ( ( a = bfm_arch_open( fpath, bfm_arch_notify, cr_w ) ) )
+			{
+				bfm_arch_show( cr_w, a, fpath, "" );
+				g_free(fpath);
+				return;
+			}
+			break;
+		}
+	}
+
+	/* execute program of first matching rule */
+	bfm_run_rule( fpath, type, cr_w->dfd );
+
+	g_debug( "%s: %s, launched in %" G_GINT64_FORMAT " us", fpath, type, g_get_monotonic_time() - start );
+	g_free(fpath);
+}
+
+/* Show directory inside archive, new archive replaces listing of window */
+void
+bfm_arch_show ( St_win * cr_w, St_arch * a, const gchar * file, const gchar * dir )
+{
+	/* Arguments may be current ones */
+	gchar * f = g_strdup(file);
+	gchar * d = g_strdup(dir);
+
+	/* Keep listing of directory being left */
+	if ( !cr_w->arch )
+		bfm_save_listing(cr_w);
+	bfm_search_stop(cr_w);
+	bfm_compare_stop( cr_w, TRUE );
+	bfm_read_stop(cr_w);
+	g_free( cr_w->seen );
+	cr_w->seen = NULL;
+	if ( cr_w->du )
+		bfm_du_cancel( cr_w->du );
+	cr_w->du = NULL;
+	cr_w->results = FALSE;
+
+	if ( cr_w->arch != a )
+		bfm_arch_leave(cr_w);
+	g_free( cr_w->arch_file );
+	g_free( cr_w->arch_dir );
+	cr_w->arch = a;
+	cr_w->arch_file = f;
+	cr_w->arch_dir = d;
+
+	gtk_tree_view_set_model( GTK_TREE_VIEW( cr_w->tree ), NULL );
+	bfm_model_clear( cr_w->model );
+	gtk_tree_view_set_model( GTK_TREE_VIEW( cr_w->tree ), GTK_TREE_MODEL( cr_w->model ) );
+	g_hash_table_remove_all( cr_w->chng );
+	bfm_extra_clear( cr_w->extra );
+	bfm_thumb_clear( cr_w->thumb );
+	g_hash_table_remove_all( cr_w->thumbs );
+
+	g_string_truncate( cr_w->typed, 0 );
+	bfm_filter_set( &cr_w->model->filter, FILTER_NONE, NULL );
+	bfm_set_title(cr_w);
+
+	/* Entries come from index as it grows, complete index is walked at once */
+	bfm_model_freeze( cr_w->model );
+	bfm_arch_rewind(a);
+	bfm_arch_ref(a);
+	g_idle_add( bfm_arch_batch, a );
+}
+
+/* Stop showing archive, its index stays cached. Entries extracted for opening are removed */
+void
+bfm_arch_leave ( St_win * cr_w )
+{
+	GList * i;
+	GList * next;
+
+	for ( i = cr_w->extracts; i; i = next )
+	{
+		next = g_list_next(i);
+		if ( ( (St_extract *)i->data )->tmp )
+			bfm_extract_drop( cr_w, i->data );
+	}
+	for ( i = cr_w->arch_tmps; i; i = g_list_next(i) )
+		bfm_arch_remove( i->data );
+	g_list_free_full( cr_w->arch_tmps, g_free );
+	cr_w->arch_tmps = NULL;
+
+	if ( !cr_w->arch )
+		return;
+
+	bfm_arch_cancel( cr_w->arch );
+	g_free( cr_w->arch_file );
+	g_free( cr_w->arch_dir );
+	cr_w->arch = NULL;
+	cr_w->arch_file = cr_w->arch_dir = NULL;
+}
+
+/* Archive index callback, called from worker thread */
+void
+bfm_arch_notify ( St_arch * a, void * data )
+{
+	(void)data;
+	bfm_arch_ref(a);
+	g_idle_add( bfm_arch_batch, a );
+}
+
+/* Move indexed entries of shown directory into list */
+gboolean
+bfm_arch_batch ( gpointer p )
+{
+	St_arch     * a = p;
+	St_win      * cr_w;
+	St_entry      buf[ROWS_PER_IDLE];
+	size_t        i;
+	size_t        n;
+	size_t        errors;
+	size_t        memory;
+	long          msec;
+	int           state;
+
+	/* Window is gone or left archive */
+	if ( bfm_arch_cancelled(a) )
+	{
+		bfm_arch_unref(a);
+		return FALSE;
+	}
+
+	cr_w = bfm_arch_data(a);
+	n = bfm_arch_take( a, cr_w->arch_dir, buf, G_N_ELEMENTS(buf), &state );
+
+	for ( i = 0; i < n; i++ )
+	{
+		bfm_model_add( cr_w->model, &buf[i] );
+		free( buf[i].name );
+	}
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	/* Owner keeps reference for moving inside archive */
+	if ( state == SCAN_DONE && cr_w->model->frozen )
+	{
+		bfm_arch_stats( a, &n, &errors, &msec, &memory );
+		if ( bfm_arch_error(a) )
+			g_warning( "%s: %s", cr_w->arch_file, bfm_arch_error(a) );
+		g_debug( "%s: %zu entries indexed in %ld ms, %zu KiB", cr_w->arch_file, n, msec, memory / 1024 );
+
+		bfm_model_thaw( cr_w->model );
+	}
+
+	bfm_arch_unref(a);
+	return FALSE;
+}
+
+/* Extract names of shown archive directory into dest, file is opened when done.
+ * Dest of file to open is temporary directory owned by window */
+void
+bfm_arch_get ( St_win * cr_w, gchar * const * names, guint n, const gchar * dest, const gchar * open )
+{
+	St_extract  * x = g_new( St_extract, 1 );
+	gchar      ** paths = g_new( gchar *, n );
+	guint         i;
+
+	for ( i = 0; i < n; i++ )
+		paths[i] = * cr_w->arch_dir ? g_strconcat( cr_w->arch_dir, "/", names[i], NULL ) : g_strdup( names[i] );
+
+	x->win = cr_w;
+	x->open = g_strdup(open);
+	x->tmp = open ? g_strdup(dest) : NULL;
+	x->a = bfm_arch_extract( cr_w->arch_file, paths, n, dest, bfm_extract_notify, x );
+	cr_w->extracts = g_list_append( cr_w->extracts, x );
+	gtk_label_set_text( GTK_LABEL( cr_w->stat ), "extracting" );
+
+	while ( n )
+		g_free( paths[--n] );
+	g_free(paths);
+}
+
+/* Stop extraction, temporary directory goes away with it */
+void
+bfm_extract_drop ( St_win * cr_w, St_extract * x )
+{
+	if ( x->tmp )
+		bfm_arch_discard( x->a );
+	else
+		bfm_arch_cancel( x->a );
+
+	cr_w->extracts = g_list_remove( cr_w->extracts, x );
+	g_free( x->open );
+	g_free( x->tmp );
+	g_free(x);
+}
+
+/* Extraction callback, called from worker thread */
+void
+bfm_extract_notify ( St_arch * a, void * data )
+{
+	(void)data;
+	bfm_arch_ref(a);
+	g_idle_add( bfm_extract_done, a );
+}
+
+/* Report finished extraction and open extracted file */
+gboolean
+bfm_extract_done ( gpointer p )
+{
+	St_arch     * a = p;
+	St_extract  * x;
+	St_win      * cr_w;
+	struct stat   st;
+	gchar       * text;
+	size_t        n;
+	size_t        errors;
+	size_t        memory;
+	long          msec;
+
+	/* Window is gone */
+	if ( bfm_arch_cancelled(a) )
+	{
+		bfm_arch_unref(a);
+		return FALSE;
+	}
+
+	x = bfm_arch_data(a);
+	cr_w = x->win;
+	bfm_arch_stats( a, &n, &errors, &msec, &memory );
+	if ( errors )
+		g_warning( "%s: %zu not extracted, %s", cr_w->arch_file ? cr_w->arch_file : cr_w->path, errors, bfm_arch_error(a) );
+	g_debug( "extracted %zu entries in %ld ms", n, msec );
+
+	if ( x->open && stat( x->open, &st ) == 0 )
+		bfm_run_rule( x->open, bfm_mime_type( x->open, st.st_mode ), -1 );
+
+	text = g_strdup_printf( "extracted %zu, %zu failed", n, errors );
+	gtk_label_set_text( GTK_LABEL( cr_w->stat ), text );
+	g_free(text);
+
+	cr_w->extracts = g_list_remove( cr_w->extracts, x );
+	if ( x->tmp )
+		cr_w->arch_tmps = g_list_prepend( cr_w->arch_tmps, x->tmp );
+	g_free( x->open );
+	g_free(x);
+
+	/* Release owner and callback references */
+	bfm_arch_unref(a);
+	bfm_arch_unref(a);
+	return FALSE;
+}
+
+/* Work left after first window is shown */
+gboolean
+bfm_idle_init ( gpointer p )
+{
+	guint i;
+	(void)p;
+
+	/* First activation does not wait for content database */
+	if ( bfm_mime_init() < 0 )
+		g_warning( "libmagic: can not load database" );
+
+	/* First bookmark is read first */
+	for ( i = G_N_ELEMENTS(bookmarks); i > 0; i-- )
+		bfm_prefetch( bookmarks[ i - 1 ] );
+
+	return FALSE;
+}
+
+/* Update persistent index in background, first update rearms timer for later ones */
+gboolean
+bfm_index_run ( gpointer p )
+{
+	if ( !bfm_index_update( index_db, (const char * const *)index_paths, bfm_index_notify, NULL ) )
+		g_debug( "index: previous update is still running" );
+
+	if ( p )
+		g_timeout_add_seconds( index_interval, bfm_index_run, NULL );
+
+	return !p;
+}
+
+/* Index callback, called from worker thread */
+void
+bfm_index_notify ( St_index * x, void * data )
+{
+	(void)x;
+	(void)data;
+	g_idle_add( bfm_index_done, NULL );
+}
+
+gboolean
+bfm_index_done ( gpointer p )
+{
+	St_index_stats s;
+	(void)p;
+
+	bfm_index_stats( index_db, &s );
+	g_debug( "index: %zu directories, %zu entries, %zu read again, %zu gone in %ld ms, %zu KiB",
+	         s.dirs, s.entries, s.reread, s.dropped, s.msec, s.size / 1024 );
+
+	return FALSE;
+}
+
+/* Apply entry from revalidation scan to cached list */
+void
+bfm_merge_entry ( St_win * cr_w, const St_entry * e )
+{
+	const St_rec * r;
+	guint32        rec = bfm_model_find( cr_w->model, e->name );
+
+	if ( rec == LISTING_NONE )
+	{
+		bfm_model_add( cr_w->model, e );
+		return;
+	}
+
+	/* Records added during revalidation are not tracked */
+	if ( rec < cr_w->n_seen )
+		cr_w->seen[rec] = TRUE;
+
+	/* Names of slow filesystem come without metadata, cached one is shown until stat pass */
+	r = &cr_w->model->list->rec[rec];
+	if ( e->size == SCAN_UNKNOWN )
+	{
+		if ( ( r->mode ^ e->mode ) & S_IFMT )
+			bfm_model_set( cr_w->model, rec, e );
+		return;
+	}
+	if ( r->mode != e->mode || r->mtime != e->mtime
+	  || ( r->size != e->size && !( cr_w->dirsize && S_ISDIR( e->mode ) ) ) )
+		bfm_model_set( cr_w->model, rec, e );
+}
+
+/* Search under current directory, results are listed in new window */
+void
+bfm_search ( St_win * cr_w, const St_arg * args )
+{
+	St_search_opts   o;
+	St_win         * new;
+	gchar          * pattern;
+	gchar          * content = NULL;
+
+	if ( !( pattern = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "search", NULL ) ) )
+		return;
+	if ( args->b && !( content = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "containing", NULL ) ) )
+	{
+		g_free(pattern);
+		return;
+	}
+
+	o.type = args->i;
+	o.pattern = pattern;
+	o.content = content;
+	o.dotfiles = cr_w->dtfl;
+	o.xdev = search_xdev;
+
+	new = bfm_create_window();
+	windows = g_list_append( windows, new );
+	new->path = g_strdup( cr_w->path );
+	new->dfd = fcntl( cr_w->dfd, F_DUPFD_CLOEXEC, 0 );
+	new->results = TRUE;
+	new->dtfl = new->model->filter.dotfiles = cr_w->dtfl;
+
+	/* Results are sorted when search is done */
+	bfm_model_freeze( new->model );
+	if ( !( new->search = bfm_search_start( new->path, &o, bfm_search_notify, new ) ) )
+		g_warning( "%s: can not search for %s", new->path, pattern );
+	bfm_set_title(new);
+
+	g_free(pattern);
+	g_free(content);
+}
+
+/* Look names up in persistent index, results are listed in new window */
+void
+bfm_locate ( St_win * cr_w, const St_arg * args )
+{
+	St_filter   f;
+	St_entry  * res;
+	St_win    * new;
+	gchar     * pattern;
+	size_t      i;
+	size_t      n;
+	guint64     t;
+	gint64      start;
+
+	if ( !index_db || !( pattern = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "locate", NULL ) ) )
+		return;
+
+	bfm_filter_init( &f, cr_w->dtfl );
+	if ( !* pattern || bfm_filter_set( &f, args->i, pattern ) < 0 )
+	{
+		g_warning( "%s: invalid pattern", pattern );
+		bfm_filter_free(&f);
+		g_free(pattern);
+		return;
+	}
+
+	start = g_get_monotonic_time();
+	t = bfm_trace_begin();
+	res = bfm_index_locate( index_db, &f, LOCATE_MAX, &n );
+	bfm_trace_end( "locate", t );
+	g_debug( "locate %s: %zu results in %.1f ms", pattern, n, ( g_get_monotonic_time() - start ) / 1000.0 );
+
+	/* Results are paths under root */
+	new = bfm_create_window();
+	windows = g_list_append( windows, new );
+	new->path = g_strdup("/");
+	new->dfd = open( "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	new->results = TRUE;
+	new->dtfl = new->model->filter.dotfiles = cr_w->dtfl;
+
+	bfm_model_freeze( new->model );
+	for ( i = 0; i < n; i++ )
+	{
+		bfm_model_add( new->model, &res[i] );
+		free( res[i].name );
+	}
+	bfm_model_thaw( new->model );
+	bfm_set_title(new);
+
+	free(res);
+	bfm_filter_free(&f);
+	g_free(pattern);
+}
+
+/* Stop unfinished search, found results stay */
+void
+bfm_search_stop ( St_win * cr_w )
+{
+	if ( !cr_w->search )
+		return;
+
+	bfm_search_cancel( cr_w->search );
+	cr_w->search = NULL;
+	bfm_model_thaw( cr_w->model );
+	bfm_set_title(cr_w);
+}
+
+/* Search callback, called from worker thread */
+void
+bfm_search_notify ( St_search * s, void * data )
+{
+	(void)data;
+	bfm_search_ref(s);
+	g_idle_add( bfm_search_batch, s );
+}
+
+/* Move search results into list */
+gboolean
+bfm_search_batch ( gpointer p )
+{
+	St_search * s = p;
+	St_win    * cr_w;
+	St_entry    buf[ROWS_PER_IDLE];
+	size_t      i;
+	size_t      n;
+	size_t      dirs;
+	long        msec;
+	int         state;
+
+	/* Window is gone or search was stopped */
+	if ( bfm_search_cancelled(s) )
+	{
+		bfm_search_unref(s);
+		return FALSE;
+	}
+
+	cr_w = bfm_search_data(s);
+	n = bfm_search_take( s, buf, G_N_ELEMENTS(buf), &state );
+
+	for ( i = 0; i < n; i++ )
+	{
+		bfm_model_add( cr_w->model, &buf[i] );
+		free( buf[i].name );
+	}
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	if ( state == SCAN_DONE )
+	{
+		bfm_search_stats( s, &n, &dirs, &msec );
+		g_debug( "%s: %zu results in %zu directories in %ld ms", cr_w->path, n, dirs, msec );
+
+		bfm_model_thaw( cr_w->model );
+
+		/* Release owner reference */
+		cr_w->search = NULL;
+		bfm_search_unref(s);
+		bfm_set_title(cr_w);
+	}
+
+	bfm_search_unref(s);
+	return FALSE;
+}
+
+/* Compare tree of window against tree of other window, or entered path if there is none.
+ * Differences are listed in new window, marked + if added here, - if removed and ~ if changed */
+void
+bfm_compare ( St_win * cr_w, const St_arg * args )
+{
+	St_win * other = NULL;
+	St_win * new;
+	GList  * w;
+	gchar  * str;
+	gchar  * old;
+	(void)args;
+
+	if ( !cr_w->path || cr_w->results || cr_w->arch )
+		return;
+
+	for ( w = windows; w && !other; w = g_list_next(w) )
+		if ( w->data != cr_w && ( (St_win *)w->data )->path && !( (St_win *)w->data )->results && !( (St_win *)w->data )->arch )
+			other = w->data;
+
+	if ( other )
+		old = g_strdup( other->path );
+	else if ( ( str = bfm_text_dialog( GTK_WINDOW( cr_w->wind ), "compare with", cr_w->path ) ) )
+	{
+		old = bfm_path_resolve( cr_w->path, str );
+		g_free(str);
+	}
+	else
+		return;
+
+	new = bfm_create_window();
+	windows = g_list_append( windows, new );
+	new->path = g_strdup( cr_w->path );
+	new->dfd = fcntl( cr_w->dfd, F_DUPFD_CLOEXEC, 0 );
+	new->results = TRUE;
+	new->diff = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+
+	/* Differences in dotfiles count too, results are sorted when done */
+	new->dtfl = new->model->filter.dotfiles = TRUE;
+	bfm_model_freeze( new->model );
+	if ( ( new->cmp = bfm_cmp_start( old, new->path, bfm_compare_notify, new ) ) )
+		bfm_set_title(new);
+	/* Empty window would wait for differences forever */
+	else
+	{
+		g_warning( "%s: can not compare with %s", new->path, old );
+		gtk_widget_destroy( new->wind );
+	}
+
+	g_free(old);
+}
+
+/* Stop unfinished comparison, found differences stay unless they are cleared */
+void
+bfm_compare_stop ( St_win * cr_w, gboolean clear )
+{
+	if ( cr_w->cmp )
+	{
+		bfm_cmp_cancel( cr_w->cmp );
+		cr_w->cmp = NULL;
+		bfm_model_thaw( cr_w->model );
+		bfm_set_title(cr_w);
+	}
+
+	if ( clear && cr_w->diff )
+	{
+		g_hash_table_destroy( cr_w->diff );
+		cr_w->diff = NULL;
+	}
+}
+
+/* Compare callback, called from worker thread */
+void
+bfm_compare_notify ( St_cmp * c, void * data )
+{
+	(void)data;
+	bfm_cmp_ref(c);
+	g_idle_add( bfm_compare_batch, c );
+}
+
+/* Move differences into list */
+gboolean
+bfm_compare_batch ( gpointer p )
+{
+	St_cmp       * c = p;
+	St_win       * cr_w;
+	St_cmp_entry   buf[ROWS_PER_IDLE];
+	St_entry       e;
+	St_cmp_stats   s;
+	size_t         i;
+	size_t         n;
+	int            state;
+
+	/* Window is gone or comparison was stopped */
+	if ( bfm_cmp_cancelled(c) )
+	{
+		bfm_cmp_unref(c);
+		return FALSE;
+	}
+
+	cr_w = bfm_cmp_data(c);
+	n = bfm_cmp_take( c, buf, G_N_ELEMENTS(buf), &state );
+
+	/* Names are kept by table of states */
+	for ( i = 0; i < n; i++ )
+	{
+		e.name  = buf[i].name;
+		e.mode  = buf[i].mode;
+		e.size  = buf[i].size;
+		e.mtime = buf[i].mtime;
+		bfm_model_add( cr_w->model, &e );
+		g_hash_table_insert( cr_w->diff, buf[i].name, GINT_TO_POINTER( buf[i].state + 1 ) );
+	}
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	if ( state == SCAN_DONE )
+	{
+		bfm_cmp_stats( c, &s );
+		g_debug( "%s: %u differences, %zu directories, %zu files, %zu hashed (%zu cached, %" G_GUINT64_FORMAT " KiB read) in %ld ms",
+		         cr_w->path, g_hash_table_size( cr_w->diff ), s.dirs, s.files, s.hashed, s.hits, s.bytes / 1024, s.msec );
+
+		bfm_model_thaw( cr_w->model );
+
+		/* Release owner reference */
+		cr_w->cmp = NULL;
+		bfm_cmp_unref(c);
+		bfm_set_title(cr_w);
+	}
+
+	bfm_cmp_unref(c);
+	return FALSE;
+}
+
+/* End keypress span after redraw */
+gboolean
+bfm_trace_redraw ( gpointer p )
+{
+	(void)p;
+	bfm_trace_end( "keypress", key_start );
+	key_start = 0;
+	return FALSE;
+}
+
+/* Scanner callback, called from worker thread */
+void
+bfm_read_notify ( St_scan * sc, void * data )
+{
+	(void)data;
+	bfm_scan_ref(sc);
+	g_idle_add( bfm_read_batch, sc );
+}
+
+/* Move scanned entries into list store */
+gboolean
+bfm_read_batch ( gpointer p )
+{
+	St_scan         * sc = p;
+	St_win          * cr_w;
+	St_entry          buf[ROWS_PER_IDLE];
+	size_t            i;
+	size_t            n;
+	long              msec;
+	guint32           rec;
+	int               state;
+	gboolean          cached;
+	guint64           t;
+
+	/* Window is gone or navigated away */
+	if ( bfm_scan_cancelled(sc) )
+	{
+		bfm_scan_unref(sc);
+		return FALSE;
+	}
+
+	cr_w = bfm_scan_data(sc);
+	n = bfm_scan_take( sc, buf, G_N_ELEMENTS(buf), &state );
+
+	t = bfm_trace_begin();
+	for ( i = 0; i < n; i++ )
+	{
+		/* Revalidating cached listing or filling metadata of listed names */
+		if ( cr_w->seen )
+			bfm_merge_entry( cr_w, &buf[i] );
+		else if ( cr_w->stat_pass )
+		{
+			if ( ( rec = bfm_model_find( cr_w->model, buf[i].name ) ) != LISTING_NONE )
+				bfm_model_set( cr_w->model, rec, &buf[i] );
+		}
+		else
+			bfm_model_add( cr_w->model, &buf[i] );
+		free( buf[i].name );
+	}
+	bfm_trace_end( "insert", t );
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	if ( state == SCAN_DONE )
+	{
+		bfm_scan_stats( sc, &n, &msec );
+		g_debug( "%s: %zu entries in %ld ms (%s)", cr_w->path, n, msec,
+		         cr_w->stat_pass ? "metadata" : cr_w->slow ? "names" : bfm_backend_name() );
+
+		if ( cr_w->scan_timer )
+			g_source_remove( cr_w->scan_timer );
+		cr_w->scan_timer = 0;
+		if ( cr_w->partial )
+			gtk_label_set_text( GTK_LABEL( cr_w->stat ), "" );
+		cr_w->partial = FALSE;
+
+		/* Drop cached entries which are gone */
+		if ( ( cached = cr_w->seen != NULL ) )
+		{
+			for ( i = 0; i < cr_w->n_seen; i++ )
+				if ( !cr_w->seen[i] && cr_w->model->list->rec[i].mode )
+					bfm_model_remove( cr_w->model, i );
+
+			g_free( cr_w->seen );
+			cr_w->seen = NULL;
+		}
+		/* Names which could not be stat'ed are gone */
+		else
+		{
+			for ( rec = 0; cr_w->stat_pass && rec < cr_w->model->list->len; rec++ )
+				if ( cr_w->model->list->rec[rec].mode && cr_w->model->list->rec[rec].size == SCAN_UNKNOWN )
+					bfm_model_remove( cr_w->model, rec );
+		}
+		/* Sort everything at once */
+		bfm_model_thaw( cr_w->model );
+
+		/* Release owner reference */
+		cr_w->scan = NULL;
+		bfm_scan_unref(sc);
+
+		/* Names of slow filesystem are followed by their metadata */
+		if ( !cr_w->slow || cr_w->stat_pass || !bfm_stat_pass( cr_w, cached ) )
+		{
+			cr_w->stat_pass = FALSE;
+			if ( cr_w->dirsize )
+				bfm_dirsize_run(cr_w);
+			bfm_prefetch_next();
+		}
+	}
+
+	bfm_scan_unref(sc);
+	return FALSE;
+}
+
+/* Stat names listed without metadata, or all names of revalidated cached listing
+ * whose metadata may be stale. Rows on screen go first */
+gboolean
+bfm_stat_pass ( St_win * cr_w, gboolean all )
+{
+	St_listing   * l = cr_w->model->list;
+	const char  ** names = g_new0( const char *, l->len + 1 );
+	GtkTreePath  * first;
+	GtkTreePath  * last;
+	guint32        i;
+	guint32        n = 0;
+	gint           row;
+	gint           fd;
+
+	for ( i = 0; i < l->len; i++ )
+		if ( l->rec[i].mode && ( all || l->rec[i].size == SCAN_UNKNOWN ) && ++n )
+			names[i] = bfm_listing_name( l, i );
+
+	if ( n && ( fd = fcntl( cr_w->dfd, F_DUPFD_CLOEXEC, 0 ) ) >= 0 )
+	{
+		/* Record index is index of name, updates do not move rows until all are in */
+		cr_w->scan = bfm_scan_stat( fd, names, l->len, bfm_read_notify, cr_w );
+		cr_w->stat_pass = TRUE;
+		bfm_model_freeze( cr_w->model );
+
+		/* Results are merged like revalidation, names which can not be stat'ed are dropped */
+		if (all)
+		{
+			cr_w->n_seen = l->len;
+			cr_w->seen = g_new0( guchar, l->len );
+		}
+
+		/* Top row is hinted last and goes first */
+		if ( gtk_tree_view_get_visible_range( GTK_TREE_VIEW( cr_w->tree ), &first, &last ) )
+		{
+			for ( row = gtk_tree_path_get_indices(last)[0]; row >= gtk_tree_path_get_indices(first)[0]; row-- )
+				bfm_scan_hint( cr_w->scan, cr_w->model->rows[row] );
+			gtk_tree_path_free(first);
+			gtk_tree_path_free(last);
+		}
+	}
+
+	g_free(names);
+	return cr_w->stat_pass;
+}
+
+/* Show what slow filesystem gave so far, rest is added when it comes */
+gboolean
+bfm_scan_timeout ( gpointer p )
+{
+	St_win * cr_w = p;
+
+	cr_w->scan_timer = 0;
+	cr_w->partial = TRUE;
+	bfm_model_thaw( cr_w->model );
+	gtk_label_set_text( GTK_LABEL( cr_w->stat ), "partial listing, filesystem is not responding" );
+
+	return FALSE;
+}
+
+/* Drop scan of current directory */
+void
+bfm_read_stop ( St_win * cr_w )
+{
+	if ( cr_w->scan )
+		bfm_scan_cancel( cr_w->scan );
+	cr_w->scan = NULL;
+	cr_w->stat_pass = FALSE;
+
+	if ( cr_w->scan_timer )
+		g_source_remove( cr_w->scan_timer );
+	cr_w->scan_timer = 0;
+	if ( cr_w->partial )
+		gtk_label_set_text( GTK_LABEL( cr_w->stat ), "" );
+	cr_w->partial = FALSE;
+}
+
+/* Queue directory for reading ahead, newest request goes first */
+void
+bfm_prefetch ( const gchar * path )
+{
+	GList * l;
+
+	if ( !prefetch_entries )
+		return;
+	if ( !ahead )
+		ahead = g_queue_new();
+
+	if ( ( l = g_queue_find_custom( ahead, path, (GCompareFunc)strcmp ) ) )
+	{
+		g_free( l->data );
+		g_queue_delete_link( ahead, l );
+	}
+	g_queue_push_head( ahead, g_strdup(path) );
+
+	while ( g_queue_get_length(ahead) > PREFETCH_QUEUE )
+		g_free( g_queue_pop_tail(ahead) );
+
+	bfm_prefetch_next();
+}
+
+/* Start next read ahead, it waits while any window is reading.
+ * Directory is opened by worker, hung mount does not block windows */
+void
+bfm_prefetch_next ( void )
+{
+	GList * w;
+
+	if ( ahead_scan || !ahead )
+		return;
+	for ( w = windows; w; w = g_list_next(w) )
+		if ( ( (St_win *)w->data )->scan )
+			return;
+
+	if ( !( ahead_path = g_queue_pop_head(ahead) ) )
+		return;
+
+	/* Identity is known once worker opened directory */
+	memset( &ahead_c, 0, sizeof(ahead_c) );
+	ahead_c.list = bfm_listing_new();
+	ahead_c.cursor = ahead_c.top = LISTING_NONE;
+	ahead_scan = bfm_scan_open( ahead_path, bfm_prefetch_accept, bfm_prefetch_notify, NULL );
+}
+
+/* Slow filesystems are not read ahead, called from worker thread */
+gint
+bfm_prefetch_accept ( gint fd )
+{
+	return !bfm_fs_rule(fd);
+}
+
+/* Foreground reading goes first, stopped read ahead is repeated later */
+void
+bfm_prefetch_stop ( void )
+{
+	if ( !ahead_scan )
+		return;
+
+	bfm_scan_cancel(ahead_scan);
+	ahead_scan = NULL;
+	bfm_listing_free( ahead_c.list );
+	g_queue_push_head( ahead, ahead_path );
+	ahead_path = NULL;
+}
+
+/* Read ahead callback, called from worker thread */
+void
+bfm_prefetch_notify ( St_scan * sc, void * data )
+{
+	(void)data;
+	bfm_scan_ref(sc);
+	g_idle_add_full( G_PRIORITY_LOW, bfm_prefetch_batch, sc, NULL );
+}
+
+/* Collect read ahead entries and put complete listing into cache */
+gboolean
+bfm_prefetch_batch ( gpointer p )
+{
+	St_scan        * sc = p;
+	St_entry         buf[ROWS_PER_IDLE];
+	St_cache_stats   cs;
+	struct stat      st;
+	GList          * w;
+	size_t           i;
+	size_t           n;
+	long             msec;
+	int              state;
+	gboolean         skip = FALSE;
+
+	if ( bfm_scan_cancelled(sc) )
+	{
+		bfm_scan_unref(sc);
+		return FALSE;
+	}
+
+	/* Listing cached or shown already is not read again */
+	if ( !ahead_c.ino && bfm_scan_dir( sc, &st ) == 0 )
+	{
+		ahead_c.dev = st.st_dev;
+		ahead_c.ino = st.st_ino;
+		ahead_c.mtime = st.st_mtim;
+		skip = bfm_cache_has( cache, st.st_dev, st.st_ino );
+		for ( w = windows; w && !skip; w = g_list_next(w) )
+			skip = ( (St_win *)w->data )->dev == st.st_dev && ( (St_win *)w->data )->ino == st.st_ino;
+	}
+
+	n = bfm_scan_take( sc, buf, G_N_ELEMENTS(buf), &state );
+	for ( i = 0; i < n; i++ )
+	{
+		bfm_listing_add( ahead_c.list, &buf[i] );
+		free( buf[i].name );
+	}
+
+	if ( skip )
+	{
+		bfm_listing_free( ahead_c.list );
+		state = SCAN_DONE;
+	}
+	/* Large directory is not worth its reading and memory */
+	else if ( ahead_c.list->len > prefetch_entries )
+	{
+		g_debug( "prefetch: %s: over %u entries, skipped", ahead_path, prefetch_entries );
+		bfm_listing_free( ahead_c.list );
+		state = SCAN_DONE;
+	}
+	else if ( state == SCAN_MORE )
+		return TRUE;
+	else if ( state == SCAN_DONE )
+	{
+		bfm_scan_stats( sc, &n, &msec );
+		bfm_cache_stats( cache, &cs );
+
+		/* Window may have left its listing meanwhile, it is newer */
+		if ( !ahead_c.list->len || bfm_cache_has( cache, ahead_c.dev, ahead_c.ino )
+		  || cs.memory + bfm_listing_memory( ahead_c.list ) > cache_size )
+			bfm_listing_free( ahead_c.list );
+		else
+		{
+			bfm_cache_put( cache, &ahead_c );
+			g_debug( "prefetch: %s: %zu entries in %ld ms", ahead_path, n, msec );
+		}
+	}
+
+	if ( state == SCAN_DONE )
+	{
+		/* Stop skipped reading and release owner reference */
+		bfm_scan_cancel(sc);
+		ahead_scan = NULL;
+		g_free(ahead_path);
+		ahead_path = NULL;
+		bfm_prefetch_next();
+	}
+
+	bfm_scan_unref(sc);
+	return FALSE;
+}
+
+/* Restart wait for cursor rest */
+void
+bfm_cursor_changed ( GtkTreeView * tree, St_win * cr_w )
+{
+	BfmModel        * m = cr_w->model;
+	GdkEvent        * ev = gtk_get_current_event();
+	GdkModifierType   state = 0;
+	GtkTreePath     * path;
+	GtkTreeIter       iter;
+	guint32           row;
+	guint32           rec;
+
+	if ( cr_w->ahead_timer )
+		g_source_remove( cr_w->ahead_timer );
+	cr_w->ahead_timer = prefetch_entries ? g_timeout_add( prefetch_delay, bfm_prefetch_cursor, cr_w ) : 0;
+
+	/* Selection follows cursor: Shift extends it from anchor,
+	 * Ctrl with click toggles row and with key leaves selection alone */
+	gtk_tree_view_get_cursor( tree, &path, NULL );
+	if ( path && ( row = gtk_tree_path_get_indices(path)[0] ) < m->n_rows )
+	{
+		rec = m->rows[row];
+		if (ev)
+			gdk_event_get_state( ev, &state );
+
+		if ( state & GDK_CONTROL_MASK )
+		{
+			if ( ev->type == GDK_BUTTON_PRESS )
+			{
+				bfm_model_iter( m, rec, &iter );
+				bfm_model_select_rec( m, rec, !bfm_model_is_selected( m, &iter ) );
+				m->sel_anchor = rec;
+			}
+		}
+		else if ( state & GDK_SHIFT_MASK && m->sel_anchor != LISTING_NONE && m->pos[ m->sel_anchor ] != MODEL_HIDDEN )
+		{
+			bfm_model_select_all( m, FALSE );
+			bfm_model_select_rows( m, m->pos[ m->sel_anchor ], row );
+		}
+		else
+		{
+			bfm_model_select_all( m, FALSE );
+			bfm_model_select_rec( m, rec, TRUE );
+			m->sel_anchor = rec;
+		}
+		gtk_widget_queue_draw( cr_w->tree );
+	}
+
+	if (path)
+		gtk_tree_path_free(path);
+	if (ev)
+		gdk_event_free(ev);
+}
+
+/* Dragging with first button selects rows from anchor to pointer, Ctrl adds them */
+gboolean
+bfm_drag_select ( GtkWidget * w, GdkEventMotion * ev, St_win * cr_w )
+{
+	BfmModel    * m = cr_w->model;
+	GtkTreePath * path;
+
+	if ( !( ev->state & GDK_BUTTON1_MASK ) || ev->window != gtk_tree_view_get_bin_window( GTK_TREE_VIEW(w) )
+	  || m->sel_anchor == LISTING_NONE || m->pos[ m->sel_anchor ] == MODEL_HIDDEN
+	  || !gtk_tree_view_get_path_at_pos( GTK_TREE_VIEW(w), ev->x, ev->y, &path, NULL, NULL, NULL ) )
+		return FALSE;
+
+	if ( !( ev->state & GDK_CONTROL_MASK ) )
+		bfm_model_select_all( m, FALSE );
+	bfm_model_select_rows( m, m->pos[ m->sel_anchor ], gtk_tree_path_get_indices(path)[0] );
+	gtk_tree_path_free(path);
+	gtk_widget_queue_draw(w);
+
+	return FALSE;
+}
+
+/* Read ahead directory under resting cursor */
+gboolean
+bfm_prefetch_cursor ( gpointer p )
+{
+	St_win       * cr_w = p;
+	GtkTreeModel * model = GTK_TREE_MODEL( cr_w->model );
+	GtkTreePath  * path;
+	GtkTreeIter    iter;
+	gboolean       is_dir = FALSE;
+	gchar        * name = NULL;
+	gchar        * dir;
+
+	cr_w->ahead_timer = 0;
+
+	gtk_tree_view_get_cursor( GTK_TREE_VIEW( cr_w->tree ), &path, NULL );
+	if ( !path )
+		return FALSE;
+
+	if ( gtk_tree_model_get_iter( model, &iter, path ) )
+		gtk_tree_model_get( model, &iter, NAME_STR, &name, IS_DIR, &is_dir, -1 );
+	gtk_tree_path_free(path);
+
+	if ( is_dir && cr_w->path && !cr_w->arch )
+	{
+		dir = g_build_filename( cr_w->path, name, NULL );
+		bfm_prefetch(dir);
+		g_free(dir);
+	}
+
+	g_free(name);
+	return FALSE;
+}
+
+/* Show recursive sizes of directories, same mode again turns it off */
+void
+bfm_dirsize ( St_win * cr_w, const St_arg * args )
+{
+	cr_w->dirsize = cr_w->dirsize == args->i ? DU_OFF : args->i;
+
+	/* Own sizes of directories come back with new listing */
+	if ( cr_w->dirsize == DU_OFF )
+		bfm_reload( cr_w, NULL );
+	else
+		bfm_dirsize_run(cr_w);
+}
+
+/* Sum sizes of listed directories in background */
+void
+bfm_dirsize_run ( St_win * cr_w )
+{
+	St_listing * l = cr_w->model->list;
+	GPtrArray  * names;
+	guint32      i;
+
+	if ( cr_w->du )
+		bfm_du_cancel( cr_w->du );
+	cr_w->du = NULL;
+
+	/* Listing is incomplete or names are not relative to path */
+	if ( !cr_w->dirsize || cr_w->scan || cr_w->results || cr_w->arch )
+		return;
+
+	names = g_ptr_array_new();
+	for ( i = 0; i < l->len; i++ )
+		if ( S_ISDIR( l->rec[i].mode ) )
+			g_ptr_array_add( names, (gpointer)bfm_listing_name( l, i ) );
+
+	if ( names->len
+	  && !( cr_w->du = bfm_du_start( cr_w->path, (char * const *)names->pdata, names->len, cr_w->du_fresh, bfm_du_notify, cr_w ) ) )
+		g_warning( "%s: can not compute directory sizes", cr_w->path );
+
+	cr_w->du_fresh = FALSE;
+	g_ptr_array_free( names, TRUE );
+}
+
+/* Size computation callback, called from worker thread */
+void
+bfm_du_notify ( St_du * d, void * data )
+{
+	(void)data;
+	bfm_du_ref(d);
+	g_idle_add( bfm_du_batch, d );
+}
+
+/* Put computed sizes into list, rows move when sorted by size */
+gboolean
+bfm_du_batch ( gpointer p )
+{
+	St_du       * d = p;
+	St_win      * cr_w;
+	St_du_entry   buf[ROWS_PER_IDLE];
+	St_entry      e[ROWS_PER_IDLE];
+	guint32       recs[ROWS_PER_IDLE];
+	guint32       rec;
+	guint32       k = 0;
+	size_t        i;
+	size_t        n;
+	size_t        dirs;
+	size_t        files;
+	long          msec;
+	int           state;
+
+	/* Window is gone or listing changed */
+	if ( bfm_du_cancelled(d) )
+	{
+		bfm_du_unref(d);
+		return FALSE;
+	}
+
+	cr_w = bfm_du_data(d);
+	n = bfm_du_take( d, buf, G_N_ELEMENTS(buf), &state );
+
+	/* Sizes of whole batch are set at once and rows are ordered once */
+	for ( i = 0; i < n; i++ )
+	{
+		if ( ( rec = bfm_model_find( cr_w->model, buf[i].name ) ) != LISTING_NONE )
+		{
+			e[k].name  = buf[i].name;
+			e[k].mode  = cr_w->model->list->rec[rec].mode;
+			e[k].size  = cr_w->dirsize == DU_ALLOCATED ? buf[i].allocated : buf[i].apparent;
+			e[k].mtime = cr_w->model->list->rec[rec].mtime;
+			recs[k++] = rec;
+		}
+	}
+	bfm_model_set_batch( cr_w->model, recs, e, k );
+	for ( i = 0; i < n; i++ )
+		free( buf[i].name );
+
+	if ( state == SCAN_MORE )
+		return TRUE;
+
+	if ( state == SCAN_DONE )
+	{
+		bfm_du_stats( d, &dirs, &files, &n, &msec );
+		g_debug( "%s: sizes of %zu dirs and %zu files in %ld ms, %zu remembered",
+		         cr_w->path, dirs, files, msec, n );
+
+		/* Release owner reference */
+		cr_w->du = NULL;
+		bfm_du_unref(d);
+	}
+
+	bfm_du_unref(d);
+	return FALSE;
+}
+
+/* Start background reading of directory */
+void
+bfm_read_files ( St_win * cr_w, DIR * dir )
+{
+	/* Drop previous scan */
+	bfm_read_stop(cr_w);
+	g_free( cr_w->seen );
+	cr_w->seen = NULL;
+
+	/* remove previous entries, view is detached to skip per-row signals */
+	gtk_tree_view_set_model( GTK_TREE_VIEW( cr_w->tree ), NULL );
+	bfm_model_clear( cr_w->model );
+	gtk_tree_view_set_model( GTK_TREE_VIEW( cr_w->tree ), GTK_TREE_MODEL( cr_w->model ) );
+	g_hash_table_remove_all( cr_w->chng );
+
+	/* Rows are appended as they come and sorted when scan is done */
+	bfm_model_freeze( cr_w->model );
+
+	bfm_prefetch_stop();
+	if ( !cr_w->slow )
+	{
+		cr_w->scan = bfm_scan_start( dir, bfm_read_notify, cr_w );
+		return;
+	}
+
+	/* Slow filesystem gives names first, what is there is shown if it takes too long */
+	cr_w->scan = bfm_scan_lazy( dir, bfm_read_notify, cr_w );
+	cr_w->scan_timer = g_timeout_add( cr_w->slow->timeout, bfm_scan_timeout, cr_w );
+}
+
+/* Show cached listing at once and revalidate it in background */
+void
+bfm_read_cached ( St_win * cr_w, DIR * dir, const St_cached * c )
+{
+	GtkTreeView * tree = GTK_TREE_VIEW( cr_w->tree );
+	GtkTreePath * path;
+	St_listing  * l;
+
+	bfm_read_stop(cr_w);
+	g_free( cr_w->seen );
+
+	gtk_tree_view_set_model( tree, NULL );
+	bfm_listing_free( bfm_model_load( cr_w->model, c->list ) );
+	gtk_tree_view_set_model( tree, GTK_TREE_MODEL( cr_w->model ) );
+	g_hash_table_remove_all( cr_w->chng );
+
+	/* Restore view as it was left */
+	l = cr_w->model->list;
+	if ( c->cursor != LISTING_NONE && cr_w->model->pos[ c->cursor ] != MODEL_HIDDEN )
+	{
+		path = gtk_tree_path_new_from_indices( cr_w->model->pos[ c->cursor ], -1 );
+		gtk_tree_view_set_cursor( tree, path, NULL, FALSE );
+		gtk_tree_path_free(path);
+	}
+	if ( c->top != LISTING_NONE && cr_w->model->pos[ c->top ] != MODEL_HIDDEN )
+	{
+		path = gtk_tree_path_new_from_indices( cr_w->model->pos[ c->top ], -1 );
+		gtk_tree_view_scroll_to_cell( tree, path, NULL, TRUE, 0.0, 0.0 );
+		gtk_tree_path_free(path);
+	}
+
+	cr_w->n_seen = l->len;
+	cr_w->seen = g_new0( guchar, l->len );
+	bfm_prefetch_stop();
+	cr_w->scan = cr_w->slow ? bfm_scan_lazy( dir, bfm_read_notify, cr_w ) : bfm_scan_start( dir, bfm_read_notify, cr_w );
+}
+
+/* Put listing of current directory into cache */
+void
+bfm_save_listing ( St_win * cr_w )
+{
+	GtkTreeView * tree = GTK_TREE_VIEW( cr_w->tree );
+	GtkTreePath * path;
+	GtkTreePath * end;
+	St_cached     c;
+	struct stat   st;
+
+	/* Only complete listings are kept, empty one is already saved */
+	if ( !cr_w->path || cr_w->scan || cr_w->results || cr_w->arch || !cr_w->model->list->len )
+		return;
+
+	c.dev = cr_w->dev;
+	c.ino = cr_w->ino;
+	c.cursor = c.top = LISTING_NONE;
+
+	/* Pending changes make listing older than directory */
+	if ( !g_hash_table_size( cr_w->chng ) && fstat( cr_w->dfd, &st ) == 0 )
+		c.mtime = st.st_mtim;
+	else
+		c.mtime = (struct timespec){ 0, 0 };
+
+	gtk_tree_view_get_cursor( tree, &path, NULL );
+	if ( path )
+	{
+		c.cursor = cr_w->model->rows[ gtk_tree_path_get_indices(path)[0] ];
+		gtk_tree_path_free(path);
+	}
+	if ( gtk_tree_view_get_visible_range( tree, &path, &end ) )
+	{
+		c.top = cr_w->model->rows[ gtk_tree_path_get_indices(path)[0] ];
+		gtk_tree_path_free(path);
+		gtk_tree_path_free(end);
+	}
+
+	gtk_tree_view_set_model( tree, NULL );
+	c.list = bfm_model_load( cr_w->model, NULL );
+	gtk_tree_view_set_model( tree, GTK_TREE_MODEL( cr_w->model ) );
+
+	/* Index keeps its own copy for next start */
+	if ( index_db )
+		bfm_index_put( index_db, cr_w->path, &c );
+	bfm_cache_put( cache, &c );
+}
+
+/* Return directory on upper level */
+gchar *
+bfm_prev_dir ( gchar * path )
+{
+	gchar * p;
+	if ( ( p = g_strrstr( path, "/" ) ) )
+	{
+		if ( p == path )
+			* ( p + 1 ) = '\0';
+		else
+			* p = '\0';
+	}
+
+	return path;
+}
+
+/* Absolute path of str under base with ".", ".." and repeated slashes folded.
+ * Only text is changed, symlinks stay as they were entered */
+gchar *
+bfm_path_resolve ( const gchar * base, const gchar * str )
+{
+	GString  * out = g_string_new(NULL);
+	gchar   ** parts;
+	gchar    * full;
+	gchar    * cwd = NULL;
+	gchar    * p;
+	guint      i;
+
+	if ( g_path_is_absolute(str) )
+		full = g_strdup(str);
+	else
+		full = g_build_filename( base ? base : ( cwd = g_get_current_dir() ), str, NULL );
+
+	parts = g_strsplit( full, "/", -1 );
+	for ( i = 0; parts[i]; i++ )
+	{
+		if ( !* parts[i] || strcmp( parts[i], "." ) == 0 )
+			continue;
+
+		/* Parent of root is root */
+		if ( strcmp( parts[i], ".." ) == 0 )
+		{
+			if ( ( p = strrchr( out->str, '/' ) ) )
+				g_string_truncate( out, p - out->str );
+		}
+		else
+			g_string_append_printf( out, "/%s", parts[i] );
+	}
+
+	if ( !out->len )
+		g_string_append_c( out, '/' );
+
+	g_strfreev(parts);
+	g_free(full);
+	g_free(cwd);
+	return g_string_free( out, FALSE );
+}
+
+/* Get directory content */
+void
+bfm_list_dir ( St_win * cr_w, const char * str )
+{
+	guint64 t = bfm_trace_begin();
+	g_return_if_fail(str);
+
+	/* Going up inside archive, from its top back to directory holding it */
+	if ( cr_w->arch && strcmp( str, ".." ) == 0 )
+	{
+		if ( * cr_w->arch_dir )
+		{
+			gchar * up = g_path_get_dirname( cr_w->arch_dir );
+			bfm_arch_show( cr_w, cr_w->arch, cr_w->arch_file, strcmp( up, "." ) ? up : "" );
+			g_free(up);
+			bfm_trace_end( "list_dir", t );
+			return;
+		}
+		str = ".";
+	}
+
+	DIR *          dir = NULL;
+	St_cached      c;
+	St_cache_stats cs;
+	struct stat    st;
+	gchar        * path = bfm_path_resolve( cr_w->path, str );
+	gint           fd;
+	gint           sfd = -1;
+
+	/* Names are opened under current directory, paths going up follow text as it was shown */
+	if ( cr_w->dfd >= 0 && !g_path_is_absolute(str) && !strstr( str, ".." ) )
+		fd = openat( cr_w->dfd, str, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	else
+		fd = open( path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+	/* Try to open directory, scan gets its own descriptor */
+	if ( fd < 0 || fstat( fd, &st ) < 0
+	  || ( sfd = fcntl( fd, F_DUPFD_CLOEXEC, 0 ) ) < 0 || !( dir = fdopendir(sfd) ) )
+	{
+		g_warning( "%s: %s\n", path, g_strerror(errno) );
+		if ( sfd >= 0 )
+			close(sfd);
+		if ( fd >= 0 )
+			close(fd);
+
+		/* Check if in root */
+		if ( strcmp( path, "/" ) != 0 )
+			bfm_list_dir( cr_w, bfm_prev_dir(path) );
+		g_free(path);
+		bfm_trace_end( "list_dir", t );
+		return;
+	}
+
+	/* Keep listing of directory being left */
+	bfm_save_listing(cr_w);
+	bfm_search_stop(cr_w);
+	bfm_compare_stop( cr_w, TRUE );
+	bfm_arch_leave(cr_w);
+	if ( cr_w->du )
+		bfm_du_cancel( cr_w->du );
+	cr_w->du = NULL;
+	cr_w->results = FALSE;
+
+	if ( cr_w->path )
+		g_free( cr_w->path );
+	if ( cr_w->dfd >= 0 )
+		close( cr_w->dfd );
+
+	/* Fill window struct */
+	cr_w->path = path;
+	cr_w->dfd = fd;
+	cr_w->dev = st.st_dev;
+	cr_w->ino = st.st_ino;
+	cr_w->mtim = st.st_mtim;
+	if ( ( cr_w->slow = bfm_fs_rule(fd) ) )
+		g_debug( "%s filesystem, names are listed first", bfm_scan_fs(fd) );
+	bfm_watch_dir(cr_w);
+	bfm_extra_clear( cr_w->extra );
+	bfm_thumb_clear( cr_w->thumb );
+	g_hash_table_remove_all( cr_w->thumbs );
+
+	/* Patterns are for directory they were set in */
+	g_string_truncate( cr_w->typed, 0 );
+	bfm_filter_set( &cr_w->model->filter, FILTER_NONE, NULL );
+	bfm_set_title(cr_w);
+
+	/* Invoke wrapped function, listing from last run is shown until directory is read */
+	if ( bfm_cache_take( cache, cr_w->dev, cr_w->ino, &cr_w->mtim, &c )
+	  || ( index_db && bfm_index_dir( index_db, cr_w->path, cr_w->dev, cr_w->ino, &c ) ) )
+		bfm_read_cached( cr_w, dir, &c );
+	else
+		bfm_read_files( cr_w, dir );
+
+	bfm_cache_stats( cache, &cs );
+	g_debug( "cache: %lu hits, %lu stale, %lu misses, %zu listings in %zu KiB",
+	         cs.hits, cs.stale, cs.misses, cs.entries, cs.memory / 1024 );
+	bfm_trace_end( "list_dir", t );
+}
+
+/* Rule for filesystem holding directory, NULL if it is read the usual way */
+const St_fs_rule *
+bfm_fs_rule ( gint fd )
+{
+	const char * type = bfm_scan_fs(fd);
+	guint        i;
+
+	for ( i = 0; i < G_N_ELEMENTS(fs_rules); i++ )
+		if ( fnmatch( fs_rules[i].type, type, 0 ) == 0 )
+			return &fs_rules[i];
+
+	return NULL;
+}
+
+/* Width of text rendered in widget with cell padding */
+gint
+bfm_text_width ( GtkWidget * w, const gchar * text )
+{
+	PangoLayout * layout = gtk_widget_create_pango_layout( w, text );
+	gint          width;
+
+	pango_layout_get_pixel_size( layout, &width, NULL );
+	g_object_unref(layout);
+
+	return width + 16;
+}
+
+/* Creates new main window */
+St_win *
+bfm_create_window ( void )
 {
 	St_win          * cr_w;
-	GtkCellRenderer * rend;
-	GtkListStore    * store;
-	GtkTreeSortable * sortable;
+	GtkCellRenderer   * rend;
+	GtkTreeViewColumn * col;
+	GtkTreeSortable   * sortable;
+	GtkWidget         * box;
+	guint               i;
 
 	/* Initialisation */
 	cr_w       = g_malloc(sizeof(St_win));
 	cr_w->path = NULL;
+	cr_w->dfd = -1;
+	cr_w->arch = NULL;
+	cr_w->arch_file = NULL;
+	cr_w->arch_dir = NULL;
+	cr_w->extracts = NULL;
+	cr_w->arch_tmps = NULL;
+	cr_w->scan = NULL;
+	cr_w->slow = NULL;
+	cr_w->stat_pass = FALSE;
+	cr_w->scan_timer = 0;
+	cr_w->partial = FALSE;
+	cr_w->seen = NULL;
+	cr_w->n_seen = 0;
+	cr_w->ahead_timer = 0;
+	cr_w->chng = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+	cr_w->chtimer = 0;
+	cr_w->be = NULL;
+	cr_w->inwatch = 0;
+	cr_w->typed = g_string_new(NULL);
+	cr_w->results = FALSE;
+	cr_w->search = NULL;
+	cr_w->cmp = NULL;
+	cr_w->diff = NULL;
+	cr_w->jobs = NULL;
+	cr_w->jobtimer = 0;
+	cr_w->dirsize = DU_OFF;
+	cr_w->du = NULL;
+	cr_w->du_fresh = FALSE;
+	cr_w->extra = bfm_extra_new( bfm_extra_notify, cr_w );
+	cr_w->thumb = bfm_thumb_new( thumb_size, bfm_thumb_notify, cr_w );
+	cr_w->thumbs = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, bfm_thumb_free );
+	cr_w->thumb_lru = g_queue_new();
+	cr_w->wd = -1;
 	cr_w->wind = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 	cr_w->dtfl = show_dotfiles;
 
@@ -639,60 +3495,121 @@ bfm_create_window ( void )
 	                              );
 
 	/* Creating storage for directory content */
-	store = gtk_list_store_new ( 5,
-			                     G_TYPE_STRING, /* Name */
-			                     G_TYPE_STRING, /* Prms */
-			                     G_TYPE_STRING, /* Size */
-			                     G_TYPE_STRING, /* Mdfd */
-			                     G_TYPE_BOOLEAN
-			                   );
-	sortable = GTK_TREE_SORTABLE(store);
+	cr_w->model = bfm_model_new();
+	cr_w->model->filter.dotfiles = cr_w->dtfl;
+	sortable = GTK_TREE_SORTABLE( cr_w->model );
 
 	/* Creating a widget for list */
-	cr_w->tree = gtk_tree_view_new_with_model( GTK_TREE_MODEL(store) );
+	cr_w->tree = gtk_tree_view_new_with_model( GTK_TREE_MODEL( cr_w->model ) );
 	gtk_tree_view_set_headers_visible( GTK_TREE_VIEW( cr_w->tree ), TRUE );
-	gtk_tree_view_set_rubber_banding( GTK_TREE_VIEW( cr_w->tree ), TRUE );
 	gtk_tree_view_set_rules_hint( GTK_TREE_VIEW( cr_w->tree ), TRUE );
+	/* Typing filters list instead */
+	gtk_tree_view_set_enable_search( GTK_TREE_VIEW( cr_w->tree ), FALSE );
+	/* Selection is kept by model for each record and painted by cells, so
+	 * selecting all or inverting does not walk rows */
 	gtk_tree_selection_set_mode
 	   (
 	   gtk_tree_view_get_selection( GTK_TREE_VIEW( cr_w->tree ) ),
-	   GTK_SELECTION_MULTIPLE
+	   GTK_SELECTION_NONE
 	   );
 
-	#define MCR_SET_COLUMN(MCR_COL_NAME,MCR_COL_ENUM)                                              \
-	   (gtk_tree_view_insert_column_with_attributes(                                               \
-	   GTK_TREE_VIEW( cr_w->tree ), -1, MCR_COL_NAME, rend, "text", MCR_COL_ENUM, NULL) )
-
-	rend = gtk_cell_renderer_text_new();
-	MCR_SET_COLUMN( "Name", NAME_STR );
-	rend = gtk_cell_renderer_text_new();
-	MCR_SET_COLUMN( "Permissions", PERMS_STR );
-	rend = gtk_cell_renderer_text_new();
-	MCR_SET_COLUMN( "Size", SIZE_STR );
-	rend = gtk_cell_renderer_text_new();
-	MCR_SET_COLUMN( "Modified", MTIME_STR );
+	/* Rows have equal height and columns have fixed width,
+	 * so only visible rows are ever formatted */
+	gtk_tree_view_set_fixed_height_mode( GTK_TREE_VIEW( cr_w->tree ), TRUE );
+
+	#define MCR_SET_COLUMN(MCR_COL_NAME,MCR_COL_ENUM,MCR_COL_SAMPLE,MCR_COL_SORT)                  \
+	   rend = gtk_cell_renderer_text_new();                                                        \
+	   col = gtk_tree_view_column_new();                                                           \
+	   gtk_tree_view_column_set_title( col, MCR_COL_NAME );                                        \
+	   gtk_tree_view_column_pack_start( col, rend, TRUE );                                         \
+	   gtk_tree_view_column_set_cell_data_func( col, rend, bfm_cell_data,                          \
+	                                            GINT_TO_POINTER(MCR_COL_ENUM), NULL );             \
+	   gtk_tree_view_column_set_sizing( col, GTK_TREE_VIEW_COLUMN_FIXED );                         \
+	   gtk_tree_view_column_set_fixed_width( col, bfm_text_width( cr_w->tree, MCR_COL_SAMPLE ) );  \
+	   if ( MCR_COL_SORT )                                                                         \
+	      gtk_tree_view_column_set_sort_column_id( col, MCR_COL_ENUM );                            \
+	   g_object_set_data( G_OBJECT(col), "win", cr_w );                                            \
+	   gtk_tree_view_append_column( GTK_TREE_VIEW( cr_w->tree ), col );
+
+	MCR_SET_COLUMN( "Name", NAME_STR, "________________________", TRUE );
+	MCR_SET_COLUMN( "Permissions", PERMS_UINT, "drwxrwxrwx", FALSE );
+	MCR_SET_COLUMN( "Size", SIZE_UINT64, "1023.9 KiB", TRUE );
+	MCR_SET_COLUMN( "Modified", MTIME_INT64, "8888/88/88 88:88:88", TRUE );
 
 	#undef MCR_SET_COLUMN
 
+	/* Optional columns, hidden ones are never formatted */
+	memset( cr_w->extra_col, 0, sizeof(cr_w->extra_col) );
+	for ( i = 0; i < G_N_ELEMENTS(columns); i++ )
+	{
+		rend = gtk_cell_renderer_text_new();
+		col = gtk_tree_view_column_new();
+		gtk_tree_view_column_set_title( col, columns[i].title );
+		gtk_tree_view_column_pack_start( col, rend, TRUE );
+		gtk_tree_view_column_set_cell_data_func( col, rend, bfm_extra_cell, GINT_TO_POINTER( columns[i].id ), NULL );
+		gtk_tree_view_column_set_sizing( col, GTK_TREE_VIEW_COLUMN_FIXED );
+		gtk_tree_view_column_set_fixed_width( col, bfm_text_width( cr_w->tree, columns[i].sample ) );
+		gtk_tree_view_column_set_visible( col, columns[i].visible );
+		g_object_set_data( G_OBJECT(col), "win", cr_w );
+		gtk_tree_view_append_column( GTK_TREE_VIEW( cr_w->tree ), col );
+		cr_w->extra_col[ columns[i].id ] = col;
+	}
+
 	/* Name column is expanded, others are using only required width */
 	gtk_tree_view_column_set_expand( gtk_tree_view_get_column( GTK_TREE_VIEW( cr_w->tree ), 0 ),
 	                                 TRUE
 	                               );
 
-	/* Setup list sorting */
-	gtk_tree_sortable_set_sort_func( sortable, NAME_STR, bfm_compare, NULL, NULL );
+	/* Thumbnails go before names, rows keep one height */
+	if ( !thumb_wait )
+	{
+		thumb_wait = gdk_pixbuf_new( GDK_COLORSPACE_RGB, TRUE, 8, thumb_size, thumb_size );
+		gdk_pixbuf_fill( thumb_wait, 0x80808040 );
+	}
+	rend = gtk_cell_renderer_pixbuf_new();
+	gtk_cell_renderer_set_fixed_size( rend, thumb_size + 4, thumb_size + 4 );
+	col = gtk_tree_view_column_new();
+	gtk_tree_view_column_pack_start( col, rend, TRUE );
+	gtk_tree_view_column_set_cell_data_func( col, rend, bfm_thumb_cell, cr_w, NULL );
+	gtk_tree_view_column_set_sizing( col, GTK_TREE_VIEW_COLUMN_FIXED );
+	gtk_tree_view_column_set_fixed_width( col, thumb_size + 4 );
+	gtk_tree_view_column_set_visible( col, show_thumbs );
+	gtk_tree_view_insert_column( GTK_TREE_VIEW( cr_w->tree ), col, 0 );
+	cr_w->thumb_col = col;
+
+	/* Setup list sorting, headers switch order */
 	gtk_tree_sortable_set_sort_column_id( sortable, NAME_STR, GTK_SORT_ASCENDING );
 
 	/* Connect signals */
 	g_signal_connect( G_OBJECT( cr_w->wind ), "destroy", G_CALLBACK(bfm_destroywin), cr_w );
 	g_signal_connect( G_OBJECT( cr_w->wind ), "key-press-event", G_CALLBACK(bfm_keypress), cr_w );
 	g_signal_connect( G_OBJECT( cr_w->tree ), "row-activated", G_CALLBACK(bfm_action), cr_w );
+	cr_w->cursor_sig = g_signal_connect( G_OBJECT( cr_w->tree ), "cursor-changed", G_CALLBACK(bfm_cursor_changed), cr_w );
+	g_signal_connect( G_OBJECT( cr_w->tree ), "motion-notify-event", G_CALLBACK(bfm_drag_select), cr_w );
+
+	/* Directory watch */
+	if ( ( cr_w->infd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) ) >= 0 )
+	{
+		GIOChannel * ch = g_io_channel_unix_new( cr_w->infd );
+		cr_w->inwatch = g_io_add_watch( ch, G_IO_IN, bfm_watch_read, cr_w );
+		g_io_channel_unref(ch);
+	}
+	else
+		g_warning( "inotify: %s", strerror(errno) );
+
+	/* File operation status, shown once operation starts */
+	cr_w->stat = gtk_label_new(NULL);
+	gtk_misc_set_alignment( GTK_MISC( cr_w->stat ), 0, 0.5 );
 
 	/* Add widgets */
+	box = gtk_vbox_new( FALSE, 0 );
 	gtk_container_add( GTK_CONTAINER( cr_w->scrl ), cr_w->tree );
-	gtk_container_add( GTK_CONTAINER( cr_w->wind ), cr_w->scrl );
+	gtk_box_pack_start( GTK_BOX(box), cr_w->scrl, TRUE, TRUE, 0 );
+	gtk_box_pack_start( GTK_BOX(box), cr_w->stat, FALSE, FALSE, 0 );
+	gtk_container_add( GTK_CONTAINER( cr_w->wind ), box );
 
 	gtk_widget_show_all( cr_w->wind );
+	gtk_widget_hide( cr_w->stat );
 	return cr_w;
 }
 
@@ -708,18 +3625,246 @@ bfm_new_window ( St_win * cr_w, const St_arg * args )
 	bfm_list_dir( new, args->v ? args->v : (cr_w ? cr_w->path : NULL) );
 }
 
+/* Log time from invocation to first drawn frame */
+gboolean
+bfm_window_shown ( gpointer p )
+{
+	gint64 * start = p;
+
+	g_debug( "window: shown %.1f ms after %s start",
+	         ( g_get_monotonic_time() - * start ) / 1000.0, * start == cold_start ? "cold" : "warm" );
+	g_free(start);
+	return FALSE;
+}
+
+/* Open window for path, start is monotonic time of invocation */
+void
+bfm_daemon_open ( const gchar * path, gint64 start )
+{
+	St_arg args = { FALSE, 0, (void *)path };
+	gint64 * t = g_new( gint64, 1 );
+
+	bfm_new_window( NULL, &args );
+
+	* t = start;
+	g_idle_add_full( GDK_PRIORITY_REDRAW + 1, bfm_window_shown, t, NULL );
+}
+
+/* Pass path to running instance, only check for one if path is NULL.
+ * FALSE if there is none */
+gboolean
+bfm_daemon_send ( const gchar * path, gint64 start )
+{
+	struct sockaddr_un   addr = { .sun_family = AF_UNIX };
+	gchar              * msg;
+	gchar                ack;
+	gint                 fd;
+	gboolean             ok = FALSE;
+
+	if ( strlen(sock_path) >= sizeof(addr.sun_path)
+	  || ( fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0 )
+		return FALSE;
+	strcpy( addr.sun_path, sock_path );
+
+	if ( connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) == 0 )
+	{
+		/* Only asked if instance is running */
+		if ( !path )
+			ok = TRUE;
+		else
+		{
+			msg = g_strdup_printf( "%" G_GINT64_FORMAT " %s\n", start, path );
+			ok = write( fd, msg, strlen(msg) ) == (ssize_t)strlen(msg) && read( fd, &ack, 1 ) == 1;
+			g_free(msg);
+		}
+	}
+	/* Stale socket of instance which is gone */
+	else if ( errno == ECONNREFUSED )
+		unlink(sock_path);
+
+	close(fd);
+	return ok;
+}
+
+/* Take connection of later instance, its path is read without blocking windows */
+gboolean
+bfm_daemon_accept ( GIOChannel * ch, GIOCondition cond, gpointer p )
+{
+	St_client * c;
+	gint        fd;
+	(void)cond;
+	(void)p;
+
+	if ( ( fd = accept4( g_io_channel_unix_get_fd(ch), NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK ) ) < 0 )
+		return TRUE;
+
+	/* Socket is closed with channel once watch is gone */
+	c = g_new0( St_client, 1 );
+	ch = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref( ch, TRUE );
+	c->watch = g_io_add_watch_full( ch, G_PRIORITY_DEFAULT, G_IO_IN | G_IO_HUP | G_IO_ERR, bfm_daemon_read, c, bfm_daemon_drop );
+	g_io_channel_unref(ch);
+
+	/* Sender is same user, still it is not waited for long */
+	c->timer = g_timeout_add_seconds( DAEMON_TIMEOUT, bfm_daemon_stall, c );
+	return TRUE;
+}
+
+/* Collect path of later instance, window is opened once whole line is in */
+gboolean
+bfm_daemon_read ( GIOChannel * ch, GIOCondition cond, gpointer p )
+{
+	St_client * c = p;
+	gchar     * path;
+	gchar     * end;
+	gint64      start;
+	gssize      r = 0;
+	gint        fd = g_io_channel_unix_get_fd(ch);
+	(void)cond;
+
+	while ( c->len < sizeof( c->buf ) - 1 && ( r = read( fd, c->buf + c->len, sizeof( c->buf ) - 1 - c->len ) ) > 0 )
+		c->len += r;
+	c->buf[ c->len ] = '\0';
+
+	if ( !( end = strchr( c->buf, '\n' ) ) )
+	{
+		/* More is coming */
+		if ( c->len < sizeof( c->buf ) - 1 && r < 0 && errno == EAGAIN )
+			return TRUE;
+		return FALSE;
+	}
+
+	if ( ( path = strchr( c->buf, ' ' ) ) && path < end )
+	{
+		* end = '\0';
+		start = g_ascii_strtoll( c->buf, NULL, 10 );
+		if ( write( fd, "", 1 ) != 1 )
+			g_warning( "daemon: %s", strerror(errno) );
+		bfm_daemon_open( path + 1, start );
+	}
+
+	return FALSE;
+}
+
+/* Give up on instance which does not send its path */
+gboolean
+bfm_daemon_stall ( gpointer p )
+{
+	St_client * c = p;
+
+	c->timer = 0;
+	g_source_remove( c->watch );
+	return FALSE;
+}
+
+/* Connection is over, watch is removed */
+void
+bfm_daemon_drop ( gpointer p )
+{
+	St_client * c = p;
+
+	if ( c->timer )
+		g_source_remove( c->timer );
+	g_free(c);
+}
+
+/* Serve later instances, nothing is served if another instance won the race */
+void
+bfm_daemon_listen ( void )
+{
+	struct sockaddr_un   addr = { .sun_family = AF_UNIX };
+	GIOChannel         * ch;
+	gint                 fd;
+
+	if ( strlen(sock_path) >= sizeof(addr.sun_path)
+	  || ( fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 ) ) < 0 )
+		return;
+	strcpy( addr.sun_path, sock_path );
+
+	if ( bind( fd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 || listen( fd, 16 ) < 0 )
+	{
+		g_debug( "daemon: %s: %s", sock_path, strerror(errno) );
+		close(fd);
+		g_free(sock_path);
+		sock_path = NULL;
+		return;
+	}
+
+	ch = g_io_channel_unix_new(fd);
+	g_io_add_watch( ch, G_IO_IN, bfm_daemon_accept, NULL );
+	g_io_channel_unref(ch);
+}
+
 int
 main( int argc, char ** argv )
 {
+	gint64   start = g_get_monotonic_time();
+	gchar  * path;
+
+	/* Resident instance starts without window */
+	if ( argc > 1 && strcmp( argv[1], "-d" ) == 0 )
+		resident = TRUE;
+
+	/* Paths are passed resolved, receiver has other directory */
+	path = bfm_path_resolve( NULL, argc > 1 && !resident ? argv[ argc - 1 ] : "." );
+
+	/* Running instance opens window, GTK is not even started */
+	if ( single_instance )
+	{
+		sock_path = g_build_filename( g_get_user_runtime_dir(), "bfm.sock", NULL );
+		if ( bfm_daemon_send( resident ? NULL : path, start ) )
+		{
+			if ( resident )
+				g_printerr( "bfm: already running\n" );
+			return resident ? EXIT_FAILURE : EXIT_SUCCESS;
+		}
+	}
+	cold_start = start;
+
 	/* Give arguments to gtk_init() for
 	 * GTK+ standart arguments support */
-	St_arg args;
-	args.v = argv[ argc - 1 ];
 	gtk_init( &argc, &argv );
+	bfm_trace_init();
 
-	bfm_new_window( NULL, &args );
+	g_debug( "scan backend: %s", bfm_backend_name() );
+	cache = bfm_cache_new(cache_size);
+
+	/* Index is mapped before first window, its listings are shown on cold start */
+	if ( index_file )
+	{
+		gchar * file = g_build_filename( g_get_user_cache_dir(), index_file, NULL );
+		gchar * dir = g_path_get_dirname(file);
+		guint   i;
+
+		g_mkdir_with_parents( dir, 0700 );
+		index_db = bfm_index_open(file);
+		index_paths = g_new0( gchar *, G_N_ELEMENTS(index_roots) + 1 );
+		for ( i = 0; i < G_N_ELEMENTS(index_roots) && index_roots[i]; i++ )
+			index_paths[i] = index_roots[i][0] == '~' ? g_strconcat( g_get_home_dir(), index_roots[i] + 1, NULL )
+			                                          : g_strdup( index_roots[i] );
+		g_timeout_add_seconds( INDEX_DELAY, bfm_index_run, GINT_TO_POINTER(TRUE) );
+		g_free(file);
+		g_free(dir);
+	}
+
+	if ( sock_path )
+		bfm_daemon_listen();
+	if ( !resident )
+		bfm_daemon_open( path, start );
+	g_idle_add( bfm_idle_init, NULL );
 
 	gtk_main();
+	bfm_mime_free();
+	bfm_trace_finish();
+
+	/* Listings visited since last update are written */
+	if ( index_db )
+		bfm_index_close(index_db);
+	g_strfreev(index_paths);
+
+	if ( sock_path )
+		unlink(sock_path);
+	g_free(path);
 
 	return EXIT_SUCCESS;
 }
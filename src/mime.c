@@ -0,0 +1,219 @@
+#include <fcntl.h>
+#include <magic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mime.h"
+
+/* Longest extension in table */
+#define MIME_EXT_MAX 8
+
+/* Structs */
+typedef struct
+{
+	const char * ext;
+	const char * type;
+} St_mime_ext;
+
+/* Globals */
+/* Types known by extension alone, sorted for binary search */
+static const St_mime_ext exts[] = {
+	{ "7z",   "application/x-7z-compressed" },
+	{ "avi",  "video/x-msvideo" },
+	{ "bmp",  "image/bmp" },
+	{ "bz2",  "application/x-bzip2" },
+	{ "c",    "text/x-c" },
+	{ "cc",   "text/x-c++" },
+	{ "conf", "text/plain" },
+	{ "cpp",  "text/x-c++" },
+	{ "css",  "text/css" },
+	{ "csv",  "text/csv" },
+	{ "djvu", "image/vnd.djvu" },
+	{ "doc",  "application/msword" },
+	{ "docx", "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+	{ "epub", "application/epub+zip" },
+	{ "flac", "audio/flac" },
+	{ "gif",  "image/gif" },
+	{ "go",   "text/x-go" },
+	{ "gz",   "application/gzip" },
+	{ "h",    "text/x-c" },
+	{ "hpp",  "text/x-c++" },
+	{ "htm",  "text/html" },
+	{ "html", "text/html" },
+	{ "ini",  "text/plain" },
+	{ "jpeg", "image/jpeg" },
+	{ "jpg",  "image/jpeg" },
+	{ "js",   "text/javascript" },
+	{ "json", "application/json" },
+	{ "log",  "text/plain" },
+	{ "m4a",  "audio/mp4" },
+	{ "md",   "text/markdown" },
+	{ "mkv",  "video/x-matroska" },
+	{ "mov",  "video/quicktime" },
+	{ "mp3",  "audio/mpeg" },
+	{ "mp4",  "video/mp4" },
+	{ "odt",  "application/vnd.oasis.opendocument.text" },
+	{ "ogg",  "audio/ogg" },
+	{ "opus", "audio/ogg" },
+	{ "pdf",  "application/pdf" },
+	{ "png",  "image/png" },
+	{ "py",   "text/x-script.python" },
+	{ "rar",  "application/vnd.rar" },
+	{ "rs",   "text/rust" },
+	{ "sh",   "text/x-shellscript" },
+	{ "svg",  "image/svg+xml" },
+	{ "tar",  "application/x-tar" },
+	{ "tex",  "text/x-tex" },
+	{ "tif",  "image/tiff" },
+	{ "tiff", "image/tiff" },
+	{ "toml", "text/plain" },
+	{ "txt",  "text/plain" },
+	{ "wav",  "audio/x-wav" },
+	{ "webm", "video/webm" },
+	{ "webp", "image/webp" },
+	{ "xml",  "text/xml" },
+	{ "xz",   "application/x-xz" },
+	{ "yaml", "text/yaml" },
+	{ "yml",  "text/yaml" },
+	{ "zip",  "application/zip" },
+	{ "zst",  "application/zstd" },
+};
+
+/* Content detection, database is loaded once. Cookie is used by one thread at a time */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static magic_t         cookie = NULL;
+/* Types found by content, kept for whole process as results of libmagic are overwritten */
+static char         ** found = NULL;
+static size_t          n_found = 0;
+
+/* Functions */
+static int
+bfm_mime_cmp ( const void * key, const void * e )
+{
+	return strcmp( key, ( (const St_mime_ext *)e )->ext );
+}
+
+/* Load content database, called with lock held */
+static int
+bfm_mime_load ( void )
+{
+	if ( cookie )
+		return 0;
+
+	if ( !( cookie = magic_open( MAGIC_MIME_TYPE | MAGIC_SYMLINK | MAGIC_ERROR ) ) )
+		return -1;
+
+	if ( magic_load( cookie, NULL ) < 0 )
+	{
+		magic_close(cookie);
+		cookie = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Load content database, 0 on success */
+int
+bfm_mime_init ( void )
+{
+	int ret;
+
+	pthread_mutex_lock(&lock);
+	ret = bfm_mime_load();
+	pthread_mutex_unlock(&lock);
+
+	return ret;
+}
+
+/* Stable copy of type, called with lock held */
+static const char *
+bfm_mime_keep ( const char * type )
+{
+	size_t i;
+
+	for ( i = 0; i < n_found; i++ )
+		if ( strcmp( found[i], type ) == 0 )
+			return found[i];
+
+	if ( !( i % 16 ) )
+		found = realloc( found, ( i + 16 ) * sizeof(char *) );
+	return found[ n_found++ ] = strdup(type);
+}
+
+/* Type of file name by its extension, NULL if it is not known */
+const char *
+bfm_mime_ext ( const char * name )
+{
+	const St_mime_ext * e;
+	const char        * dot = strrchr( name, '.' );
+	char                key[MIME_EXT_MAX + 1];
+	size_t              i;
+
+	/* Leading dot does not start extension */
+	if ( !dot || dot == name || strlen( ++dot ) > MIME_EXT_MAX )
+		return NULL;
+
+	for ( i = 0; dot[i]; i++ )
+		key[i] = dot[i] >= 'A' && dot[i] <= 'Z' ? dot[i] + 'a' - 'A' : dot[i];
+	key[i] = '\0';
+
+	e = bsearch( key, exts, sizeof(exts) / sizeof(* exts), sizeof(* exts), bfm_mime_cmp );
+	return e ? e->type : NULL;
+}
+
+/* Type of file under directory, extension is trusted before content.
+ * Safe from any thread */
+const char *
+bfm_mime_type_at ( int dfd, const char * name, mode_t mode )
+{
+	const char * type = NULL;
+	const char * base = strrchr( name, '/' );
+	int          fd;
+
+	/* Special files are not opened, names are those of libmagic */
+	if ( S_ISDIR(mode) )
+		return "inode/directory";
+	if ( S_ISFIFO(mode) )
+		return "inode/fifo";
+	if ( S_ISSOCK(mode) )
+		return "inode/socket";
+	if ( S_ISCHR(mode) )
+		return "inode/chardevice";
+	if ( S_ISBLK(mode) )
+		return "inode/blockdevice";
+
+	if ( ( type = bfm_mime_ext( base ? base + 1 : name ) ) )
+		return type;
+
+	if ( ( fd = openat( dfd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC ) ) >= 0 )
+	{
+		pthread_mutex_lock(&lock);
+		if ( bfm_mime_load() == 0 && ( type = magic_descriptor( cookie, fd ) ) )
+			type = bfm_mime_keep(type);
+		pthread_mutex_unlock(&lock);
+		close(fd);
+	}
+
+	return type ? type : "application/octet-stream";
+}
+
+/* Type of file at path */
+const char *
+bfm_mime_type ( const char * path, mode_t mode )
+{
+	return bfm_mime_type_at( AT_FDCWD, path, mode );
+}
+
+void
+bfm_mime_free ( void )
+{
+	pthread_mutex_lock(&lock);
+	if ( cookie )
+		magic_close(cookie);
+	cookie = NULL;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,13 @@
+#ifndef BFM_MIME_H
+#define BFM_MIME_H
+
+#include <sys/types.h>
+
+/* Protos */
+int          bfm_mime_init    ( void );
+const char * bfm_mime_ext     ( const char * );
+const char * bfm_mime_type    ( const char *, mode_t );
+const char * bfm_mime_type_at ( int, const char *, mode_t );
+void         bfm_mime_free    ( void );
+
+#endif
@@ -0,0 +1,942 @@
+#include <string.h>
+#include <sys/stat.h>
+
+#include "model.h"
+#include "sort.h"
+
+/* Removed records are dropped once they are this part of listing and at least COMPACT_MIN */
+#define COMPACT_PART 4
+#define COMPACT_MIN  256
+
+/* Protos */
+static void bfm_model_init            ( BfmModel * );
+static void bfm_model_class_init      ( BfmModelClass * );
+static void bfm_model_tree_init       ( GtkTreeModelIface * );
+static void bfm_model_sortable_init   ( GtkTreeSortableIface * );
+
+G_DEFINE_TYPE_WITH_CODE( BfmModel, bfm_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE( GTK_TYPE_TREE_MODEL, bfm_model_tree_init )
+                         G_IMPLEMENT_INTERFACE( GTK_TYPE_TREE_SORTABLE, bfm_model_sortable_init ) )
+
+/* Functions */
+/* Record index stored in iterator */
+#define ITER_REC(iter) GPOINTER_TO_UINT( (iter)->user_data )
+
+static void
+bfm_model_init ( BfmModel * m )
+{
+	m->list = bfm_listing_new();
+	bfm_filter_init( &m->filter, TRUE );
+	m->stamp = g_random_int();
+	m->sort_id = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+	m->sort_order = GTK_SORT_ASCENDING;
+	m->sel_anchor = LISTING_NONE;
+}
+
+static void
+bfm_model_finalize ( GObject * o )
+{
+	BfmModel * m = BFM_MODEL(o);
+
+	bfm_listing_free( m->list );
+	bfm_filter_free( &m->filter );
+	g_free( m->all );
+	g_free( m->rows );
+	g_free( m->pos );
+	g_free( m->all_pos );
+	g_free( m->sel );
+
+	G_OBJECT_CLASS(bfm_model_parent_class)->finalize(o);
+}
+
+static void
+bfm_model_class_init ( BfmModelClass * klass )
+{
+	G_OBJECT_CLASS(klass)->finalize = bfm_model_finalize;
+}
+
+/* Fill iterator for record */
+void
+bfm_model_iter ( BfmModel * m, guint32 rec, GtkTreeIter * iter )
+{
+	iter->stamp = m->stamp;
+	iter->user_data = GUINT_TO_POINTER(rec);
+	iter->user_data2 = NULL;
+	iter->user_data3 = NULL;
+}
+
+const St_rec *
+bfm_model_rec ( BfmModel * m, GtkTreeIter * iter )
+{
+	return &m->list->rec[ ITER_REC(iter) ];
+}
+
+const char *
+bfm_model_name ( BfmModel * m, GtkTreeIter * iter )
+{
+	return bfm_listing_name( m->list, ITER_REC(iter) );
+}
+
+/* GtkTreeModel interface */
+static GtkTreeModelFlags
+bfm_model_get_flags ( GtkTreeModel * tm )
+{
+	(void)tm;
+	return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint
+bfm_model_get_n_columns ( GtkTreeModel * tm )
+{
+	(void)tm;
+	return N_COLUMNS;
+}
+
+static GType
+bfm_model_get_column_type ( GtkTreeModel * tm, gint col )
+{
+	(void)tm;
+	switch ( col )
+	{
+		case NAME_STR:    return G_TYPE_STRING;
+		case PERMS_UINT:  return G_TYPE_UINT;
+		case SIZE_UINT64: return G_TYPE_UINT64;
+		case MTIME_INT64: return G_TYPE_INT64;
+		case IS_DIR:      return G_TYPE_BOOLEAN;
+		default:          return G_TYPE_INVALID;
+	}
+}
+
+static gboolean
+bfm_model_get_iter ( GtkTreeModel * tm, GtkTreeIter * iter, GtkTreePath * path )
+{
+	BfmModel * m = BFM_MODEL(tm);
+	gint       row;
+
+	if ( gtk_tree_path_get_depth(path) != 1 )
+		return FALSE;
+
+	row = gtk_tree_path_get_indices(path)[0];
+	if ( row < 0 || (guint32)row >= m->n_rows )
+		return FALSE;
+
+	bfm_model_iter( m, m->rows[row], iter );
+	return TRUE;
+}
+
+static GtkTreePath *
+bfm_model_get_path ( GtkTreeModel * tm, GtkTreeIter * iter )
+{
+	BfmModel    * m = BFM_MODEL(tm);
+	GtkTreePath * path = gtk_tree_path_new();
+
+	gtk_tree_path_append_index( path, m->pos[ ITER_REC(iter) ] );
+	return path;
+}
+
+static void
+bfm_model_get_value ( GtkTreeModel * tm, GtkTreeIter * iter, gint col, GValue * val )
+{
+	BfmModel     * m = BFM_MODEL(tm);
+	const St_rec * r = bfm_model_rec( m, iter );
+
+	g_value_init( val, bfm_model_get_column_type( tm, col ) );
+	switch ( col )
+	{
+		case NAME_STR:
+			g_value_set_string( val, bfm_model_name( m, iter ) );
+			break;
+		case PERMS_UINT:
+			g_value_set_uint( val, r->mode );
+			break;
+		case SIZE_UINT64:
+			g_value_set_uint64( val, r->size );
+			break;
+		case MTIME_INT64:
+			g_value_set_int64( val, r->mtime );
+			break;
+		case IS_DIR:
+			g_value_set_boolean( val, S_ISDIR( r->mode ) );
+			break;
+	}
+}
+
+static gboolean
+bfm_model_iter_next ( GtkTreeModel * tm, GtkTreeIter * iter )
+{
+	BfmModel * m = BFM_MODEL(tm);
+	guint32    row = m->pos[ ITER_REC(iter) ] + 1;
+
+	if ( row >= m->n_rows )
+		return FALSE;
+
+	bfm_model_iter( m, m->rows[row], iter );
+	return TRUE;
+}
+
+static gboolean
+bfm_model_iter_nth_child ( GtkTreeModel * tm, GtkTreeIter * iter, GtkTreeIter * parent, gint n )
+{
+	BfmModel * m = BFM_MODEL(tm);
+
+	if ( parent || n < 0 || (guint32)n >= m->n_rows )
+		return FALSE;
+
+	bfm_model_iter( m, m->rows[n], iter );
+	return TRUE;
+}
+
+static gboolean
+bfm_model_iter_children ( GtkTreeModel * tm, GtkTreeIter * iter, GtkTreeIter * parent )
+{
+	return bfm_model_iter_nth_child( tm, iter, parent, 0 );
+}
+
+static gboolean
+bfm_model_iter_has_child ( GtkTreeModel * tm, GtkTreeIter * iter )
+{
+	(void)tm;
+	(void)iter;
+	return FALSE;
+}
+
+static gint
+bfm_model_iter_n_children ( GtkTreeModel * tm, GtkTreeIter * iter )
+{
+	return iter ? 0 : (gint)BFM_MODEL(tm)->n_rows;
+}
+
+static gboolean
+bfm_model_iter_parent ( GtkTreeModel * tm, GtkTreeIter * iter, GtkTreeIter * child )
+{
+	(void)tm;
+	(void)iter;
+	(void)child;
+	return FALSE;
+}
+
+static void
+bfm_model_tree_init ( GtkTreeModelIface * iface )
+{
+	iface->get_flags       = bfm_model_get_flags;
+	iface->get_n_columns   = bfm_model_get_n_columns;
+	iface->get_column_type = bfm_model_get_column_type;
+	iface->get_iter        = bfm_model_get_iter;
+	iface->get_path        = bfm_model_get_path;
+	iface->get_value       = bfm_model_get_value;
+	iface->iter_next       = bfm_model_iter_next;
+	iface->iter_children   = bfm_model_iter_children;
+	iface->iter_has_child  = bfm_model_iter_has_child;
+	iface->iter_n_children = bfm_model_iter_n_children;
+	iface->iter_nth_child  = bfm_model_iter_nth_child;
+	iface->iter_parent     = bfm_model_iter_parent;
+}
+
+/* Ordering */
+/* Sort mode for sort id, -1 if rows are not sorted */
+static gint
+bfm_model_sort_mode ( BfmModel * m )
+{
+	switch ( m->sort_id )
+	{
+		case NAME_STR:    return SORT_NAME;
+		case SIZE_UINT64: return SORT_SIZE;
+		case MTIME_INT64: return SORT_MTIME;
+		case SORT_EXT_ID: return SORT_EXT;
+		default:          return -1;
+	}
+}
+
+static gint
+bfm_model_cmp ( BfmModel * m, guint32 a, guint32 b )
+{
+	return bfm_sort_cmp( m->list, bfm_model_sort_mode(m), m->sort_order == GTK_SORT_DESCENDING, a, b );
+}
+
+static gboolean
+bfm_model_sorted ( BfmModel * m )
+{
+	return !m->frozen && bfm_model_sort_mode(m) >= 0;
+}
+
+/* Place where record belongs in sorted array */
+static guint32
+bfm_model_bsearch ( BfmModel * m, const guint32 * arr, guint32 n, guint32 rec )
+{
+	guint32 lo = 0;
+	guint32 hi = n;
+	guint32 mid;
+
+	while ( lo < hi )
+	{
+		mid = lo + ( hi - lo ) / 2;
+		if ( bfm_model_cmp( m, arr[mid], rec ) <= 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Record selection bit, selection is bit flipped by sel_inv */
+#define SEL_WORD(rec) ( (rec) / 64 )
+#define SEL_BIT(rec)  ( G_GUINT64_CONSTANT(1) << ( (rec) % 64 ) )
+
+/* Set selection of one record */
+static void
+bfm_model_sel_set ( BfmModel * m, guint32 rec, gboolean state )
+{
+	if ( !state != !m->sel_inv )
+		m->sel[ SEL_WORD(rec) ] |= SEL_BIT(rec);
+	else
+		m->sel[ SEL_WORD(rec) ] &= ~SEL_BIT(rec);
+}
+
+/* Check selection of one record */
+static gboolean
+bfm_model_sel_get ( BfmModel * m, guint32 rec )
+{
+	return !( m->sel[ SEL_WORD(rec) ] & SEL_BIT(rec) ) != !m->sel_inv;
+}
+
+/* Make per-record arrays as large as listing */
+static void
+bfm_model_grow_pos ( BfmModel * m )
+{
+	if ( m->list->cap <= m->pos_cap )
+		return;
+
+	m->pos_cap = m->list->cap;
+	m->pos = g_renew( guint32, m->pos, m->pos_cap );
+	m->all_pos = g_renew( guint32, m->all_pos, m->pos_cap );
+	m->sel = g_renew( guint64, m->sel, SEL_WORD( m->pos_cap ) + 1 );
+}
+
+/* Recalculate record positions for rows starting with given one */
+static void
+bfm_model_update_pos ( BfmModel * m, guint32 from )
+{
+	guint32 i;
+
+	for ( i = from; i < m->n_rows; i++ )
+		m->pos[ m->rows[i] ] = i;
+}
+
+/* Put value into array at index */
+static void
+bfm_model_insert ( guint32 * arr, guint32 * n, guint32 at, guint32 val )
+{
+	memmove( arr + at + 1, arr + at, ( * n - at ) * sizeof(guint32) );
+	arr[at] = val;
+	( * n )++;
+}
+
+/* Take value out of array at index */
+static void
+bfm_model_delete ( guint32 * arr, guint32 * n, guint32 at )
+{
+	memmove( arr + at, arr + at + 1, ( * n - at - 1 ) * sizeof(guint32) );
+	( * n )--;
+}
+
+/* Recalculate indices in all for records between from and to */
+static void
+bfm_model_update_all ( BfmModel * m, guint32 from, guint32 to )
+{
+	guint32 i;
+
+	for ( i = from; i < to; i++ )
+		m->all_pos[ m->all[i] ] = i;
+}
+
+/* Make visible rows from all records marked by filter */
+static void
+bfm_model_fill_rows ( BfmModel * m )
+{
+	guint8  * match;
+	guint32   i;
+
+	for ( i = 0; i < m->list->len; i++ )
+		m->pos[i] = MODEL_HIDDEN;
+
+	m->n_rows = 0;
+	if ( !bfm_filter_active( &m->filter ) )
+	{
+		memcpy( m->rows, m->all, m->n_all * sizeof(guint32) );
+		m->n_rows = m->n_all;
+	}
+	else
+	{
+		match = g_malloc( m->list->len );
+		bfm_filter_mark( &m->filter, m->list, match );
+		for ( i = 0; i < m->n_all; i++ )
+			if ( match[ m->all[i] ] )
+				m->rows[ m->n_rows++ ] = m->all[i];
+		g_free(match);
+	}
+
+	bfm_model_update_pos( m, 0 );
+}
+
+/* Take order of visible rows from all, emit single reorder signal if any moved */
+static void
+bfm_model_reorder ( BfmModel * m )
+{
+	GtkTreePath * path;
+	gint        * order;
+	guint32       i;
+	guint32       n = 0;
+	gboolean      moved = FALSE;
+
+	/* Old positions are still in pos array */
+	order = g_new( gint, m->n_rows + 1 );
+	for ( i = 0; i < m->n_all; i++ )
+	{
+		if ( m->pos[ m->all[i] ] != MODEL_HIDDEN )
+		{
+			order[n] = m->pos[ m->all[i] ];
+			moved |= order[n] != (gint)n;
+			m->rows[n++] = m->all[i];
+		}
+	}
+	bfm_model_update_pos( m, 0 );
+
+	if ( moved )
+	{
+		path = gtk_tree_path_new();
+		gtk_tree_model_rows_reordered( GTK_TREE_MODEL(m), path, NULL, order );
+		gtk_tree_path_free(path);
+	}
+	g_free(order);
+}
+
+/* Sort all records, emit single reorder signal for visible ones */
+static void
+bfm_model_sort ( BfmModel * m )
+{
+	if ( !bfm_model_sorted(m) || m->n_all < 2 )
+		return;
+
+	bfm_sort_rows( m->list, bfm_model_sort_mode(m), m->sort_order == GTK_SORT_DESCENDING, m->all, m->n_all );
+	bfm_model_update_all( m, 0, m->n_all );
+	bfm_model_reorder(m);
+}
+
+/* GtkTreeSortable interface */
+static gboolean
+bfm_model_get_sort_column_id ( GtkTreeSortable * ts, gint * id, GtkSortType * order )
+{
+	BfmModel * m = BFM_MODEL(ts);
+
+	if ( id )
+		* id = m->sort_id;
+	if ( order )
+		* order = m->sort_order;
+
+	return m->sort_id >= 0;
+}
+
+static void
+bfm_model_set_sort_column_id ( GtkTreeSortable * ts, gint id, GtkSortType order )
+{
+	BfmModel * m = BFM_MODEL(ts);
+
+	if ( m->sort_id == id && m->sort_order == order )
+		return;
+
+	m->sort_id = id;
+	m->sort_order = order;
+
+	gtk_tree_sortable_sort_column_changed(ts);
+	bfm_model_sort(m);
+}
+
+/* Orders are built in, custom functions are not supported */
+static void
+bfm_model_set_sort_func ( GtkTreeSortable * ts, gint id, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy )
+{
+	(void)ts;
+	(void)id;
+	(void)func;
+	if ( destroy )
+		destroy(data);
+}
+
+static gboolean
+bfm_model_has_default_sort_func ( GtkTreeSortable * ts )
+{
+	(void)ts;
+	return FALSE;
+}
+
+static void
+bfm_model_sortable_init ( GtkTreeSortableIface * iface )
+{
+	iface->get_sort_column_id    = bfm_model_get_sort_column_id;
+	iface->set_sort_column_id    = bfm_model_set_sort_column_id;
+	iface->set_sort_func         = bfm_model_set_sort_func;
+	iface->has_default_sort_func = bfm_model_has_default_sort_func;
+}
+
+/* Public */
+BfmModel *
+bfm_model_new ( void )
+{
+	return g_object_new( BFM_TYPE_MODEL, NULL );
+}
+
+/* Drop all rows without signals, model must be detached from views */
+void
+bfm_model_clear ( BfmModel * m )
+{
+	bfm_listing_clear( m->list );
+	m->n_all = 0;
+	m->n_rows = 0;
+	m->sel_inv = FALSE;
+	m->sel_anchor = LISTING_NONE;
+	m->stamp++;
+}
+
+/* Make room for one more record */
+static void
+bfm_model_grow ( BfmModel * m )
+{
+	if ( m->n_all == m->all_cap )
+	{
+		m->all_cap = m->all_cap ? m->all_cap * 2 : 256;
+		m->all = g_renew( guint32, m->all, m->all_cap );
+		m->rows = g_renew( guint32, m->rows, m->all_cap );
+	}
+
+	bfm_model_grow_pos(m);
+}
+
+/* Make room for every record of listing */
+static void
+bfm_model_reserve ( BfmModel * m )
+{
+	if ( m->list->len > m->all_cap )
+	{
+		m->all_cap = m->list->len;
+		m->all = g_renew( guint32, m->all, m->all_cap );
+		m->rows = g_renew( guint32, m->rows, m->all_cap );
+	}
+
+	bfm_model_grow_pos(m);
+}
+
+/* Put changed records back into all, records from first_new on are new.
+ * Sorted: changed ones are taken out, sorted alone and merged with the rest.
+ * Unsorted: removed ones are taken out and new ones appended */
+static void
+bfm_model_merge ( BfmModel * m, const guint32 * ch, guint32 n, guint32 first_new )
+{
+	guint8   * mark = g_malloc0( m->list->len );
+	guint32  * add = g_new( guint32, n + 1 );
+	guint32    n_add = 0;
+	guint32    i;
+	guint32    j;
+	guint32    k = 0;
+	gboolean   sorted = bfm_model_sorted(m);
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( mark[ ch[i] ] )
+			continue;
+		mark[ ch[i] ] = 1;
+		if ( m->list->rec[ ch[i] ].mode && ( sorted || ch[i] >= first_new ) )
+			add[ n_add++ ] = ch[i];
+	}
+
+	for ( i = 0; i < m->n_all; i++ )
+		if ( sorted ? !mark[ m->all[i] ] : m->list->rec[ m->all[i] ].mode != 0 )
+			m->all[ k++ ] = m->all[i];
+	m->n_all = k + n_add;
+
+	/* Merge from the end in place, kept records go first among equal ones */
+	if ( sorted )
+	{
+		bfm_sort_rows( m->list, bfm_model_sort_mode(m), m->sort_order == GTK_SORT_DESCENDING, add, n_add );
+		for ( i = k, j = n_add, k = m->n_all; j; )
+			m->all[ --k ] = i && bfm_model_cmp( m, m->all[ i - 1 ], add[ j - 1 ] ) > 0 ? m->all[ --i ] : add[ --j ];
+	}
+	else
+		memcpy( m->all + k, add, n_add * sizeof(guint32) );
+
+	bfm_model_update_all( m, 0, m->n_all );
+	g_free(add);
+	g_free(mark);
+}
+
+/* Replace listing without signals, model must be detached from views.
+ * Rows are made for live records of new listing, old listing is returned */
+St_listing *
+bfm_model_load ( BfmModel * m, St_listing * l )
+{
+	St_listing * old = m->list;
+	guint32      i;
+
+	m->list = l ? l : bfm_listing_new();
+	m->frozen = FALSE;
+	m->n_all = 0;
+	m->stamp++;
+
+	/* Nothing is selected in new listing */
+	bfm_model_reserve(m);
+	if ( m->pos_cap )
+		memset( m->sel, 0, ( SEL_WORD( m->pos_cap ) + 1 ) * sizeof(guint64) );
+	m->sel_inv = FALSE;
+	m->sel_anchor = LISTING_NONE;
+
+	for ( i = 0; i < m->list->len; i++ )
+		if ( m->list->rec[i].mode )
+			m->all[ m->n_all++ ] = i;
+
+	if ( bfm_model_sorted(m) )
+		bfm_sort_rows( m->list, bfm_model_sort_mode(m), m->sort_order == GTK_SORT_DESCENDING, m->all, m->n_all );
+	bfm_model_update_all( m, 0, m->n_all );
+	bfm_model_fill_rows(m);
+
+	return old;
+}
+
+/* Apply changed filter without signals, model must be detached from views.
+ * Narrowing checks only visible rows, filter must not show anything new */
+void
+bfm_model_refilter ( BfmModel * m, gboolean narrow )
+{
+	guint32 i;
+	guint32 n = 0;
+
+	m->stamp++;
+
+	if ( !narrow )
+	{
+		/* Hidden records come back unselected, like rows which were removed */
+		for ( i = 0; i < m->list->len; i++ )
+			if ( m->pos[i] == MODEL_HIDDEN )
+				bfm_model_sel_set( m, i, FALSE );
+		bfm_model_fill_rows(m);
+		return;
+	}
+
+	for ( i = 0; i < m->n_rows; i++ )
+	{
+		if ( bfm_filter_match( &m->filter, m->list, m->rows[i] ) )
+			m->rows[n++] = m->rows[i];
+		else
+			m->pos[ m->rows[i] ] = MODEL_HIDDEN;
+	}
+	m->n_rows = n;
+	bfm_model_update_pos( m, 0 );
+}
+
+/* Append rows unsorted until thawed, for filling large listings */
+void
+bfm_model_freeze ( BfmModel * m )
+{
+	m->frozen = TRUE;
+}
+
+/* Sort rows added while frozen */
+void
+bfm_model_thaw ( BfmModel * m )
+{
+	if ( !m->frozen )
+		return;
+
+	m->frozen = FALSE;
+	bfm_model_sort(m);
+}
+
+/* Add entry, in sorted position if sorting is active */
+guint32
+bfm_model_add ( BfmModel * m, const St_entry * e )
+{
+	GtkTreePath * path;
+	GtkTreeIter   iter;
+	guint32       rec = bfm_listing_add( m->list, e );
+	guint32       row;
+	gboolean      sorted = bfm_model_sorted(m);
+
+	bfm_model_grow(m);
+
+	row = sorted ? bfm_model_bsearch( m, m->all, m->n_all, rec ) : m->n_all;
+	bfm_model_insert( m->all, &m->n_all, row, rec );
+	bfm_model_update_all( m, row, m->n_all );
+
+	m->pos[rec] = MODEL_HIDDEN;
+	bfm_model_sel_set( m, rec, FALSE );
+	if ( !bfm_filter_match( &m->filter, m->list, rec ) )
+		return rec;
+
+	row = sorted ? bfm_model_bsearch( m, m->rows, m->n_rows, rec ) : m->n_rows;
+	bfm_model_insert( m->rows, &m->n_rows, row, rec );
+	bfm_model_update_pos( m, row );
+
+	bfm_model_iter( m, rec, &iter );
+	path = gtk_tree_path_new_from_indices( row, -1 );
+	gtk_tree_model_row_inserted( GTK_TREE_MODEL(m), path, &iter );
+	gtk_tree_path_free(path);
+
+	return rec;
+}
+
+/* Update record, moving its row if order changes.
+ * Visibility depends on name only, so it stays the same */
+void
+bfm_model_set ( BfmModel * m, guint32 rec, const St_entry * e )
+{
+	GtkTreePath * path;
+	GtkTreeIter   iter;
+	gint        * order;
+	guint32       from = m->pos[rec];
+	guint32       to;
+	guint32       i;
+
+	bfm_listing_set( m->list, rec, e );
+
+	if ( bfm_model_sorted(m) )
+	{
+		/* Take record out and find new place for it, only records between move */
+		i = m->all_pos[rec];
+		bfm_model_delete( m->all, &m->n_all, i );
+		to = bfm_model_bsearch( m, m->all, m->n_all, rec );
+		bfm_model_insert( m->all, &m->n_all, to, rec );
+		bfm_model_update_all( m, MIN( i, to ), MAX( i, to ) + 1 );
+
+		if ( from != MODEL_HIDDEN )
+		{
+			bfm_model_delete( m->rows, &m->n_rows, from );
+			to = bfm_model_bsearch( m, m->rows, m->n_rows, rec );
+			bfm_model_insert( m->rows, &m->n_rows, to, rec );
+
+			if ( to != from )
+			{
+				order = g_new( gint, m->n_rows );
+				for ( i = 0; i < m->n_rows; i++ )
+					order[i] = m->pos[ m->rows[i] ];
+				bfm_model_update_pos( m, MIN( from, to ) );
+
+				path = gtk_tree_path_new();
+				gtk_tree_model_rows_reordered( GTK_TREE_MODEL(m), path, NULL, order );
+				gtk_tree_path_free(path);
+				g_free(order);
+			}
+		}
+	}
+
+	if ( from == MODEL_HIDDEN )
+		return;
+
+	bfm_model_iter( m, rec, &iter );
+	path = gtk_tree_path_new_from_indices( m->pos[rec], -1 );
+	gtk_tree_model_row_changed( GTK_TREE_MODEL(m), path, &iter );
+	gtk_tree_path_free(path);
+}
+
+/* Update batch of records in place, rows are ordered once with single reorder signal.
+ * Visibility depends on name only, so it stays the same */
+void
+bfm_model_set_batch ( BfmModel * m, const guint32 * recs, const St_entry * e, guint32 n )
+{
+	GtkTreePath * path;
+	GtkTreeIter   iter;
+	guint32       i;
+
+	for ( i = 0; i < n; i++ )
+		bfm_listing_set( m->list, recs[i], &e[i] );
+
+	if ( bfm_model_sorted(m) && n )
+	{
+		bfm_model_merge( m, recs, n, m->list->len );
+		bfm_model_reorder(m);
+	}
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( m->pos[ recs[i] ] == MODEL_HIDDEN )
+			continue;
+
+		bfm_model_iter( m, recs[i], &iter );
+		path = gtk_tree_path_new_from_indices( m->pos[ recs[i] ], -1 );
+		gtk_tree_model_row_changed( GTK_TREE_MODEL(m), path, &iter );
+		gtk_tree_path_free(path);
+	}
+}
+
+/* Remove record row */
+void
+bfm_model_remove ( BfmModel * m, guint32 rec )
+{
+	GtkTreePath * path;
+	guint32       row = m->pos[rec];
+	guint32       i = m->all_pos[rec];
+
+	bfm_model_delete( m->all, &m->n_all, i );
+	bfm_model_update_all( m, i, m->n_all );
+	bfm_listing_remove( m->list, rec );
+	m->pos[rec] = MODEL_HIDDEN;
+	if ( m->sel_anchor == rec )
+		m->sel_anchor = LISTING_NONE;
+
+	if ( row == MODEL_HIDDEN )
+		return;
+
+	bfm_model_delete( m->rows, &m->n_rows, row );
+	bfm_model_update_pos( m, row );
+
+	path = gtk_tree_path_new_from_indices( row, -1 );
+	gtk_tree_model_row_deleted( GTK_TREE_MODEL(m), path );
+	gtk_tree_path_free(path);
+}
+
+/* Reclaim slots of removed records, live ones get new indices.
+ * Model must be detached from views, rows are filled afterwards */
+static void
+bfm_model_compact ( BfmModel * m )
+{
+	guint32 * map = g_new( guint32, m->list->len + 1 );
+	guint64 * sel = g_new0( guint64, SEL_WORD( m->pos_cap ) + 1 );
+	guint32   len = m->list->len;
+	guint32   i;
+
+	bfm_listing_compact( m->list, map );
+
+	/* Bits move as they are, inversion still applies */
+	for ( i = 0; i < len; i++ )
+		if ( map[i] != LISTING_NONE && ( m->sel[ SEL_WORD(i) ] & SEL_BIT(i) ) )
+			sel[ SEL_WORD( map[i] ) ] |= SEL_BIT( map[i] );
+	g_free( m->sel );
+	m->sel = sel;
+	if ( m->sel_anchor != LISTING_NONE )
+		m->sel_anchor = map[ m->sel_anchor ];
+
+	for ( i = 0; i < m->n_all; i++ )
+		m->all[i] = map[ m->all[i] ];
+	bfm_model_update_all( m, 0, m->n_all );
+
+	g_free(map);
+}
+
+/* Apply batch of created, changed and removed entries without signals, model must be detached from views.
+ * Entries without mode are removed, rows are ordered once for whole batch */
+void
+bfm_model_update ( BfmModel * m, const St_entry * e, guint32 n )
+{
+	guint32 * ch = g_new( guint32, n + 1 );
+	guint32   first_new = m->list->len;
+	guint32   rec;
+	guint32   i;
+	guint32   k = 0;
+
+	for ( i = 0; i < n; i++ )
+	{
+		rec = bfm_listing_find( m->list, e[i].name );
+
+		/* Created or changed */
+		if ( e[i].mode )
+		{
+			if ( rec == LISTING_NONE )
+			{
+				rec = bfm_listing_add( m->list, &e[i] );
+				bfm_model_reserve(m);
+				bfm_model_sel_set( m, rec, FALSE );
+			}
+			else
+				bfm_listing_set( m->list, rec, &e[i] );
+		}
+		/* Removed */
+		else if ( rec != LISTING_NONE )
+		{
+			bfm_listing_remove( m->list, rec );
+			if ( m->sel_anchor == rec )
+				m->sel_anchor = LISTING_NONE;
+		}
+		else
+			continue;
+
+		ch[ k++ ] = rec;
+	}
+
+	m->stamp++;
+	bfm_model_merge( m, ch, k, first_new );
+	if ( m->list->dead >= COMPACT_MIN && m->list->dead > m->list->len / COMPACT_PART )
+		bfm_model_compact(m);
+	bfm_model_fill_rows(m);
+	g_free(ch);
+}
+
+/* Find record by file name */
+guint32
+bfm_model_find ( BfmModel * m, const char * name )
+{
+	return bfm_listing_find( m->list, name );
+}
+
+/* Check if row of iterator is selected */
+gboolean
+bfm_model_is_selected ( BfmModel * m, GtkTreeIter * iter )
+{
+	return bfm_model_sel_get( m, ITER_REC(iter) );
+}
+
+/* Records of selected rows in row order, n is set to their count */
+guint32 *
+bfm_model_selected ( BfmModel * m, guint32 * n )
+{
+	guint32 * rec = g_new( guint32, m->n_rows + 1 );
+	guint32   i;
+
+	* n = 0;
+	for ( i = 0; i < m->n_rows; i++ )
+		if ( bfm_model_sel_get( m, m->rows[i] ) )
+			rec[ ( * n )++ ] = m->rows[i];
+
+	return rec;
+}
+
+/* Select or unselect records marked by filter */
+void
+bfm_model_select ( BfmModel * m, const guint8 * marks, gboolean state )
+{
+	guint32 i;
+
+	for ( i = 0; i < m->n_rows; i++ )
+		if ( marks[ m->rows[i] ] )
+			bfm_model_sel_set( m, m->rows[i], state );
+}
+
+/* Select or unselect one record */
+void
+bfm_model_select_rec ( BfmModel * m, guint32 rec, gboolean state )
+{
+	bfm_model_sel_set( m, rec, state );
+}
+
+/* Select rows between two, both included */
+void
+bfm_model_select_rows ( BfmModel * m, guint32 from, guint32 to )
+{
+	guint32 i;
+
+	for ( i = MIN( from, to ); i <= MAX( from, to ) && i < m->n_rows; i++ )
+		bfm_model_sel_set( m, m->rows[i], TRUE );
+}
+
+/* Select all rows or none, bits are cleared and read through inversion */
+void
+bfm_model_select_all ( BfmModel * m, gboolean state )
+{
+	if ( m->pos_cap )
+		memset( m->sel, 0, ( SEL_WORD( m->pos_cap ) + 1 ) * sizeof(guint64) );
+	m->sel_inv = state;
+}
+
+/* Invert selection of all rows at once. Hidden records are unselected when shown again */
+void
+bfm_model_invert ( BfmModel * m )
+{
+	m->sel_inv = !m->sel_inv;
+}
@@ -0,0 +1,93 @@
+#ifndef BFM_MODEL_H
+#define BFM_MODEL_H
+
+#include <gtk/gtk.h>
+
+#include "filter.h"
+#include "listing.h"
+
+#define BFM_TYPE_MODEL  ( bfm_model_get_type() )
+#define BFM_MODEL(o)    ( G_TYPE_CHECK_INSTANCE_CAST( (o), BFM_TYPE_MODEL, BfmModel ) )
+#define BFM_IS_MODEL(o) ( G_TYPE_CHECK_INSTANCE_TYPE( (o), BFM_TYPE_MODEL ) )
+
+/* Enums */
+/* Columns for listed files */
+enum ListColumns
+{
+	NAME_STR,
+	PERMS_UINT,
+	SIZE_UINT64,
+	MTIME_INT64,
+	IS_DIR,
+	N_COLUMNS
+};
+
+/* Sort id for ordering by extension, it has no column */
+#define SORT_EXT_ID N_COLUMNS
+
+/* Position of record hidden by filter */
+#define MODEL_HIDDEN ( (guint32)-1 )
+
+/* Structs */
+/* List model over flat listing, rows hold record indices */
+typedef struct
+{
+	GObject                parent;
+	St_listing           * list;
+	/* All live records in sort order */
+	guint32              * all;
+	guint32                n_all;
+	guint32                all_cap;
+	/* Record for each row, subset of all passing filter */
+	guint32              * rows;
+	guint32                n_rows;
+	/* Row for each record, MODEL_HIDDEN if it has none */
+	guint32              * pos;
+	/* Index in all for each live record */
+	guint32              * all_pos;
+	guint32                pos_cap;
+	/* Selection bit for each record, all bits are read inverted if sel_inv is set */
+	guint64              * sel;
+	gboolean               sel_inv;
+	/* Record where range selection starts, LISTING_NONE if there is none */
+	guint32                sel_anchor;
+	St_filter              filter;
+	gint                   stamp;
+	/* Sorting */
+	gint                   sort_id;
+	GtkSortType            sort_order;
+	/* Rows are appended unsorted */
+	gboolean               frozen;
+} BfmModel;
+
+typedef struct
+{
+	GObjectClass parent_class;
+} BfmModelClass;
+
+/* Protos */
+BfmModel *     bfm_model_new      ( void );
+GType          bfm_model_get_type ( void );
+const St_rec * bfm_model_rec      ( BfmModel *, GtkTreeIter * );
+const char *   bfm_model_name     ( BfmModel *, GtkTreeIter * );
+St_listing *   bfm_model_load     ( BfmModel *, St_listing * );
+guint32        bfm_model_add      ( BfmModel *, const St_entry * );
+guint32        bfm_model_find     ( BfmModel *, const char * );
+guint32 *      bfm_model_selected ( BfmModel *, guint32 * );
+gboolean       bfm_model_is_selected ( BfmModel *, GtkTreeIter * );
+void           bfm_model_clear    ( BfmModel * );
+void           bfm_model_freeze   ( BfmModel * );
+void           bfm_model_thaw     ( BfmModel * );
+void           bfm_model_iter     ( BfmModel *, guint32, GtkTreeIter * );
+void           bfm_model_refilter ( BfmModel *, gboolean );
+void           bfm_model_remove   ( BfmModel *, guint32 );
+void           bfm_model_invert   ( BfmModel * );
+void           bfm_model_select   ( BfmModel *, const guint8 *, gboolean );
+void           bfm_model_select_all ( BfmModel *, gboolean );
+void           bfm_model_select_rec ( BfmModel *, guint32, gboolean );
+void           bfm_model_select_rows ( BfmModel *, guint32, guint32 );
+void           bfm_model_set      ( BfmModel *, guint32, const St_entry * );
+void           bfm_model_set_batch ( BfmModel *, const guint32 *, const St_entry *, guint32 );
+void           bfm_model_update   ( BfmModel *, const St_entry *, guint32 );
+
+#endif
@@ -0,0 +1,571 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "rename.h"
+
+/* Index of no name */
+#define RENAME_NONE ( (size_t)-1 )
+
+/* Structs */
+struct St_rename
+{
+	size_t     n;
+	char    ** from;
+	/* NULL until new names are made */
+	char    ** to;
+	/* One of RenameProblem */
+	int      * problem;
+	/* errno of failed rename */
+	int      * error;
+};
+
+/* Name with its position, sorted for lookups */
+typedef struct
+{
+	const char * name;
+	size_t       i;
+} St_rename_key;
+
+/* Growing string */
+typedef struct
+{
+	char   * s;
+	size_t   len;
+	size_t   cap;
+} St_rename_buf;
+
+/* Functions */
+/* Copy names, new names are same until they are made */
+St_rename *
+bfm_rename_new ( char * const * names, size_t n )
+{
+	St_rename * r = calloc( 1, sizeof(St_rename) );
+	size_t      i;
+
+	r->n = n;
+	r->from = malloc( n * sizeof(char *) );
+	r->to = malloc( n * sizeof(char *) );
+	r->problem = calloc( n, sizeof(int) );
+	r->error = calloc( n, sizeof(int) );
+
+	for ( i = 0; i < n; i++ )
+	{
+		r->from[i] = strdup( names[i] );
+		r->to[i] = strdup( names[i] );
+	}
+
+	return r;
+}
+
+void
+bfm_rename_free ( St_rename * r )
+{
+	size_t i;
+
+	for ( i = 0; i < r->n; i++ )
+	{
+		free( r->from[i] );
+		free( r->to[i] );
+	}
+
+	free( r->from );
+	free( r->to );
+	free( r->problem );
+	free( r->error );
+	free(r);
+}
+
+size_t
+bfm_rename_count ( St_rename * r )
+{
+	return r->n;
+}
+
+const char *
+bfm_rename_from ( St_rename * r, size_t i )
+{
+	return r->from[i];
+}
+
+const char *
+bfm_rename_to ( St_rename * r, size_t i )
+{
+	return r->to[i];
+}
+
+/* One of RenameProblem, valid after bfm_rename_check() */
+int
+bfm_rename_problem ( St_rename * r, size_t i )
+{
+	return r->problem[i];
+}
+
+/* errno of rename which failed in bfm_rename_apply(), 0 if it was done */
+int
+bfm_rename_error ( St_rename * r, size_t i )
+{
+	return r->error[i];
+}
+
+static void
+bfm_rename_put ( St_rename_buf * b, const char * s, size_t len )
+{
+	if ( b->len + len + 1 > b->cap )
+	{
+		b->cap = ( b->len + len + 1 ) * 2;
+		b->s = realloc( b->s, b->cap );
+	}
+
+	memcpy( b->s + b->len, s, len );
+	b->len += len;
+	b->s[ b->len ] = '\0';
+}
+
+/* Start of extension, end of name if it has none. Leading dot does not start extension */
+static const char *
+bfm_rename_ext ( const char * name )
+{
+	const char * dot = strrchr( name + 1, '.' );
+
+	return dot && name[0] ? dot : name + strlen(name);
+}
+
+/* Template with numbered runs of # and * for old name */
+static char *
+bfm_rename_sequence ( const char * tpl, const char * name, size_t num )
+{
+	St_rename_buf   b = { NULL, 0, 0 };
+	const char    * ext = bfm_rename_ext(name);
+	char            digits[32];
+	int             width;
+
+	bfm_rename_put( &b, "", 0 );
+	for ( ; * tpl; tpl++ )
+	{
+		if ( * tpl == '#' )
+		{
+			for ( width = 1; tpl[1] == '#'; width++ )
+				tpl++;
+			bfm_rename_put( &b, digits, snprintf( digits, sizeof(digits), "%0*zu", width, num ) );
+		}
+		else if ( * tpl == '*' )
+			bfm_rename_put( &b, name, ext - name );
+		else
+			bfm_rename_put( &b, tpl, 1 );
+	}
+	bfm_rename_put( &b, ext, strlen(ext) );
+
+	return b.s;
+}
+
+/* Replace all matches, \0 to \9 in replacement insert groups and \\ inserts backslash */
+static char *
+bfm_rename_regex ( const regex_t * re, const char * repl, const char * name )
+{
+	St_rename_buf   b = { NULL, 0, 0 };
+	regmatch_t      m[10];
+	const char    * s = name;
+	const char    * p;
+	int             flags = 0;
+	int             after = 0;
+	int             g;
+
+	bfm_rename_put( &b, "", 0 );
+	while ( regexec( re, s, 10, m, flags ) == 0 )
+	{
+		flags = REG_NOTBOL;
+
+		/* No empty match right after other match */
+		if ( after && m[0].rm_eo == 0 )
+		{
+			if ( !* s )
+				break;
+			bfm_rename_put( &b, s++, 1 );
+			after = 0;
+			continue;
+		}
+
+		bfm_rename_put( &b, s, m[0].rm_so );
+		for ( p = repl; * p; p++ )
+		{
+			if ( p[0] == '\\' && p[1] >= '0' && p[1] <= '9' )
+			{
+				g = * ++p - '0';
+				if ( m[g].rm_so >= 0 )
+					bfm_rename_put( &b, s + m[g].rm_so, m[g].rm_eo - m[g].rm_so );
+			}
+			else if ( p[0] == '\\' && p[1] == '\\' )
+				bfm_rename_put( &b, ++p, 1 );
+			else
+				bfm_rename_put( &b, p, 1 );
+		}
+
+		after = m[0].rm_eo > m[0].rm_so;
+		s += m[0].rm_eo;
+
+		/* Empty match moves on by one character */
+		if ( !after )
+		{
+			if ( !* s )
+				break;
+			bfm_rename_put( &b, s++, 1 );
+		}
+	}
+	bfm_rename_put( &b, s, strlen(s) );
+
+	return b.s;
+}
+
+/* Change case of characters of current locale, invalid bytes are kept */
+static char *
+bfm_rename_case ( const char * name, int upper )
+{
+	St_rename_buf   b = { NULL, 0, 0 };
+	mbstate_t       in;
+	mbstate_t       out;
+	wchar_t         wc;
+	char            mb[MB_LEN_MAX];
+	size_t          len;
+	size_t          n;
+	size_t          rest = strlen(name);
+
+	memset( &in, 0, sizeof(in) );
+	memset( &out, 0, sizeof(out) );
+
+	bfm_rename_put( &b, "", 0 );
+	while ( rest )
+	{
+		len = mbrtowc( &wc, name, rest, &in );
+		if ( len == (size_t)-1 || len == (size_t)-2 || len == 0 )
+		{
+			memset( &in, 0, sizeof(in) );
+			bfm_rename_put( &b, name, 1 );
+			len = 1;
+		}
+		else
+		{
+			wc = upper ? (wchar_t)towupper(wc) : (wchar_t)towlower(wc);
+			n = wcrtomb( mb, wc, &out );
+			if ( n == (size_t)-1 )
+				bfm_rename_put( &b, name, len );
+			else
+				bfm_rename_put( &b, mb, n );
+		}
+
+		name += len;
+		rest -= len;
+	}
+
+	return b.s;
+}
+
+/* Make new names of given kind, names in text are set by bfm_rename_parse().
+ * Returns -1 if regex is not valid */
+int
+bfm_rename_map ( St_rename * r, int kind, const char * arg, const char * repl )
+{
+	regex_t re;
+	size_t  i;
+	char  * s;
+
+	if ( kind == RENAME_REGEX && regcomp( &re, arg, REG_EXTENDED ) != 0 )
+		return -1;
+
+	for ( i = 0; i < r->n; i++ )
+	{
+		switch ( kind )
+		{
+			case RENAME_SEQUENCE:
+				s = bfm_rename_sequence( arg, r->from[i], i + 1 );
+				break;
+			case RENAME_REGEX:
+				s = bfm_rename_regex( &re, repl ? repl : "", r->from[i] );
+				break;
+			case RENAME_LOWER:
+			case RENAME_UPPER:
+				s = bfm_rename_case( r->from[i], kind == RENAME_UPPER );
+				break;
+			default:
+				s = strdup( r->from[i] );
+				break;
+		}
+
+		free( r->to[i] );
+		r->to[i] = s;
+	}
+
+	if ( kind == RENAME_REGEX )
+		regfree(&re);
+
+	return 0;
+}
+
+/* Old names one per line for editing, NULL if some name contains newline */
+char *
+bfm_rename_text ( St_rename * r, size_t * len )
+{
+	St_rename_buf b = { NULL, 0, 0 };
+	size_t        i;
+
+	bfm_rename_put( &b, "", 0 );
+	for ( i = 0; i < r->n; i++ )
+	{
+		if ( strchr( r->from[i], '\n' ) )
+		{
+			free( b.s );
+			errno = EINVAL;
+			return NULL;
+		}
+
+		bfm_rename_put( &b, r->from[i], strlen( r->from[i] ) );
+		bfm_rename_put( &b, "\n", 1 );
+	}
+
+	* len = b.len;
+	return b.s;
+}
+
+/* Take edited names, line of each name has to stay on its place.
+ * Returns -1 if number of lines changed */
+int
+bfm_rename_parse ( St_rename * r, const char * text, size_t len )
+{
+	const char * end = text + len;
+	const char * nl;
+	size_t       lines = 0;
+	size_t       i;
+
+	/* Last newline is optional */
+	if ( len && end[-1] == '\n' )
+		end--;
+
+	for ( nl = text; len && nl <= end; nl++ )
+		if ( nl == end || * nl == '\n' )
+			lines++;
+	if ( lines != r->n )
+		return -1;
+
+	for ( i = 0; i < r->n; i++ )
+	{
+		nl = memchr( text, '\n', end - text );
+		if ( !nl )
+			nl = end;
+
+		free( r->to[i] );
+		r->to[i] = strndup( text, nl - text );
+		text = nl + 1;
+	}
+
+	return 0;
+}
+
+static int
+bfm_rename_key_cmp ( const void * a, const void * b )
+{
+	return strcmp( ( (const St_rename_key *)a )->name, ( (const St_rename_key *)b )->name );
+}
+
+/* Sorted keys of old or new names */
+static St_rename_key *
+bfm_rename_keys ( St_rename * r, int to )
+{
+	St_rename_key * k = malloc( ( r->n ? r->n : 1 ) * sizeof(St_rename_key) );
+	size_t          i;
+
+	for ( i = 0; i < r->n; i++ )
+	{
+		k[i].name = to ? r->to[i] : r->from[i];
+		k[i].i = i;
+	}
+	qsort( k, r->n, sizeof(St_rename_key), bfm_rename_key_cmp );
+
+	return k;
+}
+
+/* Position of old name, RENAME_NONE if it is not renamed */
+static size_t
+bfm_rename_find ( St_rename * r, const St_rename_key * k, const char * name )
+{
+	St_rename_key   key = { name, 0 };
+	St_rename_key * f = bsearch( &key, k, r->n, sizeof(St_rename_key), bfm_rename_key_cmp );
+
+	return f ? f->i : RENAME_NONE;
+}
+
+/* Find renames which can not be done, returns their count */
+size_t
+bfm_rename_check ( St_rename * r, int dfd )
+{
+	St_rename_key * from = bfm_rename_keys( r, 0 );
+	St_rename_key * to = bfm_rename_keys( r, 1 );
+	struct stat     st;
+	size_t          bad = 0;
+	size_t          i;
+	const char    * s;
+
+	for ( i = 0; i < r->n; i++ )
+	{
+		s = r->to[i];
+		if ( !* s || strchr( s, '/' ) || strcmp( s, "." ) == 0 || strcmp( s, ".." ) == 0 || strlen(s) > NAME_MAX )
+			r->problem[i] = RENAME_INVALID;
+		else if ( strcmp( s, r->from[i] ) != 0 && bfm_rename_find( r, from, s ) == RENAME_NONE
+		       && fstatat( dfd, s, &st, AT_SYMLINK_NOFOLLOW ) == 0 )
+			r->problem[i] = RENAME_EXISTS;
+		else
+			r->problem[i] = RENAME_OK;
+	}
+
+	/* Equal new names are next to each other */
+	for ( i = 1; i < r->n; i++ )
+	{
+		if ( strcmp( to[ i - 1 ].name, to[i].name ) == 0 )
+		{
+			if ( r->problem[ to[ i - 1 ].i ] == RENAME_OK )
+				r->problem[ to[ i - 1 ].i ] = RENAME_DUPLICATE;
+			if ( r->problem[ to[i].i ] == RENAME_OK )
+				r->problem[ to[i].i ] = RENAME_DUPLICATE;
+		}
+	}
+
+	for ( i = 0; i < r->n; i++ )
+		if ( r->problem[i] != RENAME_OK )
+			bad++;
+
+	free(from);
+	free(to);
+	return bad;
+}
+
+/* Rename without replacing anything, 0 on success */
+static int
+bfm_rename_one ( int dfd, const char * from, const char * to, unsigned flags )
+{
+	return renameat2( dfd, from, dfd, to, flags ) == 0 ? 0 : errno;
+}
+
+/* Rotate names of cycle, start moves to name of next and last to name of start.
+ * Exchanges leave content wanted by next one at start, temporary name is used
+ * where filesystem can not exchange */
+static size_t
+bfm_rename_cycle ( St_rename * r, int dfd, const size_t * cyc, size_t len )
+{
+	char   tmp[64];
+	size_t done = 0;
+	size_t k;
+	int    err = 0;
+
+	for ( k = 1; k < len && !err; k++ )
+		if ( !( err = bfm_rename_one( dfd, r->from[ cyc[0] ], r->from[ cyc[k] ], RENAME_EXCHANGE ) ) )
+			done++;
+
+	/* Last exchange places two names */
+	if ( !err )
+		return len;
+
+	if ( done || ( err != EINVAL && err != ENOSYS ) )
+	{
+		for ( k = done; k < len; k++ )
+			r->error[ cyc[k] ] = err;
+		return done;
+	}
+
+	snprintf( tmp, sizeof(tmp), ".bfm-rename-%ld-%zu", (long)getpid(), cyc[0] );
+	if ( ( err = bfm_rename_one( dfd, r->from[ cyc[0] ], tmp, RENAME_NOREPLACE ) ) )
+	{
+		for ( k = 0; k < len; k++ )
+			r->error[ cyc[k] ] = err;
+		return 0;
+	}
+
+	/* Each one moves to name freed by previous move */
+	for ( k = len - 1; k > 0; k-- )
+	{
+		if ( ( r->error[ cyc[k] ] = bfm_rename_one( dfd, r->from[ cyc[k] ], r->to[ cyc[k] ], RENAME_NOREPLACE ) ) == 0 )
+			done++;
+	}
+	if ( ( r->error[ cyc[0] ] = bfm_rename_one( dfd, tmp, r->to[ cyc[0] ], RENAME_NOREPLACE ) ) == 0 )
+		done++;
+
+	return done;
+}
+
+/* Rename in one pass, plan has to pass bfm_rename_check().
+ * Chains are renamed from their free end, cycles by exchanging names.
+ * Nothing is replaced, returns number of renamed names */
+size_t
+bfm_rename_apply ( St_rename * r, int dfd, size_t * failed )
+{
+	St_rename_key * from = bfm_rename_keys( r, 0 );
+	size_t        * next = malloc( ( r->n ? r->n : 1 ) * sizeof(size_t) );
+	size_t        * prev = malloc( ( r->n ? r->n : 1 ) * sizeof(size_t) );
+	size_t        * cyc = malloc( ( r->n ? r->n : 1 ) * sizeof(size_t) );
+	unsigned char * done = calloc( r->n ? r->n : 1, 1 );
+	size_t          renamed = 0;
+	size_t          len;
+	size_t          i;
+	size_t          k;
+
+	/* Rename i wants old name of next[i], prev[i] wants old name of i */
+	for ( i = 0; i < r->n; i++ )
+		prev[i] = RENAME_NONE;
+	for ( i = 0; i < r->n; i++ )
+	{
+		r->error[i] = 0;
+		if ( strcmp( r->from[i], r->to[i] ) == 0 )
+		{
+			next[i] = RENAME_NONE;
+			done[i] = 1;
+		}
+		else if ( ( next[i] = bfm_rename_find( r, from, r->to[i] ) ) != RENAME_NONE )
+			prev[ next[i] ] = i;
+	}
+
+	/* Chains, each rename frees name for previous one */
+	for ( i = 0; i < r->n; i++ )
+	{
+		if ( done[i] || next[i] != RENAME_NONE )
+			continue;
+
+		for ( k = i; k != RENAME_NONE && !done[k]; k = prev[k] )
+		{
+			done[k] = 1;
+			if ( !( r->error[k] = bfm_rename_one( dfd, r->from[k], r->to[k], RENAME_NOREPLACE ) ) )
+				renamed++;
+		}
+	}
+
+	/* Everything left is in cycles */
+	for ( i = 0; i < r->n; i++ )
+	{
+		if ( done[i] )
+			continue;
+
+		for ( len = 0, k = i; !done[k]; k = next[k] )
+		{
+			done[k] = 1;
+			cyc[ len++ ] = k;
+		}
+		renamed += bfm_rename_cycle( r, dfd, cyc, len );
+	}
+
+	* failed = 0;
+	for ( i = 0; i < r->n; i++ )
+		if ( r->error[i] )
+			( * failed )++;
+
+	free(from);
+	free(next);
+	free(prev);
+	free(cyc);
+	free(done);
+	return renamed;
+}
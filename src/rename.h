@@ -0,0 +1,51 @@
+#ifndef BFM_RENAME_H
+#define BFM_RENAME_H
+
+#include <stddef.h>
+
+/* Structs */
+/* New names planned for names in one directory */
+typedef struct St_rename St_rename;
+
+/* Enums */
+/* Way new names are made */
+enum RenameKind
+{
+	/* Template, runs of # are numbered and * is old name without extension.
+	 * Old extension is kept */
+	RENAME_SEQUENCE,
+	/* Matches of extended regex are replaced, \0 to \9 insert groups */
+	RENAME_REGEX,
+	RENAME_LOWER,
+	RENAME_UPPER,
+	/* Names are edited as text, one per line */
+	RENAME_EDITOR
+};
+
+/* Reason why rename can not be done */
+enum RenameProblem
+{
+	RENAME_OK,
+	/* Empty, too long, "." or ".." or containing slash */
+	RENAME_INVALID,
+	/* Other name gets same new name */
+	RENAME_DUPLICATE,
+	/* New name belongs to file which is not renamed */
+	RENAME_EXISTS
+};
+
+/* Protos */
+St_rename *  bfm_rename_new     ( char * const *, size_t );
+int          bfm_rename_map     ( St_rename *, int, const char *, const char * );
+char *       bfm_rename_text    ( St_rename *, size_t * );
+int          bfm_rename_parse   ( St_rename *, const char *, size_t );
+size_t       bfm_rename_check   ( St_rename *, int );
+size_t       bfm_rename_apply   ( St_rename *, int, size_t * );
+size_t       bfm_rename_count   ( St_rename * );
+const char * bfm_rename_from    ( St_rename *, size_t );
+const char * bfm_rename_to      ( St_rename *, size_t );
+int          bfm_rename_problem ( St_rename *, size_t );
+int          bfm_rename_error   ( St_rename *, size_t );
+void         bfm_rename_free    ( St_rename * );
+
+#endif
@@ -0,0 +1,563 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "scan.h"
+#include "trace.h"
+
+/* Entries passed in first batch, enough to fill a screen */
+#define SCAN_FIRST_BATCH 64
+/* Entries passed in following batches */
+#define SCAN_BATCH       2048
+/* Maximum delay before passing incomplete batch (in ms) */
+#define SCAN_LATENCY     40
+/* Buffer for raw directory records */
+#define SCAN_DENTS_BUF   32768
+/* Entries asked for by receiver and not yet stat'ed, older ones are dropped */
+#define SCAN_HINTS       256
+
+/* Structs */
+/* Record returned by getdents64 */
+struct linux_dirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+struct St_scan
+{
+	pthread_mutex_t lock;
+	/* Owner and worker hold a reference each */
+	int             refs;
+	int             cancel;
+	int             done;
+	/* Notification is sent and not yet answered */
+	int             signalled;
+	/* Entries waiting for receiver */
+	St_entry      * pend;
+	size_t          pend_len;
+	size_t          pend_pos;
+	size_t          pend_cap;
+	/* Scanned directory */
+	DIR           * dir;
+	/* Directory opened by worker from path, accept may refuse it by descriptor */
+	char          * path;
+	int          (* accept)( int );
+	int             opened;
+	struct stat     st;
+	/* Names and types only, metadata is left for stat pass */
+	int             lazy;
+	/* Stat pass over names under dfd, taken names are set to NULL */
+	int             dfd;
+	char         ** names;
+	size_t          n_names;
+	size_t          next;
+	/* Names asked for first, newest is on top */
+	size_t          hints[SCAN_HINTS];
+	size_t          n_hints;
+	/* Statistics */
+	size_t          count;
+	long            start;
+	long            msec;
+	/* Receiver */
+	Scan_notify     notify;
+	void          * data;
+};
+
+/* Filesystem names by statfs magic */
+static const struct
+{
+	unsigned long  magic;
+	const char   * name;
+} fs_names[] = {
+	{ 0xEF53,     "ext4" },
+	{ 0x9123683E, "btrfs" },
+	{ 0x58465342, "xfs" },
+	{ 0x01021994, "tmpfs" },
+	{ 0x794C7630, "overlay" },
+	{ 0x6969,     "nfs" },
+	{ 0xFF534D42, "cifs" },
+	{ 0xFE534D42, "smb2" },
+	{ 0x517B,     "smb" },
+	{ 0x65735546, "fuse" },
+	{ 0x01021997, "9p" },
+	{ 0x00C36400, "ceph" },
+	{ 0x5346414F, "afs" },
+	{ 0x73757245, "coda" },
+};
+
+/* Functions */
+/* Checks if filename is beginnings with dot */
+int
+bfm_name_validat ( const char * s, int dot_flag )
+{
+	return dot_flag ? ( strcmp( s, "." ) != 0 && strcmp( s, ".." ) != 0 ) : * s != '.';
+}
+
+/* Milliseconds from monotonic clock */
+static long
+bfm_scan_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Free names of entries in range */
+static void
+bfm_scan_free_entries ( St_entry * e, size_t n )
+{
+	size_t i;
+	for ( i = 0; i < n; i++ )
+		free( e[i].name );
+}
+
+/* Move worker batch into shared queue */
+static void
+bfm_scan_flush ( St_scan * sc, St_entry * batch, size_t n, int done )
+{
+	int signal = 0;
+
+	pthread_mutex_lock( &sc->lock );
+
+	if ( sc->pend_len + n > sc->pend_cap )
+	{
+		/* Compact consumed part first */
+		if ( sc->pend_pos )
+		{
+			memmove( sc->pend, sc->pend + sc->pend_pos, ( sc->pend_len - sc->pend_pos ) * sizeof(St_entry) );
+			sc->pend_len -= sc->pend_pos;
+			sc->pend_pos = 0;
+		}
+
+		while ( sc->pend_len + n > sc->pend_cap )
+			sc->pend_cap = sc->pend_cap ? sc->pend_cap * 2 : SCAN_BATCH;
+
+		sc->pend = realloc( sc->pend, sc->pend_cap * sizeof(St_entry) );
+	}
+
+	memcpy( sc->pend + sc->pend_len, batch, n * sizeof(St_entry) );
+	sc->pend_len += n;
+	sc->done = done;
+
+	if ( !sc->signalled && !sc->cancel )
+		signal = sc->signalled = 1;
+
+	pthread_mutex_unlock( &sc->lock );
+
+	if ( signal )
+		sc->notify( sc, sc->data );
+}
+
+/* Stat collected names and pass valid entries on */
+static void
+bfm_scan_batch ( St_scan * sc, St_backend * be, int dfd, St_entry * batch, size_t n, int done )
+{
+	St_entry tmp;
+	size_t   i;
+	size_t   j;
+	size_t   m = n;
+
+	/* Entries typed by readdir go without stat, others are moved in front */
+	if ( sc->lazy )
+	{
+		for ( i = m = 0; i < n; i++ )
+		{
+			if ( batch[i].mode )
+				continue;
+			tmp = batch[m];
+			batch[m++] = batch[i];
+			batch[i] = tmp;
+		}
+	}
+
+	bfm_backend_stat( be, dfd, batch, m );
+
+	/* Drop entries which failed */
+	for ( i = j = 0; i < n; i++ )
+	{
+		if ( batch[i].mode )
+			batch[j++] = batch[i];
+		else
+			free( batch[i].name );
+	}
+
+	sc->count += j;
+	if ( done )
+		sc->msec = bfm_scan_msec() - sc->start;
+
+	bfm_scan_flush( sc, batch, j, done );
+}
+
+/* Worker thread routine */
+static void *
+bfm_scan_worker ( void * p )
+{
+	St_scan               * sc = p;
+	St_backend            * be = bfm_backend_new();
+	St_entry              * batch = malloc( SCAN_BATCH * sizeof(St_entry) );
+	char                  * buf = malloc(SCAN_DENTS_BUF);
+	struct linux_dirent64 * e;
+	size_t                  n = 0;
+	size_t                  limit = SCAN_FIRST_BATCH;
+	long                    last = sc->start = bfm_scan_msec();
+	long                    len;
+	long                    pos;
+	int                     dfd = dirfd( sc->dir );
+	uint64_t                t;
+
+	while ( !__atomic_load_n( &sc->cancel, __ATOMIC_RELAXED ) )
+	{
+		t = bfm_trace_begin();
+		len = syscall( SYS_getdents64, dfd, buf, SCAN_DENTS_BUF );
+		bfm_trace_end( "readdir", t );
+		if ( len <= 0 )
+			break;
+
+		for ( pos = 0; pos < len; pos += e->d_reclen )
+		{
+			e = (struct linux_dirent64 *)( buf + pos );
+			/* Dotfiles are kept, they are hidden by filter */
+			if ( !bfm_name_validat( e->d_name, 1 ) )
+				continue;
+
+			batch[n].name = strdup( e->d_name );
+			batch[n].mode = 0;
+
+			/* Type from readdir is enough, symlinks are followed by stat */
+			if ( sc->lazy && e->d_type != DT_UNKNOWN && e->d_type != DT_LNK )
+			{
+				batch[n].mode = DTTOIF( e->d_type );
+				batch[n].size = SCAN_UNKNOWN;
+				batch[n].mtime = 0;
+			}
+
+			if ( ++n == limit )
+			{
+				bfm_scan_batch( sc, be, dfd, batch, n, 0 );
+				n = 0;
+				limit = SCAN_BATCH;
+				last = bfm_scan_msec();
+			}
+		}
+
+		/* Pass stalled batch on slow filesystems */
+		if ( n && bfm_scan_msec() - last > SCAN_LATENCY )
+		{
+			bfm_scan_batch( sc, be, dfd, batch, n, 0 );
+			n = 0;
+			last = bfm_scan_msec();
+		}
+	}
+
+	if ( __atomic_load_n( &sc->cancel, __ATOMIC_RELAXED ) )
+		bfm_scan_free_entries( batch, n );
+	else
+		bfm_scan_batch( sc, be, dfd, batch, n, 1 );
+
+	closedir( sc->dir );
+	sc->dir = NULL;
+	bfm_backend_free(be);
+	free(batch);
+	free(buf);
+	bfm_scan_unref(sc);
+
+	return NULL;
+}
+
+/* Open directory in worker thread, so hung mount blocks only worker */
+static void *
+bfm_scan_open_worker ( void * p )
+{
+	St_scan * sc = p;
+	St_entry  none;
+	int       ok;
+
+	sc->start = bfm_scan_msec();
+	ok = ( sc->dir = opendir( sc->path ) ) && fstat( dirfd( sc->dir ), &sc->st ) == 0
+	  && ( !sc->accept || sc->accept( dirfd( sc->dir ) ) );
+
+	pthread_mutex_lock( &sc->lock );
+	sc->opened = ok;
+	pthread_mutex_unlock( &sc->lock );
+	if (ok)
+		return bfm_scan_worker(sc);
+
+	/* Ends empty */
+	if ( sc->dir )
+		closedir( sc->dir );
+	sc->dir = NULL;
+	sc->msec = bfm_scan_msec() - sc->start;
+	bfm_scan_flush( sc, &none, 0, 1 );
+	bfm_scan_unref(sc);
+
+	return NULL;
+}
+
+/* Stat names in order, names asked for by receiver go first */
+static void *
+bfm_scan_stat_worker ( void * p )
+{
+	St_scan    * sc = p;
+	St_backend * be = bfm_backend_new();
+	St_entry   * batch = malloc( SCAN_FIRST_BATCH * sizeof(St_entry) );
+	size_t       n = 0;
+	size_t       i;
+
+	sc->start = bfm_scan_msec();
+
+	/* Small batches keep hinted names close to front */
+	while ( !__atomic_load_n( &sc->cancel, __ATOMIC_RELAXED ) )
+	{
+		pthread_mutex_lock( &sc->lock );
+		for ( n = 0; n < SCAN_FIRST_BATCH && sc->n_hints; )
+		{
+			i = sc->hints[ --sc->n_hints ];
+			if ( !sc->names[i] )
+				continue;
+			batch[n].name = sc->names[i];
+			batch[n++].mode = 0;
+			sc->names[i] = NULL;
+		}
+		for ( ; n < SCAN_FIRST_BATCH && sc->next < sc->n_names; sc->next++ )
+		{
+			if ( !sc->names[ sc->next ] )
+				continue;
+			batch[n].name = sc->names[ sc->next ];
+			batch[n++].mode = 0;
+			sc->names[ sc->next ] = NULL;
+		}
+		pthread_mutex_unlock( &sc->lock );
+
+		if ( !n )
+			break;
+		bfm_scan_batch( sc, be, sc->dfd, batch, n, 0 );
+	}
+
+	if ( !__atomic_load_n( &sc->cancel, __ATOMIC_RELAXED ) )
+		bfm_scan_batch( sc, be, sc->dfd, batch, 0, 1 );
+
+	close( sc->dfd );
+	bfm_backend_free(be);
+	free(batch);
+	bfm_scan_unref(sc);
+
+	return NULL;
+}
+
+/* Create scan with owner and worker references and start worker */
+static St_scan *
+bfm_scan_run ( St_scan * sc, void * (* worker)( void * ), Scan_notify notify, void * data )
+{
+	pthread_t      thr;
+	pthread_attr_t attr;
+
+	pthread_mutex_init( &sc->lock, NULL );
+	sc->refs   = 2;
+	sc->notify = notify;
+	sc->data   = data;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+	if ( pthread_create( &thr, &attr, worker, sc ) != 0 )
+	{
+		/* Run synchronously if no thread is available */
+		worker(sc);
+	}
+
+	pthread_attr_destroy(&attr);
+	return sc;
+}
+
+/* Start scanning of opened directory, takes ownership of it */
+St_scan *
+bfm_scan_start ( DIR * dir, Scan_notify notify, void * data )
+{
+	St_scan * sc = calloc( 1, sizeof(St_scan) );
+
+	sc->dir = dir;
+	return bfm_scan_run( sc, bfm_scan_worker, notify, data );
+}
+
+/* Start scanning of directory at path, it is opened by worker. Scan ends empty
+ * if it can not be opened or accept called from worker returns 0 for its descriptor */
+St_scan *
+bfm_scan_open ( const char * path, int (* accept)( int ), Scan_notify notify, void * data )
+{
+	St_scan * sc = calloc( 1, sizeof(St_scan) );
+
+	sc->path = strdup(path);
+	sc->accept = accept;
+	return bfm_scan_run( sc, bfm_scan_open_worker, notify, data );
+}
+
+/* Start scanning for names and types only, for filesystems with slow stat.
+ * Size of entries is SCAN_UNKNOWN, symlinks and untyped entries are stat'ed */
+St_scan *
+bfm_scan_lazy ( DIR * dir, Scan_notify notify, void * data )
+{
+	St_scan * sc = calloc( 1, sizeof(St_scan) );
+
+	sc->dir = dir;
+	sc->lazy = 1;
+	return bfm_scan_run( sc, bfm_scan_worker, notify, data );
+}
+
+/* Start stat of names under dfd, takes ownership of dfd. NULL names are skipped.
+ * Entries which can not be stat'ed are left out */
+St_scan *
+bfm_scan_stat ( int dfd, const char * const * names, size_t n, Scan_notify notify, void * data )
+{
+	St_scan * sc = calloc( 1, sizeof(St_scan) );
+	size_t    i;
+
+	sc->dfd = dfd;
+	sc->names = malloc( ( n + 1 ) * sizeof(char *) );
+	sc->n_names = n;
+	for ( i = 0; i < n; i++ )
+		sc->names[i] = names[i] ? strdup( names[i] ) : NULL;
+
+	return bfm_scan_run( sc, bfm_scan_stat_worker, notify, data );
+}
+
+/* Move name of stat pass in front, for rows coming on screen */
+void
+bfm_scan_hint ( St_scan * sc, size_t i )
+{
+	pthread_mutex_lock( &sc->lock );
+
+	if ( i < sc->n_names && sc->names[i] )
+	{
+		if ( sc->n_hints == SCAN_HINTS )
+			memmove( sc->hints, sc->hints + 1, --sc->n_hints * sizeof(size_t) );
+		sc->hints[ sc->n_hints++ ] = i;
+	}
+
+	pthread_mutex_unlock( &sc->lock );
+}
+
+/* Filesystem type of descriptor, "unknown" if it is not named */
+const char *
+bfm_scan_fs ( int fd )
+{
+	struct statfs sf;
+	size_t        i;
+
+	if ( fstatfs( fd, &sf ) == 0 )
+		for ( i = 0; i < sizeof(fs_names) / sizeof(* fs_names); i++ )
+			if ( (unsigned long)(unsigned int)sf.f_type == fs_names[i].magic )
+				return fs_names[i].name;
+
+	return "unknown";
+}
+
+/* Receive up to max entries, state is set to one of ScanState */
+size_t
+bfm_scan_take ( St_scan * sc, St_entry * out, size_t max, int * state )
+{
+	size_t n;
+
+	pthread_mutex_lock( &sc->lock );
+
+	n = sc->pend_len - sc->pend_pos;
+	if ( n > max )
+		n = max;
+
+	memcpy( out, sc->pend + sc->pend_pos, n * sizeof(St_entry) );
+	sc->pend_pos += n;
+
+	if ( sc->pend_pos < sc->pend_len )
+		* state = SCAN_MORE;
+	else
+	{
+		sc->pend_pos = sc->pend_len = 0;
+		sc->signalled = 0;
+		* state = sc->done ? SCAN_DONE : SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &sc->lock );
+	return n;
+}
+
+/* Identity of directory opened by worker, 0 once it is opened and accepted.
+ * Valid after first notification */
+int
+bfm_scan_dir ( St_scan * sc, struct stat * st )
+{
+	int ok;
+
+	pthread_mutex_lock( &sc->lock );
+	if ( ( ok = sc->opened ) )
+		* st = sc->st;
+	pthread_mutex_unlock( &sc->lock );
+
+	return ok ? 0 : -1;
+}
+
+/* Receiver data */
+void *
+bfm_scan_data ( St_scan * sc )
+{
+	return sc->data;
+}
+
+/* Number of entries and time spent, valid when scan is done */
+void
+bfm_scan_stats ( St_scan * sc, size_t * count, long * msec )
+{
+	* count = sc->count;
+	* msec = sc->msec;
+}
+
+/* Check if scan was cancelled by owner */
+int
+bfm_scan_cancelled ( St_scan * sc )
+{
+	return __atomic_load_n( &sc->cancel, __ATOMIC_RELAXED );
+}
+
+/* Stop scanning and release owner reference */
+void
+bfm_scan_cancel ( St_scan * sc )
+{
+	pthread_mutex_lock( &sc->lock );
+	__atomic_store_n( &sc->cancel, 1, __ATOMIC_RELAXED );
+	bfm_scan_free_entries( sc->pend + sc->pend_pos, sc->pend_len - sc->pend_pos );
+	sc->pend_pos = sc->pend_len = 0;
+	pthread_mutex_unlock( &sc->lock );
+
+	bfm_scan_unref(sc);
+}
+
+void
+bfm_scan_ref ( St_scan * sc )
+{
+	__atomic_add_fetch( &sc->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_scan_unref ( St_scan * sc )
+{
+	if ( __atomic_sub_fetch( &sc->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	bfm_scan_free_entries( sc->pend + sc->pend_pos, sc->pend_len - sc->pend_pos );
+	free( sc->pend );
+	while ( sc->n_names )
+		free( sc->names[ --sc->n_names ] );
+	free( sc->names );
+	free( sc->path );
+	pthread_mutex_destroy( &sc->lock );
+	free(sc);
+}
@@ -0,0 +1,56 @@
+#ifndef BFM_SCAN_H
+#define BFM_SCAN_H
+
+#include <dirent.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* Size of entry listed from name and type only, rest of metadata is not known yet */
+#define SCAN_UNKNOWN ( (off_t)-1 )
+
+/* Structs */
+/* Directory entry produced by scanner */
+typedef struct
+{
+	/* Allocated with malloc(), owned by receiver */
+	char   * name;
+	mode_t   mode;
+	off_t    size;
+	time_t   mtime;
+} St_entry;
+
+/* Background directory scan */
+typedef struct St_scan St_scan;
+
+/* Called from worker thread when new entries are waiting */
+typedef void (* Scan_notify)( St_scan *, void * );
+
+/* Enums */
+/* Queue state reported by bfm_scan_take() */
+enum ScanState
+{
+	SCAN_MORE,
+	SCAN_WAIT,
+	SCAN_DONE
+};
+
+/* Protos */
+St_scan *    bfm_scan_start     ( DIR *, Scan_notify, void * );
+St_scan *    bfm_scan_lazy      ( DIR *, Scan_notify, void * );
+St_scan *    bfm_scan_open      ( const char *, int (*)( int ), Scan_notify, void * );
+St_scan *    bfm_scan_stat      ( int, const char * const *, size_t, Scan_notify, void * );
+void         bfm_scan_hint      ( St_scan *, size_t );
+int          bfm_scan_dir       ( St_scan *, struct stat * );
+const char * bfm_scan_fs        ( int );
+size_t       bfm_scan_take      ( St_scan *, St_entry *, size_t, int * );
+void *       bfm_scan_data      ( St_scan * );
+void         bfm_scan_stats     ( St_scan *, size_t *, long * );
+int          bfm_scan_cancelled ( St_scan * );
+void         bfm_scan_cancel    ( St_scan * );
+void         bfm_scan_ref       ( St_scan * );
+void         bfm_scan_unref     ( St_scan * );
+int          bfm_name_validat   ( const char *, int );
+
+#endif
@@ -0,0 +1,650 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filter.h"
+#include "search.h"
+
+/* Results collected by worker before passing them on */
+#define SEARCH_BATCH     256
+/* Buffer for raw directory records */
+#define SEARCH_DENTS_BUF 32768
+/* Buffer for reading file content */
+#define SEARCH_READ_BUF  65536
+/* Limit of idle wait, covers wakeups missed between checks (in ms) */
+#define SEARCH_IDLE_WAIT 10
+
+/* Structs */
+/* Record returned by getdents64 */
+struct linux_dirent64
+{
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+/* Directories waiting to be read by one worker.
+ * Owner works at tail, others steal from head */
+typedef struct
+{
+	pthread_mutex_t   lock;
+	/* Paths relative to root, ring buffer */
+	char           ** jobs;
+	size_t            head;
+	size_t            len;
+	size_t            cap;
+} St_deque;
+
+/* Directory identity */
+typedef struct
+{
+	dev_t dev;
+	ino_t ino;
+} St_devino;
+
+typedef struct
+{
+	St_search * s;
+	int         id;
+	St_entry    batch[SEARCH_BATCH];
+	size_t      n;
+	char        dents[SEARCH_DENTS_BUF];
+	char        buf[SEARCH_READ_BUF];
+} St_worker;
+
+struct St_search
+{
+	pthread_mutex_t   lock;
+	/* Owner and coordinator hold a reference each */
+	int               refs;
+	int               cancel;
+	int               done;
+	/* Notification is sent and not yet answered */
+	int               signalled;
+	/* Results waiting for receiver */
+	St_entry        * pend;
+	size_t            pend_len;
+	size_t            pend_pos;
+	size_t            pend_cap;
+	/* Parameters */
+	int               rootfd;
+	dev_t             rootdev;
+	St_filter         filter;
+	char            * content;
+	size_t            content_len;
+	int               xdev;
+	/* Traversal */
+	St_deque        * deques;
+	int               workers;
+	/* Directories queued or being read */
+	long              pending;
+	pthread_mutex_t   idle_lock;
+	pthread_cond_t    idle;
+	int               sleepers;
+	/* Directories already entered, for bind mounts and loops */
+	pthread_mutex_t   seen_lock;
+	St_devino       * seen;
+	size_t            seen_len;
+	size_t            seen_cap;
+	/* Statistics */
+	size_t            count;
+	size_t            dirs;
+	long              start;
+	long              msec;
+	/* Receiver */
+	Search_notify     notify;
+	void            * data;
+};
+
+/* Functions */
+/* Milliseconds from monotonic clock */
+static long
+bfm_search_msec ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int
+bfm_search_stopped ( St_search * s )
+{
+	return __atomic_load_n( &s->cancel, __ATOMIC_RELAXED );
+}
+
+/* Slot of directory in seen set, free slot if it is not there */
+static size_t
+bfm_search_slot ( St_search * s, dev_t dev, ino_t ino )
+{
+	size_t mask = s->seen_cap - 1;
+	size_t h = ( ino * 0x9e3779b97f4a7c15ull ^ dev ) & mask;
+
+	/* Zero inode marks free slot */
+	while ( s->seen[h].ino && ( s->seen[h].ino != ino || s->seen[h].dev != dev ) )
+		h = ( h + 1 ) & mask;
+
+	return h;
+}
+
+/* Remember directory, return 0 if it was entered before */
+static int
+bfm_search_enter ( St_search * s, dev_t dev, ino_t ino )
+{
+	St_devino * old;
+	size_t      n;
+	size_t      h;
+	int         ret = 0;
+
+	pthread_mutex_lock( &s->seen_lock );
+
+	if ( ( s->seen_len + 1 ) * 2 > s->seen_cap )
+	{
+		old = s->seen;
+		n = s->seen_cap;
+		s->seen_cap = s->seen_cap ? s->seen_cap * 2 : 1024;
+		s->seen = calloc( s->seen_cap, sizeof(St_devino) );
+
+		while ( n-- )
+			if ( old[n].ino )
+				s->seen[ bfm_search_slot( s, old[n].dev, old[n].ino ) ] = old[n];
+		free(old);
+	}
+
+	h = bfm_search_slot( s, dev, ino );
+	if ( !s->seen[h].ino )
+	{
+		s->seen[h].dev = dev;
+		s->seen[h].ino = ino;
+		s->seen_len++;
+		ret = 1;
+	}
+
+	pthread_mutex_unlock( &s->seen_lock );
+	return ret;
+}
+
+/* Move worker results into shared queue */
+static void
+bfm_search_flush ( St_search * s, St_entry * batch, size_t n, int done )
+{
+	int signal = 0;
+
+	pthread_mutex_lock( &s->lock );
+
+	if ( s->pend_len + n > s->pend_cap )
+	{
+		/* Compact consumed part first */
+		if ( s->pend_pos )
+		{
+			memmove( s->pend, s->pend + s->pend_pos, ( s->pend_len - s->pend_pos ) * sizeof(St_entry) );
+			s->pend_len -= s->pend_pos;
+			s->pend_pos = 0;
+		}
+
+		while ( s->pend_len + n > s->pend_cap )
+			s->pend_cap = s->pend_cap ? s->pend_cap * 2 : SEARCH_BATCH;
+
+		s->pend = realloc( s->pend, s->pend_cap * sizeof(St_entry) );
+	}
+
+	if ( n )
+		memcpy( s->pend + s->pend_len, batch, n * sizeof(St_entry) );
+	s->pend_len += n;
+	s->count += n;
+	s->done = done;
+
+	if ( !s->signalled && !s->cancel )
+		signal = s->signalled = 1;
+
+	pthread_mutex_unlock( &s->lock );
+
+	if ( signal )
+		s->notify( s, s->data );
+}
+
+/* Queue directory for worker */
+static void
+bfm_search_push ( St_search * s, int id, char * path )
+{
+	St_deque * d = &s->deques[id];
+	size_t     i;
+
+	__atomic_add_fetch( &s->pending, 1, __ATOMIC_ACQ_REL );
+
+	pthread_mutex_lock( &d->lock );
+	if ( d->len == d->cap )
+	{
+		d->cap = d->cap ? d->cap * 2 : 64;
+		d->jobs = realloc( d->jobs, d->cap * sizeof(char *) );
+
+		/* Unwrap ring into grown buffer */
+		for ( i = 0; i < d->head; i++ )
+			d->jobs[ d->len + i ] = d->jobs[i];
+		if ( d->head )
+			memmove( d->jobs, d->jobs + d->head, d->len * sizeof(char *) );
+		d->head = 0;
+	}
+	d->jobs[ ( d->head + d->len++ ) % d->cap ] = path;
+	pthread_mutex_unlock( &d->lock );
+
+	if ( __atomic_load_n( &s->sleepers, __ATOMIC_ACQUIRE ) )
+	{
+		pthread_mutex_lock( &s->idle_lock );
+		pthread_cond_signal( &s->idle );
+		pthread_mutex_unlock( &s->idle_lock );
+	}
+}
+
+/* Take newest own directory or oldest one of other worker */
+static char *
+bfm_search_pop ( St_search * s, int id )
+{
+	St_deque * d;
+	char     * path = NULL;
+	int        i;
+
+	for ( i = 0; i < s->workers && !path; i++ )
+	{
+		d = &s->deques[ ( id + i ) % s->workers ];
+
+		pthread_mutex_lock( &d->lock );
+		if ( d->len )
+		{
+			/* Own work goes depth first, stolen work is close to root */
+			if ( i == 0 )
+				path = d->jobs[ ( d->head + --d->len ) % d->cap ];
+			else
+			{
+				path = d->jobs[ d->head ];
+				d->head = ( d->head + 1 ) % d->cap;
+				d->len--;
+			}
+		}
+		pthread_mutex_unlock( &d->lock );
+	}
+
+	return path;
+}
+
+/* Wait for directory to read, NULL when traversal is over */
+static char *
+bfm_search_next ( St_search * s, int id )
+{
+	struct timespec ts;
+	char          * path;
+
+	while ( !bfm_search_stopped(s) )
+	{
+		if ( ( path = bfm_search_pop( s, id ) ) )
+			return path;
+
+		if ( !__atomic_load_n( &s->pending, __ATOMIC_ACQUIRE ) )
+			break;
+
+		clock_gettime( CLOCK_REALTIME, &ts );
+		ts.tv_nsec += SEARCH_IDLE_WAIT * 1000000L;
+		if ( ts.tv_nsec >= 1000000000L )
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+
+		pthread_mutex_lock( &s->idle_lock );
+		__atomic_add_fetch( &s->sleepers, 1, __ATOMIC_ACQ_REL );
+		if ( __atomic_load_n( &s->pending, __ATOMIC_ACQUIRE ) )
+			pthread_cond_timedwait( &s->idle, &s->idle_lock, &ts );
+		__atomic_sub_fetch( &s->sleepers, 1, __ATOMIC_ACQ_REL );
+		pthread_mutex_unlock( &s->idle_lock );
+	}
+
+	return NULL;
+}
+
+/* Look for text in regular file */
+static int
+bfm_search_grep ( St_search * s, St_worker * w, int dfd, const char * name )
+{
+	ssize_t len;
+	size_t  keep = 0;
+	int     found = 0;
+	int     fd;
+
+	if ( ( fd = openat( dfd, name, O_RDONLY | O_NOFOLLOW | O_NOCTTY | O_CLOEXEC ) ) < 0 )
+		return 0;
+
+	while ( !found && !bfm_search_stopped(s)
+	     && ( len = read( fd, w->buf + keep, sizeof(w->buf) - keep ) ) > 0 )
+	{
+		len += keep;
+		found = memmem( w->buf, len, s->content, s->content_len ) != NULL;
+
+		/* Text may cross buffer boundary */
+		keep = (size_t)len < s->content_len - 1 ? (size_t)len : s->content_len - 1;
+		memmove( w->buf, w->buf + len - keep, keep );
+	}
+
+	close(fd);
+	return found;
+}
+
+/* Add matching entry to worker results */
+static void
+bfm_search_report ( St_search * s, St_worker * w, int dfd, const char * name, const char * path )
+{
+	struct stat st;
+
+	if ( fstatat( dfd, name, &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+		return;
+
+	if ( s->content && ( !S_ISREG( st.st_mode ) || !bfm_search_grep( s, w, dfd, name ) ) )
+		return;
+
+	w->batch[ w->n ].name = strdup(path);
+	w->batch[ w->n ].mode = st.st_mode;
+	w->batch[ w->n ].size = st.st_size;
+	w->batch[ w->n ].mtime = st.st_mtime;
+
+	if ( ++w->n == SEARCH_BATCH )
+	{
+		bfm_search_flush( s, w->batch, w->n, 0 );
+		w->n = 0;
+	}
+}
+
+/* Read one directory, queue its subdirectories and report matches */
+static void
+bfm_search_dir ( St_search * s, St_worker * w, const char * path )
+{
+	struct linux_dirent64 * e;
+	struct stat             st;
+	char                  * sub;
+	size_t                  plen = strlen(path);
+	long                    len;
+	long                    pos;
+	int                     isdir;
+	int                     dfd;
+
+	dfd = plen ? openat( s->rootfd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC ) : dup( s->rootfd );
+	if ( dfd < 0 )
+		return;
+
+	/* Skip other filesystems and directories seen through other paths */
+	if ( fstat( dfd, &st ) < 0 || ( s->xdev && st.st_dev != s->rootdev ) || !bfm_search_enter( s, st.st_dev, st.st_ino ) )
+	{
+		close(dfd);
+		return;
+	}
+
+	__atomic_add_fetch( &s->dirs, 1, __ATOMIC_RELAXED );
+
+	while ( !bfm_search_stopped(s)
+	     && ( len = syscall( SYS_getdents64, dfd, w->dents, sizeof(w->dents) ) ) > 0 )
+	{
+		for ( pos = 0; pos < len; pos += e->d_reclen )
+		{
+			e = (struct linux_dirent64 *)( w->dents + pos );
+			if ( !bfm_name_validat( e->d_name, s->filter.dotfiles ) )
+				continue;
+
+			sub = malloc( plen + strlen( e->d_name ) + 2 );
+			if ( plen )
+				sprintf( sub, "%s/%s", path, e->d_name );
+			else
+				strcpy( sub, e->d_name );
+
+			if ( bfm_filter_name( &s->filter, e->d_name ) )
+				bfm_search_report( s, w, dfd, e->d_name, sub );
+
+			/* Symbolic links are never followed */
+			isdir = e->d_type == DT_DIR;
+			if ( e->d_type == DT_UNKNOWN && fstatat( dfd, e->d_name, &st, AT_SYMLINK_NOFOLLOW ) == 0 )
+				isdir = S_ISDIR( st.st_mode );
+
+			if ( isdir )
+				bfm_search_push( s, w->id, sub );
+			else
+				free(sub);
+		}
+	}
+
+	close(dfd);
+
+	/* Pass results of every directory for steady updates */
+	if ( w->n )
+	{
+		bfm_search_flush( s, w->batch, w->n, 0 );
+		w->n = 0;
+	}
+}
+
+static void *
+bfm_search_worker ( void * p )
+{
+	St_worker * w = p;
+	St_search * s = w->s;
+	char      * path;
+
+	while ( ( path = bfm_search_next( s, w->id ) ) )
+	{
+		bfm_search_dir( s, w, path );
+		free(path);
+
+		/* Last directory is done, wake up idle workers to exit */
+		if ( !__atomic_sub_fetch( &s->pending, 1, __ATOMIC_ACQ_REL ) )
+		{
+			pthread_mutex_lock( &s->idle_lock );
+			pthread_cond_broadcast( &s->idle );
+			pthread_mutex_unlock( &s->idle_lock );
+		}
+	}
+
+	return NULL;
+}
+
+/* Run workers and wait for them */
+static void *
+bfm_search_main ( void * p )
+{
+	St_search * s = p;
+	St_worker * w = calloc( s->workers, sizeof(St_worker) );
+	pthread_t * thr = calloc( s->workers, sizeof(pthread_t) );
+	int       * started = calloc( s->workers, sizeof(int) );
+	int         i;
+
+	for ( i = 0; i < s->workers; i++ )
+	{
+		w[i].s = s;
+		w[i].id = i;
+	}
+
+	bfm_search_push( s, 0, strdup("") );
+
+	for ( i = 1; i < s->workers; i++ )
+		started[i] = pthread_create( &thr[i], NULL, bfm_search_worker, &w[i] ) == 0;
+	bfm_search_worker( &w[0] );
+	for ( i = 1; i < s->workers; i++ )
+		if ( started[i] )
+			pthread_join( thr[i], NULL );
+
+	/* Queues are left only after cancel */
+	for ( i = 0; i < s->workers; i++ )
+	{
+		while ( s->deques[i].len-- )
+			free( s->deques[i].jobs[ ( s->deques[i].head++ ) % s->deques[i].cap ] );
+		free( s->deques[i].jobs );
+		pthread_mutex_destroy( &s->deques[i].lock );
+	}
+
+	s->msec = bfm_search_msec() - s->start;
+	bfm_search_flush( s, NULL, 0, 1 );
+
+	free(w);
+	free(thr);
+	free(started);
+	bfm_search_unref(s);
+	return NULL;
+}
+
+/* Start searching under root directory, NULL if it can not be opened
+ * or pattern is invalid */
+St_search *
+bfm_search_start ( const char * root, const St_search_opts * o, Search_notify notify, void * data )
+{
+	St_search    * s = calloc( 1, sizeof(St_search) );
+	struct stat    st;
+	pthread_t      thr;
+	pthread_attr_t attr;
+	long           cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int            i;
+
+	bfm_filter_init( &s->filter, o->dotfiles );
+	if ( bfm_filter_set( &s->filter, o->type, o->pattern ) < 0
+	  || ( s->rootfd = open( root, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0 )
+	{
+		bfm_filter_free( &s->filter );
+		free(s);
+		return NULL;
+	}
+
+	fstat( s->rootfd, &st );
+	s->rootdev = st.st_dev;
+	s->xdev = o->xdev;
+	if ( o->content && * o->content )
+	{
+		s->content = strdup( o->content );
+		s->content_len = strlen( o->content );
+	}
+
+	s->workers = cpus > 0 ? cpus : 1;
+	s->deques = calloc( s->workers, sizeof(St_deque) );
+	for ( i = 0; i < s->workers; i++ )
+		pthread_mutex_init( &s->deques[i].lock, NULL );
+
+	pthread_mutex_init( &s->lock, NULL );
+	pthread_mutex_init( &s->idle_lock, NULL );
+	pthread_mutex_init( &s->seen_lock, NULL );
+	pthread_cond_init( &s->idle, NULL );
+	s->refs   = 2;
+	s->notify = notify;
+	s->data   = data;
+	s->start  = bfm_search_msec();
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+
+	if ( pthread_create( &thr, &attr, bfm_search_main, s ) != 0 )
+	{
+		/* Run synchronously if no thread is available */
+		bfm_search_main(s);
+	}
+
+	pthread_attr_destroy(&attr);
+	return s;
+}
+
+/* Receive up to max results, state is set to one of ScanState */
+size_t
+bfm_search_take ( St_search * s, St_entry * out, size_t max, int * state )
+{
+	size_t n;
+
+	pthread_mutex_lock( &s->lock );
+
+	n = s->pend_len - s->pend_pos;
+	if ( n > max )
+		n = max;
+
+	if ( n )
+		memcpy( out, s->pend + s->pend_pos, n * sizeof(St_entry) );
+	s->pend_pos += n;
+
+	if ( s->pend_pos < s->pend_len )
+		* state = SCAN_MORE;
+	else
+	{
+		s->pend_pos = s->pend_len = 0;
+		s->signalled = 0;
+		* state = s->done ? SCAN_DONE : SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &s->lock );
+	return n;
+}
+
+/* Receiver data */
+void *
+bfm_search_data ( St_search * s )
+{
+	return s->data;
+}
+
+/* Number of results, directories read and time spent, valid when search is done */
+void
+bfm_search_stats ( St_search * s, size_t * count, size_t * dirs, long * msec )
+{
+	* count = s->count;
+	* dirs = s->dirs;
+	* msec = s->msec;
+}
+
+/* Check if search was cancelled by owner */
+int
+bfm_search_cancelled ( St_search * s )
+{
+	return bfm_search_stopped(s);
+}
+
+/* Stop searching and release owner reference */
+void
+bfm_search_cancel ( St_search * s )
+{
+	size_t i;
+
+	pthread_mutex_lock( &s->lock );
+	__atomic_store_n( &s->cancel, 1, __ATOMIC_RELAXED );
+	for ( i = s->pend_pos; i < s->pend_len; i++ )
+		free( s->pend[i].name );
+	s->pend_pos = s->pend_len = 0;
+	pthread_mutex_unlock( &s->lock );
+
+	bfm_search_unref(s);
+}
+
+void
+bfm_search_ref ( St_search * s )
+{
+	__atomic_add_fetch( &s->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_search_unref ( St_search * s )
+{
+	size_t i;
+
+	if ( __atomic_sub_fetch( &s->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	for ( i = s->pend_pos; i < s->pend_len; i++ )
+		free( s->pend[i].name );
+	free( s->pend );
+	free( s->deques );
+	free( s->seen );
+	free( s->content );
+	bfm_filter_free( &s->filter );
+	close( s->rootfd );
+	pthread_mutex_destroy( &s->lock );
+	pthread_mutex_destroy( &s->idle_lock );
+	pthread_mutex_destroy( &s->seen_lock );
+	pthread_cond_destroy( &s->idle );
+	free(s);
+}
@@ -0,0 +1,39 @@
+#ifndef BFM_SEARCH_H
+#define BFM_SEARCH_H
+
+#include <stddef.h>
+
+#include "scan.h"
+
+/* Structs */
+/* Background recursive search */
+typedef struct St_search St_search;
+
+/* Called from worker thread when new results are waiting */
+typedef void (* Search_notify)( St_search *, void * );
+
+/* Search parameters */
+typedef struct
+{
+	/* One of FilterType, for names */
+	int          type;
+	const char * pattern;
+	/* Text to look for in regular files, NULL to match names only */
+	const char * content;
+	/* Enter and report dotfiles */
+	int          dotfiles;
+	/* Stay on filesystem of root */
+	int          xdev;
+} St_search_opts;
+
+/* Protos */
+St_search * bfm_search_start     ( const char *, const St_search_opts *, Search_notify, void * );
+size_t      bfm_search_take      ( St_search *, St_entry *, size_t, int * );
+void *      bfm_search_data      ( St_search * );
+void        bfm_search_stats     ( St_search *, size_t *, size_t *, long * );
+int         bfm_search_cancelled ( St_search * );
+void        bfm_search_cancel    ( St_search * );
+void        bfm_search_ref       ( St_search * );
+void        bfm_search_unref     ( St_search * );
+
+#endif
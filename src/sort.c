@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "sort.h"
+#include "trace.h"
+
+/* Groups smaller than this are sorted by insertion */
+#define SORT_RADIX_MIN 16
+/* Key bytes taken at once, two chunks */
+#define SORT_KEY_BYTES 16
+
+/* Structs */
+/* Comparison parameters */
+typedef struct
+{
+	const St_listing * l;
+	int                mode;
+	int                desc;
+} St_sortctx;
+
+/* Row with two chunks of its collation key */
+typedef struct
+{
+	uint64_t pre;
+	uint64_t next;
+	uint32_t rec;
+	/* Bit set if key goes on after pre, next */
+	uint32_t more;
+} St_sortitem;
+
+/* Bytes of collation key from given position */
+typedef struct
+{
+	unsigned char out[SORT_KEY_BYTES];
+	size_t        pos;
+	size_t        from;
+	int           desc;
+} St_sortkey;
+
+/* Functions */
+#define IS_DIGIT(c) ( (c) >= '0' && (c) <= '9' )
+
+/* Compare with digit runs ordered by numeric value */
+static int
+bfm_sort_natural ( const unsigned char * a, const unsigned char * b )
+{
+	size_t la;
+	size_t lb;
+	int    c;
+
+	while ( * a && * b )
+	{
+		if ( IS_DIGIT(* a) && IS_DIGIT(* b) )
+		{
+			while ( * a == '0' )
+				a++;
+			while ( * b == '0' )
+				b++;
+
+			for ( la = 0; IS_DIGIT( a[la] ); la++ );
+			for ( lb = 0; IS_DIGIT( b[lb] ); lb++ );
+
+			/* Longer number is bigger */
+			if ( la != lb )
+				return la < lb ? -1 : 1;
+			if ( ( c = memcmp( a, b, la ) ) != 0 )
+				return c;
+
+			a += la;
+			b += lb;
+			continue;
+		}
+
+		if ( * a != * b )
+			return * a - * b;
+
+		a++;
+		b++;
+	}
+
+	return * a - * b;
+}
+
+/* Name order, total so that sorting is deterministic */
+static int
+bfm_sort_cmp_name ( const St_listing * l, uint32_t a, uint32_t b )
+{
+	int c;
+
+	if ( ( c = bfm_sort_natural( (const unsigned char *)bfm_listing_key( l, a ),
+	                             (const unsigned char *)bfm_listing_key( l, b ) ) ) != 0 )
+		return c;
+	if ( ( c = strcmp( bfm_listing_name( l, a ), bfm_listing_name( l, b ) ) ) != 0 )
+		return c;
+
+	return a < b ? -1 : a > b;
+}
+
+/* Compare records, directories go first in both directions */
+int
+bfm_sort_cmp ( const St_listing * l, int mode, int desc, uint32_t a, uint32_t b )
+{
+	const St_rec * ra = &l->rec[a];
+	const St_rec * rb = &l->rec[b];
+	int            da = S_ISDIR( ra->mode );
+	int            db = S_ISDIR( rb->mode );
+	int            c = 0;
+
+	if ( da != db )
+		return da ? -1 : 1;
+
+	switch ( mode )
+	{
+		case SORT_SIZE:
+			c = ra->size < rb->size ? -1 : ra->size > rb->size;
+			break;
+		case SORT_MTIME:
+			c = ra->mtime < rb->mtime ? -1 : ra->mtime > rb->mtime;
+			break;
+		case SORT_EXT:
+			/* Entries without extension go first */
+			if ( !ra->ext || !rb->ext )
+				c = !!ra->ext - !!rb->ext;
+			else
+				c = strcmp( bfm_listing_key( l, a ) + ra->ext, bfm_listing_key( l, b ) + rb->ext );
+			break;
+	}
+
+	if ( c == 0 )
+		c = bfm_sort_cmp_name( l, a, b );
+
+	return desc ? -c : c;
+}
+
+/* Append byte of collation key, returns 0 once chunks are full */
+static int
+bfm_sort_put ( St_sortkey * k, unsigned char c )
+{
+	/* Descending order reverses everything after directory flag */
+	if ( k->desc && k->pos )
+		c = ~c;
+	if ( k->pos >= k->from && k->pos < k->from + SORT_KEY_BYTES )
+		k->out[ k->pos - k->from ] = c;
+
+	return ++k->pos <= k->from + SORT_KEY_BYTES;
+}
+
+static uint64_t
+bfm_sort_word ( const unsigned char * p )
+{
+	uint64_t v = 0;
+	int      i;
+
+	for ( i = 0; i < 8; i++ )
+		v = ( v << 8 ) | p[i];
+
+	return v;
+}
+
+/* Encode key so that plain comparison follows natural order:
+ * digit run is written as its significant length and significant digits */
+static int
+bfm_sort_put_natural ( St_sortkey * k, const unsigned char * s )
+{
+	size_t len;
+
+	while ( * s )
+	{
+		if ( IS_DIGIT(* s) )
+		{
+			while ( * s == '0' )
+				s++;
+			for ( len = 0; IS_DIGIT( s[len] ); len++ );
+
+			/* Stays inside digit range to compare with other chars as before,
+			 * runs are shorter than NAME_MAX so length fits in byte */
+			if ( len < 9 )
+			{
+				if ( !bfm_sort_put( k, '0' + len ) )
+					return 0;
+			}
+			else if ( !bfm_sort_put( k, '9' ) || !bfm_sort_put( k, len ) )
+				return 0;
+
+			for ( ; IS_DIGIT(* s); s++ )
+				if ( !bfm_sort_put( k, * s ) )
+					return 0;
+		}
+		else if ( !bfm_sort_put( k, * s++ ) )
+			return 0;
+	}
+
+	/* End of string compares lower than any char */
+	return bfm_sort_put( k, 0 );
+}
+
+/* Fill item with two chunks of record's collation key from given one:
+ * directory flag, mode value, natural name and terminator.
+ * Differing keys order as bfm_sort_cmp(), equal ones are left to it */
+static void
+bfm_sort_chunk ( const St_listing * l, int mode, int desc, St_sortitem * it, size_t chunk )
+{
+	const St_rec        * r = &l->rec[ it->rec ];
+	const unsigned char * key = (const unsigned char *)bfm_listing_key( l, it->rec );
+	St_sortkey            k;
+	uint64_t              v;
+	int                   ok;
+	int                   i;
+
+	/* Zero padding, only keys which ended at same place are equal there */
+	memset( k.out, 0, sizeof(k.out) );
+	k.pos  = 0;
+	k.from = chunk * 8;
+	k.desc = desc;
+
+	ok = bfm_sort_put( &k, !S_ISDIR( r->mode ) );
+
+	switch ( mode )
+	{
+		case SORT_SIZE:
+		case SORT_MTIME:
+			/* Biased so that unsigned order follows signed one */
+			v = (uint64_t)( mode == SORT_SIZE ? r->size : r->mtime ) ^ ( (uint64_t)1 << 63 );
+			for ( i = 56; ok && i >= 0; i -= 8 )
+				ok = bfm_sort_put( &k, v >> i );
+			break;
+		case SORT_EXT:
+			/* Entries without extension go first */
+			ok = ok && bfm_sort_put( &k, !!r->ext );
+			if ( r->ext )
+			{
+				for ( i = r->ext; ok && key[i]; i++ )
+					ok = bfm_sort_put( &k, key[i] );
+				ok = ok && bfm_sort_put( &k, 0 );
+			}
+			break;
+	}
+
+	if ( ok )
+		bfm_sort_put_natural( &k, key );
+
+	it->pre  = bfm_sort_word( k.out );
+	it->next = bfm_sort_word( k.out + 8 );
+	it->more = ( k.pos > k.from + 8 ) | ( k.pos > k.from + 16 ) << 1;
+}
+
+static int
+bfm_sort_cmp_rows ( const void * a, const void * b, void * p )
+{
+	const St_sortctx  * ctx = p;
+	const St_sortitem * ia = a;
+	const St_sortitem * ib = b;
+
+	if ( ia->pre != ib->pre )
+		return ia->pre < ib->pre ? -1 : 1;
+
+	return bfm_sort_cmp( ctx->l, ctx->mode, ctx->desc, ia->rec, ib->rec );
+}
+
+/* Sort small group, pre decides most comparisons */
+static void
+bfm_sort_insert ( const St_sortctx * ctx, St_sortitem * a, size_t n )
+{
+	St_sortitem x;
+	size_t      i;
+	size_t      j;
+
+	for ( i = 1; i < n; i++ )
+	{
+		x = a[i];
+		for ( j = i; j > 0 && bfm_sort_cmp_rows( &x, &a[j - 1], (void *)ctx ) < 0; j-- )
+			a[j] = a[j - 1];
+		a[j] = x;
+	}
+}
+
+/* MSD radix sort on byte of key chunk, then buckets on next bytes and chunks;
+ * bytes equal in all items are passed over without moving them */
+static void
+bfm_sort_items ( const St_sortctx * ctx, St_sortitem * a, St_sortitem * tmp, size_t n, size_t chunk, int byte )
+{
+	uint32_t start[257];
+	uint32_t pos[256];
+	size_t   i;
+	int      more;
+	int      c;
+
+	for (;;)
+	{
+		if ( n < SORT_RADIX_MIN )
+		{
+			bfm_sort_insert( ctx, a, n );
+			return;
+		}
+
+		/* Chunk is equal in all items, go on with next one if any key goes on */
+		if ( byte < 0 )
+		{
+			for ( more = 0, i = 0; i < n; i++ )
+				more |= a[i].more & 1;
+
+			/* Whole keys are equal, only names or record order differ */
+			if ( !more )
+			{
+				qsort_r( a, n, sizeof(St_sortitem), bfm_sort_cmp_rows, (void *)ctx );
+				return;
+			}
+
+			/* Every other chunk is at hand, rest are read again from records */
+			if ( ++chunk % 2 )
+			{
+				for ( i = 0; i < n; i++ )
+				{
+					a[i].pre = a[i].next;
+					a[i].more >>= 1;
+				}
+			}
+			else
+			{
+				for ( i = 0; i < n; i++ )
+					bfm_sort_chunk( ctx->l, ctx->mode, ctx->desc, &a[i], chunk );
+			}
+			byte = 7;
+			continue;
+		}
+
+		memset( start, 0, sizeof(start) );
+		for ( i = 0; i < n; i++ )
+			start[ ( ( a[i].pre >> byte * 8 ) & 0xff ) + 1 ]++;
+
+		if ( start[ ( ( a[0].pre >> byte * 8 ) & 0xff ) + 1 ] != n )
+			break;
+		byte--;
+	}
+
+	for ( c = 0; c < 256; c++ )
+	{
+		pos[c] = start[c];
+		start[c + 1] += start[c];
+	}
+
+	for ( i = 0; i < n; i++ )
+		tmp[ pos[ ( a[i].pre >> byte * 8 ) & 0xff ]++ ] = a[i];
+	memcpy( a, tmp, n * sizeof(St_sortitem) );
+
+	for ( c = 0; c < 256; c++ )
+		if ( start[c + 1] - start[c] > 1 )
+			bfm_sort_items( ctx, a + start[c], tmp + start[c], start[c + 1] - start[c], chunk, byte - 1 );
+}
+
+/* Sort row array of record indices */
+void
+bfm_sort_rows ( const St_listing * l, int mode, int desc, uint32_t * rows, uint32_t n )
+{
+	St_sortctx    ctx = { l, mode, desc };
+	St_sortitem * items;
+	uint32_t      i;
+	uint64_t      t = bfm_trace_begin();
+
+	if ( n < 2 || !( items = malloc( 2 * (size_t)n * sizeof(St_sortitem) ) ) )
+		return;
+
+	for ( i = 0; i < n; i++ )
+	{
+		items[i].rec = rows[i];
+		bfm_sort_chunk( l, mode, desc, &items[i], 0 );
+	}
+
+	bfm_sort_items( &ctx, items, items + n, n, 0, 7 );
+
+	for ( i = 0; i < n; i++ )
+		rows[i] = items[i].rec;
+
+	free(items);
+	bfm_trace_end( "sort", t );
+}
@@ -0,0 +1,22 @@
+#ifndef BFM_SORT_H
+#define BFM_SORT_H
+
+#include <stdint.h>
+
+#include "listing.h"
+
+/* Enums */
+/* Listing order */
+enum SortMode
+{
+	SORT_NAME,
+	SORT_SIZE,
+	SORT_MTIME,
+	SORT_EXT
+};
+
+/* Protos */
+int  bfm_sort_cmp  ( const St_listing *, int, int, uint32_t, uint32_t );
+void bfm_sort_rows ( const St_listing *, int, int, uint32_t *, uint32_t );
+
+#endif
@@ -0,0 +1,215 @@
+#include <archive.h>
+#include <archive_entry.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arch.h"
+#include "trace.h"
+
+/* Structs */
+/* Member of generated archive, hard link if link is set */
+typedef struct
+{
+	const char * path;
+	const char * data;
+	const char * link;
+} St_member;
+
+/* Extraction completion */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	int             ready;
+} St_wait;
+
+/* Globals */
+static const St_member members[] =
+{
+	{ "top/",          NULL,    NULL },
+	{ "top/a.txt",     "hello", NULL },
+	{ "top/sub/",      NULL,    NULL },
+	{ "top/sub/b.txt", "world", NULL },
+	{ "top/c.txt",     NULL,    "top/a.txt" },
+};
+
+static int failed = 0;
+
+/* Functions */
+static void
+bfm_test_check ( int ok, const char * what )
+{
+	printf( "%s %s\n", ok ? "ok  " : "FAIL", what );
+	failed |= !ok;
+}
+
+/* Write tar with all members */
+static int
+bfm_test_tar ( const char * file )
+{
+	struct archive       * ar = archive_write_new();
+	struct archive_entry * e;
+	size_t                 i;
+	int                    ret = 0;
+
+	archive_write_set_format_pax_restricted(ar);
+	if ( archive_write_open_filename( ar, file ) != ARCHIVE_OK )
+	{
+		archive_write_free(ar);
+		return -1;
+	}
+
+	for ( i = 0; i < sizeof(members) / sizeof(members[0]); i++ )
+	{
+		e = archive_entry_new();
+		archive_entry_set_pathname( e, members[i].path );
+		archive_entry_set_perm( e, members[i].data ? 0644 : 0755 );
+		if ( members[i].link )
+		{
+			archive_entry_set_filetype( e, AE_IFREG );
+			archive_entry_set_hardlink( e, members[i].link );
+		}
+		else if ( members[i].data )
+		{
+			archive_entry_set_filetype( e, AE_IFREG );
+			archive_entry_set_size( e, strlen( members[i].data ) );
+		}
+		else
+			archive_entry_set_filetype( e, AE_IFDIR );
+
+		if ( archive_write_header( ar, e ) < ARCHIVE_WARN
+		  || ( members[i].data && archive_write_data( ar, members[i].data, strlen( members[i].data ) ) < 0 ) )
+			ret = -1;
+		archive_entry_free(e);
+	}
+
+	archive_write_close(ar);
+	archive_write_free(ar);
+	return ret;
+}
+
+static void
+bfm_test_notify ( St_arch * a, void * data )
+{
+	St_wait * w = data;
+	(void)a;
+
+	pthread_mutex_lock( &w->lock );
+	w->ready = 1;
+	pthread_cond_signal( &w->cond );
+	pthread_mutex_unlock( &w->lock );
+}
+
+/* Extract paths and wait for it, number of failed entries */
+static size_t
+bfm_test_extract ( const char * file, char * const * paths, size_t n, const char * dest, size_t * count )
+{
+	St_wait   w = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+	St_arch * a;
+	size_t    errors;
+	size_t    memory;
+	long      msec;
+
+	a = bfm_arch_extract( file, paths, n, dest, bfm_test_notify, &w );
+	pthread_mutex_lock( &w.lock );
+	while ( !w.ready )
+		pthread_cond_wait( &w.cond, &w.lock );
+	pthread_mutex_unlock( &w.lock );
+
+	bfm_arch_stats( a, count, &errors, &msec, &memory );
+	if ( errors && bfm_arch_error(a) )
+		printf( "     %s\n", bfm_arch_error(a) );
+	bfm_arch_unref(a);
+
+	return errors;
+}
+
+/* Check content of extracted file */
+static int
+bfm_test_file ( const char * dir, const char * name, const char * data )
+{
+	char   path[PATH_MAX];
+	char   buf[64];
+	FILE * f;
+	size_t len;
+
+	snprintf( path, sizeof(path), "%s/%s", dir, name );
+	if ( !( f = fopen( path, "r" ) ) )
+		return 0;
+	len = fread( buf, 1, sizeof(buf) - 1, f );
+	fclose(f);
+	buf[len] = '\0';
+
+	return strcmp( buf, data ) == 0;
+}
+
+static int
+bfm_test_same ( const char * dir, const char * a, const char * b )
+{
+	char        path[PATH_MAX];
+	struct stat sa;
+	struct stat sb;
+
+	snprintf( path, sizeof(path), "%s/%s", dir, a );
+	if ( stat( path, &sa ) < 0 )
+		return 0;
+	snprintf( path, sizeof(path), "%s/%s", dir, b );
+	if ( stat( path, &sb ) < 0 )
+		return 0;
+
+	return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+int
+main ( int argc, char ** argv )
+{
+	const char * tmp = getenv("TMPDIR");
+	char         base[PATH_MAX];
+	char         file[PATH_MAX + 16];
+	char         one[PATH_MAX + 16];
+	char         tree[PATH_MAX + 16];
+	char       * file_paths[] = { "top/a.txt" };
+	char       * tree_paths[] = { "top" };
+	size_t       count;
+	size_t       errors;
+
+	snprintf( base, sizeof(base), "%s/bfm-test-XXXXXX", argc > 1 ? argv[1] : tmp ? tmp : "/tmp" );
+	if ( !mkdtemp(base) )
+	{
+		fprintf( stderr, "%s: %s\n", base, strerror(errno) );
+		return 1;
+	}
+	bfm_trace_init();
+
+	snprintf( file, sizeof(file), "%s/test.tar", base );
+	snprintf( one, sizeof(one), "%s/one", base );
+	snprintf( tree, sizeof(tree), "%s/tree", base );
+	bfm_test_check( bfm_test_tar(file) == 0, "write tar" );
+	mkdir( one, 0755 );
+	mkdir( tree, 0755 );
+
+	/* Opened entry lands directly in its directory */
+	errors = bfm_test_extract( file, file_paths, 1, one, &count );
+	bfm_test_check( errors == 0 && count == 1, "extract file" );
+	bfm_test_check( bfm_test_file( one, "a.txt", "hello" ), "file content" );
+
+	/* Copied directory takes its content and hard links along */
+	errors = bfm_test_extract( file, tree_paths, 1, tree, &count );
+	bfm_test_check( errors == 0 && count == 5, "extract directory" );
+	bfm_test_check( bfm_test_file( tree, "top/sub/b.txt", "world" ), "nested content" );
+	bfm_test_check( bfm_test_same( tree, "top/a.txt", "top/c.txt" ), "hard link" );
+
+	/* Existing files are not replaced, directories are merged */
+	errors = bfm_test_extract( file, tree_paths, 1, tree, &count );
+	bfm_test_check( errors == 3 && count == 2, "keep existing files" );
+
+	bfm_arch_remove(base);
+	bfm_trace_finish();
+	return failed;
+}
@@ -0,0 +1,384 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scan.h"
+#include "thumb.h"
+#include "trace.h"
+
+/* Most decoding threads per window */
+#define THUMB_THREADS   8
+/* Requests kept, older ones were scrolled past */
+#define THUMB_QUEUE_MAX 256
+
+/* Structs */
+/* Thumbnail waiting for worker */
+typedef struct
+{
+	char     * path;
+	char     * name;
+	int64_t    mtime;
+	/* Requests from before clear are dropped */
+	unsigned   gen;
+} St_thumb_req;
+
+struct St_thumb
+{
+	pthread_mutex_t    lock;
+	/* Owner and each worker hold a reference */
+	int                refs;
+	int                cancel;
+	/* Notification is sent and not yet answered */
+	int                signalled;
+	unsigned           gen;
+	/* Newest request is taken first, it is the one on screen */
+	St_thumb_req    ** queue;
+	size_t             q_len;
+	size_t             q_cap;
+	int                workers;
+	/* Results waiting for receiver */
+	St_thumb_result  * pend;
+	size_t             pend_len;
+	size_t             pend_pos;
+	size_t             pend_cap;
+	/* Shown size and size stored in freedesktop cache */
+	int                size;
+	int                cache_px;
+	char             * cache_dir;
+	/* Receiver */
+	Thumb_notify       notify;
+	void             * data;
+};
+
+/* Functions */
+static void
+bfm_thumb_req_free ( St_thumb_req * r )
+{
+	g_free( r->path );
+	free( r->name );
+	free(r);
+}
+
+/* Queue result, called with lock held. Returns 1 if receiver has to be notified */
+static int
+bfm_thumb_push ( St_thumb * t, char * name, GdkPixbuf * pb, int dropped )
+{
+	if ( t->pend_len == t->pend_cap )
+	{
+		t->pend_cap = t->pend_cap ? t->pend_cap * 2 : 64;
+		t->pend = realloc( t->pend, t->pend_cap * sizeof(St_thumb_result) );
+	}
+	t->pend[ t->pend_len ].name = name;
+	t->pend[ t->pend_len ].pixbuf = pb;
+	t->pend[ t->pend_len++ ].dropped = dropped;
+
+	if ( t->signalled || t->cancel )
+		return 0;
+	return t->signalled = 1;
+}
+
+/* Write thumbnail atomically so that other readers never see partial file */
+static void
+bfm_thumb_store ( St_thumb * t, GdkPixbuf * pb, const char * file, const char * uri, const char * mtime )
+{
+	gchar * tmp = g_strdup_printf( "%s/bfm-XXXXXX", t->cache_dir );
+	gint    fd;
+
+	if ( g_mkdir_with_parents( t->cache_dir, 0700 ) < 0 || ( fd = mkstemp(tmp) ) < 0 )
+	{
+		g_free(tmp);
+		return;
+	}
+	close(fd);
+
+	if ( gdk_pixbuf_save( pb, tmp, "png", NULL, "tEXt::Thumb::URI", uri, "tEXt::Thumb::MTime", mtime, NULL )
+	  && rename( tmp, file ) == 0 )
+		chmod( file, 0600 );
+	else
+		unlink(tmp);
+
+	g_free(tmp);
+}
+
+/* Thumbnail from freedesktop cache, file is decoded and stored if it is missing or outdated */
+static GdkPixbuf *
+bfm_thumb_load ( St_thumb * t, const St_thumb_req * r )
+{
+	GdkPixbuf   * pb = NULL;
+	GdkPixbuf   * tmp;
+	const gchar * opt;
+	gchar       * uri;
+	gchar       * md5;
+	gchar       * file;
+	gchar         mtime[32];
+	gint          w;
+	gint          h;
+
+	if ( !( uri = g_filename_to_uri( r->path, NULL, NULL ) ) )
+		return NULL;
+
+	md5 = g_compute_checksum_for_string( G_CHECKSUM_MD5, uri, -1 );
+	file = g_strdup_printf( "%s/%s.png", t->cache_dir, md5 );
+	g_snprintf( mtime, sizeof(mtime), "%" G_GINT64_FORMAT, (gint64)r->mtime );
+
+	/* Stored thumbnail is valid for same modification time only */
+	if ( ( pb = gdk_pixbuf_new_from_file( file, NULL ) )
+	  && !( ( opt = gdk_pixbuf_get_option( pb, "tEXt::Thumb::MTime" ) ) && strcmp( opt, mtime ) == 0 ) )
+	{
+		g_object_unref(pb);
+		pb = NULL;
+	}
+
+	if ( !pb && gdk_pixbuf_get_file_info( r->path, &w, &h ) )
+	{
+		/* Small images are not enlarged */
+		if ( w <= t->cache_px && h <= t->cache_px )
+			pb = gdk_pixbuf_new_from_file( r->path, NULL );
+		else
+			pb = gdk_pixbuf_new_from_file_at_scale( r->path, t->cache_px, t->cache_px, TRUE, NULL );
+
+		if ( pb )
+		{
+			tmp = gdk_pixbuf_apply_embedded_orientation(pb);
+			g_object_unref(pb);
+			pb = tmp;
+
+			/* Thumbnails of thumbnails are not stored */
+			if ( !g_str_has_prefix( r->path, t->cache_dir ) )
+				bfm_thumb_store( t, pb, file, uri, mtime );
+		}
+	}
+
+	if ( pb )
+	{
+		w = gdk_pixbuf_get_width(pb);
+		h = gdk_pixbuf_get_height(pb);
+	}
+
+	/* Fit shown size */
+	if ( pb && ( w > t->size || h > t->size ) )
+	{
+		tmp = w > h
+		    ? gdk_pixbuf_scale_simple( pb, t->size, MAX( 1, h * t->size / w ), GDK_INTERP_BILINEAR )
+		    : gdk_pixbuf_scale_simple( pb, MAX( 1, w * t->size / h ), t->size, GDK_INTERP_BILINEAR );
+		g_object_unref(pb);
+		pb = tmp;
+	}
+
+	g_free(file);
+	g_free(md5);
+	g_free(uri);
+	return pb;
+}
+
+static void *
+bfm_thumb_worker ( void * p )
+{
+	St_thumb     * t = p;
+	St_thumb_req * r;
+	GdkPixbuf    * pb;
+	uint64_t       tr;
+	int            signal;
+
+	pthread_mutex_lock( &t->lock );
+	while ( t->q_len && !t->cancel )
+	{
+		r = t->queue[ --t->q_len ];
+		pthread_mutex_unlock( &t->lock );
+
+		tr = bfm_trace_begin();
+		pb = bfm_thumb_load( t, r );
+		bfm_trace_end( "thumbnail", tr );
+
+		pthread_mutex_lock( &t->lock );
+		signal = 0;
+		if ( r->gen == t->gen && !t->cancel )
+		{
+			signal = bfm_thumb_push( t, r->name, pb, 0 );
+			r->name = NULL;
+		}
+		else if ( pb )
+			g_object_unref(pb);
+		bfm_thumb_req_free(r);
+
+		if ( signal )
+		{
+			pthread_mutex_unlock( &t->lock );
+			t->notify( t, t->data );
+			pthread_mutex_lock( &t->lock );
+		}
+	}
+	t->workers--;
+	pthread_mutex_unlock( &t->lock );
+
+	bfm_thumb_unref(t);
+	return NULL;
+}
+
+/* Create loader of thumbnails shown at given size, threads are started on demand */
+St_thumb *
+bfm_thumb_new ( int size, Thumb_notify notify, void * data )
+{
+	St_thumb * t = calloc( 1, sizeof(St_thumb) );
+
+	pthread_mutex_init( &t->lock, NULL );
+	t->refs = 1;
+	t->size = size;
+	/* Freedesktop sizes are normal (128) and large (256) */
+	t->cache_px = size <= 128 ? 128 : 256;
+	t->cache_dir = g_build_filename( g_get_user_cache_dir(), "thumbnails", size <= 128 ? "normal" : "large", NULL );
+	t->notify = notify;
+	t->data = data;
+
+	return t;
+}
+
+/* Ask for thumbnail of name under dir, most recent request is served first */
+void
+bfm_thumb_request ( St_thumb * t, const char * dir, const char * name, int64_t mtime )
+{
+	St_thumb_req * r = malloc( sizeof(St_thumb_req) );
+	pthread_t      thr;
+	pthread_attr_t attr;
+	long           cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int            signal = 0;
+
+	r->path = g_build_filename( dir, name, NULL );
+	r->name = strdup(name);
+	r->mtime = mtime;
+
+	pthread_mutex_lock( &t->lock );
+	r->gen = t->gen;
+
+	/* Oldest request is for row scrolled away, it is asked again when drawn */
+	if ( t->q_len == THUMB_QUEUE_MAX )
+	{
+		signal = bfm_thumb_push( t, t->queue[0]->name, NULL, 1 );
+		t->queue[0]->name = NULL;
+		bfm_thumb_req_free( t->queue[0] );
+		memmove( t->queue, t->queue + 1, --t->q_len * sizeof(St_thumb_req *) );
+	}
+
+	if ( t->q_len == t->q_cap )
+	{
+		t->q_cap = t->q_cap ? t->q_cap * 2 : 64;
+		t->queue = realloc( t->queue, t->q_cap * sizeof(St_thumb_req *) );
+	}
+	t->queue[ t->q_len++ ] = r;
+
+	if ( t->workers < THUMB_THREADS && t->workers < cpus )
+	{
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+		bfm_thumb_ref(t);
+		if ( pthread_create( &thr, &attr, bfm_thumb_worker, t ) == 0 )
+			t->workers++;
+		/* Owner reference is still held */
+		else
+			bfm_thumb_unref(t);
+		pthread_attr_destroy(&attr);
+	}
+	pthread_mutex_unlock( &t->lock );
+
+	if ( signal )
+		t->notify( t, t->data );
+}
+
+/* Receive up to max thumbnails, state is SCAN_MORE or SCAN_WAIT */
+size_t
+bfm_thumb_take ( St_thumb * t, St_thumb_result * out, size_t max, int * state )
+{
+	size_t n;
+
+	pthread_mutex_lock( &t->lock );
+
+	n = t->pend_len - t->pend_pos;
+	if ( n > max )
+		n = max;
+
+	if ( n )
+		memcpy( out, t->pend + t->pend_pos, n * sizeof(St_thumb_result) );
+	t->pend_pos += n;
+
+	if ( t->pend_pos < t->pend_len )
+		* state = SCAN_MORE;
+	else
+	{
+		t->pend_pos = t->pend_len = 0;
+		t->signalled = 0;
+		* state = SCAN_WAIT;
+	}
+
+	pthread_mutex_unlock( &t->lock );
+	return n;
+}
+
+/* Receiver data */
+void *
+bfm_thumb_data ( St_thumb * t )
+{
+	return t->data;
+}
+
+/* Drop waiting requests and results, names are from other directory now */
+void
+bfm_thumb_clear ( St_thumb * t )
+{
+	size_t i;
+
+	pthread_mutex_lock( &t->lock );
+	t->gen++;
+	for ( i = 0; i < t->q_len; i++ )
+		bfm_thumb_req_free( t->queue[i] );
+	t->q_len = 0;
+	for ( i = t->pend_pos; i < t->pend_len; i++ )
+	{
+		free( t->pend[i].name );
+		if ( t->pend[i].pixbuf )
+			g_object_unref( t->pend[i].pixbuf );
+	}
+	t->pend_pos = t->pend_len = 0;
+	pthread_mutex_unlock( &t->lock );
+}
+
+/* Check if loader was cancelled by owner */
+int
+bfm_thumb_cancelled ( St_thumb * t )
+{
+	return __atomic_load_n( &t->cancel, __ATOMIC_RELAXED );
+}
+
+/* Stop loading and release owner reference */
+void
+bfm_thumb_cancel ( St_thumb * t )
+{
+	pthread_mutex_lock( &t->lock );
+	__atomic_store_n( &t->cancel, 1, __ATOMIC_RELAXED );
+	pthread_mutex_unlock( &t->lock );
+
+	bfm_thumb_clear(t);
+	bfm_thumb_unref(t);
+}
+
+void
+bfm_thumb_ref ( St_thumb * t )
+{
+	__atomic_add_fetch( &t->refs, 1, __ATOMIC_ACQ_REL );
+}
+
+void
+bfm_thumb_unref ( St_thumb * t )
+{
+	if ( __atomic_sub_fetch( &t->refs, 1, __ATOMIC_ACQ_REL ) )
+		return;
+
+	bfm_thumb_clear(t);
+	free( t->queue );
+	free( t->pend );
+	g_free( t->cache_dir );
+	pthread_mutex_destroy( &t->lock );
+	free(t);
+}
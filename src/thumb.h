@@ -0,0 +1,37 @@
+#ifndef BFM_THUMB_H
+#define BFM_THUMB_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Structs */
+/* Background thumbnail loading for one window */
+typedef struct St_thumb St_thumb;
+
+/* Called from worker thread when new thumbnails are waiting */
+typedef void (* Thumb_notify)( St_thumb *, void * );
+
+/* Loaded thumbnail */
+typedef struct
+{
+	/* Allocated with malloc(), owned by receiver */
+	char      * name;
+	/* Owned by receiver, NULL if file can not be read */
+	GdkPixbuf * pixbuf;
+	/* Request was dropped for newer ones and may be repeated */
+	int         dropped;
+} St_thumb_result;
+
+/* Protos */
+St_thumb * bfm_thumb_new     ( int, Thumb_notify, void * );
+void       bfm_thumb_request ( St_thumb *, const char *, const char *, int64_t );
+size_t     bfm_thumb_take    ( St_thumb *, St_thumb_result *, size_t, int * );
+void *     bfm_thumb_data    ( St_thumb * );
+void       bfm_thumb_clear   ( St_thumb * );
+int        bfm_thumb_cancelled ( St_thumb * );
+void       bfm_thumb_cancel  ( St_thumb * );
+void       bfm_thumb_ref     ( St_thumb * );
+void       bfm_thumb_unref   ( St_thumb * );
+
+#endif
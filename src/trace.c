@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Spans kept, later ones are counted as dropped */
+#define TRACE_MAX_SPANS ( 1 << 20 )
+
+/* Structs */
+/* Timed section of code */
+typedef struct
+{
+	const char * name;
+	uint32_t     tid;
+	uint64_t     start;
+	uint64_t     dur;
+} St_span;
+
+/* Globals */
+int                  bfm_trace_enabled = 0;
+static const char  * trace_path = NULL;
+static St_span     * spans = NULL;
+static size_t        n_spans = 0;
+static uint64_t      epoch = 0;
+static __thread long tid = 0;
+
+/* Functions */
+/* Monotonic time in nanoseconds */
+uint64_t
+bfm_trace_now ( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Enable tracing if BFM_TRACE names output file */
+void
+bfm_trace_init ( void )
+{
+	if ( !( trace_path = getenv("BFM_TRACE") ) || !* trace_path )
+		return;
+
+	/* Kept for whole process, workers may still end spans while it is written */
+	if ( !( spans = calloc( TRACE_MAX_SPANS, sizeof(St_span) ) ) )
+		return;
+
+	epoch = bfm_trace_now();
+	bfm_trace_enabled = 1;
+}
+
+/* Append span ending now, safe from any thread */
+void
+bfm_trace_add ( const char * name, uint64_t start )
+{
+	uint64_t end = bfm_trace_now();
+	size_t   i = __atomic_fetch_add( &n_spans, 1, __ATOMIC_RELAXED );
+
+	if ( i >= TRACE_MAX_SPANS )
+		return;
+
+	if ( !tid )
+		tid = syscall(SYS_gettid);
+
+	spans[i].tid = tid;
+	spans[i].start = start;
+	spans[i].dur = end - start;
+	/* Name marks complete span */
+	__atomic_store_n( &spans[i].name, name, __ATOMIC_RELEASE );
+}
+
+static int
+bfm_trace_cmp ( const void * a, const void * b )
+{
+	const St_span * sa = a;
+	const St_span * sb = b;
+	int             c = strcmp( sa->name, sb->name );
+
+	if ( c )
+		return c;
+	return sa->dur < sb->dur ? -1 : sa->dur > sb->dur;
+}
+
+/* Duration at percentile of sorted group in milliseconds */
+static double
+bfm_trace_pct ( const St_span * s, size_t n, int pct )
+{
+	return s[ ( n - 1 ) * pct / 100 ].dur / 1e6;
+}
+
+/* Write Chrome trace and print percentiles of each span name */
+void
+bfm_trace_finish ( void )
+{
+	FILE    * f;
+	St_span * out;
+	size_t    n;
+	size_t    i;
+	size_t    j;
+
+	if ( !bfm_trace_enabled )
+		return;
+
+	/* Later spans land past end and are dropped, buffer stays allocated */
+	bfm_trace_enabled = 0;
+	n = __atomic_fetch_add( &n_spans, TRACE_MAX_SPANS, __ATOMIC_ACQ_REL );
+	if ( n > TRACE_MAX_SPANS )
+	{
+		fprintf( stderr, "trace: %zu spans dropped\n", n - TRACE_MAX_SPANS );
+		n = TRACE_MAX_SPANS;
+	}
+
+	/* Copied so that late writers do not touch sorted spans, unfinished ones are left out */
+	if ( !( out = malloc( ( n ? n : 1 ) * sizeof(St_span) ) ) )
+		return;
+	for ( i = j = 0; i < n; i++ )
+		if ( __atomic_load_n( &spans[i].name, __ATOMIC_ACQUIRE ) )
+			out[j++] = spans[i];
+	n = j;
+
+	if ( ( f = fopen( trace_path, "w" ) ) )
+	{
+		fprintf( f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+		for ( i = 0; i < n; i++ )
+			fprintf( f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			         i ? "," : "", out[i].name, (long)getpid(), out[i].tid,
+			         ( out[i].start - epoch ) / 1e3, out[i].dur / 1e3 );
+		fprintf( f, "\n]}\n" );
+		fclose(f);
+	}
+	else
+		fprintf( stderr, "trace: can not write %s\n", trace_path );
+
+	qsort( out, n, sizeof(St_span), bfm_trace_cmp );
+	for ( i = 0; i < n; i = j )
+	{
+		for ( j = i + 1; j < n && strcmp( out[i].name, out[j].name ) == 0; j++ )
+			;
+		fprintf( stderr, "trace: %-10s %8zu spans, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		         out[i].name, j - i,
+		         bfm_trace_pct( out + i, j - i, 50 ),
+		         bfm_trace_pct( out + i, j - i, 90 ),
+		         bfm_trace_pct( out + i, j - i, 99 ),
+		         out[j - 1].dur / 1e6 );
+	}
+
+	free(out);
+}
@@ -0,0 +1,32 @@
+#ifndef BFM_TRACE_H
+#define BFM_TRACE_H
+
+#include <stdint.h>
+
+/* Globals */
+/* Set once by bfm_trace_init() before threads are started */
+extern int bfm_trace_enabled;
+
+/* Protos */
+void     bfm_trace_init   ( void );
+void     bfm_trace_finish ( void );
+uint64_t bfm_trace_now    ( void );
+void     bfm_trace_add    ( const char *, uint64_t );
+
+/* Functions */
+/* Start of span, zero while tracing is off */
+static inline uint64_t
+bfm_trace_begin ( void )
+{
+	return bfm_trace_enabled ? bfm_trace_now() : 0;
+}
+
+/* Record span named by static string */
+static inline void
+bfm_trace_end ( const char * name, uint64_t start )
+{
+	if ( start )
+		bfm_trace_add( name, start );
+}
+
+#endif